@@ -12,6 +12,8 @@
 #cmakedefine HAVE_FTELLO
 #cmakedefine HAVE_FSEEK64
 #cmakedefine HAVE_FTELL64
+#cmakedefine HAVE_PWRITE
+#cmakedefine HAVE_FDATASYNC
 
 #cmakedefine HAVE_OFF_T
 #ifdef HAVE_OFF_T
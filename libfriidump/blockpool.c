@@ -0,0 +1,184 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Pool of reference-counted 16-sector block buffers, shared by the disc cache and its readers.
+ *
+ * Buffers are allocated in slabs and never returned to the system until the pool is destroyed: when more blocks are referenced than the pool
+ * holds (i.e. many blocks are queued in the dumping pipeline), a new slab is added.
+ */
+
+#include "misc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "constants.h"
+#include "thread.h"
+#include "blockpool.h"
+
+
+/* Alignment of the block buffers, suitable for vector instructions */
+#define BLOCKPOOL_ALIGNMENT 64
+
+
+/*! \brief A group of blocks allocated at once.
+ */
+typedef struct blockpool_slab_s {
+	u_int8_t *mem;				//!< The memory holding the buffers of all the blocks.
+	disc_block *blocks;
+	struct blockpool_slab_s *next;
+} blockpool_slab;
+
+
+/*! \brief A pool of block buffers.
+ */
+struct blockpool_s {
+	u_int32_t slab_size;			//!< Number of blocks in each slab.
+	blockpool_slab *slabs;
+	disc_block *free;			//!< Blocks that are not referenced.
+	my_mutex lock;				//!< Protects reference counts and the free list, as blocks are released by the dumper threads.
+};
+
+
+/* Adds a slab to the pool. Must be called with the pool lock held. */
+static bool blockpool_grow (blockpool *bp) {
+	blockpool_slab *slab;
+	u_int8_t *p;
+	u_int32_t i;
+	bool out;
+
+	out = false;
+	if ((slab = (blockpool_slab *) malloc (sizeof (blockpool_slab)))) {
+		slab -> mem = (u_int8_t *) malloc ((size_t) bp -> slab_size * (RAW_BLOCK_SIZE + BLOCK_SIZE) + BLOCKPOOL_ALIGNMENT);
+		slab -> blocks = (disc_block *) malloc (sizeof (disc_block) * bp -> slab_size);
+		if (!slab -> mem || !slab -> blocks) {
+			my_free (slab -> mem);
+			my_free (slab -> blocks);
+			free (slab);
+		} else {
+			p = (u_int8_t *) (((size_t) slab -> mem + BLOCKPOOL_ALIGNMENT - 1) & ~((size_t) BLOCKPOOL_ALIGNMENT - 1));
+			for (i = 0; i < bp -> slab_size; i++) {
+				slab -> blocks[i].block = -1;
+				slab -> blocks[i].raw = p;
+				slab -> blocks[i].data = p + RAW_BLOCK_SIZE;
+				slab -> blocks[i].refs = 0;
+				slab -> blocks[i].next = bp -> free;
+				bp -> free = &(slab -> blocks[i]);
+				p += RAW_BLOCK_SIZE + BLOCK_SIZE;
+			}
+			slab -> next = bp -> slabs;
+			bp -> slabs = slab;
+			out = true;
+		}
+	}
+
+	return (out);
+}
+
+
+/**
+ * Creates a new block pool.
+ * @param size The number of blocks to allocate at once.
+ * @return The pool, or NULL if it could not be allocated.
+ */
+blockpool *blockpool_new (u_int32_t size) {
+	blockpool *bp;
+
+	if ((bp = (blockpool *) malloc (sizeof (blockpool)))) {
+		bp -> slab_size = size;
+		bp -> slabs = NULL;
+		bp -> free = NULL;
+		my_mutex_init (&(bp -> lock));
+		if (!blockpool_grow (bp))
+			bp = blockpool_destroy (bp);
+	}
+
+	return (bp);
+}
+
+
+/**
+ * Gets an unused block from the pool.
+ * @param bp The pool.
+ * @return The block, holding one reference and no valid data, or NULL if no memory is available.
+ */
+disc_block *blockpool_get (blockpool *bp) {
+	disc_block *b;
+
+	my_mutex_lock (&(bp -> lock));
+	if (!bp -> free)
+		blockpool_grow (bp);
+	if ((b = bp -> free)) {
+		bp -> free = b -> next;
+		b -> block = -1;
+		b -> refs = 1;
+		b -> next = NULL;
+	} else {
+		error ("Cannot allocate block buffers");
+	}
+	my_mutex_unlock (&(bp -> lock));
+
+	return (b);
+}
+
+
+void blockpool_ref (blockpool *bp, disc_block *b) {
+	my_mutex_lock (&(bp -> lock));
+	b -> refs++;
+	my_mutex_unlock (&(bp -> lock));
+
+	return;
+}
+
+
+/**
+ * Drops a reference to a block, giving it back to the pool if it was the last one.
+ * @param bp The pool.
+ * @param b The block.
+ */
+void blockpool_unref (blockpool *bp, disc_block *b) {
+	my_mutex_lock (&(bp -> lock));
+	MY_ASSERT (b -> refs > 0);
+	if (--(b -> refs) == 0) {
+		b -> next = bp -> free;
+		bp -> free = b;
+	}
+	my_mutex_unlock (&(bp -> lock));
+
+	return;
+}
+
+
+void *blockpool_destroy (blockpool *bp) {
+	blockpool_slab *slab;
+
+	if (bp) {
+		while ((slab = bp -> slabs)) {
+			bp -> slabs = slab -> next;
+			free (slab -> mem);
+			free (slab -> blocks);
+			free (slab);
+		}
+		my_mutex_destroy (&(bp -> lock));
+		free (bp);
+	}
+
+	return (NULL);
+}
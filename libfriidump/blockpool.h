@@ -0,0 +1,61 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Pool of reference-counted 16-sector block buffers, shared by the disc cache and its readers.
+ */
+
+#ifndef BLOCKPOOL_H_INCLUDED
+#define BLOCKPOOL_H_INCLUDED
+
+#include "misc.h"
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief A 16-sector block of disc data.
+ *
+ * Read methods dump and unscramble data straight into the block buffers, which are then handed around by reference until they have been hashed
+ * and written. A block goes back to the pool when its last reference is dropped.
+ */
+typedef struct disc_block_s {
+	u_int32_t block;		//!< The block number, or -1 if the buffers hold no valid data yet.
+	u_int8_t *raw;			//!< Raw sectors, RAW_BLOCK_SIZE bytes.
+	u_int8_t *data;			//!< Unscrambled sectors, BLOCK_SIZE bytes.
+	u_int32_t refs;			//!< Number of references.
+	struct disc_block_s *next;	//!< Next block in the free list.
+} disc_block;
+
+typedef struct blockpool_s blockpool;
+
+blockpool *blockpool_new (u_int32_t size);
+disc_block *blockpool_get (blockpool *bp);
+void blockpool_ref (blockpool *bp, disc_block *b);
+void blockpool_unref (blockpool *bp, disc_block *b);
+void *blockpool_destroy (blockpool *bp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
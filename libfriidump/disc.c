@@ -33,12 +33,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 //#include <time.h>
 #include "constants.h"
 #include "byteorder.h"
 #include "disc.h"
 #include "dvd_drive.h"
+#include "dvd_sim.h"
 #include "unscrambler.h"
+#include "raw2384.h"
+#include "ecma-267.h"
+#include "thread.h"
 
 // #define cachedebug(...) debug (__VA_ARGS__);
 #define cachedebug(...)
@@ -47,7 +52,6 @@
 /* Cache always deals with 16-sector blocks. All numbers refer to the 16-sector blocks */
 #define DISC_MINIMUM_CACHE_SIZE 5
 #define DISC_DEFAULT_CACHE_SIZE 40
-#define CACHE_ENTRY_INVALID ((u_int32_t) -1)
 
 
 #define DISC_GAMECUBE_SECTORS_NO 0x0AE0B0	/* 712880 */
@@ -57,14 +61,48 @@
 
 #define MAX_READ_RETRIES 5
 
+/* Strategies used to recover a single block that failed to unscramble, from the cheapest to the slowest */
+#define RECOVER_MEMDUMP 0		/* Dump it again from the drive memory */
+#define RECOVER_READ 1			/* Read it again */
+#define RECOVER_FLUSH 2			/* Read it again after flushing the drive cache */
+#define RECOVER_SLOW 3			/* Read it again at a lower speed */
+
+/* Speed used by RECOVER_SLOW, in KB/s */
+#define RECOVER_SPEED (4 * 177)
+
+/* Speed that means "as fast as possible" for the SET SPEED and SET STREAMING commands */
+#define MAX_SPEED 0xFFFF
+
 #define DEFAULT_READ_METHOD 0
 #define DEFAULT_READ_SECTOR disc_read_sector_0
 
 
 typedef int (*disc_read_sector_func) (disc *d, u_int32_t sector_no, u_int8_t **data, u_int8_t **rawdata);
 
-u_int8_t buf[1024*1024*4];
-u_int8_t buf_unscrambled[1024*1024*4];
+/* Size of the buffer holding the raw data of a read window of the generic methods */
+#define DISC_WINDOW_SIZE (1024 * 1024 * 4)
+
+/* Size of the buffer holding the same read window as 2384-byte frames, for the drives returning them */
+#define DISC_FRAMES_SIZE (DISC_WINDOW_SIZE / RAW_SECTOR_SIZE * RAW2384_FRAME_SIZE)
+
+/* Number of sectors of the simulated disc read by disc_self_test() */
+#define DISC_SELF_TEST_SECTORS (6 * SECTORS_PER_BLOCK)
+
+/* Size of the buffer receiving user data from READ commands of the generic methods (At most 100 sectors are read at a time) */
+#define DISC_READBUF_SIZE (100 * RAW_SECTOR_SIZE)
+
+/* Blocks cached by a streaming READ, which make up a read window of the Hitachi methods */
+#define WINDOW_BLOCKS 5
+
+/* The Hitachi methods keep the user data and the partial dumps of a read window in <code>window</code>, in one of two sets, so that the next
+ * window can be prefetched while the current one is still being processed. This is the size of a set. */
+#define DISC_WINDOW_SET_SIZE (WINDOW_BLOCKS * BLOCK_SIZE + WINDOW_BLOCKS * SECTORS_PER_BLOCK * 16)
+
+/* Default number of commands of the next read window that are queued while the current one is processed */
+#define DEFAULT_PREFETCH 1
+
+/* Maximum prefetch depth, which is not worth being larger than the drive command queue */
+#define MAX_PREFETCH 16
 
 //struct timeval tim;
 //double t1, t2;
@@ -76,6 +114,7 @@ struct disc_s {
 	disc_type type;				//!< The disc type.
 	char system_id;				//!< A letter identifying the target system.
 	char game_id[2 + 1];			//!< Two letters identifying the game.
+	char disc_id[6 + 1];			//!< The complete disc ID (System, game, region and maker codes), usable in file names.
 	disc_region region;			//!< The disc region.
 	char maker[3];				//!< Two letters identifying the maker of the game.
 	u_int8_t version;			//!< A number identifying the game version.
@@ -96,34 +135,41 @@ struct disc_s {
 //	int def_read_method;		//!< Default read method ID.
 	disc_read_sector_func read_sector;	//!< The actual function that will be used to perform read operations, corresponding to <code>read_method</code>.
 	bool unscrambling;			//!< If true, raw data read from the disc will be unscrambled to assure it is error-free. Disabling this is only useful for raw performance tests.
+	u_int32_t retries;			//!< Number of read retries since the disc structure was created.
+	u_int32_t max_retries;			//!< Number of times a read window, or a block that failed in it, is tried before giving up.
+	u_int8_t *block_retries;		//!< Number of read retries for each block (Saturated at 255), allocated on the first retry.
+	u_int32_t block_retries_no;		//!< The number of blocks in <code>block_retries</code>.
+	u_int32_t speed;			//!< The speed set with disc_set_speed(), or -1.
+	u_int32_t streaming_speed;		//!< The speed set with disc_set_streaming_speed(), or -1.
 	unscrambler *u;				//!< The unscrambler structure that will be used to perform the unscrambling.
+	u_int8_t *window;			//!< Raw data dumped by the generic read methods for a whole read window.
+	u_int8_t *frames;			//!< Uncorrected 2384-byte frames dumped by the generic read methods, allocated the first time a drive returns them.
+	u_int8_t *readbuf;			//!< User data returned by the READ commands of the generic read methods, which is not used.
+	farm *farm;				//!< The farm the disc is dumped in, or NULL.
+
+	/* Prefetching of the next read window (Hitachi methods) */
+	u_int32_t prefetch;			//!< Number of commands of the next read window queued while the current one is processed, 0 disables prefetching.
+	u_int32_t prefetch_sector;		//!< The first sector of the prefetched read window, or -1 if none is.
+	u_int32_t prefetch_set;			//!< The buffer set in <code>window</code> used by the prefetched read window.
+	u_int32_t prefetch_queued;		//!< The number of commands of the prefetched read window that have been queued.
+	disc_block *prefetch_blocks[WINDOW_BLOCKS];	//!< The buffers the prefetched read window is being dumped to.
 	
 	/* Read cache */
+	blockpool *pool;			//!< The buffers of the cached blocks, of the blocks being read and of those still used by readers.
 	u_int32_t cache_size;			//!< The number of blocks that will be cached when read.
-	u_int8_t **raw_cache;			//!< Memory area for raw sectors cache.
-	u_int8_t **cache;			//!< Memory area for unscrambled sectors cache.
-	u_int32_t *cache_map;			//!< Data structure used by the caching system to know which blocks are in memory.
+	disc_block **cache;			//!< The cached blocks, each one at position <code>block % cache_size</code> and holding a reference.
 };
 
 
 static void disc_cache_init (disc *d, u_int32_t size) {
-	u_int32_t i;
-
 	if (size < DISC_MINIMUM_CACHE_SIZE) {
 		error ("Invalid cache size %u (must be >= %u)", size, DISC_MINIMUM_CACHE_SIZE);
 		exit (3);
+	} else if (!(d -> pool = blockpool_new (size)) || !(d -> cache = (disc_block **) calloc (size, sizeof (disc_block *)))) {
+		error ("Cannot allocate disc cache");
+		exit (3);
 	} else {
 		d -> cache_size = size;
-		d -> cache = (u_int8_t **) malloc (sizeof (u_int8_t *) * size);
-		d -> raw_cache = (u_int8_t **) malloc (sizeof (u_int8_t *) * size);
-		for (i = 0; i < size; i++) {
-			d -> cache[i] = (u_int8_t *) malloc (sizeof (u_int8_t) * BLOCK_SIZE);
-			d -> raw_cache[i] = (u_int8_t *) malloc (sizeof (u_int8_t) * RAW_BLOCK_SIZE);
-		}
-
-		d -> cache_map = (u_int32_t *) malloc (sizeof (u_int32_t) * size);
-		for (i = 0; i < size; i++)
-			d -> cache_map[i] = CACHE_ENTRY_INVALID;
 	}
 
 	return;
@@ -131,79 +177,272 @@ static void disc_cache_init (disc *d, u_int32_t size) {
 
 
 static void disc_cache_destroy (disc *d) {
-	u_int32_t i;
-	
-	my_free (d -> cache_map);
-	
-	for (i = 0; i < d -> cache_size; i++) {
-			my_free (d -> cache[i]);
-			my_free (d -> raw_cache[i]);
-	}
+	disc_cache_flush (d);
 	my_free (d -> cache);
-	my_free (d -> raw_cache);
+	d -> pool = blockpool_destroy (d -> pool);
 	d -> cache_size = 0;
 
 	return;
 }
 
 
-void disc_cache_add_block (disc *d, u_int32_t block, u_int8_t *data, u_int8_t *rawdata) {
+/* Gets the buffers for a block that is about to be read. They are cached with disc_cache_add_block() or given back with disc_release_block(). */
+static disc_block *disc_block_new (disc *d) {
+	disc_block *b;
+
+	if (!(b = blockpool_get (d -> pool))) {
+		error ("Cannot allocate block buffers");
+		exit (3);
+	}
+
+	return (b);
+}
+
+
+/**
+ * Gives back a block obtained with disc_read_block(). This can be called from any thread.
+ * @param d The disc structure.
+ * @param b The block.
+ */
+void disc_release_block (disc *d, disc_block *b) {
+	blockpool_unref (d -> pool, b);
+
+	return;
+}
+
+
+/**
+ * Adds a block that has been read (and unscrambled) to the cache. The cache takes over the reference of the caller, so that no data is copied.
+ * @param d The disc structure.
+ * @param block The block number.
+ * @param b The block buffers.
+ */
+void disc_cache_add_block (disc *d, u_int32_t block, disc_block *b) {
 	u_int32_t pos;
 	u_int32_t cnt;
+	u_int64_t start;
 	
+	start = my_time_usec ();
 	pos = block % d -> cache_size;
 	//uniform unscrambled output
-	memcpy (d -> cache[pos], data, BLOCK_SIZE);
 	if (d -> type == DISC_TYPE_DVD) {
 		for (cnt = 0; cnt < SECTORS_PER_BLOCK; cnt++) {
-			memcpy (rawdata+(cnt*RAW_SECTOR_SIZE)+12, data+(cnt*SECTOR_SIZE), SECTOR_SIZE);
+			memcpy (b -> raw+(cnt*RAW_SECTOR_SIZE)+12, b -> data+(cnt*SECTOR_SIZE), SECTOR_SIZE);
 		}
 	} else {
 		for (cnt = 0; cnt < SECTORS_PER_BLOCK; cnt++) {
-			memcpy (rawdata+(cnt*RAW_SECTOR_SIZE)+6, data+(cnt*SECTOR_SIZE), SECTOR_SIZE);
+			memcpy (b -> raw+(cnt*RAW_SECTOR_SIZE)+6, b -> data+(cnt*SECTOR_SIZE), SECTOR_SIZE);
 		}
 	}
-	memcpy (d -> raw_cache[pos], rawdata, RAW_BLOCK_SIZE);
-	d -> cache_map[pos] = block;
+	b -> block = block;
+
+	/* Readers of the block being replaced keep it alive as long as they need it */
+	if (d -> cache[pos])
+		blockpool_unref (d -> pool, d -> cache[pos]);
+	d -> cache[pos] = b;
 
 	cachedebug ("Cached block %u (sectors %u-%u) at position %u", block, block * SECTORS_PER_BLOCK, (block + 1) * SECTORS_PER_BLOCK - 1, pos);
+	metrics_add_time (dvd_get_metrics (d -> dvd), METRICS_STAGE_CACHE_ADD, my_time_usec () - start);
 
 	return;
 }
 
 
-static bool disc_cache_lookup_block (disc *d, u_int32_t block, u_int8_t **data, u_int8_t **rawdata) {
-	u_int32_t pos;
-	bool out;
+/**
+ * Drops all the cached blocks, so that they are read again from the disc.
+ * @param d The disc structure.
+ */
+void disc_cache_flush (disc *d) {
+	u_int32_t i;
+
+	for (i = 0; i < d -> cache_size; i++) {
+		if (d -> cache[i])
+			blockpool_unref (d -> pool, d -> cache[i]);
+		d -> cache[i] = NULL;
+	}
+
+	return;
+}
 
-	pos = block % d -> cache_size;
 
-	if (d -> cache_map[pos] == block) {
+static disc_block *disc_cache_lookup_block (disc *d, u_int32_t block) {
+	disc_block *b;
+
+	b = d -> cache[block % d -> cache_size];
+	if (b && b -> block == block) {
 		cachedebug ("Cache HIT for block %u", block);
-		if (data)
-			*data = d -> cache[pos];
-		if (rawdata)
-			*rawdata = d -> raw_cache[pos];
-		out = true;
 	} else {
 		cachedebug ("Cache MISS for block %u", block);
-		if (data)
-			*data = NULL;
-		if (rawdata)
-			*rawdata = NULL;
-		out = false;
+		b = NULL;
 	}
 
+	return (b);
+}
+
+
+/* Checks that raw data read from the drive memory really belong to the block starting at the given sector. Stale data pass the EDC check, as
+ * the unscrambler takes the sector number from the frame itself */
+static bool disc_check_block_id (u_int8_t *raw, u_int32_t sector_no) {
+	return ((raw[0] & 1) != 0 || (raw[1] << 16) + (raw[2] << 8) + raw[3] == 0x30000 + sector_no);
+}
+
+
+/* Records how long a stage of a read took, returning the current time so that stages can be chained */
+static u_int64_t disc_stage_done (disc *d, metrics_timer stage, u_int64_t start) {
+	u_int64_t now;
+
+	now = my_time_usec ();
+	metrics_add_time (dvd_get_metrics (d -> dvd), stage, now - start);
+
+	return (now);
+}
+
+
+/* Unscrambles a block, holding a CPU slot of the farm while doing so */
+static bool disc_unscramble (disc *d, u_int32_t sector_no, u_int8_t *raw, u_int8_t *data) {
+	u_int64_t start;
+	bool out;
+
+	if (d -> farm)
+		farm_cpu_acquire (d -> farm);
+	start = my_time_usec ();
+	out = unscrambler_unscramble_16sectors (d -> u, sector_no, raw, data);
+	disc_stage_done (d, METRICS_STAGE_UNSCRAMBLE, start);
+	if (d -> farm)
+		farm_cpu_release (d -> farm);
+
 	return (out);
 }
 
 
+/* Accounts for a read retry of a block */
+static void disc_count_retry (disc *d, u_int32_t block) {
+	u_int32_t n;
+	u_int8_t *p;
+
+	d -> retries++;
+
+	if (block >= d -> block_retries_no) {
+		n = d -> sectors_no / SECTORS_PER_BLOCK + 1;
+		if (n <= block)
+			n = block + 1;
+		if ((p = (u_int8_t *) realloc (d -> block_retries, n))) {
+			memset (p + d -> block_retries_no, 0, n - d -> block_retries_no);
+			d -> block_retries = p;
+			d -> block_retries_no = n;
+		}
+	}
+	if (block < d -> block_retries_no && d -> block_retries[block] < 255)
+		d -> block_retries[block]++;
+
+	return;
+}
+
+
+/**
+ * Tries to read again a single block that failed to unscramble, escalating the recovery strategy at each attempt: first the block is dumped again
+ * from the drive memory (If it is still there), then it is read again, then it is read again after flushing the drive cache and finally it is read
+ * at a lower speed. The block is cached if it can be recovered.
+ * @param d The disc structure.
+ * @param block The block to recover.
+ * @param mem_offset The offset of the block in the drive memory, if it was read last and nothing was read afterwards, -1 otherwise.
+ * @return True if the block could be recovered.
+ */
+static bool disc_recover_block (disc *d, u_int32_t block, int mem_offset) {
+	disc_block *b;
+	u_int32_t sector_no, attempt, level;
+	int ret;
+	bool out, slow;
+
+	b = disc_block_new (d);
+	sector_no = block * SECTORS_PER_BLOCK;
+	slow = false;
+	out = false;
+	for (attempt = 0; !out && attempt < d -> max_retries; attempt++) {
+		level = mem_offset >= 0 ? attempt : attempt + 1;
+		if (level > RECOVER_SLOW)
+			level = RECOVER_SLOW;
+		warning ("Read retry %u for block %u (sectors %u-%u)", attempt + 1, block, sector_no, sector_no + SECTORS_PER_BLOCK - 1);
+		disc_count_retry (d, block);
+		metrics_count (dvd_get_metrics (d -> dvd), METRICS_COUNT_BLOCK_RETRIES);
+
+		if (level == RECOVER_MEMDUMP) {
+			ret = 0;
+		} else {
+			if (level == RECOVER_SLOW && !slow) {
+				dvd_set_speed (d -> dvd, RECOVER_SPEED, NULL);
+				dvd_set_streaming (d -> dvd, RECOVER_SPEED, NULL);
+				slow = true;
+			}
+			if (level >= RECOVER_FLUSH) {
+				/* Try to reset in-memory data by seeking to a distant sector */
+				if (sector_no +992 +16 <= d -> sectors_no) //smaller than last sector
+					dvd_read_sector_dummy (d -> dvd, sector_no +992, 16, NULL, NULL, 0);
+				else if (sector_no >= 992)                //larger than first sector
+					dvd_read_sector_dummy (d -> dvd, sector_no -992, 16, NULL, NULL, 0);
+				dvd_flush_cache_READ12 (d -> dvd, sector_no, NULL);
+			}
+			ret = dvd_read_sector_dummy (d -> dvd, sector_no, SECTORS_PER_BLOCK, NULL, NULL, 0);
+			mem_offset = 0;
+		}
+
+		if (ret < 0) {
+			error ("dvd_read_sector_dummy() failed with %d", ret);
+		} else if (dvd_memdump (d -> dvd, mem_offset, 1, RAW_BLOCK_SIZE, b -> raw) < 0) {
+			error ("Memdump failed");
+		} else if (!disc_check_block_id (b -> raw, sector_no)) {
+			/* Wrong sector in memory */
+		} else if (disc_unscramble (d, sector_no, b -> raw, b -> data)) {
+			disc_cache_add_block (d, block, b);
+			out = true;
+		}
+	}
+	if (!out)
+		disc_release_block (d, b);
+	metrics_count (dvd_get_metrics (d -> dvd), out ? METRICS_COUNT_RECOVERED : METRICS_COUNT_UNRECOVERED);
+
+	/* Back to the requested speed */
+	if (slow) {
+		dvd_set_speed (d -> dvd, d -> speed != -1 ? d -> speed : MAX_SPEED, NULL);
+		dvd_set_streaming (d -> dvd, d -> streaming_speed != -1 ? d -> streaming_speed : MAX_SPEED, NULL);
+	}
+
+	return (out);
+}
+
+
+/* Corrects the 2384-byte frames of the first chunks of a read window as a whole, so that the ECC blocks straddling two chunks still get their PO
+   parity, and converts them to the raw sectors of the window. Returns the number of chunks holding the requested sectors */
+static u_int32_t disc_convert_frames (disc *d, u_int32_t sector_no, u_int32_t step, u_int32_t chunks) {
+	u_int32_t cnt, n;
+	u_int8_t *p;
+	u_int64_t t;
+
+	t = my_time_usec ();
+	raw2384_correct (d -> frames, chunks * step);
+	if ((n = raw2384_deinterleave (d -> frames, chunks * step, d -> window)) < chunks * step)
+		error ("sector sequence broken");
+	disc_stage_done (d, METRICS_STAGE_MEMDUMP, t);
+
+	for (cnt = 0; (cnt + 1) * step <= n; cnt++) {
+		//do this check only on 1st layer
+		p = &d -> window[cnt*(2064*step)];
+		if (((p[0] & 1) == 0) && ((p[1]<<16)+(p[2]<<8)+(p[3]) != 0x30000 + sector_no+(cnt*step)))
+			break;
+	}
+
+	return (cnt);
+}
+
+
 static int disc_read_sector_generic (disc *d, u_int32_t sector_no, u_int8_t **data, u_int8_t **rawdata, u_int32_t method) {
-	bool out;
+	disc_block *b;
+	bool out, frames;
 	u_int32_t start_block;
 	int ret, retry;
 	u_int32_t step, cnt, max_cnt, max_blk;
-	u_int32_t block_len, block_size, _block_size, last_block_size, block_cnt;
+	int mem_offset;
+	u_int64_t t;
 //fprintf (stdout,"disc_read_sector_%d", method);
 	start_block = sector_no / SECTORS_PER_BLOCK;
 
@@ -212,51 +451,57 @@ static int disc_read_sector_generic (disc *d, u_int32_t sector_no, u_int8_t **da
 	max_cnt = d->max_cnt;
 	max_blk = d->max_blk;
 
-	block_size = step*2064;
-	last_block_size = block_size;
-	block_len = 1;
-	if (block_size > 27 * 2064) {
-		block_len = block_size / (27*2064);
-		if (block_size % (27*2064) != 0) block_len += 1;
-		block_size = 27*2064;
-		last_block_size = (step*2064) - (27*2064*(block_len-1));
+	if ((frames = dvd_memdump_returns_frames (d -> dvd)) && !d -> frames && !(d -> frames = (u_int8_t *) malloc (DISC_FRAMES_SIZE))) {
+		error ("Cannot allocate read buffers");
+		exit (3);
 	}
-	_block_size=block_size;
 
-	for (retry = 0; !out && retry < MAX_READ_RETRIES; retry++) {
+	for (retry = 0; !out && retry < d -> max_retries; retry++) {
 		/* Assume everything will turn out well */
 		out = true;
+		if (retry > 0) {
+			disc_count_retry (d, start_block);
+			metrics_count (dvd_get_metrics (d -> dvd), METRICS_COUNT_WINDOW_RETRIES);
+		}
 
 		//Streaming read
 		if (retry < 3) {
 			cnt=0;
 			while (cnt <= max_cnt){
 
-				_block_size=block_size;
+				t = my_time_usec ();
 				if (method == 0 || method == 1 || method == 4) {
 					if (sector_no+(cnt*step) +992 +16 <= d -> sectors_no) //smaller than last sector
 						dvd_read_sector_dummy (d -> dvd, sector_no+(cnt*step) +992, 16, NULL, NULL, 0);
 					else if (sector_no+(cnt*step) -992 >= 0)             //larger than first sector
 						dvd_read_sector_dummy (d -> dvd, sector_no+(cnt*step) -992, 16, NULL, NULL, 0);
 					else dvd_flush_cache_READ12 (d -> dvd, sector_no+(cnt*step), NULL);
+					t = disc_stage_done (d, METRICS_STAGE_SEEK, t);
 				}
 
-				if (method == 0 || method == 2 || method == 5) dvd_flush_cache_READ12 (d -> dvd, sector_no+(cnt*step), NULL);
-				if (method == 0 || method == 1 || method == 2 || method == 3) ret = dvd_read_sector_dummy (d -> dvd, sector_no+(cnt*step), d->sec_disc, NULL, &buf_unscrambled[0], 2064*step);
-				if (method == 4 || method == 5 || method == 6) ret = dvd_read_streaming (d -> dvd, sector_no+(cnt*step), d->sec_disc, NULL, &buf_unscrambled[0], 2064*step);
+				if (method == 0 || method == 2 || method == 5) {
+					dvd_flush_cache_READ12 (d -> dvd, sector_no+(cnt*step), NULL);
+					t = disc_stage_done (d, METRICS_STAGE_FLUSH, t);
+				}
+				if (method == 0 || method == 1 || method == 2 || method == 3) ret = dvd_read_sector_dummy (d -> dvd, sector_no+(cnt*step), d->sec_disc, NULL, d -> readbuf, 2064*step);
+				if (method == 4 || method == 5 || method == 6) ret = dvd_read_streaming (d -> dvd, sector_no+(cnt*step), d->sec_disc, NULL, d -> readbuf, 2064*step);
+				t = disc_stage_done (d, METRICS_STAGE_READ, t);
 				if (ret >= 0) {
-					for (block_cnt=0; block_cnt<block_len; block_cnt++) {
-						if (dvd_memdump (d -> dvd, block_cnt*27*2064, 1, _block_size, &buf[(cnt*(2064 * step))+(block_cnt*27*2064)]) < 0) {
-							error ("Memdump failed");
-							//retry = MAX_READ_RETRIES;		/* Well, if this fails going on is useless */ //no it's not!
-							out = false;
-							break;
-						} 
-						if (block_cnt==block_len-1) _block_size = last_block_size;
+					/* Dump the chunk with as few commands as the drive accepts. 2384-byte frames are only corrected once the whole window
+					 * is there, as the ECC blocks straddling two chunks are split between two READs */
+					if (frames)
+						ret = dvd_memdump_frames (d -> dvd, 0, 2064 * step, &d -> frames[cnt*(RAW2384_FRAME_SIZE * step)]);
+					else
+						ret = dvd_memdump_range (d -> dvd, 0, 2064 * step, &d -> window[cnt*(2064 * step)]);
+					disc_stage_done (d, METRICS_STAGE_MEMDUMP, t);
+					if (ret < 0) {
+						error ("Memdump failed");
+						//retry = MAX_READ_RETRIES;		/* Well, if this fails going on is useless */ //no it's not!
+						out = false;
+						break;
 					}
-					if (!out) break;
 					//do this check only on 1st layer
-					else if (((buf[cnt*(2064*step)] & 1) == 0) && ((buf[cnt*(2064*step)+1]<<16)+(buf[cnt*(2064*step)+2]<<8)+(buf[cnt*(2064*step)+3]) != 0x30000 + sector_no+(cnt*step))) {
+					else if (!frames && ((d -> window[cnt*(2064*step)] & 1) == 0) && ((d -> window[cnt*(2064*step)+1]<<16)+(d -> window[cnt*(2064*step)+2]<<8)+(d -> window[cnt*(2064*step)+3]) != 0x30000 + sector_no+(cnt*step))) {
 						out = false;
 						break;
 					}
@@ -268,27 +513,45 @@ static int disc_read_sector_generic (disc *d, u_int32_t sector_no, u_int8_t **da
 				}
 
 			}
-			
+
+			if (frames && cnt > 0 && (cnt = disc_convert_frames (d, sector_no, step, cnt)) <= max_cnt)
+				out = false;
 			if (cnt < max_cnt) out = false;
 			else {
+				/* The last chunk read is still in the drive memory, so its blocks can be dumped again if they fail */
+				mem_offset = -1;
+
+				/* Try to unscramble all data to see if EDC fails. Blocks that unscramble correctly are cached, the others are recovered
+				 * one at a time, so that a single bad block does not cause the whole window to be read again. Memdumps here span
+				 * several blocks, so raw data must be moved to the block buffers */
+				//for(cnt=0; cnt <= 4; cnt++) {
+				for(cnt=max_blk; cnt--;) {
+					/* The window can extend past the end of the disc */
+					if ((start_block + cnt) * SECTORS_PER_BLOCK >= d -> sectors_no)
+						continue;
+
+					b = disc_block_new (d);
 #ifdef DEBUG
-				if (d -> unscrambling) {
+					if (!d -> unscrambling) {
+						memcpy (b -> raw, &d -> window[cnt*(2064*16)], RAW_BLOCK_SIZE);
+						disc_cache_add_block (d, start_block+cnt, b);
+					} else
 #endif
-					/* Try to unscramble all data to see if EDC fails */
-					//for(cnt=0; cnt <= 4; cnt++) {
-					for(cnt=max_blk; cnt--;) {
-						if (!unscrambler_unscramble_16sectors (d -> u, sector_no+(cnt*16), &buf[cnt*(2064*16)], &buf_unscrambled[cnt*(2048*16)]))
+					if (disc_check_block_id (&d -> window[cnt*(2064*16)], sector_no+(cnt*16)) &&
+					    disc_unscramble (d, sector_no+(cnt*16), &d -> window[cnt*(2064*16)], b -> data)) {
+						memcpy (b -> raw, &d -> window[cnt*(2064*16)], RAW_BLOCK_SIZE);
+						disc_cache_add_block (d, start_block+cnt, b);
+					} else {
+						disc_release_block (d, b);
+						if (mem_offset == -1 && cnt*16 >= max_cnt*step && (cnt+1)*16 <= (max_cnt+1)*step)
+							mem_offset = (cnt*16 - max_cnt*step) * 2064;
+						if (!disc_recover_block (d, start_block+cnt, mem_offset) && cnt == 0) {
+							/* The requested block could not be recovered, reading the window again is pointless */
 							out = false;
+							retry = d -> max_retries;
+						}
+						mem_offset = -2;	/* Something else was read */
 					}
-#ifdef DEBUG
-				}
-#endif
-			}
-			if (out) {
-				/* If data were unscrambled correctly, add them to the cache */
-				//for(cnt = 0; cnt <= 4; cnt++) {
-				for(cnt=max_blk; cnt--;) {
-					disc_cache_add_block (d, start_block+cnt, &buf_unscrambled[cnt*(2048*16)], &buf[cnt*(2064*16)]);
 				}
 			}
 		} //if (retry < 3)
@@ -304,18 +567,19 @@ static int disc_read_sector_generic (disc *d, u_int32_t sector_no, u_int8_t **da
 			dvd_flush_cache_READ12 (d -> dvd, sector_no, NULL);
 			ret = dvd_read_sector_dummy (d -> dvd, sector_no, SECTORS_PER_BLOCK, NULL, NULL, 0);
 			if (ret >= 0) {
-				if (dvd_memdump (d -> dvd, 0, 1, RAW_BLOCK_SIZE, buf) < 0) {
+				b = disc_block_new (d);
+				if (dvd_memdump (d -> dvd, 0, 1, RAW_BLOCK_SIZE, b -> raw) < 0) {
 					error ("Memdump failed");
 					//retry = MAX_READ_RETRIES;		/* Well, if this fails going on is useless */
 					out = false;
 				} 
-				else if ( ((*(buf) & 1) == 0) && ((*(buf+1)<<16)+(*(buf+2)<<8)+(*(buf+3)) != 0x30000+sector_no) ) out = false;
+				else if ( ((*(b -> raw) & 1) == 0) && ((*(b -> raw+1)<<16)+(*(b -> raw+2)<<8)+(*(b -> raw+3)) != 0x30000+sector_no) ) out = false;
 				else {
 #ifdef DEBUG
 					if (d -> unscrambling) {
 #endif
 						/* Try to unscramble all data to see if EDC fails */
-						if (!unscrambler_unscramble_16sectors (d -> u, sector_no, buf, buf_unscrambled))
+						if (!disc_unscramble (d, sector_no, b -> raw, b -> data))
 							out = false;
 #ifdef DEBUG
 					}
@@ -323,7 +587,9 @@ static int disc_read_sector_generic (disc *d, u_int32_t sector_no, u_int8_t **da
 				}
 				if (out) {
 					/* If data were unscrambled correctly, add them to the cache */
-					disc_cache_add_block (d, start_block, buf_unscrambled, buf);
+					disc_cache_add_block (d, start_block, b);
+				} else {
+					disc_release_block (d, b);
 				}
 			} else {
 				error ("dvd_read_sector_dummy() failed with %d", ret);
@@ -383,22 +649,198 @@ static int disc_read_sector_6 (disc *d, u_int32_t sector_no, u_int8_t **data, u_
 
 
 ///////////////////////////// Hitachi /////////////////////////////
+/* Number of blocks in the read window starting at the given sector, which is shorter at the end of the disc */
+static u_int32_t disc_window_nblocks (disc *d, u_int32_t sector_no) {
+	u_int32_t blocks;
+
+	for (blocks = 0; blocks < WINDOW_BLOCKS && sector_no + blocks * SECTORS_PER_BLOCK < d -> sectors_no; blocks++)
+		;
+
+	return (blocks);
+}
+
+
+/* User data returned by the READ command for a block of a read window */
+static u_int8_t *disc_window_data (disc *d, u_int32_t set, u_int32_t block) {
+	return (d -> window + set * DISC_WINDOW_SET_SIZE + block * BLOCK_SIZE);
+}
+
+
+/* EDC field of a sector of a read window, followed by the first 12 bytes of the next sector (Method 9) */
+static u_int8_t *disc_window_fields (disc *d, u_int32_t set, u_int32_t block, u_int32_t sector) {
+	return (d -> window + set * DISC_WINDOW_SET_SIZE + WINDOW_BLOCKS * BLOCK_SIZE + (block * SECTORS_PER_BLOCK + sector) * 16);
+}
+
+
+/**
+ * Tells how many commands the current read method (7 or 9) needs to read a window.
+ * @param d The disc structure.
+ * @param sector_no The first sector of the window.
+ * @param opening Will hold how many of them, at the beginning, are READ commands that bring the window into the drive memory.
+ * @return The number of commands.
+ */
+static u_int32_t disc_window_cmds (disc *d, u_int32_t sector_no, u_int32_t *opening) {
+	u_int32_t blocks, out;
+
+	blocks = disc_window_nblocks (d, sector_no);
+	if (d -> read_method == 7) {
+		*opening = 1;
+		out = 1 + blocks;
+	} else {
+		*opening = 2;
+		out = 2 + 1 + 16 * blocks + (blocks - 1);
+	}
+
+	return (out);
+}
+
+
+/**
+ * Queues a command of a read window of method 7 or 9. The drive executes queued commands in order, so a READ command never overwrites the drive
+ * memory before the dumps queued ahead of it have been transferred.
+ * @param d The disc structure.
+ * @param sector_no The first sector of the window.
+ * @param set The buffer set in <code>window</code> used by the window.
+ * @param b The buffers of the blocks of the window.
+ * @param i The command number, from 0 to disc_window_cmds() - 1.
+ */
+static void disc_submit_window_cmd (disc *d, u_int32_t sector_no, u_int32_t set, disc_block **b, u_int32_t i) {
+	u_int32_t blocks, j, k;
+
+	blocks = disc_window_nblocks (d, sector_no);
+	if (d -> read_method == 7) {
+		/* A READ command, which will cache 5 16-sector blocks, then a dump for each block */
+		if (i == 0)
+			dvd_submit_read_sector_streaming (d -> dvd, sector_no, NULL, disc_window_data (d, set, 0), BLOCK_SIZE);
+		else
+			dvd_memdump_submit (d -> dvd, (i - 1) * 16 * 2064, 16 * 2064, b[i - 1] -> raw);	/* Dumping in a single block is faster */
+	} else if (i == 0) {
+		/* Reading a different window first makes the drive read the requested one from the disc again */
+		if (sector_no > d -> sectors_no - 1000)
+			dvd_submit_read_sector_streaming (d -> dvd, sector_no - 16 * 5 * 2, NULL, disc_window_data (d, set, 1), BLOCK_SIZE);
+		else
+			dvd_submit_read_sector_streaming (d -> dvd, sector_no + 16 * 5, NULL, disc_window_data (d, set, 1), BLOCK_SIZE);
+	} else if (i == 1) {
+		dvd_submit_read_sector_streaming (d -> dvd, sector_no, NULL, disc_window_data (d, set, 0), BLOCK_SIZE);
+	} else if (i == 2) {
+		/* The first 12 bytes (ID, IED and CPR_MAI fields) of the first sector */
+		dvd_memdump_submit (d -> dvd, 0, 12, b[0] -> raw);
+	} else if (i <= 2 + 16 * blocks) {
+		/* The last 4 bytes (EDC field) of every sector together with the first 12 of the following one */
+		j = (i - 3) / 16;
+		k = (i - 3) % 16;
+		dvd_memdump_submit (d -> dvd, (j * RAW_BLOCK_SIZE) + k * RAW_SECTOR_SIZE + 2060, 16, disc_window_fields (d, set, j, k));	/* Dumping in a single block is faster */
+	} else {
+		/* The READ commands for the remaining 4 16-sector blocks, which return their user data */
+		j = i - 2 - 16 * blocks;
+		dvd_submit_read_sector_streaming (d -> dvd, sector_no + j * 16, NULL, disc_window_data (d, set, j), BLOCK_SIZE);
+	}
+
+	return;
+}
+
+
+/**
+ * Prefetches the read window starting at <code>sector_no</code>, which is expected to be requested next: its READ commands, and up to
+ * <code>prefetch</code> - 1 of the following ones, are queued behind the commands of the current window, so that the drive reads it from the
+ * disc while the current one is being unscrambled and consumed. Commands that do not fit in the drive queue are queued by later calls.
+ * @param d The disc structure.
+ * @param sector_no The first sector of the window.
+ * @param set The buffer set in <code>window</code> to be used by the window, which must not be the one of the current window.
+ */
+static void disc_prefetch (disc *d, u_int32_t sector_no, u_int32_t set) {
+	u_int32_t j, cmds, opening;
+
+	if (d -> prefetch > 0 && sector_no < d -> sectors_no && (d -> read_method == 7 || d -> read_method == 9)) {
+		cmds = disc_window_cmds (d, sector_no, &opening);
+		if (d -> prefetch_sector == (u_int32_t) -1 && dvd_get_queue_free (d -> dvd) >= opening) {
+			for (j = 0; j < disc_window_nblocks (d, sector_no); j++)
+				d -> prefetch_blocks[j] = disc_block_new (d);
+			d -> prefetch_sector = sector_no;
+			d -> prefetch_set = set;
+			d -> prefetch_queued = 0;
+			metrics_count (dvd_get_metrics (d -> dvd), METRICS_COUNT_PREFETCH);
+		}
+
+		if (d -> prefetch_sector == sector_no) {
+			for (; d -> prefetch_queued < opening + d -> prefetch - 1 && d -> prefetch_queued < cmds && dvd_get_queue_free (d -> dvd) > 0;
+				d -> prefetch_queued++)
+				disc_submit_window_cmd (d, sector_no, d -> prefetch_set, d -> prefetch_blocks, d -> prefetch_queued);
+		}
+	}
+
+	return;
+}
+
+
+/* Drops the prefetched read window, if any. This must be done before the drive is sent any command which is not part of it. */
+static void disc_prefetch_cancel (disc *d) {
+	u_int32_t i;
+
+	if (d -> prefetch_sector != (u_int32_t) -1) {
+		for (i = 0; i < d -> prefetch_queued; i++)
+			dvd_reap (d -> dvd);
+		for (i = 0; i < disc_window_nblocks (d, d -> prefetch_sector); i++)
+			disc_release_block (d, d -> prefetch_blocks[i]);
+		d -> prefetch_sector = -1;
+	}
+
+	return;
+}
+
+
+/**
+ * Gets the buffers for a read window of method 7 or 9, taking over the prefetched window if it is the requested one and dropping it otherwise.
+ * @param d The disc structure.
+ * @param sector_no The first sector of the window.
+ * @param b Will hold the buffers of the blocks of the window.
+ * @param set Will hold the buffer set in <code>window</code> used by the window.
+ * @return The number of commands of the window that have already been queued.
+ */
+static u_int32_t disc_prefetch_take (disc *d, u_int32_t sector_no, disc_block **b, u_int32_t *set) {
+	u_int32_t j, out;
+
+	if (d -> prefetch_sector == sector_no) {
+		for (j = 0; j < disc_window_nblocks (d, sector_no); j++)
+			b[j] = d -> prefetch_blocks[j];
+		*set = d -> prefetch_set;
+		out = d -> prefetch_queued;
+		d -> prefetch_sector = -1;
+		metrics_count (dvd_get_metrics (d -> dvd), METRICS_COUNT_PREFETCH_HITS);
+	} else {
+		disc_prefetch_cancel (d);
+		for (j = 0; j < disc_window_nblocks (d, sector_no); j++)
+			b[j] = disc_block_new (d);
+		*set = 0;
+		out = 0;
+	}
+
+	return (out);
+}
+
+
 static int disc_read_sector_7 (disc *d, u_int32_t sector_no, u_int8_t **data, u_int8_t **rawdata) {
 	bool out;
-	u_int32_t start_block;
+	u_int32_t start_block, set, blocks, cmds, opening, submitted, reaped;
 	int j, ret, retry;
-	u_int8_t buf[5][16 * 2064];
-	u_int8_t buf_unscrambled[5][16 * 2048];
+	disc_block *b[WINDOW_BLOCKS];
 //fprintf (stdout,"disc_read_sector_7");
 	start_block = sector_no / SECTORS_PER_BLOCK;
+	blocks = disc_window_nblocks (d, sector_no);
+	cmds = disc_window_cmds (d, sector_no, &opening);
 
 	out = false;
-	for (retry = 0; !out && retry < MAX_READ_RETRIES; retry++) {
+	for (retry = 0; !out && retry < d -> max_retries; retry++) {
 		/* Assume everything will turn out well */
 		out = true;
 
+		/* Some commands might have been queued while the previous window was being processed */
+		submitted = disc_prefetch_take (d, sector_no, b, &set);
+
 		if (retry > 0) {
 			warning ("Read retry %d for sector %u", retry, sector_no);
+			disc_count_retry (d, start_block);
+			metrics_count (dvd_get_metrics (d -> dvd), METRICS_COUNT_WINDOW_RETRIES);
 
 			/* Try to reset in-memory data by seeking to a distant sector */
 //			if (sector_no > 1000)
@@ -412,34 +854,46 @@ static int disc_read_sector_7 (disc *d, u_int32_t sector_no, u_int8_t **data, u_
 			else dvd_flush_cache_READ12 (d -> dvd, sector_no, NULL);
 		}
 
-		if ((ret = dvd_read_sector_streaming (d -> dvd, sector_no, NULL, NULL, 0)) >= 0) {
-			for (j = 0; j < 5 && sector_no + j * 16 < d -> sectors_no && out; j++) {
-				if (dvd_memdump (d -> dvd, 0 + (j * 16 * 2064), 1, 16 * 2064, buf[j]) < 0) {	/* Dumping in a single block is faster */
-					error ("Memdump failed");
-					out = false;
-					retry = MAX_READ_RETRIES;		/* Well, if this fails going on is useless */
+		/* Queue the READ command and all the dumps, so that each block can be unscrambled while the following ones are being transferred.
+		 * The next window is prefetched right behind them. */
+		for (reaped = 0; reaped < cmds; reaped++) {
+			for (; out && submitted < cmds && dvd_get_queue_free (d -> dvd) > 0; submitted++)
+				disc_submit_window_cmd (d, sector_no, set, b, submitted);
+			if (out && submitted == cmds)
+				disc_prefetch (d, sector_no + blocks * SECTORS_PER_BLOCK, 1 - set);
+			if (reaped == submitted)
+				break;		/* Something failed and all that was queued has been reaped */
+
+			if ((ret = dvd_reap (d -> dvd)) < 0 && out) {
+				if (reaped == 0) {
+					error ("dvd_read_sector_streaming() failed with %d", ret);
 				} else {
+					error ("Memdump failed");
+					retry = d -> max_retries;		/* Well, if this fails going on is useless */
+				}
+				out = false;
+			} else if (out && reaped > 0) {
+				j = reaped - 1;
 #ifdef DEBUG
-					if (d -> unscrambling) {
+				if (d -> unscrambling) {
 #endif
-						/* Try to unscramble all data to see if EDC fails */
-						if (!unscrambler_unscramble_16sectors (d -> u, sector_no + (j * 16), buf[j], buf_unscrambled[j]))
-							out = false;
+					/* Try to unscramble all data to see if EDC fails. The drive memory might still hold an older window, if the READ
+					 * command was served from the drive cache */
+					if (!disc_check_block_id (b[j] -> raw, sector_no + (j * 16)) || !disc_unscramble (d, sector_no + (j * 16), b[j] -> raw, b[j] -> data))
+						out = false;
 #ifdef DEBUG
-					}
-#endif
 				}
+#endif
 			}
+		}
 
-			if (out) {
-				/* It seems all data was unscrambled correctly, so cache them out */
-				for (j = 0; j < 5 && sector_no + j * 16 < d -> sectors_no; j++)
-					disc_cache_add_block (d, start_block + j, buf_unscrambled[j], buf[j]);
-
-			}
+		if (out) {
+			/* It seems all data were unscrambled correctly, so cache them out */
+			for (j = 0; j < blocks; j++)
+				disc_cache_add_block (d, start_block + j, b[j]);
 		} else {
-			error ("dvd_read_sector_streaming() failed with %d", ret);
-			out = false;
+			for (j = 0; j < blocks; j++)
+				disc_release_block (d, b[j]);
 		}
 	}
 
@@ -453,21 +907,25 @@ static int disc_read_sector_7 (disc *d, u_int32_t sector_no, u_int8_t **data, u_
 static int disc_read_sector_8 (disc *d, u_int32_t sector_no, u_int8_t **data, u_int8_t **rawdata) {
 	bool out;
 	u_int32_t ram_offset;
-	int j, k, ret, retry;
-	u_int8_t *sect, buf[5][RAW_BLOCK_SIZE];
+	int j, k, ret, retry, nblk;
+	u_int8_t *sect;
 	u_int8_t readbuf[BLOCK_SIZE];
-	u_int8_t buf_unscrambled[5][BLOCK_SIZE];
+	disc_block *b[5];
 	u_int32_t start_block;
 //fprintf (stdout,"disc_read_sector_8");
 	start_block = sector_no / SECTORS_PER_BLOCK;
 	
 	out = false;
-	for (retry = 0; !out && retry < MAX_READ_RETRIES; retry++) {
+	for (retry = 0; !out && retry < d -> max_retries; retry++) {
 		/* Assume everything will turn out well */
 		out = true;
+		for (nblk = 0; nblk < 5 && sector_no + nblk * 16 < d -> sectors_no; nblk++)
+			b[nblk] = disc_block_new (d);
 
 		if (retry > 0) {
 			warning ("Read retry %d for sector %u", retry, sector_no);
+			disc_count_retry (d, start_block);
+			metrics_count (dvd_get_metrics (d -> dvd), METRICS_COUNT_WINDOW_RETRIES);
 
 			/* Try to reset in-memory data by seeking to a distant sector */
 //			if (sector_no > 1000)
@@ -490,13 +948,13 @@ static int disc_read_sector_8 (disc *d, u_int32_t sector_no, u_int8_t **data, u_
 			for (j = 0; j < 5 && sector_no + j * 16 < d -> sectors_no && out; j++) {
 				/* Reconstruct raw sectors */
 				for (k = 0; k < 16; k++) {
-					sect = &buf[j][k * RAW_SECTOR_SIZE];
+					sect = &b[j] -> raw[k * RAW_SECTOR_SIZE];
 					ram_offset = (j * RAW_BLOCK_SIZE) + k * RAW_SECTOR_SIZE;
 					/* Get first 12 bytes (ID. IED and CPR_MAI fields) and last 4 bytes (EDC field) with memdump */
 					if (dvd_memdump (d -> dvd, ram_offset, 1, 12, sect) < 0) {
 						error ("Memdump (1) failed");
 						out = false;
-						retry = MAX_READ_RETRIES;		/* Well, if this fails going on is useless */
+						retry = d -> max_retries;		/* Well, if this fails going on is useless */
 					} else if (dvd_memdump (d -> dvd, ram_offset + 2060, 1, 4, sect + 2060) < 0) {	/* Dumping in a single block is faster */
 						error ("Memdump (2) failed");
 						out = false;
@@ -509,14 +967,14 @@ static int disc_read_sector_8 (disc *d, u_int32_t sector_no, u_int8_t **data, u_
 				if (j == 0 || (ret = dvd_read_sector_streaming (d -> dvd, sector_no + j * 16, NULL, readbuf, sizeof (readbuf))) >= 0) {
 					/* Copy "user data" field which has been incorrectly unscrambled by the DVD drive firmware */
 					for (k = 0; k < 16; k++) {
-						sect = &buf[j][k * RAW_SECTOR_SIZE];
+						sect = &b[j] -> raw[k * RAW_SECTOR_SIZE];
 						memcpy (sect + 12, readbuf + k * SECTOR_SIZE, SECTOR_SIZE);
 					}
 #ifdef DEBUG
 					if (d -> unscrambling) {
 #endif
 						/* Try to unscramble all data to see if EDC fails */
-						if (!unscrambler_unscramble_16sectors (d -> u, sector_no + (j * 16), buf[j], buf_unscrambled[j]))
+						if (!disc_unscramble (d, sector_no + (j * 16), b[j] -> raw, b[j] -> data))
 							out = false;
 #ifdef DEBUG
 					}
@@ -529,13 +987,18 @@ static int disc_read_sector_8 (disc *d, u_int32_t sector_no, u_int8_t **data, u_
 
 			if (out) {
 				/* It seems all data were unscrambled correctly, so cache them out */
-				for (j = 0; j < 5 && sector_no + j * SECTORS_PER_BLOCK < d -> sectors_no; j++)
-					disc_cache_add_block (d, start_block + j, buf_unscrambled[j], buf[j]);
+				for (j = 0; j < nblk; j++)
+					disc_cache_add_block (d, start_block + j, b[j]);
 			}
 		} else {
 			error ("dvd_read_sector_streaming() failed with %d", ret);
 			out = false;
 		}
+
+		if (!out) {
+			for (j = 0; j < nblk; j++)
+				disc_release_block (d, b[j]);
+		}
 	}
 
 	if (!out)
@@ -547,22 +1010,27 @@ static int disc_read_sector_8 (disc *d, u_int32_t sector_no, u_int8_t **data, u_
 
 static int disc_read_sector_9 (disc *d, u_int32_t sector_no, u_int8_t **data, u_int8_t **rawdata) {
 	bool out;
-	u_int32_t ram_offset;
+	u_int32_t start_block, set, blocks, cmds, opening, submitted, reaped;
 	int j, k, ret, retry;
-	u_int8_t *sect, buf[5][RAW_BLOCK_SIZE];
-	u_int8_t readbuf[BLOCK_SIZE], tmp[16];
-	u_int8_t buf_unscrambled[5][BLOCK_SIZE];
-	u_int32_t start_block;
+	u_int8_t *sect;
+	disc_block *b[WINDOW_BLOCKS];
 //fprintf (stdout,"disc_read_sector_9");
 	start_block = sector_no / SECTORS_PER_BLOCK;
+	blocks = disc_window_nblocks (d, sector_no);
+	cmds = disc_window_cmds (d, sector_no, &opening);
 
 	out = false;
-	for (retry = 0; !out && retry < MAX_READ_RETRIES; retry++) {
+	for (retry = 0; !out && retry < d -> max_retries; retry++) {
 		/* Assume everything will turn out well */
 		out = true;
 
+		/* Some commands might have been queued while the previous window was being processed */
+		submitted = disc_prefetch_take (d, sector_no, b, &set);
+
 		if (retry > 0) {
 			warning ("Read retry %d for sector %u", retry, sector_no);
+			disc_count_retry (d, start_block);
+			metrics_count (dvd_get_metrics (d -> dvd), METRICS_COUNT_WINDOW_RETRIES);
 
 			/* Try to reset in-memory data by seeking to a distant sector */
 //			if (sector_no > 1000)
@@ -576,68 +1044,59 @@ static int disc_read_sector_9 (disc *d, u_int32_t sector_no, u_int8_t **data, u_
 			else dvd_flush_cache_READ12 (d -> dvd, sector_no, NULL);
 		}
 
-		/* First READ command, this will cache 5 16-sector blocks. Immediately dump relevant data */
-		if (sector_no > d -> sectors_no - 1000)
-			dvd_read_sector_streaming (d -> dvd, sector_no - 16 * 5 * 2, NULL, NULL, 0);
-		else
-			dvd_read_sector_streaming (d -> dvd, sector_no + 16 * 5, NULL, NULL, 0);
-		if ((ret = dvd_read_sector_streaming (d -> dvd, sector_no, NULL, readbuf, BLOCK_SIZE)) >= 0) {
-			for (j = 0; j < 5 && sector_no + j * 16 < d -> sectors_no && out; j++) {
-				/* Reconstruct raw sectors */
-				for (k = 0; k < 16; k++) {
-					sect = &buf[j][k * RAW_SECTOR_SIZE];
-					ram_offset = (j * RAW_BLOCK_SIZE) + k * RAW_SECTOR_SIZE;
-					/* Get first 12 bytes (ID. IED and CPR_MAI fields) and last 4 bytes (EDC field) with memdump */
-					if (j == 0 && k == 0) {
-						if (dvd_memdump (d -> dvd, ram_offset, 1, 12, sect) < 0) {
-							error ("Memdump (1) failed");
-							out = false;
-							retry = MAX_READ_RETRIES;		/* Well, if this fails going on is useless */
-						}
-					} else {
-						memcpy (sect, tmp + 4, 12);
-					}
-					
-					if (out && dvd_memdump (d -> dvd, ram_offset + 2060, 1, 16, tmp) < 0) {	/* Dumping in a single block is faster */
-						error ("Memdump (2) failed");
-						out = false;
-					} else {
-						memcpy (sect + 2060, tmp, 4);
-					}
+		/* The commands are queued in the same order they used to be issued in (See disc_submit_window_cmd()), and the next window is
+		 * prefetched right behind them. Each block is rebuilt as soon as all of its data has arrived.
+		 */
+		for (reaped = 0; reaped < cmds; reaped++) {
+			for (; out && submitted < cmds && dvd_get_queue_free (d -> dvd) > 0; submitted++)
+				disc_submit_window_cmd (d, sector_no, set, b, submitted);
+			if (out && submitted == cmds)
+				disc_prefetch (d, sector_no + blocks * SECTORS_PER_BLOCK, 1 - set);
+			if (reaped == submitted)
+				break;		/* Something failed and all that was queued has been reaped */
+
+			if ((ret = dvd_reap (d -> dvd)) < 0 && out && reaped > 0) {
+				if (reaped == 2) {
+					error ("Memdump (1) failed");
+					retry = d -> max_retries;		/* Well, if this fails going on is useless */
+				} else if (reaped > 2 && reaped <= 2 + 16 * blocks) {
+					error ("Memdump (2) failed");
+				} else {
+					error ("dvd_read_sector_streaming() failed with %d", ret);
 				}
-			}
+				out = false;
+			} else if (out && (reaped == 2 + 16 || reaped > 2 + 16 * blocks)) {
+				j = reaped == 2 + 16 ? 0 : reaped - 2 - 16 * blocks;
 
-			/* Now the same for remaining 4 16-sector blocks */
-			for (j = 0; j < 5 && sector_no + j * 16 < d -> sectors_no && out; j++) {
-				if (j == 0 || (ret = dvd_read_sector_streaming (d -> dvd, sector_no + j * 16, NULL, readbuf, BLOCK_SIZE)) >= 0) {
-					/* Copy "user data" field which has been incorrectly unscrambled by the DVD drive firmware */
-					for (k = 0; k < 16; k++) {
-						sect = &buf[j][k * RAW_SECTOR_SIZE];
-						memcpy (sect + 12, readbuf + k * SECTOR_SIZE, SECTOR_SIZE);
-					}
+				/* Reconstruct raw sectors, copying the "user data" field which has been incorrectly unscrambled by the DVD drive firmware */
+				for (k = 0; k < 16; k++) {
+					sect = &b[j] -> raw[k * RAW_SECTOR_SIZE];
+					if (k > 0)
+						memcpy (sect, disc_window_fields (d, set, j, k - 1) + 4, 12);
+					else if (j > 0)
+						memcpy (sect, disc_window_fields (d, set, j - 1, 15) + 4, 12);
+					memcpy (sect + 12, disc_window_data (d, set, j) + k * SECTOR_SIZE, SECTOR_SIZE);
+					memcpy (sect + 2060, disc_window_fields (d, set, j, k), 4);
+				}
 #ifdef DEBUG
-					if (d -> unscrambling) {
+				if (d -> unscrambling) {
 #endif
-						/* Try to unscramble all data to see if EDC fails */
-						if (!unscrambler_unscramble_16sectors (d -> u, sector_no + (j * 16), buf[j], buf_unscrambled[j]))
-							out = false;
+					/* Try to unscramble all data to see if EDC fails */
+					if (!disc_unscramble (d, sector_no + (j * 16), b[j] -> raw, b[j] -> data))
+						out = false;
 #ifdef DEBUG
-					}
-#endif
-				} else {
-					error ("dvd_read_sector_streaming() failed with %d", ret);
-					out = false;
 				}
+#endif
 			}
+		}
 
-			if (out) {
-				/* It seems all data were unscrambled correctly, so cache them out */
-				for (j = 0; j < 5 && sector_no + j * SECTORS_PER_BLOCK < d -> sectors_no; j++)
-					disc_cache_add_block (d, start_block + j, buf_unscrambled[j], buf[j]);
-			}
+		if (out) {
+			/* It seems all data were unscrambled correctly, so cache them out */
+			for (j = 0; j < blocks; j++)
+				disc_cache_add_block (d, start_block + j, b[j]);
 		} else {
-			error ("dvd_read_sector_streaming() failed with %d", ret);
-			out = false;
+			for (j = 0; j < blocks; j++)
+				disc_release_block (d, b[j]);
 		}
 	}
 
@@ -685,6 +1144,7 @@ static disc_type disc_detect_type (disc *d, u_int32_t forced_type, u_int32_t sec
 
 	}
 	if (sectors_no != -1) d -> sectors_no = sectors_no;
+	unscrambler_set_disctype (d -> u, d -> type);
 
 	return (d -> type);
 }
@@ -700,7 +1160,7 @@ static disc_type disc_detect_type (disc *d, u_int32_t forced_type, u_int32_t sec
  */
 int disc_read_sector (disc *d, u_int32_t sector_no, u_int8_t **data, u_int8_t **rawdata) {
 	u_int32_t block;
-	u_int8_t *cdata, *crawdata;
+	disc_block *b;
 	int out;
 
 	/* Unscrambled data cannot be requested if unscrambling was disabled */
@@ -709,20 +1169,20 @@ int disc_read_sector (disc *d, u_int32_t sector_no, u_int8_t **data, u_int8_t **
 	block = sector_no / SECTORS_PER_BLOCK;
 	
 	/* See if sector is in cache */
-	if (!(out = disc_cache_lookup_block (d, block, &cdata, &crawdata))) {
+	if (!(out = ((b = disc_cache_lookup_block (d, block)) != NULL))) {
 		/* Requested block is not in cache, try to read it from media */
 		out = d -> read_sector (d, sector_no, data, rawdata);
 		
 		/* Now requested sector is in cache, for sure ;) */
 		if (out)
-			MY_ASSERT (disc_cache_lookup_block (d, block, &cdata, &crawdata));
+			MY_ASSERT ((b = disc_cache_lookup_block (d, block)));
 	}
 
 	if (out) {
 		if (data)
-			*data = cdata + (sector_no % SECTORS_PER_BLOCK) * SECTOR_SIZE;
+			*data = b -> data + (sector_no % SECTORS_PER_BLOCK) * SECTOR_SIZE;
 		if (rawdata)
-			*rawdata = crawdata + (sector_no % SECTORS_PER_BLOCK) * RAW_SECTOR_SIZE;
+			*rawdata = b -> raw + (sector_no % SECTORS_PER_BLOCK) * RAW_SECTOR_SIZE;
 	} else {
 		if (data)
 			*data = NULL;
@@ -734,16 +1194,88 @@ int disc_read_sector (disc *d, u_int32_t sector_no, u_int8_t **data, u_int8_t **
 }
 
 
+/**
+ * Reads a whole block and returns a reference to its buffers, which stay valid even after the block is evicted from the cache. The reference
+ * must be given back with disc_release_block().
+ * @param d The disc structure.
+ * @param block The block number.
+ * @return The block, or NULL if it could not be read.
+ */
+disc_block *disc_read_block (disc *d, u_int32_t block) {
+	disc_span s;
+
+	return (disc_read_blocks (d, block, 1, &s) == 1 ? s.blk : NULL);
+}
+
+
+/**
+ * Reads a run of consecutive blocks, returning one span per block, with no per-sector work. Blocks missing from the cache are read with the
+ * preset read method, which brings a whole read window into the cache at a time, so asking for disc_get_window_blocks() blocks costs at most one
+ * window read. Each span holds a reference to its block, which must be given back with disc_release_spans().
+ * @param d The disc structure.
+ * @param first_block The first block number.
+ * @param count The number of blocks.
+ * @param spans An array of at least <code>count</code> spans, which will describe the blocks read.
+ * @return The number of spans filled, which is less than <code>count</code> if a block could not be read or the end of the disc was reached.
+ */
+u_int32_t disc_read_blocks (disc *d, u_int32_t first_block, u_int32_t count, disc_span *spans) {
+	disc_block *b;
+	u_int32_t i, block;
+
+	for (i = 0; i < count; i++) {
+		block = first_block + i;
+		if (block * SECTORS_PER_BLOCK >= d -> sectors_no)
+			break;
+
+		if (!(b = disc_cache_lookup_block (d, block))) {
+			/* Requested block is not in cache, try to read it from media */
+			if (!d -> read_sector (d, block * SECTORS_PER_BLOCK, NULL, NULL))
+				break;
+			MY_ASSERT ((b = disc_cache_lookup_block (d, block)));
+		}
+
+		blockpool_ref (d -> pool, b);
+		spans[i].sector = block * SECTORS_PER_BLOCK;
+		spans[i].sectors = d -> sectors_no - spans[i].sector < SECTORS_PER_BLOCK ? d -> sectors_no - spans[i].sector : SECTORS_PER_BLOCK;
+		spans[i].raw = b -> raw;
+		spans[i].data = b -> data;
+		spans[i].blk = b;
+	}
+
+	return (i);
+}
+
+
+/**
+ * Gives back the spans obtained with disc_read_blocks(). This can be called from any thread.
+ * @param d The disc structure.
+ * @param spans The spans.
+ * @param n The number of spans.
+ */
+void disc_release_spans (disc *d, disc_span *spans, u_int32_t n) {
+	u_int32_t i;
+
+	for (i = 0; i < n; i++)
+		blockpool_unref (d -> pool, spans[i].blk);
+
+	return;
+}
+
+
 static bool disc_analyze (disc *d) {
 	u_int8_t *buf;
 	char tmp[0x03E0 + 1];
 	bool unscramble_old, out;
+	int i;
+	disc_span s;
 
 	/* Force unscrambling for this read */
 	unscramble_old = d -> unscrambling;
 	disc_set_unscrambling (d, true);
 	
-	if (disc_read_sector (d, 0, &buf, NULL)) {
+	if (disc_read_blocks (d, 0, 1, &s) == 1) {
+		buf = s.data;
+
 		/* System ID */
 		d -> system_id = buf[0];
 // 		if (d -> system_id == 'G') {
@@ -761,6 +1293,11 @@ static bool disc_analyze (disc *d) {
 		strncpy (d -> game_id, (char *) buf + 1, 2);
 		d -> game_id[2] = '\0';
 
+		/* Disc ID, keeping only characters that are safe in file names */
+		for (i = 0; i < 6; i++)
+			d -> disc_id[i] = isalnum (buf[i]) ? buf[i] : '_';
+		d -> disc_id[6] = '\0';
+
 		/* Region */
 		switch (buf[3]) {
 			case 'P':
@@ -813,6 +1350,7 @@ static bool disc_analyze (disc *d) {
 		strtrimr (tmp);
 		my_strdup (d -> title, tmp);
 
+		disc_release_spans (d, &s, 1);
 		out = true;
 	} else {
 		error ("Cannot analyze disc");
@@ -1389,11 +1927,58 @@ u_int32_t disc_get_sec_mem (disc *d) {
 	return (d -> sec_mem);
 }
 
+/**
+ * Retrieves how many blocks the preset read method brings into the cache with each read, which is the natural count for disc_read_blocks().
+ * @param d The disc structure.
+ * @return The number of blocks.
+ */
+u_int32_t disc_get_window_blocks (disc *d) {
+	u_int32_t out;
+
+	if (d -> read_method >= 7)
+		out = 5;
+	else if (d -> max_blk > 0)
+		out = d -> max_blk;
+	else
+		out = 1;
+
+	return (out);
+}
+
+u_int32_t disc_get_speed (disc *d) {
+	return (d -> speed);
+}
+
+u_int32_t disc_get_def_speed (disc *d) {
+	dvd_profile *p;
+
+	p = dvd_get_profile (d -> dvd);
+
+	return (p ? p -> speed : -1);
+}
+
+u_int32_t disc_get_retries (disc *d) {
+	return (d -> retries);
+}
+
+u_int32_t disc_get_block_retries (disc *d, u_int32_t block) {
+	return (block < d -> block_retries_no ? d -> block_retries[block] : 0);
+}
+
+void disc_set_command (disc *d, u_int32_t command) {
+	dvd_set_command (d -> dvd, command);
+	d -> command = command;
+}
+
+dvd_drive *disc_get_dvd (disc *d) {
+	return (d -> dvd);
+}
+
 /* wiidevel@stacktic.org */
 static bool disc_check_update (disc *d) {
-	u_int8_t *buf;
 	u_int32_t x;
 	bool unscramble_old;
+	disc_span s;
 
 	if (d -> type == DISC_TYPE_WII || d -> type == DISC_TYPE_WII_DL) {
 		/* Force unscrambling for this read */
@@ -1401,12 +1986,13 @@ static bool disc_check_update (disc *d) {
 		disc_set_unscrambling (d, true);
 
 		/* We need to read offset 0x50004 of the disc. Sector 160 has offset 0x50000 */
-		if (disc_read_sector (d, 160, &buf, NULL)) {
-			x = my_ntohl (*(u_int32_t *) (buf + 4));
+		if (disc_read_blocks (d, 160 / SECTORS_PER_BLOCK, 1, &s) == 1) {
+			x = my_ntohl (*(u_int32_t *) (s.data + (160 % SECTORS_PER_BLOCK) * SECTOR_SIZE + 4));
 			if (x == 0xA5BED6AE)
 				d -> has_update = false;
 			else
 				d -> has_update = true;
+			disc_release_spans (d, &s, 1);
 		} else {
 			error ("disc_check_update() failed");
 		}
@@ -1432,7 +2018,9 @@ bool disc_set_read_method (disc *d, int method) {
 	u_int32_t deviation;
 	u_int32_t counter;
 	u_int32_t cnt1;
+	dvd_profile *p;
 
+	disc_prefetch_cancel (d);
 	d -> command = dvd_get_command(d -> dvd);
 //	d -> def_read_method = dvd_get_def_method(d -> dvd);
 	d -> read_method = method;
@@ -1518,14 +2106,23 @@ bool disc_set_read_method (disc *d, int method) {
 			}
 	}
 
+	/* Use the tuned values, if the drive was tuned for this method */
+	p = dvd_get_profile (d -> dvd);
+	if (p && p -> method != d -> read_method)
+		p = NULL;
+
 	if (d->sec_disc==-1) {
-		if ((d->read_method == 4) || (d->read_method == 5) || (d->read_method == 6)) 
+		if (p && p -> sec_disc >= 1 && p -> sec_disc <= 100)
+			d->sec_disc=p -> sec_disc;
+		else if ((d->read_method == 4) || (d->read_method == 5) || (d->read_method == 6)) 
 			d->sec_disc=27;
 		else 
 			d->sec_disc=16;
 	}
 	if (d->sec_mem==-1) {
-		if ((d->read_method == 4) || (d->read_method == 5) || (d->read_method == 6)) 
+		if (p && p -> sec_mem >= 16 && p -> sec_mem <= 100)
+			d->sec_mem=p -> sec_mem;
+		else if ((d->read_method == 4) || (d->read_method == 5) || (d->read_method == 6)) 
 			d->sec_mem=27;
 		else
 			d->sec_mem=16;
@@ -1568,6 +2165,30 @@ void disc_set_unscrambling (disc *d, bool unscramble) {
 }
 
 
+/**
+ * Makes the disc share the CPU with the other drives of a farm: unscrambling will only take place while holding one of its CPU slots.
+ * @param d The disc structure.
+ * @param f The farm structure, or NULL.
+ */
+void disc_set_farm (disc *d, farm *f) {
+	d -> farm = f;
+
+	return;
+}
+
+
+/**
+ * Starts or stops recording how long drive commands and the stages of sector reads take.
+ * @param d The disc structure.
+ * @param m Where to record them, which must outlive the disc structure, or NULL to stop.
+ */
+void disc_set_metrics (disc *d, metrics *m) {
+	dvd_set_metrics (d -> dvd, m);
+
+	return;
+}
+
+
 static void disc_crack_seeds (disc *d) {
 	int i;
 
@@ -1580,6 +2201,28 @@ static void disc_crack_seeds (disc *d) {
 }
 
 
+/**
+ * Gets the seeds of the disc from the per-user seed cache, cracking and caching them if this disc was never seen before. The unscrambler then
+ * keeps the cache up to date with any new seed found during the dump.
+ * @param d The disc structure, which must have been analyzed already.
+ */
+static void disc_setup_seeds (disc *d) {
+	char name[64], *path;
+
+	snprintf (name, sizeof (name), "seeds-%s-%02x-%s", d -> disc_id, d -> version, disc_type_strings[d -> type]);
+	if ((path = my_user_file (name)) && unscrambler_set_seed_file (d -> u, path) > 0) {
+		debug ("Seeds loaded from \"%s\"", path);
+	} else {
+		disc_crack_seeds (d);
+		if (path)
+			unscrambler_save_seeds (d -> u, path);
+	}
+	my_free (path);
+
+	return;
+}
+
+
 /**
  * Creates a new structure representing a Nintendo GameCube/Wii optical disc.
  * @param dvd_device The CD/DVD-ROM device, in OS-dependent format (i.e.: /dev/something on Unix, x: on Windows).
@@ -1594,6 +2237,15 @@ disc *disc_new (char *dvd_device, u_int32_t command) {
 		memset (d, 0, sizeof (disc));
 		d -> dvd = dvd;
 		d -> u = unscrambler_new ();
+		if (!(d -> window = (u_int8_t *) malloc (DISC_WINDOW_SIZE)) || !(d -> readbuf = (u_int8_t *) malloc (DISC_READBUF_SIZE))) {
+			error ("Cannot allocate read buffers");
+			exit (3);
+		}
+		d -> speed = -1;
+		d -> streaming_speed = -1;
+		d -> max_retries = MAX_READ_RETRIES;
+		d -> prefetch = DEFAULT_PREFETCH;
+		d -> prefetch_sector = -1;
 		disc_set_unscrambling (d, true);	// Unscramble by default
 		disc_set_read_method (d, DEFAULT_READ_METHOD);
 		disc_cache_init (d, DISC_DEFAULT_CACHE_SIZE);
@@ -1610,14 +2262,16 @@ bool disc_init (disc *d, u_int32_t disctype, u_int32_t sectors_no) {
 	
 	d -> sectors_no = 1000; 		// TODO
 	disc_detect_type (d, disctype, sectors_no);
-	disc_crack_seeds (d);
 //	unscrambler_set_bruteforce (d -> u, false);		// Disabling bruteforcing will allow us to detect errors more quickly
 	unscrambler_set_bruteforce (d -> u, true);
 	if (d -> type==DISC_TYPE_DVD) {
+		disc_crack_seeds (d);
 		my_strdup (d -> title, "DVD"+'\0');
 		out = true;
 	}
 	else if (disc_analyze (d)) {
+		/* Block 0 tells which game this is, so the seeds might already be known */
+		disc_setup_seeds (d);
 		disc_check_update (d);
 		out = true;
 	} else {
@@ -1634,10 +2288,15 @@ bool disc_init (disc *d, u_int32_t disctype, u_int32_t sectors_no) {
  * @return NULL.
  */
 void *disc_destroy (disc *d) {
+	disc_prefetch_cancel (d);
 	disc_cache_destroy (d);
 	unscrambler_destroy (d -> u);
+	my_free (d -> window);
+	my_free (d -> frames);
+	my_free (d -> readbuf);
 	my_free (d -> version_string);
 	my_free (d -> title);
+	my_free (d -> block_retries);
 	dvd_drive_destroy (d -> dvd);
 	my_free (d);
 
@@ -1655,14 +2314,40 @@ bool disc_get_drive_support_status (disc *d) {
 }
 
 void disc_set_speed (disc *d, u_int32_t speed) {
+	disc_prefetch_cancel (d);
 	if (speed != -1) dvd_set_speed (d -> dvd, speed, NULL);
+	if (speed != -1) d -> speed = speed;
 }
 
 void disc_set_streaming_speed (disc *d, u_int32_t speed) {
+	disc_prefetch_cancel (d);
 	if (speed != -1) dvd_set_streaming (d -> dvd, speed, NULL);
+	if (speed != -1) d -> streaming_speed = speed;
+}
+
+/**
+ * Sets how many times a read is tried before it is reported as failed. A single try skips bad blocks quickly, leaving them for a later, more
+ * thorough pass.
+ * @param d The disc structure.
+ * @param retries The number of tries, or 0 for the default (MAX_READ_RETRIES).
+ */
+void disc_set_retries (disc *d, u_int32_t retries) {
+	d -> max_retries = retries > 0 ? retries : MAX_READ_RETRIES;
+}
+
+/**
+ * Sets how many commands of the next read window are queued while the current one is being processed, so that the drive reads the disc while the
+ * host unscrambles. 1 only queues the READ commands of the window, each additional level one of its memory dumps. Only methods 7 and 9 prefetch.
+ * @param d The disc structure.
+ * @param depth The prefetch depth, or 0 to disable prefetching.
+ */
+void disc_set_prefetch (disc *d, u_int32_t depth) {
+	disc_prefetch_cancel (d);
+	d -> prefetch = depth < MAX_PREFETCH ? depth : MAX_PREFETCH;
 }
 
 bool disc_stop_unit (disc *d, bool start) {
+	disc_prefetch_cancel (d);
 	if (dvd_stop_unit (d -> dvd, start, NULL) == 0) return true;
 	else return false;
 }
@@ -1672,4 +2357,96 @@ void init_range (disc *d, u_int32_t sec_disc, u_int32_t sec_mem) {
 	else d->sec_disc = -1;
 	if ((sec_mem>=16)&&(sec_mem<=100)) d->sec_mem = sec_mem;
 	else d->sec_mem = -1;
-}
\ No newline at end of file
+}
+
+
+/* Writes the scrambled image of the disc read by disc_self_test(), with a different seed for every block, and returns the user data of its sectors */
+static u_int8_t *disc_self_test_image (char *path) {
+	FILE *fp;
+	u_int8_t frame[RAW_SECTOR_SIZE], key[LFSR_EDC_LENGTH], *data;
+	u_int32_t s, i, psn, edc;
+	bool ok;
+
+	data = (u_int8_t *) malloc (DISC_SELF_TEST_SECTORS * SECTOR_SIZE);
+	edc_init ();
+	for (s = 0, ok = (fp = fopen (path, "wb")) != NULL; s < DISC_SELF_TEST_SECTORS && ok; s++) {
+		memset (frame, 0, sizeof (frame));
+		psn = 0x30000 + s;
+		frame[1] = (u_int8_t) (psn >> 16);
+		frame[2] = (u_int8_t) (psn >> 8);
+		frame[3] = (u_int8_t) psn;
+		for (i = 0; i < SECTOR_SIZE; i++)
+			frame[6 + i] = data[s * SECTOR_SIZE + i] = (u_int8_t) (s * 31 + i * 7);
+		edc = edc_calc (0, frame, RAW_SECTOR_SIZE - 4);
+		frame[RAW_SECTOR_SIZE - 4] = (u_int8_t) (edc >> 24);
+		frame[RAW_SECTOR_SIZE - 3] = (u_int8_t) (edc >> 16);
+		frame[RAW_SECTOR_SIZE - 2] = (u_int8_t) (edc >> 8);
+		frame[RAW_SECTOR_SIZE - 1] = (u_int8_t) edc;
+
+		LFSR_stream ((u_int16_t) ((0x1234 + 0x111 * (s / SECTORS_PER_BLOCK)) & 0x7FFF), key, LFSR_EDC_LENGTH);
+		for (i = 0; i < LFSR_EDC_LENGTH; i++)
+			frame[12 + i] ^= key[i];
+		ok = fwrite (frame, RAW_SECTOR_SIZE, 1, fp) == 1;
+	}
+	if (fp && fclose (fp) != 0)
+		ok = false;
+
+	if (!ok) {
+		error ("Cannot write simulated disc image \"%s\"", path);
+		my_free (data);
+	}
+
+	return (data);
+}
+
+
+/**
+ * Reads a simulated disc with a Lite-On drive, which returns 2384-byte frames, and checks that the sectors that can only be corrected with the PO
+ * parity of their ECC block are, without any retry, even when the block straddles two of the chunks the read window is read in.
+ * @param verbose If true, results will be printed to stdout.
+ * @return True if the test passed, false otherwise.
+ */
+bool disc_self_test (bool verbose) {
+	disc_span spans[DISC_SELF_TEST_SECTORS / SECTORS_PER_BLOCK];
+	char *path, *spec;
+	u_int8_t *data;
+	u_int32_t i, n;
+	size_t len;
+	disc *d;
+	bool out;
+
+	if (verbose)
+		printf ("  PO correction across read chunks: ");
+
+	if (!(path = my_user_file ("selftest.raw")))
+		my_strdup (path, "friidump-selftest.raw");
+	len = strlen (path) + 64;
+	spec = (char *) malloc (len);
+	snprintf (spec, len, "%s%s,drive=liteon,bad=20-20,bad=60-60", DVD_SIM_PREFIX, path);
+
+	out = false;
+	if ((data = disc_self_test_image (path)) && (d = disc_new (spec, 3))) {
+		/* Reading 27 sectors at a time, whatever was tuned, the bad sectors are in blocks 1 and 3, which are split between two READs */
+		init_range (d, 27, 27);
+		disc_set_read_method (d, 5);
+		disc_detect_type (d, 0, DISC_SELF_TEST_SECTORS);
+		unscrambler_set_bruteforce (d -> u, true);
+
+		n = disc_read_blocks (d, 0, disc_get_window_blocks (d), spans);
+		out = n == 5 && d -> retries == 0;
+		for (i = 0; i < n && out; i++)
+			out = memcmp (spans[i].data, data + i * BLOCK_SIZE, BLOCK_SIZE) == 0;
+		disc_release_spans (d, spans, n);
+		disc_destroy (d);
+	}
+	remove (path);
+
+	if (verbose)
+		printf (out ? "passed\n" : "failed\n");
+
+	my_free (data);
+	my_free (spec);
+	my_free (path);
+
+	return (out);
+}
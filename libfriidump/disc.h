@@ -24,6 +24,9 @@
 
 #include "misc.h"
 #include <sys/types.h>
+#include "dvd_drive.h"
+#include "blockpool.h"
+#include "farm.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,17 +58,40 @@ typedef enum {
 typedef struct disc_s disc;
 
 
+/*! \brief The sectors of a block returned by disc_read_blocks().
+ *
+ * Data is not copied: the span points into the block buffers of the disc cache, which stay valid until the span is given back with
+ * disc_release_spans(), even if the block is evicted meanwhile.
+ */
+typedef struct {
+	u_int32_t sector;			//!< The first sector.
+	u_int32_t sectors;			//!< The number of sectors (Only the last block of a disc can be shorter than 16 sectors).
+	u_int8_t *raw;				//!< Raw data, RAW_SECTOR_SIZE bytes per sector.
+	u_int8_t *data;				//!< Unscrambled data, SECTOR_SIZE bytes per sector.
+	disc_block *blk;			//!< The block holding the data.
+} disc_span;
+
+
 /* Functions */
 FRIIDUMPLIB_EXPORT disc *disc_new (char *dvd_device, u_int32_t command);
 FRIIDUMPLIB_EXPORT bool disc_init (disc *d, u_int32_t forced_type, u_int32_t sectors_no);
 FRIIDUMPLIB_EXPORT void *disc_destroy (disc *d);
 FRIIDUMPLIB_EXPORT int disc_read_sector (disc *d, u_int32_t sector_no, u_int8_t **data, u_int8_t **rawdata);
+FRIIDUMPLIB_EXPORT disc_block *disc_read_block (disc *d, u_int32_t block);
+FRIIDUMPLIB_EXPORT u_int32_t disc_read_blocks (disc *d, u_int32_t first_block, u_int32_t count, disc_span *spans);
+FRIIDUMPLIB_EXPORT void disc_release_spans (disc *d, disc_span *spans, u_int32_t n);
+FRIIDUMPLIB_EXPORT void disc_release_block (disc *d, disc_block *b);
 FRIIDUMPLIB_EXPORT bool disc_set_read_method (disc *d, int method);
 FRIIDUMPLIB_EXPORT void disc_set_unscrambling (disc *d, bool unscramble);
+FRIIDUMPLIB_EXPORT void disc_set_farm (disc *d, farm *f);
+FRIIDUMPLIB_EXPORT void disc_set_metrics (disc *d, metrics *m);
 FRIIDUMPLIB_EXPORT void disc_set_speed (disc *d, u_int32_t speed);
 FRIIDUMPLIB_EXPORT void disc_set_streaming_speed (disc *d, u_int32_t speed);
+FRIIDUMPLIB_EXPORT void disc_set_retries (disc *d, u_int32_t retries);
+FRIIDUMPLIB_EXPORT void disc_set_prefetch (disc *d, u_int32_t depth);
 FRIIDUMPLIB_EXPORT bool disc_stop_unit (disc *d, bool start);
 FRIIDUMPLIB_EXPORT void init_range (disc *d, u_int32_t sec_disc, u_int32_t sec_mem);
+FRIIDUMPLIB_EXPORT bool disc_self_test (bool verbose);
 
 /* Getters */
 FRIIDUMPLIB_EXPORT u_int32_t disc_get_sectors_no (disc *d);
@@ -75,6 +101,11 @@ FRIIDUMPLIB_EXPORT u_int32_t disc_get_method (disc *d);
 FRIIDUMPLIB_EXPORT u_int32_t disc_get_def_method (disc *d);
 FRIIDUMPLIB_EXPORT u_int32_t disc_get_sec_disc (disc *d);
 FRIIDUMPLIB_EXPORT u_int32_t disc_get_sec_mem (disc *d);
+FRIIDUMPLIB_EXPORT u_int32_t disc_get_window_blocks (disc *d);
+FRIIDUMPLIB_EXPORT u_int32_t disc_get_speed (disc *d);
+FRIIDUMPLIB_EXPORT u_int32_t disc_get_def_speed (disc *d);
+FRIIDUMPLIB_EXPORT u_int32_t disc_get_retries (disc *d);
+FRIIDUMPLIB_EXPORT u_int32_t disc_get_block_retries (disc *d, u_int32_t block);
 
 FRIIDUMPLIB_EXPORT char *disc_get_type (disc *d, disc_type *dt, char **dt_s);
 FRIIDUMPLIB_EXPORT char *disc_get_gameid (disc *d, char **gid_s);
@@ -87,6 +118,11 @@ FRIIDUMPLIB_EXPORT bool disc_get_update (disc *d);
 FRIIDUMPLIB_EXPORT char *disc_get_drive_model_string (disc *d);
 FRIIDUMPLIB_EXPORT bool disc_get_drive_support_status (disc *d);
 
+/* The following are exported for use by the tuner */
+void disc_cache_flush (disc *d);
+void disc_set_command (disc *d, u_int32_t command);
+dvd_drive *disc_get_dvd (disc *d);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,6 +27,9 @@
 #include "constants.h"
 #include "disc.h"
 #include "dumper.h"
+#include "speedctl.h"
+#include "thread.h"
+#include "writer.h"
 
 #ifndef WIN32
 #include <unistd.h>
@@ -37,19 +40,119 @@ struct dumper_s {
 	disc *dsk;
 	char *outfile_raw;
 	u_int32_t start_sector_raw;
-	FILE *fp_raw;
+	writer *wr_raw;
 	char *outfile_iso;
 	u_int32_t start_sector_iso;
-	FILE *fp_iso;
+	writer *wr_iso;
 	u_int32_t start_sector;
 	bool hashing;
 	bool flushing;
+	bool direct;
+	u_int32_t sync_interval;
+	u_int32_t digests;
+	farm *farm;
+	bool adaptive_speed;
+	speedctl *speedctl;
 
 	multihash hash_raw;
 	multihash hash_iso;
+
+	/* Map stuff */
+	char *mapfile;
+	u_int32_t passes;
+	u_int8_t *map;
+	u_int32_t blocks_no;
+	u_int32_t unread_sectors;
 	
 	progress_func progress;
 	void *progress_data;
+
+	/* Pipeline stuff */
+	u_int32_t threads;
+	u_int64_t stage_busy[DUMPER_STAGES];
+	u_int64_t stage_queued[DUMPER_STAGES];
+	u_int64_t stage_samples[DUMPER_STAGES];
+	u_int64_t elapsed;
+};
+
+
+/* Sidecar holding the hash state at the last checkpoint, next to each output file */
+#define DUMPER_CHECKPOINT_SUFFIX ".checkpoint"
+#define DUMPER_CHECKPOINT_MAGIC "friidump-checkpoint 1"
+
+/* Map file telling which blocks have been read, like those of ddrescue, with a line for each run of blocks in the same state */
+#define DUMPER_MAP_MAGIC "# friidump map 1"
+#define DUMPER_MAP_GOOD '+'
+#define DUMPER_MAP_BAD '-'
+#define DUMPER_MAP_UNTRIED '?'
+
+#define DUMPER_DEFAULT_PASSES 3
+
+/* Speeds of the slow passes, which halve it each time, in KB/s. They start from the current speed or, if the drive was never told one,
+ * from DUMPER_MAP_SLOW_SPEED */
+#define DUMPER_MAP_SLOW_SPEED (8 * 177)
+#define DUMPER_MAP_MIN_SPEED 177
+#define DUMPER_MAP_MAX_SPEED 0xFFFF
+
+/* Read method alternated with the requested one in the slow passes: plain reads of a block at a time, where no other block of the read
+ * window can make the read fail */
+#define DUMPER_MAP_ALT_METHOD 0
+
+/* Number of sectors hashed at a time when hashing data already in an output file */
+#define DUMPER_HASH_EXISTING_SECTORS 256
+
+/* Number of 16-sector blocks that can be in flight between the reader and the writer */
+#define DUMPER_RING_SLOTS 32
+
+/* Reader, writer and one thread per digest */
+#define DUMPER_DEFAULT_THREADS (2 + MULTIHASH_DIGESTS)
+
+#define DUMPER_DEFAULT_DIGESTS (MULTIHASH_CRC32 | MULTIHASH_MD5 | MULTIHASH_SHA1)
+
+/* The writer and one hasher per digest at most, the reader being the calling thread */
+#define DUMPER_MAX_WORKERS (MULTIHASH_DIGESTS + 1)
+
+
+/* A 16-sector block travelling through the pipeline. Data is not copied: the slot is the span returned by disc_read_blocks(), holding a
+ * reference to the block buffers of the disc cache, which the writer gives back */
+typedef disc_span dumper_slot;
+
+
+typedef struct dumper_pipeline_s dumper_pipeline;
+
+
+/*! \brief A worker thread, running one or more consecutive stages.
+ */
+typedef struct {
+	dumper_pipeline *p;
+	dumper_stage first;
+	dumper_stage last;
+	u_int32_t digests;			//!< The digests this worker computes, if it runs the hash stage.
+	u_int32_t done;				//!< Number of blocks this worker has completed.
+	u_int64_t busy[DUMPER_STAGES];		//!< Time spent on each stage.
+	my_thread thread;
+} dumper_worker;
+
+
+/*! \brief Shared state of a running pipeline.
+ *
+ * Every stage consumes the blocks in order: slot <code>k % DUMPER_RING_SLOTS</code> can be processed by a worker of stage <code>s</code>
+ * when the worker has completed <code>k</code> blocks and <code>done[s - 1] > k</code>. Several workers can run the hash stage, each one
+ * computing different digests over the same slots, which are only read: the stage has completed a block when all of them have. The reader can
+ * reuse a slot only after the writer is done with it.
+ */
+struct dumper_pipeline_s {
+	dumper *dmp;
+	dumper_slot *slots;
+	my_mutex lock;
+	my_cond cond;
+	dumper_worker workers[DUMPER_MAX_WORKERS];
+	u_int32_t workers_no;
+	u_int32_t done[DUMPER_STAGES];		//!< Number of blocks each stage has completed.
+	u_int32_t running[DUMPER_STAGES];	//!< Number of workers still running each stage.
+	bool finished[DUMPER_STAGES];		//!< True when a stage will not produce any more blocks.
+	bool failed;				//!< Set when the writer fails, so that the reader stops.
+	u_int32_t failed_sector;		//!< The first sector that could not be written.
 };
 
 
@@ -86,7 +189,7 @@ bool dumper_set_raw_output_file (dumper *dmp, char *outfile_raw, bool resume) {
 		filesize = my_ftell (fp);
 		fclose (fp);
 		out = true;
-		dmp -> start_sector_raw = (u_int32_t) (filesize / RAW_SECTOR_SIZE / SECTORS_PER_BLOCK) * SECTORS_PER_BLOCK;
+		dmp -> start_sector_raw = writer_get_resume_sectors (outfile_raw, RAW_SECTOR_SIZE, filesize) / SECTORS_PER_BLOCK * SECTORS_PER_BLOCK;
 		debug ("Raw output can restart from sector %u", dmp -> start_sector_raw);
 		my_strdup (dmp -> outfile_raw, outfile_raw);
 	} else {
@@ -128,7 +231,7 @@ bool dumper_set_iso_output_file (dumper *dmp, char *outfile_iso, bool resume) {
 		filesize = my_ftell (fp);
 		fclose (fp);
 		out = true;
-		dmp -> start_sector_iso = (u_int32_t) (filesize / SECTOR_SIZE / SECTORS_PER_BLOCK) * SECTORS_PER_BLOCK;
+		dmp -> start_sector_iso = writer_get_resume_sectors (outfile_iso, SECTOR_SIZE, filesize) / SECTORS_PER_BLOCK * SECTORS_PER_BLOCK;
 		debug ("ISO output can restart from sector %u", dmp -> start_sector_iso);
 		my_strdup (dmp -> outfile_iso, outfile_iso);
 	} else {
@@ -145,12 +248,375 @@ bool dumper_set_iso_output_file (dumper *dmp, char *outfile_iso, bool resume) {
 }
 
 
-bool dumper_prepare (dumper *dmp) {
+/* Feeds the sectors of an output file in the given range to the hashes */
+static bool dumper_hash_existing (char *outfile, u_int32_t sector_size, multihash *mh, u_int32_t from, u_int32_t to) {
+	bool out;
+	u_int8_t *buf;
+	u_int32_t i, n;
+	FILE *fp;
+
+	out = false;
+	if (!(buf = (u_int8_t *) malloc (DUMPER_HASH_EXISTING_SECTORS * RAW_SECTOR_SIZE))) {
+		error ("Cannot allocate buffer to hash pre-existing data");
+	} else if (!(fp = fopen (outfile, "rb"))) {
+		error ("Cannot open \"%s\" to hash pre-existing data", outfile);
+	} else {
+		my_fseek (fp, (my_off_t) from * sector_size, SEEK_SET);
+		for (i = from, out = true; i < to && out; i += n) {
+			n = to - i < DUMPER_HASH_EXISTING_SECTORS ? to - i : DUMPER_HASH_EXISTING_SECTORS;
+			if (fread (buf, sector_size, n, fp) != n) {
+				error ("Cannot read pre-existing data from \"%s\"", outfile);
+				out = false;
+			} else {
+				multihash_update (mh, buf, n * sector_size);
+			}
+		}
+		fclose (fp);
+	}
+	my_free (buf);
+
+	return (out);
+}
+
+
+static char *dumper_checkpoint_file (char *outfile) {
+	char *out;
+	size_t len;
+
+	len = strlen (outfile) + strlen (DUMPER_CHECKPOINT_SUFFIX) + 1;
+	if ((out = (char *) malloc (len)))
+		snprintf (out, len, "%s%s", outfile, DUMPER_CHECKPOINT_SUFFIX);
+
+	return (out);
+}
+
+
+/* Computes the CRC32 of the last block of an output file before the given sector, which tells whether the file still holds the data a
+ * checkpoint was made on */
+static bool dumper_tail_crc32 (char *outfile, u_int32_t sector_size, u_int32_t sector, u_int32_t *crc) {
+	bool out;
+	u_int8_t *buf;
+	u_int32_t n;
+	multihash mh;
+	FILE *fp;
+
+	n = sector < SECTORS_PER_BLOCK ? sector : SECTORS_PER_BLOCK;
+	out = false;
+	if ((buf = (u_int8_t *) malloc (RAW_BLOCK_SIZE)) && (fp = fopen (outfile, "rb"))) {
+		if (my_fseek (fp, (my_off_t) (sector - n) * sector_size, SEEK_SET) == 0 && fread (buf, sector_size, n, fp) == n) {
+			multihash_init_digests (&mh, MULTIHASH_CRC32);
+			multihash_update (&mh, buf, n * sector_size);
+			*crc = mh.crc32;
+			out = true;
+		}
+		fclose (fp);
+	}
+	my_free (buf);
+
+	return (out);
+}
+
+
+/* Saves the hash state of an output file, whose sectors up to the given one have been synced to disk */
+static bool dumper_save_checkpoint (char *outfile, u_int32_t sector_size, u_int32_t sector, multihash *mh) {
 	bool out;
-	u_int8_t buf[RAW_SECTOR_SIZE];
-	size_t r;
+	char *file, *tmp;
+	u_int32_t crc;
+	size_t len;
+	FILE *fp;
+
+	out = false;
+	tmp = NULL;
+	if ((file = dumper_checkpoint_file (outfile)) && dumper_tail_crc32 (outfile, sector_size, sector, &crc)) {
+		len = strlen (file) + 5;
+		if ((tmp = (char *) malloc (len))) {
+			snprintf (tmp, len, "%s.tmp", file);
+			if ((fp = fopen (tmp, "w"))) {
+				fprintf (fp, "%s\n%u %u %08x\n", DUMPER_CHECKPOINT_MAGIC, sector_size, sector, crc);
+				out = multihash_save_state (mh, fp) == 0;
+				out = fclose (fp) == 0 && out;
+#ifdef WIN32
+				remove (file);
+#endif
+				if (out)
+					out = rename (tmp, file) == 0;
+				else
+					remove (tmp);
+			}
+		}
+	}
+
+	if (!out) {
+		warning ("Cannot save checkpoint for \"%s\"", outfile);
+	} else {
+		debug ("Checkpoint for \"%s\" saved at sector %u", outfile, sector);
+	}
+	my_free (tmp);
+	my_free (file);
+
+	return (out);
+}
+
+
+/* Restores the hash state of an output file from its checkpoint, if it has a valid one at or before the dump start sector. Returns the sector
+ * hashing must go on from, which is 0 if there is no usable checkpoint. An unusable checkpoint is removed */
+static u_int32_t dumper_load_checkpoint (dumper *dmp, char *outfile, u_int32_t sector_size, multihash *mh) {
+	u_int32_t out, size, sector, crc, tail;
+	char magic[sizeof (DUMPER_CHECKPOINT_MAGIC)], *file;
+	FILE *fp;
+
+	out = 0;
+	if ((file = dumper_checkpoint_file (outfile)) && (fp = fopen (file, "r"))) {
+		if (fgets (magic, sizeof (magic), fp) && strcmp (magic, DUMPER_CHECKPOINT_MAGIC) == 0 &&
+		    fscanf (fp, "%u %u %x", &size, &sector, &crc) == 3 && size == sector_size && sector > 0 && sector <= dmp -> start_sector &&
+		    multihash_load_state (mh, fp) == 0 && (mh -> digests & dmp -> digests) == dmp -> digests &&
+		    dumper_tail_crc32 (outfile, sector_size, sector, &tail) && tail == crc) {
+			mh -> digests = dmp -> digests;
+			out = sector;
+			debug ("Hashes of \"%s\" restored from the checkpoint at sector %u", outfile, sector);
+		}
+		fclose (fp);
+		if (out == 0) {
+			debug ("Ignoring checkpoint for \"%s\"", outfile);
+			remove (file);
+		}
+	}
+	my_free (file);
+
+	if (out == 0)
+		multihash_init_digests (mh, dmp -> digests);
+
+	return (out);
+}
+
+
+/* Number of sectors between two checkpoints, or 0 if they are disabled. They are made at the same pace as sync points */
+static u_int32_t dumper_checkpoint_interval (dumper *dmp) {
+	u_int32_t out;
+
+	if (!dmp -> hashing || !dmp -> flushing || dmp -> sync_interval == 0)
+		out = 0;
+	else
+		out = ((my_off_t) dmp -> sync_interval * 1024 * 1024 / SECTOR_SIZE) / SECTORS_PER_BLOCK * SECTORS_PER_BLOCK;
+
+	return (out);
+}
+
+
+/* Syncs the output files and saves their hash state. All the sectors up to the given one must have been hashed and written */
+static bool dumper_checkpoint (dumper *dmp, u_int32_t sector) {
+	bool out;
+
+	out = true;
+	if (dmp -> wr_raw && !writer_sync (dmp -> wr_raw))
+		out = false;
+	if (dmp -> wr_iso && !writer_sync (dmp -> wr_iso))
+		out = false;
+
+	/* Not being able to save a checkpoint only makes resuming slower */
+	if (out && dmp -> wr_raw)
+		dumper_save_checkpoint (dmp -> outfile_raw, RAW_SECTOR_SIZE, sector, &(dmp -> hash_raw));
+	if (out && dmp -> wr_iso)
+		dumper_save_checkpoint (dmp -> outfile_iso, SECTOR_SIZE, sector, &(dmp -> hash_iso));
+
+	return (out);
+}
+
+
+/* Removes the checkpoint of an output file, which is no longer needed or no longer valid */
+static void dumper_remove_checkpoint (char *outfile) {
+	char *file;
+
+	if (outfile && (file = dumper_checkpoint_file (outfile))) {
+		remove (file);
+		free (file);
+	}
+
+	return;
+}
+
+
+/* Number of sectors in the blocks that are in the given state */
+static u_int32_t dumper_map_sectors (dumper *dmp, u_int32_t sectors_no, u_int8_t state) {
+	u_int32_t out, i;
+
+	for (i = 0, out = 0; i < dmp -> blocks_no; i++) {
+		if (dmp -> map[i] == state)
+			out += sectors_no - i * SECTORS_PER_BLOCK < SECTORS_PER_BLOCK ? sectors_no - i * SECTORS_PER_BLOCK : SECTORS_PER_BLOCK;
+	}
+
+	return (out);
+}
+
+
+/* Number of sectors at the beginning of the disc that have all been read */
+static u_int32_t dumper_map_prefix (dumper *dmp, u_int32_t sectors_no) {
+	u_int32_t i;
+
+	for (i = 0; i < dmp -> blocks_no && dmp -> map[i] == DUMPER_MAP_GOOD; i++)
+		;
+
+	return (i * SECTORS_PER_BLOCK < sectors_no ? i * SECTORS_PER_BLOCK : sectors_no);
+}
+
+
+/* Number of sectors up to the end of the last block that has been read */
+static u_int32_t dumper_map_end (dumper *dmp, u_int32_t sectors_no) {
 	u_int32_t i;
 
+	for (i = dmp -> blocks_no; i > 0 && dmp -> map[i - 1] != DUMPER_MAP_GOOD; i--)
+		;
+
+	return (i * SECTORS_PER_BLOCK < sectors_no ? i * SECTORS_PER_BLOCK : sectors_no);
+}
+
+
+/* Loads the map file, if it exists and was made for a disc of the same size */
+static bool dumper_load_map (dumper *dmp, u_int32_t sectors_no) {
+	bool out;
+	char magic[sizeof (DUMPER_MAP_MAGIC)], state;
+	u_int32_t n, sector, sectors, i;
+	FILE *fp;
+
+	out = false;
+	if ((fp = fopen (dmp -> mapfile, "r"))) {
+		if (fgets (magic, sizeof (magic), fp) && strcmp (magic, DUMPER_MAP_MAGIC) == 0 && fscanf (fp, "%u", &n) == 1 && n == sectors_no) {
+			memset (dmp -> map, DUMPER_MAP_UNTRIED, dmp -> blocks_no);
+			for (out = true; out && fscanf (fp, "%u %u %c", &sector, &sectors, &state) == 3; ) {
+				if (sector % SECTORS_PER_BLOCK != 0 || sectors == 0 || sector >= sectors_no || sectors > sectors_no - sector ||
+				    (state != DUMPER_MAP_GOOD && state != DUMPER_MAP_BAD && state != DUMPER_MAP_UNTRIED)) {
+					out = false;
+				} else {
+					for (i = sector / SECTORS_PER_BLOCK; i * SECTORS_PER_BLOCK < sector + sectors; i++)
+						dmp -> map[i] = state;
+				}
+			}
+			if (!feof (fp))
+				out = false;
+		}
+		fclose (fp);
+
+		if (!out)
+			warning ("Ignoring invalid map file \"%s\"", dmp -> mapfile);
+	}
+
+	return (out);
+}
+
+
+/* Atomically replaces the map file with the current state of the blocks */
+static bool dumper_save_map (dumper *dmp, u_int32_t sectors_no) {
+	bool out;
+	char *tmp;
+	u_int32_t i, j;
+	size_t len;
+	FILE *fp;
+
+	out = false;
+	len = strlen (dmp -> mapfile) + 5;
+	if ((tmp = (char *) malloc (len))) {
+		snprintf (tmp, len, "%s.tmp", dmp -> mapfile);
+		if ((fp = fopen (tmp, "w"))) {
+			fprintf (fp, "%s\n%u\n", DUMPER_MAP_MAGIC, sectors_no);
+			for (i = 0; i < dmp -> blocks_no; i = j) {
+				for (j = i + 1; j < dmp -> blocks_no && dmp -> map[j] == dmp -> map[i]; j++)
+					;
+				fprintf (fp, "%u %u %c\n", i * SECTORS_PER_BLOCK,
+					(j * SECTORS_PER_BLOCK < sectors_no ? j * SECTORS_PER_BLOCK : sectors_no) - i * SECTORS_PER_BLOCK, dmp -> map[i]);
+			}
+			out = fclose (fp) == 0;
+#ifdef WIN32
+			remove (dmp -> mapfile);
+#endif
+			if (out)
+				out = rename (tmp, dmp -> mapfile) == 0;
+			else
+				remove (tmp);
+		}
+		free (tmp);
+	}
+
+	if (!out)
+		error ("Cannot save map file \"%s\"", dmp -> mapfile);
+
+	return (out);
+}
+
+
+/* Number of whole sectors in an output file */
+static u_int32_t dumper_file_sectors (char *outfile, u_int32_t sector_size) {
+	u_int32_t out;
+	FILE *fp;
+
+	out = 0;
+	if (outfile && (fp = fopen (outfile, "rb"))) {
+		my_fseek (fp, 0, SEEK_END);
+		out = (u_int32_t) (my_ftell (fp) / sector_size);
+		fclose (fp);
+	}
+
+	return (out);
+}
+
+
+/* Sets up the map of the blocks. Without a usable map file, the blocks the output files can be resumed from are taken as read and the others as
+ * untried. Returns the sector the output files must be kept up to, while the dump start sector becomes the first one that was not read */
+static u_int32_t dumper_prepare_map (dumper *dmp) {
+	u_int32_t out, sectors_no, end;
+	bool loaded;
+
+	sectors_no = disc_get_sectors_no (dmp -> dsk);
+	dmp -> blocks_no = (sectors_no + SECTORS_PER_BLOCK - 1) / SECTORS_PER_BLOCK;
+	my_free (dmp -> map);
+	if (!(dmp -> map = (u_int8_t *) malloc (dmp -> blocks_no + 1))) {
+		error ("Cannot allocate map");
+		exit (3);
+	}
+
+	/* Output files that are shorter than the map says have been replaced or truncated */
+	loaded = dumper_load_map (dmp, sectors_no);
+	end = loaded ? dumper_map_end (dmp, sectors_no) : 0;
+	if (loaded && ((dmp -> outfile_raw && dumper_file_sectors (dmp -> outfile_raw, RAW_SECTOR_SIZE) < end) ||
+		       (dmp -> outfile_iso && dumper_file_sectors (dmp -> outfile_iso, SECTOR_SIZE) < end))) {
+		warning ("Output files do not match map file \"%s\", ignoring it", dmp -> mapfile);
+		loaded = false;
+	}
+
+	if (!loaded) {
+		memset (dmp -> map, DUMPER_MAP_GOOD, dmp -> start_sector / SECTORS_PER_BLOCK);
+		memset (dmp -> map + dmp -> start_sector / SECTORS_PER_BLOCK, DUMPER_MAP_UNTRIED, dmp -> blocks_no - dmp -> start_sector / SECTORS_PER_BLOCK);
+		out = dmp -> start_sector;
+	} else {
+		debug ("Map loaded, %u sectors already read", dumper_map_sectors (dmp, sectors_no, DUMPER_MAP_GOOD));
+		dmp -> start_sector = dumper_map_prefix (dmp, sectors_no);
+		out = end;
+	}
+
+	return (out);
+}
+
+
+/* Opens an output file through a writer, applying the dumper settings. The file is truncated to the given sector */
+static writer *dumper_open_writer (dumper *dmp, char *outfile, u_int32_t sector_size, u_int32_t sector) {
+	writer *w;
+
+	if ((w = writer_open (outfile, sector_size, sector, dmp -> direct))) {
+		writer_set_sync_interval (w, dmp -> flushing ? dmp -> sync_interval : 0);
+		if (dmp -> mapfile) {
+			/* Only the sectors before the first one that was not read can be trusted without the map */
+			writer_set_resume_limit (w, dmp -> start_sector);
+			writer_sync (w);
+		}
+	}
+
+	return (w);
+}
+
+
+bool dumper_prepare (dumper *dmp) {
+	bool out;
+	u_int32_t from, end;
+
 	/* Outputting to both files, resume must start from the file with the least sectors. Hopefully they will have the same number of sectors, anyway... */
 	if (dmp -> outfile_raw && dmp -> outfile_iso && dmp -> start_sector_raw != dmp -> start_sector_iso) {
 		if (dmp -> start_sector_raw < dmp -> start_sector_iso)
@@ -165,178 +631,377 @@ bool dumper_prepare (dumper *dmp) {
 		MY_ASSERT (0);
 	}
 
+	/* With a map, blocks that have been read are kept wherever they are, and the dump starts from the first one that was not */
+	if (dmp -> mapfile)
+		end = dumper_prepare_map (dmp);
+	else
+		end = dmp -> start_sector;
+
 	/* Prepare hashes */
 	if (dmp -> hashing) {
-		multihash_init (&(dmp -> hash_raw));
-		multihash_init (&(dmp -> hash_iso));
+		multihash_init_digests (&(dmp -> hash_raw), dmp -> digests);
+		multihash_init_digests (&(dmp -> hash_iso), dmp -> digests);
 	}
 
-	/* Setup raw output file */
+	/* Setup raw output file. Hashes of pre-existing data are restored from the last checkpoint, so that only what was written after it must
+	 * be read again */
+	out = true;
+	dmp -> wr_raw = NULL;
 	if (dmp -> outfile_raw) {
-		dmp -> fp_raw = fopen (dmp -> outfile_raw, "a+b");
-
-		if (dmp -> hashing) {
+		if (dmp -> hashing && dmp -> start_sector > 0) {
 			debug ("Calculating hashes for pre-existing raw dump data");
-			if (dmp -> start_sector > 0) {
-				for (i = 0; i < dmp -> start_sector && (r = fread (buf, RAW_SECTOR_SIZE, 1, dmp -> fp_raw)) > 0; i++)
-					multihash_update (&(dmp -> hash_raw), buf, RAW_SECTOR_SIZE);
-				MY_ASSERT (r > 0);
-			}
+			from = dumper_load_checkpoint (dmp, dmp -> outfile_raw, RAW_SECTOR_SIZE, &(dmp -> hash_raw));
+			out = dumper_hash_existing (dmp -> outfile_raw, RAW_SECTOR_SIZE, &(dmp -> hash_raw), from, dmp -> start_sector);
+		} else {
+			dumper_remove_checkpoint (dmp -> outfile_raw);
 		}
 
-		/* Now call fseek as file will only be written, from now on */
-		if (my_fseek (dmp -> fp_raw, dmp -> start_sector * RAW_SECTOR_SIZE, SEEK_SET) == 0 &&
-		    ftruncate (fileno (dmp -> fp_raw), (int64_t) dmp -> start_sector * RAW_SECTOR_SIZE) == 0) {
-			out = true;
-			debug ("Writing to file \"%s\" in raw format (fseeked() to %lld)", dmp -> outfile_raw, my_ftell (dmp -> fp_raw));
+		/* The file will only be written from now on, truncated to the first sector that will be dumped, or to the last block that was read
+		 * when there is a map */
+		if (out && !(dmp -> wr_raw = dumper_open_writer (dmp, dmp -> outfile_raw, RAW_SECTOR_SIZE, end)))
+			out = false;
+	}
+
+	/* Setup ISO output file */
+	dmp -> wr_iso = NULL;
+	if (out && dmp -> outfile_iso) {
+		if (dmp -> hashing && dmp -> start_sector > 0) {
+			debug ("Calculating hashes for pre-existing ISO dump data");
+			from = dumper_load_checkpoint (dmp, dmp -> outfile_iso, SECTOR_SIZE, &(dmp -> hash_iso));
+			out = dumper_hash_existing (dmp -> outfile_iso, SECTOR_SIZE, &(dmp -> hash_iso), from, dmp -> start_sector);
 		} else {
+			dumper_remove_checkpoint (dmp -> outfile_iso);
+		}
+
+		if (out && !(dmp -> wr_iso = dumper_open_writer (dmp, dmp -> outfile_iso, SECTOR_SIZE, end)))
 			out = false;
-			fclose (dmp -> fp_raw);
-			dmp -> fp_raw = NULL;
+	}
+
+	if (!out && dmp -> wr_raw) {
+		writer_close (dmp -> wr_raw);
+		dmp -> wr_raw = NULL;
+	}
+
+	return (out);
+}
+
+
+static bool dumper_write_block (dumper *dmp, u_int8_t *rawbuf, u_int8_t *isobuf, u_int32_t sectors) {
+	bool out;
+
+	if (dmp -> farm)
+		farm_throttle_write (dmp -> farm, sectors * ((dmp -> wr_raw ? RAW_SECTOR_SIZE : 0) + (dmp -> wr_iso ? SECTOR_SIZE : 0)));
+
+	out = true;
+	if (dmp -> wr_raw && !writer_write (dmp -> wr_raw, rawbuf, sectors)) {
+		error ("Write to raw output file failed");
+		out = false;
+	}
+
+	if (dmp -> wr_iso && !writer_write (dmp -> wr_iso, isobuf, sectors)) {
+		error ("Write to ISO output file failed");
+		out = false;
+	}
+
+	return (out);
+}
+
+
+static void dumper_hash_block (dumper *dmp, u_int32_t digests, u_int8_t *rawbuf, u_int8_t *isobuf, u_int32_t sectors) {
+	u_int32_t digest;
+
+	if (dmp -> hashing) {
+		if (dmp -> farm)
+			farm_cpu_acquire (dmp -> farm);
+		for (digest = 1; digest <= MULTIHASH_ALL; digest <<= 1) {
+			if (digests & digest) {
+				if (dmp -> wr_raw)
+					multihash_update_digest (&(dmp -> hash_raw), digest, rawbuf, RAW_SECTOR_SIZE * sectors);
+				if (dmp -> wr_iso)
+					multihash_update_digest (&(dmp -> hash_iso), digest, isobuf, SECTOR_SIZE * sectors);
+			}
 		}
+		if (dmp -> farm)
+			farm_cpu_release (dmp -> farm);
+	}
+
+	return;
+}
+
+
+/* Reads blocks with disc_read_blocks(), telling the adaptive speed controller, if any, how it went */
+static u_int32_t dumper_read_blocks (dumper *dmp, u_int32_t block, u_int32_t count, disc_span *spans) {
+	u_int32_t out, retries, errors;
+	u_int64_t t;
+
+	if (!dmp -> speedctl) {
+		out = disc_read_blocks (dmp -> dsk, block, count, spans);
 	} else {
-		dmp -> fp_raw = NULL;
+		retries = disc_get_retries (dmp -> dsk);
+		t = my_time_usec ();
+		out = disc_read_blocks (dmp -> dsk, block, count, spans);
+		t = my_time_usec () - t;
+
+		/* Fewer blocks than requested only means a failure before the end of the disc */
+		errors = disc_get_retries (dmp -> dsk) - retries;
+		if (out < count && (block + out) * SECTORS_PER_BLOCK < disc_get_sectors_no (dmp -> dsk))
+			errors++;
+		speedctl_update (dmp -> speedctl, block * SECTORS_PER_BLOCK, out, errors, t);
 	}
 
-	/* Setup ISO output file */
-	if (dmp -> outfile_iso) {
-		dmp -> fp_iso = fopen (dmp -> outfile_iso, "a+b");
+	return (out);
+}
 
-		if (dmp -> hashing) {
-			debug ("Calculating hashes for pre-existing ISO dump data");
-			if (dmp -> start_sector > 0) {
-				for (i = 0; i < dmp -> start_sector && (r = fread (buf, SECTOR_SIZE, 1, dmp -> fp_iso)) > 0; i++)
-					multihash_update (&(dmp -> hash_iso), buf, SECTOR_SIZE);
-				MY_ASSERT (r > 0);
+
+/* Makes a span start at the given sector, when resuming from the middle of a block */
+static void dumper_skip_to (disc_span *s, u_int32_t sector) {
+	u_int32_t skip;
+
+	if (sector > s -> sector) {
+		skip = sector - s -> sector;
+		s -> sector += skip;
+		s -> sectors -= skip;
+		s -> raw += skip * RAW_SECTOR_SIZE;
+		s -> data += skip * SECTOR_SIZE;
+	}
+
+	return;
+}
+
+
+/* The loop used when pipelining is disabled, reading, writing and hashing a read window at a time */
+static bool dumper_dump_serial (dumper *dmp, u_int32_t sectors_no, u_int32_t *current_sector) {
+	bool out;
+	disc_span spans[DUMPER_RING_SLOTS];
+	u_int32_t i, j, n, window, last_progress, interval, next_checkpoint;
+
+	window = disc_get_window_blocks (dmp -> dsk);
+	if (window > DUMPER_RING_SLOTS)
+		window = DUMPER_RING_SLOTS;
+	interval = dumper_checkpoint_interval (dmp);
+	next_checkpoint = dmp -> start_sector + interval;
+
+	last_progress = dmp -> start_sector;
+	for (i = dmp -> start_sector, out = true; i < sectors_no && out; ) {
+		if (interval > 0 && i >= next_checkpoint) {
+			if (!dumper_checkpoint (dmp, i)) {
+				out = false;
+				*(current_sector) = i;
+				break;
 			}
+			next_checkpoint = i + interval;
 		}
 
-		if (my_fseek (dmp -> fp_iso, dmp -> start_sector * SECTOR_SIZE, SEEK_SET) == 0 &&
-		    ftruncate (fileno (dmp -> fp_iso), (int64_t) dmp -> start_sector * SECTOR_SIZE) == 0) {
-			out = true;
-			debug ("Writing to file \"%s\" in ISO format (fseeked() to %lld)", dmp -> outfile_iso, my_ftell (dmp -> fp_iso));
-		} else {
+		if ((n = dumper_read_blocks (dmp, i / SECTORS_PER_BLOCK, window, spans)) == 0) {
+			error ("NULL buffer");
 			out = false;
-			fclose (dmp -> fp_iso);
-			dmp -> fp_iso = NULL;
+			*(current_sector) = i;
+			break;
+		}
+		dumper_skip_to (&(spans[0]), i);
+
+		for (j = 0; j < n && out; j++) {
+			if (!dumper_write_block (dmp, spans[j].raw, spans[j].data, spans[j].sectors)) {
+				out = false;
+				*(current_sector) = spans[j].sector;
+			} else {
+				dumper_hash_block (dmp, dmp -> digests, spans[j].raw, spans[j].data, spans[j].sectors);
+				i = spans[j].sector + spans[j].sectors;
+			}
+		}
+		disc_release_spans (dmp -> dsk, spans, n);
+
+		if (i - last_progress >= 320 || i == sectors_no) { //speedhack
+			last_progress = i;
+			if (dmp -> progress)
+				dmp -> progress (false, i, sectors_no, dmp -> progress_data);
 		}
-	} else {
-		dmp -> fp_iso = NULL;
 	}
 
 	return (out);
 }
 
 
-int dumper_dump (dumper *dmp, u_int32_t *current_sector) {
+/* Syncs the output files, then saves the map, so that it never tells a block was read before it is on disk. The hash state of the
+ * sectors hashed so far, which are all at the beginning of the files, is saved as well */
+static bool dumper_map_sync (dumper *dmp, u_int32_t sectors_no, u_int32_t hashed) {
 	bool out;
-	u_int8_t *rawbuf, *isobuf;
-	u_int32_t i, sectors_no, last_sector;
-#ifdef DEBUGaa
-	bool no_unscrambling;
-#endif
+	u_int32_t prefix;
 
-#ifdef DEBUGaa
-	no_unscrambling = dd -> no_unscrambling;
-	if (fp_iso && no_unscrambling) {
-		warning ("Output to ISO format requested, ignoring no_unscrambling!");
-		no_unscrambling = false;
+	prefix = dumper_map_prefix (dmp, sectors_no);
+	out = true;
+	if (dmp -> wr_raw) {
+		writer_set_resume_limit (dmp -> wr_raw, prefix);
+		if (!writer_sync (dmp -> wr_raw))
+			out = false;
 	}
-#endif
-
-	sectors_no = disc_get_sectors_no (dmp -> dsk);
-#if 0
-	if (dd -> start_sector != -1) {
-		if (dd -> start_sector >= sectors_no) {
-			error ("Cannot start dumping from sector %u as the inserted disc only has %u sectors\n", dd -> start_sector, sectors_no);
+	if (dmp -> wr_iso) {
+		writer_set_resume_limit (dmp -> wr_iso, prefix);
+		if (!writer_sync (dmp -> wr_iso))
 			out = false;
-		} else {
-			warning ("Start sector forced to %u\n", dd -> start_sector);
-			ss = dd -> start_sector;
+	}
 
-			if (fp_iso)
-				fseek (fp_iso, ss * 2048, SEEK_SET);
-			if (fp_raw)
-				fseek (fp_raw, ss * 2064, SEEK_SET);
-		}
+	if (out)
+		out = dumper_save_map (dmp, sectors_no);
+
+	if (out && dmp -> hashing && hashed > 0) {
+		if (dmp -> wr_raw)
+			dumper_save_checkpoint (dmp -> outfile_raw, RAW_SECTOR_SIZE, hashed, &(dmp -> hash_raw));
+		if (dmp -> wr_iso)
+			dumper_save_checkpoint (dmp -> outfile_iso, SECTOR_SIZE, hashed, &(dmp -> hash_iso));
 	}
-#endif
-	
-	if (true) {
-		debug ("Starting dump process from sector %u...\n", dmp -> start_sector);
 
-		/* First call to progress function */
-		if (dmp -> progress)
-			dmp -> progress (true, dmp -> start_sector, sectors_no, dmp -> progress_data);
+	return (out);
+}
 
-		last_sector=sectors_no-1;
-		
-		for (i = dmp -> start_sector, out = true; i < sectors_no && out; i++) {
-			disc_read_sector (dmp -> dsk, i, &isobuf, &rawbuf);
 
-			if (dmp -> fp_raw) {
-				clearerr (dmp -> fp_raw);
+/* Sets up the drive for a pass over the map. The first one gives up on a block at the first error, the second one retries as usual, and the
+ * following ones also slow the drive down more and more, switching to DUMPER_MAP_ALT_METHOD every other pass */
+static void dumper_map_pass_setup (dumper *dmp, u_int32_t pass, u_int32_t speed, u_int32_t method) {
+	u_int32_t i;
 
-				if (!rawbuf) {
-					error ("NULL buffer");
-					out = false;
-					*(current_sector) = i;
-				}
-				else fwrite (rawbuf, RAW_SECTOR_SIZE, 1, dmp -> fp_raw);
-				if (ferror (dmp -> fp_raw)) {
-					error ("fwrite() to raw output file failed");
-					out = false;
-					*(current_sector) = i;
-				}
+	disc_set_retries (dmp -> dsk, pass == 1 ? 1 : 0);
+	if (pass >= 3) {
+		/* These passes choose their own speeds */
+		dmp -> speedctl = speedctl_destroy (dmp -> speedctl);
+		if (speed == -1)
+			speed = DUMPER_MAP_SLOW_SPEED;
+		for (i = 2; i < pass && speed > DUMPER_MAP_MIN_SPEED; i++)
+			speed /= 2;
+		if (speed < DUMPER_MAP_MIN_SPEED)
+			speed = DUMPER_MAP_MIN_SPEED;
+		disc_set_speed (dmp -> dsk, speed);
+		disc_set_streaming_speed (dmp -> dsk, speed);
+		disc_set_read_method (dmp -> dsk, pass % 2 == 1 ? DUMPER_MAP_ALT_METHOD : method);
+		debug ("Pass %u: speed %u KB/s, method %u", pass, speed, disc_get_method (dmp -> dsk));
+	}
 
-				if (dmp -> flushing)
-					fflush (dmp -> fp_raw);
+	return;
+}
 
-				if (dmp -> hashing && out)
-					multihash_update (&(dmp -> hash_raw), rawbuf, RAW_SECTOR_SIZE);
-			}
 
-			if (dmp -> fp_iso) {
-				clearerr (dmp -> fp_iso);
+/**
+ * Dumps the disc in several passes, keeping track of the blocks that were read in the map file. The first pass goes through the blocks that
+ * were never tried, skipping those that cannot be read at the first attempt, so that the good areas of the disc are dumped at full speed. The
+ * following ones only go back to the blocks that failed. Blocks are written in place, wherever they are in the output files.
+ */
+static bool dumper_dump_map (dumper *dmp, u_int32_t sectors_no, u_int32_t *current_sector) {
+	bool out;
+	disc_span spans[DUMPER_RING_SLOTS];
+	u_int32_t pass, block, next, j, n, run, window, interval, saved, position, hashed, good, last_progress, speed, method;
+
+	interval = ((my_off_t) (dmp -> sync_interval > 0 ? dmp -> sync_interval : WRITER_DEFAULT_SYNC_INTERVAL) * 1024 * 1024 / SECTOR_SIZE) / SECTORS_PER_BLOCK;
+	speed = disc_get_speed (dmp -> dsk);
+	method = disc_get_method (dmp -> dsk);
+	good = dumper_map_sectors (dmp, sectors_no, DUMPER_MAP_GOOD);
+	hashed = dmp -> start_sector;
+	position = -1;
+	last_progress = good;
+
+	for (pass = 1, out = true; out && pass <= dmp -> passes && good < sectors_no; pass++) {
+		dumper_map_pass_setup (dmp, pass, speed, method);
+		window = disc_get_window_blocks (dmp -> dsk);
+		if (window > DUMPER_RING_SLOTS)
+			window = DUMPER_RING_SLOTS;
+
+		for (block = 0, saved = 0; out && block < dmp -> blocks_no; block = next) {
+			/* Read as many consecutive blocks left for this pass as fit in a read window */
+			for (run = 0; run < window && block + run < dmp -> blocks_no && dmp -> map[block + run] != DUMPER_MAP_GOOD &&
+			     (pass > 1 || dmp -> map[block + run] == DUMPER_MAP_UNTRIED); run++)
+				;
+			if (run == 0) {
+				next = block + 1;
+				continue;
+			}
 
-				if (!isobuf) {
-					error ("NULL buffer");
+			n = dumper_read_blocks (dmp, block, run, spans);
+			for (j = 0; j < n && out; j++) {
+				if (spans[j].sector != position && ((dmp -> wr_raw && !writer_seek (dmp -> wr_raw, spans[j].sector)) ||
+								     (dmp -> wr_iso && !writer_seek (dmp -> wr_iso, spans[j].sector)))) {
 					out = false;
-					*(current_sector) = i;
-				}
-				else fwrite (isobuf, SECTOR_SIZE, 1, dmp -> fp_iso);
-
-				if (ferror (dmp -> fp_iso)) {
-					error ("fwrite() to ISO output file failed");
+				} else if (!dumper_write_block (dmp, spans[j].raw, spans[j].data, spans[j].sectors)) {
 					out = false;
-					*(current_sector) = i;
+				} else {
+					/* Blocks are hashed as long as they come in order, the others will be hashed from the files at the end */
+					if (spans[j].sector == hashed) {
+						dumper_hash_block (dmp, dmp -> digests, spans[j].raw, spans[j].data, spans[j].sectors);
+						hashed += spans[j].sectors;
+					}
+					dmp -> map[block + j] = DUMPER_MAP_GOOD;
+					good += spans[j].sectors;
+					position = spans[j].sector + spans[j].sectors;
 				}
+				if (!out)
+					*(current_sector) = spans[j].sector;
+			}
+			disc_release_spans (dmp -> dsk, spans, n);
 
-				if (dmp -> flushing)
-					fflush (dmp -> fp_iso);
+			next = block + n;
+			if (out && n < run) {
+				/* Leave the block that failed to the next pass */
+				warning ("Cannot read sectors %u-%u in pass %u, skipping them", (block + n) * SECTORS_PER_BLOCK, (block + n) * SECTORS_PER_BLOCK + 15, pass);
+				dmp -> map[next++] = DUMPER_MAP_BAD;
+			}
 
-				if (dmp -> hashing && out)
-					multihash_update (&(dmp -> hash_iso), isobuf, SECTOR_SIZE);
+			if (out && next - saved >= interval) {
+				out = dumper_map_sync (dmp, sectors_no, hashed);
+				saved = next;
+				if (!out)
+					*(current_sector) = block * SECTORS_PER_BLOCK;
 			}
 
-			if ((i % 320 == 0) || (i == last_sector)) { //speedhack
+			if (good - last_progress >= 320 || good == sectors_no) { //speedhack
+				last_progress = good;
 				if (dmp -> progress)
-					dmp -> progress (false, i + 1, sectors_no, dmp -> progress_data);		/* i + 1 'cause sectors range from 0 to N */
+					dmp -> progress (false, good, sectors_no, dmp -> progress_data);
 			}
 		}
 
-		if (dmp -> hashing) {
-			multihash_finish (&(dmp -> hash_raw));
-			multihash_finish (&(dmp -> hash_iso));
+		if (out && !dumper_map_sync (dmp, sectors_no, hashed)) {
+			out = false;
+			*(current_sector) = dumper_map_prefix (dmp, sectors_no);
 		}
+		debug ("Pass %u done, %u sectors left", pass, sectors_no - good);
+	}
+
+	/* Put the drive back as it was */
+	disc_set_retries (dmp -> dsk, 0);
+	if (pass > 3) {
+		disc_set_speed (dmp -> dsk, speed != -1 ? speed : DUMPER_MAP_MAX_SPEED);
+		disc_set_streaming_speed (dmp -> dsk, speed != -1 ? speed : DUMPER_MAP_MAX_SPEED);
+		disc_set_read_method (dmp -> dsk, method);
+	}
 
-		if (dmp -> fp_raw)
-			fclose (dmp -> fp_raw);
-		if (dmp -> fp_iso)
-			fclose (dmp -> fp_iso);
-		if (out) {
+	dmp -> unread_sectors = sectors_no - good;
+	if (out && good < sectors_no) {
+		out = false;
+		*(current_sector) = dumper_map_prefix (dmp, sectors_no);
+	}
 
+	/* Everything has been read and synced: hash what could not be hashed while reading */
+	if (out && dmp -> hashing && hashed < sectors_no) {
+		debug ("Hashing sectors %u-%u from the output files", hashed, sectors_no - 1);
+		if (dmp -> wr_raw && !dumper_hash_existing (dmp -> outfile_raw, RAW_SECTOR_SIZE, &(dmp -> hash_raw), hashed, sectors_no))
+			out = false;
+		if (dmp -> wr_iso && !dumper_hash_existing (dmp -> outfile_iso, SECTOR_SIZE, &(dmp -> hash_iso), hashed, sectors_no))
+			out = false;
+		if (!out)
+			*(current_sector) = hashed;
+	}
 
+	return (out);
+}
+
+
+/* The number of blocks completed by all the workers running a stage. Must be called with the pipeline lock held. */
+static u_int32_t dumper_stage_done (dumper_pipeline *p, dumper_stage s) {
+	u_int32_t i, out;
+	bool found;
+
+	for (i = 0, out = 0, found = false; i < p -> workers_no; i++) {
+		if (p -> workers[i].first <= s && p -> workers[i].last >= s && (!found || p -> workers[i].done < out)) {
+			out = p -> workers[i].done;
+			found = true;
 		}
 	}
 
@@ -344,6 +1009,313 @@ int dumper_dump (dumper *dmp, u_int32_t *current_sector) {
 }
 
 
+static void *dumper_worker_thread (void *arg) {
+	dumper_worker *w;
+	dumper_pipeline *p;
+	dumper *dmp;
+	dumper_slot *slot;
+	dumper_stage s;
+	u_int32_t k;
+	u_int64_t t;
+	bool failed;
+
+	w = (dumper_worker *) arg;
+	p = w -> p;
+	dmp = p -> dmp;
+
+	my_mutex_lock (&(p -> lock));
+	while (true) {
+		/* Wait for the previous stage to hand us a block */
+		while (w -> done == p -> done[w -> first - 1] && !p -> finished[w -> first - 1])
+			my_cond_wait (&(p -> cond), &(p -> lock));
+		if (w -> done == p -> done[w -> first - 1])
+			break;
+
+		k = w -> done;
+		slot = &(p -> slots[k % DUMPER_RING_SLOTS]);
+		dmp -> stage_queued[w -> first] += p -> done[w -> first - 1] - k;
+		dmp -> stage_samples[w -> first]++;
+		failed = p -> failed;
+		my_mutex_unlock (&(p -> lock));
+
+		for (s = w -> first; s <= w -> last; s++) {
+			t = my_time_usec ();
+			if (s == DUMPER_STAGE_HASH) {
+				dumper_hash_block (dmp, w -> digests, slot -> raw, slot -> data, slot -> sectors);
+			} else if (s == DUMPER_STAGE_WRITE && !failed) {
+				/* After a failure blocks are just drained, so that the other stages can terminate */
+				if (!dumper_write_block (dmp, slot -> raw, slot -> data, slot -> sectors)) {
+					my_mutex_lock (&(p -> lock));
+					p -> failed = true;
+					p -> failed_sector = slot -> sector;
+					my_mutex_unlock (&(p -> lock));
+					failed = true;
+				}
+			}
+			w -> busy[s] += my_time_usec () - t;
+		}
+		if (w -> last == DUMPER_STAGE_WRITE)
+			disc_release_spans (dmp -> dsk, slot, 1);
+
+		my_mutex_lock (&(p -> lock));
+		w -> done++;
+		for (s = w -> first; s <= w -> last; s++)
+			p -> done[s] = dumper_stage_done (p, s);
+		my_cond_broadcast (&(p -> cond));
+	}
+
+	for (s = w -> first; s <= w -> last; s++) {
+		if (--(p -> running[s]) == 0)
+			p -> finished[s] = true;
+	}
+	my_cond_broadcast (&(p -> cond));
+	my_mutex_unlock (&(p -> lock));
+
+	return (NULL);
+}
+
+
+/**
+ * Dumps the disc running the read, hash and write stages concurrently. Blocks travel through a bounded ring of 16-sector slots, so that the
+ * drive is never left idle while data is being hashed or written. The reader runs in the calling thread, which also calls the progress function.
+ */
+static bool dumper_dump_pipelined (dumper *dmp, u_int32_t sectors_no, u_int32_t *current_sector) {
+	bool out;
+	dumper_pipeline p;
+	dumper_worker *w;
+	disc_span spans[DUMPER_RING_SLOTS];
+	u_int32_t i, j, k, n, workers_no, hashers, digests, digest, last_progress, window, free_slots, interval, next_checkpoint;
+	u_int64_t t;
+	dumper_stage s;
+
+	memset (&p, 0, sizeof (p));
+	p.dmp = dmp;
+	if (!(p.slots = (dumper_slot *) malloc (sizeof (dumper_slot) * DUMPER_RING_SLOTS))) {
+		error ("Cannot allocate pipeline buffers");
+		*(current_sector) = dmp -> start_sector;
+		return (false);
+	}
+	my_mutex_init (&(p.lock));
+	my_cond_init (&(p.cond));
+
+	/* With only two threads, hashing and writing share the same worker. With more, the writer gets a thread of its own, and the digests are
+	 * spread over the remaining ones */
+	digests = dmp -> hashing ? dmp -> digests : 0;
+	for (digest = 1, n = 0; digest <= MULTIHASH_ALL; digest <<= 1) {
+		if (digests & digest)
+			n++;
+	}
+	if (dmp -> threads < DUMPER_STAGES) {
+		hashers = 0;
+		workers_no = 1;
+	} else {
+		hashers = dmp -> threads - 2;
+		if (hashers > n)
+			hashers = n;
+		if (hashers < 1)
+			hashers = 1;
+		workers_no = hashers + 1;
+	}
+	for (i = 0; i < workers_no; i++) {
+		w = &(p.workers[i]);
+		w -> p = &p;
+		w -> first = (i < hashers || hashers == 0) ? DUMPER_STAGE_HASH : DUMPER_STAGE_WRITE;
+		w -> last = (i < hashers) ? DUMPER_STAGE_HASH : DUMPER_STAGE_WRITE;
+		w -> digests = (hashers == 0) ? digests : 0;
+	}
+	for (digest = 1, n = 0; digest <= MULTIHASH_ALL && hashers > 0; digest <<= 1) {
+		if (digests & digest)
+			p.workers[n++ % hashers].digests |= digest;
+	}
+
+	for (i = 0, out = true; i < workers_no && out; i++) {
+		w = &(p.workers[i]);
+		my_mutex_lock (&(p.lock));
+		for (s = w -> first; s <= w -> last; s++)
+			p.running[s]++;
+		p.workers_no++;
+		my_mutex_unlock (&(p.lock));
+
+		if (!my_thread_create (&(w -> thread), dumper_worker_thread, w)) {
+			my_mutex_lock (&(p.lock));
+			for (s = w -> first; s <= w -> last; s++)
+				p.running[s]--;
+			p.workers_no--;
+			my_mutex_unlock (&(p.lock));
+			out = false;
+		}
+	}
+
+	if (!out) {
+		*(current_sector) = dmp -> start_sector;
+		p.failed = true;
+	}
+
+	window = disc_get_window_blocks (dmp -> dsk);
+	if (window > DUMPER_RING_SLOTS)
+		window = DUMPER_RING_SLOTS;
+	interval = dumper_checkpoint_interval (dmp);
+	next_checkpoint = dmp -> start_sector + interval;
+
+	last_progress = dmp -> start_sector;
+	for (i = dmp -> start_sector, k = 0; out && i < sectors_no; i = spans[n - 1].sector + spans[n - 1].sectors, k += n) {
+		/* At a checkpoint, wait for the ring to drain, so that the hashes match what has been written */
+		if (interval > 0 && i >= next_checkpoint) {
+			my_mutex_lock (&(p.lock));
+			while (k != p.done[DUMPER_STAGES - 1] && !p.failed)
+				my_cond_wait (&(p.cond), &(p.lock));
+			if (!(out = !p.failed))
+				*(current_sector) = p.failed_sector;
+			my_mutex_unlock (&(p.lock));
+			if (out && !dumper_checkpoint (dmp, i)) {
+				*(current_sector) = i;
+				out = false;
+			}
+			if (!out)
+				break;
+			next_checkpoint = i + interval;
+		}
+
+		/* Wait for a free slot */
+		my_mutex_lock (&(p.lock));
+		while (k - p.done[DUMPER_STAGES - 1] == DUMPER_RING_SLOTS && !p.failed)
+			my_cond_wait (&(p.cond), &(p.lock));
+		dmp -> stage_queued[DUMPER_STAGE_READ] += k - p.done[DUMPER_STAGES - 1];
+		dmp -> stage_samples[DUMPER_STAGE_READ]++;
+		free_slots = DUMPER_RING_SLOTS - (k - p.done[DUMPER_STAGES - 1]);
+		if (!(out = !p.failed))
+			*(current_sector) = p.failed_sector;
+		my_mutex_unlock (&(p.lock));
+		if (!out)
+			break;
+
+		/* Read up to a whole read window, as many blocks as there are free slots for */
+		t = my_time_usec ();
+		if ((n = dumper_read_blocks (dmp, i / SECTORS_PER_BLOCK, window < free_slots ? window : free_slots, spans)) == 0) {
+			error ("NULL buffer");
+			out = false;
+			*(current_sector) = i;
+			break;
+		}
+		dumper_skip_to (&(spans[0]), i);
+		for (j = 0; j < n; j++)
+			p.slots[(k + j) % DUMPER_RING_SLOTS] = spans[j];
+		dmp -> stage_busy[DUMPER_STAGE_READ] += my_time_usec () - t;
+
+		/* Hand them to the next stage */
+		my_mutex_lock (&(p.lock));
+		p.done[DUMPER_STAGE_READ] += n;
+		my_cond_broadcast (&(p.cond));
+		my_mutex_unlock (&(p.lock));
+
+		j = spans[n - 1].sector + spans[n - 1].sectors;
+		if (j - last_progress >= 320 || j == sectors_no) { //speedhack
+			last_progress = j;
+			if (dmp -> progress)
+				dmp -> progress (false, j, sectors_no, dmp -> progress_data);
+		}
+	}
+
+	/* Let the workers drain the ring and terminate */
+	my_mutex_lock (&(p.lock));
+	p.finished[DUMPER_STAGE_READ] = true;
+	my_cond_broadcast (&(p.cond));
+	my_mutex_unlock (&(p.lock));
+	for (i = 0; i < p.workers_no; i++)
+		my_thread_join (p.workers[i].thread);
+
+	/* When several workers run a stage, report the busiest one */
+	for (i = 0; i < p.workers_no; i++) {
+		for (s = DUMPER_STAGE_HASH; s < DUMPER_STAGES; s++) {
+			if (p.workers[i].busy[s] > dmp -> stage_busy[s])
+				dmp -> stage_busy[s] = p.workers[i].busy[s];
+		}
+	}
+
+	if (out && p.failed) {
+		out = false;
+		*(current_sector) = p.failed_sector;
+	}
+
+	my_cond_destroy (&(p.cond));
+	my_mutex_destroy (&(p.lock));
+	free (p.slots);
+
+	return (out);
+}
+
+
+int dumper_dump (dumper *dmp, u_int32_t *current_sector) {
+	bool out;
+	u_int32_t sectors_no;
+	u_int64_t t;
+	dumper_stage s;
+
+	sectors_no = disc_get_sectors_no (dmp -> dsk);
+
+	debug ("Starting dump process from sector %u...\n", dmp -> start_sector);
+
+	/* First call to progress function, which is told how many sectors are already there */
+	if (dmp -> progress)
+		dmp -> progress (true, dmp -> mapfile ? dumper_map_sectors (dmp, sectors_no, DUMPER_MAP_GOOD) : dmp -> start_sector, sectors_no, dmp -> progress_data);
+
+	for (s = 0; s < DUMPER_STAGES; s++) {
+		dmp -> stage_busy[s] = 0;
+		dmp -> stage_queued[s] = 0;
+		dmp -> stage_samples[s] = 0;
+	}
+
+	if (dmp -> adaptive_speed)
+		dmp -> speedctl = speedctl_new (dmp -> dsk, disc_get_speed (dmp -> dsk));
+
+	t = my_time_usec ();
+	dmp -> unread_sectors = 0;
+	if (dmp -> mapfile)
+		out = dumper_dump_map (dmp, sectors_no, current_sector);
+	else if (dmp -> threads > 1)
+		out = dumper_dump_pipelined (dmp, sectors_no, current_sector);
+	else
+		out = dumper_dump_serial (dmp, sectors_no, current_sector);
+	dmp -> elapsed = my_time_usec () - t;
+	dmp -> speedctl = speedctl_destroy (dmp -> speedctl);
+
+	if (dmp -> threads > 1 && !dmp -> mapfile) {
+		for (s = 0; s < DUMPER_STAGES; s++)
+			debug ("Stage %d: %.1f%% busy, %.1f blocks queued on average", s, dumper_get_stage_occupancy (dmp, s) * 100,
+				dumper_get_stage_backlog (dmp, s));
+	}
+
+	if (dmp -> hashing) {
+		multihash_finish (&(dmp -> hash_raw));
+		multihash_finish (&(dmp -> hash_iso));
+	}
+
+	/* Closing flushes the last buffered blocks */
+	if (dmp -> wr_raw && !writer_close (dmp -> wr_raw) && out) {
+		error ("Cannot complete raw output file");
+		out = false;
+		*(current_sector) = sectors_no - 1;
+	}
+	if (dmp -> wr_iso && !writer_close (dmp -> wr_iso) && out) {
+		error ("Cannot complete ISO output file");
+		out = false;
+		*(current_sector) = sectors_no - 1;
+	}
+	dmp -> wr_raw = NULL;
+	dmp -> wr_iso = NULL;
+
+	/* Complete files need no checkpoint nor map, their size is reliable */
+	if (out) {
+		dumper_remove_checkpoint (dmp -> outfile_raw);
+		dumper_remove_checkpoint (dmp -> outfile_iso);
+		if (dmp -> mapfile)
+			remove (dmp -> mapfile);
+	}
+
+	return (out);
+}
+
+
 dumper *dumper_new (disc *d) {
 	dumper *dmp;
 
@@ -351,7 +1323,11 @@ dumper *dumper_new (disc *d) {
 	memset (dmp, 0, sizeof (dumper));
 	dmp -> dsk = d;
 	dumper_set_hashing (dmp, true);
+	dumper_set_digests (dmp, DUMPER_DEFAULT_DIGESTS);
 	dumper_set_flushing (dmp, true);
+	dumper_set_sync_interval (dmp, WRITER_DEFAULT_SYNC_INTERVAL);
+	dumper_set_threads (dmp, DUMPER_DEFAULT_THREADS);
+	dmp -> passes = DUMPER_DEFAULT_PASSES;
 
 	return (dmp);
 }
@@ -373,6 +1349,25 @@ void dumper_set_hashing (dumper *dmp, bool h) {
 }
 
 
+/**
+ * Chooses the digests computed when hashing is enabled. Digests that are not chosen are returned as empty strings.
+ * @param dmp The dumper structure.
+ * @param digests MULTIHASH_* values, OR'ed together.
+ */
+void dumper_set_digests (dumper *dmp, u_int32_t digests) {
+	dmp -> digests = digests & MULTIHASH_ALL;
+	debug ("Digests: 0x%02x", dmp -> digests);
+
+	return;
+}
+
+
+/**
+ * Enables or disables sync points. When enabled, output files are synced to disk every few MB and a resume point is kept next to them, so
+ * that an interrupted dump can be resumed safely.
+ * @param dmp The dumper structure.
+ * @param f true to enable sync points.
+ */
 void dumper_set_flushing (dumper *dmp, bool f) {
 	dmp -> flushing = f;
 	debug ("Flushing %s", f ? "enabled" : "disabled");
@@ -380,9 +1375,152 @@ void dumper_set_flushing (dumper *dmp, bool f) {
 	return;
 }
 
+
+/**
+ * Sets how much data is written to the output files between two sync points.
+ * @param dmp The dumper structure.
+ * @param mb The interval in MB. 0 disables sync points, as dumper_set_flushing (dmp, false) does.
+ */
+void dumper_set_sync_interval (dumper *dmp, u_int32_t mb) {
+	dmp -> sync_interval = mb;
+	debug ("Sync interval: %u MB", mb);
+
+	return;
+}
+
+
+/**
+ * Chooses whether output files are written bypassing the OS page cache (O_DIRECT), which avoids filling memory with data that will not
+ * be read again. Files are written normally where it is not supported.
+ * @param dmp The dumper structure.
+ * @param direct true to use direct I/O.
+ */
+void dumper_set_direct_io (dumper *dmp, bool direct) {
+	dmp -> direct = direct;
+	debug ("Direct I/O %s", direct ? "enabled" : "disabled");
+
+	return;
+}
+
+/**
+ * Sets how many threads the dumper will use.
+ * @param dmp The dumper structure.
+ * @param threads 1 does everything in the calling thread, reading a read window at a time with disc_read_blocks(), then writing and hashing
+ *                it before reading the next one. With 2 threads, disc reading is overlapped with hashing and writing, while 3 or
+ *                more threads give writing a thread of its own and spread the digests over the remaining ones, up to one thread per digest.
+ */
+void dumper_set_threads (dumper *dmp, u_int32_t threads) {
+	if (threads < 1)
+		threads = 1;
+	dmp -> threads = threads;
+	debug ("Dumping with %u thread(s)", threads);
+
+	return;
+}
+
+
+/**
+ * Makes the dumper share the CPU and the output bandwidth with the other drives of a farm: hashing will only take place while holding one of
+ * its CPU slots, and writes are throttled to the farm bandwidth. The disc should be attached to the same farm with disc_set_farm().
+ * @param dmp The dumper structure.
+ * @param f The farm structure, or NULL.
+ */
+void dumper_set_farm (dumper *dmp, farm *f) {
+	dmp -> farm = f;
+
+	return;
+}
+
+
+/**
+ * Lets the drive speed follow the read errors during the dump. It is lowered where windows need retries, or take much longer than usual, and
+ * raised again where they are clean, separately for each area of the disc. The speed the drive is set to when the dump starts is never exceeded.
+ * @param dmp The dumper structure.
+ * @param adaptive true to enable adaptive speed.
+ */
+void dumper_set_adaptive_speed (dumper *dmp, bool adaptive) {
+	dmp -> adaptive_speed = adaptive;
+	debug ("Adaptive speed %s", adaptive ? "enabled" : "disabled");
+
+	return;
+}
+
+
+/**
+ * Makes the dumper keep a map of the blocks that have been read, like ddrescue does, so that unreadable blocks are skipped and tried again in
+ * later passes, or in a later run with the same map file, instead of stopping the dump. Blocks are written in place, so output files are
+ * never truncated past the last block that was read. Reading, hashing and writing are then not pipelined.
+ * @param dmp The dumper structure.
+ * @param mapfile The map file, which is created if it does not exist and removed when the dump completes, or NULL to dump sequentially.
+ * @param passes The number of passes, 0 for the default (DUMPER_DEFAULT_PASSES). The first one only gives each block a single try, the
+ *               second one retries the blocks that failed as usual, and the following ones also lower the speed and change the read method.
+ */
+void dumper_set_map (dumper *dmp, char *mapfile, u_int32_t passes) {
+	my_free (dmp -> mapfile);
+	dmp -> mapfile = NULL;
+	if (mapfile) {
+		my_strdup (dmp -> mapfile, mapfile);
+	}
+	dmp -> passes = passes > 0 ? passes : DUMPER_DEFAULT_PASSES;
+	debug ("Map file: %s, %u passes", mapfile ? mapfile : "none", dmp -> passes);
+
+	return;
+}
+
+
+/**
+ * Tells how many sectors could not be read during the last dump, which are marked as such in the map file.
+ * @param dmp The dumper structure.
+ * @return The number of sectors, always 0 without a map file.
+ */
+u_int32_t dumper_get_unread_sectors (dumper *dmp) {
+	return (dmp -> unread_sectors);
+}
+
+
+/**
+ * Tells how busy a pipeline stage was during the last dump. The stage with the highest value is the bottleneck. When the hash stage is
+ * spread over several threads, this is how busy the busiest of them was.
+ * @param dmp The dumper structure.
+ * @param stage The stage.
+ * @return The fraction of the dump time the stage spent working, between 0 and 1.
+ */
+double dumper_get_stage_occupancy (dumper *dmp, dumper_stage stage) {
+	double out;
+
+	if (dmp -> elapsed > 0 && stage < DUMPER_STAGES)
+		out = (double) dmp -> stage_busy[stage] / dmp -> elapsed;
+	else
+		out = 0;
+
+	return (out);
+}
+
+
+/**
+ * Tells how many blocks were waiting in front of a pipeline stage, on average, during the last dump. For the reader stage, this is the
+ * number of ring slots that were in use when it needed a free one.
+ * @param dmp The dumper structure.
+ * @param stage The stage.
+ * @return The average number of queued blocks.
+ */
+double dumper_get_stage_backlog (dumper *dmp, dumper_stage stage) {
+	double out;
+
+	if (stage < DUMPER_STAGES && dmp -> stage_samples[stage] > 0)
+		out = (double) dmp -> stage_queued[stage] / dmp -> stage_samples[stage];
+	else
+		out = 0;
+
+	return (out);
+}
+
+
 void *dumper_destroy (dumper *dmp) {
 	my_free (dmp -> outfile_raw);
 	my_free (dmp -> outfile_iso);
+	my_free (dmp -> mapfile);
+	my_free (dmp -> map);
 	my_free (dmp);
 
 	return (NULL);
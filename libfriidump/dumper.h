@@ -24,6 +24,8 @@
 
 #include "misc.h"
 #include <sys/types.h>
+#include <multihash.h>
+#include "farm.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +33,15 @@ extern "C" {
 
 typedef struct dumper_s dumper;
 
+/*! \brief The stages of the dumping pipeline.
+ */
+typedef enum {
+	DUMPER_STAGE_READ,		//!< Reading (and unscrambling) blocks from the disc.
+	DUMPER_STAGE_HASH,		//!< Updating hashes.
+	DUMPER_STAGE_WRITE,		//!< Writing to the output files.
+	DUMPER_STAGES
+} dumper_stage;
+
 typedef void (*progress_func) (bool start, u_int32_t current_sector, u_int32_t total_sectors, void *progress_data);
 
 FRIIDUMPLIB_EXPORT bool dumper_set_raw_output_file (dumper *dmp, char *outfile_raw, bool resume);
@@ -40,7 +51,17 @@ FRIIDUMPLIB_EXPORT int dumper_dump (dumper *dmp, u_int32_t *current_sector);
 FRIIDUMPLIB_EXPORT dumper *dumper_new (disc *d);
 FRIIDUMPLIB_EXPORT void dumper_set_progress_callback (dumper *dmp, progress_func progress, void *progress_data);
 FRIIDUMPLIB_EXPORT void dumper_set_hashing (dumper *dmp, bool h);
+FRIIDUMPLIB_EXPORT void dumper_set_digests (dumper *dmp, u_int32_t digests);
 FRIIDUMPLIB_EXPORT void dumper_set_flushing (dumper *dmp, bool f);
+FRIIDUMPLIB_EXPORT void dumper_set_sync_interval (dumper *dmp, u_int32_t mb);
+FRIIDUMPLIB_EXPORT void dumper_set_direct_io (dumper *dmp, bool direct);
+FRIIDUMPLIB_EXPORT void dumper_set_threads (dumper *dmp, u_int32_t threads);
+FRIIDUMPLIB_EXPORT void dumper_set_farm (dumper *dmp, farm *f);
+FRIIDUMPLIB_EXPORT void dumper_set_map (dumper *dmp, char *mapfile, u_int32_t passes);
+FRIIDUMPLIB_EXPORT void dumper_set_adaptive_speed (dumper *dmp, bool adaptive);
+FRIIDUMPLIB_EXPORT u_int32_t dumper_get_unread_sectors (dumper *dmp);
+FRIIDUMPLIB_EXPORT double dumper_get_stage_occupancy (dumper *dmp, dumper_stage stage);
+FRIIDUMPLIB_EXPORT double dumper_get_stage_backlog (dumper *dmp, dumper_stage stage);
 FRIIDUMPLIB_EXPORT void *dumper_destroy (dumper *dmp);
 FRIIDUMPLIB_EXPORT char *dumper_get_iso_crc32 (dumper *dmp);
 FRIIDUMPLIB_EXPORT char *dumper_get_raw_crc32 (dumper *dmp);
@@ -32,7 +32,6 @@
  * a lot of other people. See his page for full details.
  */
 
-#include "rs.h"
 #include "misc.h"
 #include <stdio.h>
 #include <sys/types.h>
@@ -40,8 +39,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include "constants.h"
 #include "dvd_drive.h"
+#include "dvd_sim.h"
 #include "disc.h"
+#include "thread.h"
+#include "ecc.h"
+#include "raw2384.h"
 
 #ifdef WIN32
 #include <windows.h>
@@ -52,6 +56,22 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <scsi/sg.h>
+#define DVD_HAVE_SG
+#endif
+
+#ifdef DVD_HAVE_SG
+/* Older headers lack this: without it, the sg driver queues commands at the head, reversing their order */
+#ifndef SG_FLAG_Q_AT_TAIL
+#define SG_FLAG_Q_AT_TAIL 0x10
+#endif
+
+/* The first sg driver version supporting the v3 interface */
+#define DVD_SG_MIN_VERSION 30000
+
+/* Size of the sense buffer used with the sg driver */
+#define DVD_SG_SENSE_LEN 32
 #endif
 
 
@@ -61,13 +81,42 @@
  */
 #define MMC_CMD_TIMEOUT 10
 
+/*! \brief Maximum number of commands that can be queued with dvd_submit() */
+#define DVD_QUEUE_DEPTH 16
+
+/*! \brief Name of the per-user file holding the tuned drive profiles */
+#define DVD_PROFILES_FILE "drives"
+
 
 /* Imported drive-specific functions */
+void hitachi_dvd_memdump_cmd	(mmc_command *mmc, u_int32_t block_off, u_int32_t block_size, u_int8_t *buf);
 int vanilla_2064_dvd_dump_mem	(dvd_drive *dvd, u_int32_t block_off, u_int32_t block_len, u_int32_t block_size, u_int8_t *buf);
 int vanilla_2384_dvd_dump_mem	(dvd_drive *dvd, u_int32_t block_off, u_int32_t block_len, u_int32_t block_size, u_int8_t *buf);
 int hitachi_dvd_dump_mem	(dvd_drive *dvd, u_int32_t block_off, u_int32_t block_len, u_int32_t block_size, u_int8_t *buf);
 int liteon_dvd_dump_mem		(dvd_drive *dvd, u_int32_t block_off, u_int32_t block_len, u_int32_t block_size, u_int8_t *buf);
 int renesas_dvd_dump_mem	(dvd_drive *dvd, u_int32_t block_off, u_int32_t block_len, u_int32_t block_size, u_int8_t *buf);
+int vanilla_2384_dvd_dump_frames (dvd_drive *dvd, u_int32_t offset, u_int32_t block_size, u_int8_t *buf);
+int liteon_dvd_dump_frames	(dvd_drive *dvd, u_int32_t offset, u_int32_t block_size, u_int8_t *buf);
+extern const dvd_memdump_caps vanilla_2064_dvd_memdump_caps;
+extern const dvd_memdump_caps vanilla_2384_dvd_memdump_caps;
+extern const dvd_memdump_caps hitachi_dvd_memdump_caps;
+extern const dvd_memdump_caps liteon_dvd_memdump_caps;
+extern const dvd_memdump_caps renesas_dvd_memdump_caps;
+
+
+/*! \brief A command queued with dvd_submit().
+ */
+typedef struct {
+	mmc_command mmc;		//!< A copy of the command. Buffers still belong to the caller.
+	bool ignore_errors;
+	bool async;			//!< True if the command was handed to the sg driver, false if it was executed right away.
+	int status;			//!< The result, for commands that were executed right away.
+	u_int64_t submitted;		//!< When the command was handed to the sg driver, see my_time_usec().
+#ifdef DVD_HAVE_SG
+	sg_io_hdr_t hdr;
+	u_int8_t sense[DVD_SG_SENSE_LEN];
+#endif
+} dvd_request;
 
 
 /*! \brief A structure that represents a CD/DVD-ROM drive.
@@ -90,7 +139,18 @@ struct dvd_drive_s {
 	 *  might be changed in the future, if we get support for other drives.
 	 */
 	dvd_drive_memdump_func memdump;	//!< A pointer to a function that is able to dump the drive's internal memory area.
+	dvd_drive_memdump_cmd_func memdump_cmd;	//!< A pointer to a function that prepares a memory dump command that can be queued, or NULL if dumped data needs post-processing.
+	dvd_drive_memdump_frames_func memdump_frames;	//!< A pointer to a function dumping uncorrected 2384-byte frames, or NULL if the command returns 2064-byte sectors.
+	const dvd_memdump_caps *memdump_caps;	//!< What the memory dump command accepts.
+	u_int32_t memdump_cmds;		//!< Number of memory dump commands issued.
+	u_int64_t memdump_bytes;	//!< Number of bytes dumped by them.
+	metrics *metrics;		//!< Where to record the latency of commands and of what the disc layer does with them, or NULL.
 	bool supported;			//!< True if the drive is a supported model, false otherwise.
+	dvd_profile profile;		//!< The tuned parameters for this drive model.
+	bool has_profile;		//!< True if <code>profile</code> is valid.
+
+	/* Simulated drive, used instead of the OS device when not NULL */
+	dvd_sim *sim;			//!< The simulated drive, if the device path starts with DVD_SIM_PREFIX.
 
 
 	/* File descriptor & stuff used to access drive */
@@ -98,7 +158,14 @@ struct dvd_drive_s {
 	HANDLE fd;			//!< The HANDLE to interact with the drive on Windows.
 #else
 	int fd;				//!< The file descriptor to interact with the drive on Unix.
+	int sg_fd;			//!< The sg device of the drive, used to queue commands, or -1.
 #endif
+
+	/* Command queue */
+	dvd_request queue[DVD_QUEUE_DEPTH];	//!< Commands submitted and not reaped yet, in submission order.
+	u_int32_t queue_head;		//!< Index of the oldest command in the queue.
+	u_int32_t queue_len;		//!< Number of commands in the queue.
+	u_int32_t pack_id;		//!< Identifier of the last command handed to the sg driver.
 };
 
 
@@ -107,9 +174,47 @@ struct dvd_drive_s {
 enum mmc_commands_e {
 	SPC_INQUIRY = 0x12,
 	MMC_READ_12 = 0xA8,
+	MMC_SET_STREAMING = 0xB6,
+	MMC_SET_CD_SPEED = 0xBB,
+	SPC_READ_BUFFER = 0x3C,
+	HITACHI_MEMDUMP = 0xE7,
 };
 
 
+/* Tells which histogram the latency of a command goes to */
+static metrics_timer dvd_command_timer (mmc_command *mmc) {
+	metrics_timer out;
+
+	switch (mmc -> cmd[0]) {
+		case MMC_READ_12:
+			if (mmc -> cmd[10] & 0x80)
+				out = METRICS_CMD_READ12_STREAMING;
+			else if (mmc -> cmd[1] & 0x08)
+				out = METRICS_CMD_READ12_FUA;
+			else
+				out = METRICS_CMD_READ12;
+			break;
+		case HITACHI_MEMDUMP:
+			out = METRICS_CMD_MEMDUMP_E7;
+			break;
+		case SPC_READ_BUFFER:
+			out = METRICS_CMD_MEMDUMP_3C;
+			break;
+		case MMC_SET_CD_SPEED:
+			out = METRICS_CMD_SET_CD_SPEED;
+			break;
+		case MMC_SET_STREAMING:
+			out = METRICS_CMD_SET_STREAMING;
+			break;
+		default:
+			out = METRICS_CMD_OTHER;
+			break;
+	}
+
+	return (out);
+}
+
+
 /**
  * Initializes a structure representing an MMC command.
  * @param mmc A pointer to the MMC command structure.
@@ -132,7 +237,7 @@ void dvd_init_command (mmc_command *mmc, u_int8_t *buf, int len, req_sense *sens
 #ifdef WIN32
 
 /* Doc is under the UNIX function */
-int dvd_execute_cmd (dvd_drive *dvd, mmc_command *mmc, bool ignore_errors) {
+static int dvd_execute_cmd_os (dvd_drive *dvd, mmc_command *mmc, bool ignore_errors) {
 	SCSI_PASS_THROUGH_DIRECT *sptd;
 	unsigned char sptd_sense[sizeof (*sptd) + 18], *sense;
 	DWORD bytes;
@@ -186,13 +291,13 @@ int dvd_execute_cmd (dvd_drive *dvd, mmc_command *mmc, bool ignore_errors) {
 #else
 
 /**
- * Executes an MMC command.
+ * Executes an MMC command through the OS.
  * @param dvd The DVD drive the command should be exectued on.
  * @param mmc The command to be executed.
  * @param ignore_errors If set to true, no error will be printed if the command fails.
  * @return 0 if the command was executed successfully, < 0 otherwise.
  */
-int dvd_execute_cmd (dvd_drive *dvd, mmc_command *mmc, bool ignore_errors) {
+static int dvd_execute_cmd_os (dvd_drive *dvd, mmc_command *mmc, bool ignore_errors) {
 	int out;
 	struct cdrom_generic_command cgc;
 	struct request_sense sense;
@@ -231,6 +336,235 @@ int dvd_execute_cmd (dvd_drive *dvd, mmc_command *mmc, bool ignore_errors) {
 #endif
 
 
+/**
+ * Executes an MMC command, either on a real drive or on a simulated one.
+ * @param dvd The DVD drive the command should be exectued on.
+ * @param mmc The command to be executed.
+ * @param ignore_errors If set to true, no error will be printed if the command fails.
+ * @return 0 if the command was executed successfully, < 0 otherwise.
+ */
+int dvd_execute_cmd (dvd_drive *dvd, mmc_command *mmc, bool ignore_errors) {
+	u_int64_t start;
+	int out;
+
+	start = my_time_usec ();
+	if (!dvd -> sim) {
+		out = dvd_execute_cmd_os (dvd, mmc, ignore_errors);
+	} else if (dvd_sim_execute_cmd (dvd -> sim, mmc) < 0 && !ignore_errors) {
+		out = -1;	/* Failure */
+		error ("Execution of MMC command failed on simulated drive");
+		debug ("Command was:");
+		hex_and_ascii_print ("", mmc -> cmd, sizeof (mmc -> cmd));
+		if (mmc -> sense)
+			debug ("Sense data: %02X/%02X/%02X", mmc -> sense -> sense_key, mmc -> sense -> asc, mmc -> sense -> ascq);
+	} else {
+		out = 0;
+	}
+	metrics_add_time (dvd -> metrics, dvd_command_timer (mmc), my_time_usec () - start);
+	if (out < 0)
+		metrics_count (dvd -> metrics, METRICS_COUNT_CMD_FAILED);
+
+	return (out);
+}
+
+
+#ifdef DVD_HAVE_SG
+/**
+ * Finds and opens the sg device of the drive, which can run several commands at a time through its write()/read() interface. The drive can be
+ * given either as its sg device or as a block device (i.e.: /dev/sr0), whose sg device is then looked up in sysfs. If none can be found, or the
+ * user has no access to it, commands will just be executed one at a time.
+ * @param dvd The DVD drive.
+ */
+static void dvd_open_sg (dvd_drive *dvd) {
+	char path[PATH_MAX], sgpath[PATH_MAX], *name;
+	struct dirent *de;
+	DIR *dir;
+	int fd, version, one;
+
+	fd = -1;
+	if (realpath (dvd -> device, path)) {
+		name = strrchr (path, '/') ? strrchr (path, '/') + 1 : path;
+		if (strncmp (name, "sg", 2) == 0) {
+			strcpy (sgpath, path);
+			fd = open (sgpath, O_RDWR);
+		} else {
+			snprintf (sgpath, sizeof (sgpath), "/sys/block/%.255s/device/scsi_generic", name);
+			if ((dir = opendir (sgpath))) {
+				while (fd < 0 && (de = readdir (dir))) {
+					if (strncmp (de -> d_name, "sg", 2) == 0) {
+						snprintf (sgpath, sizeof (sgpath), "/dev/%s", de -> d_name);
+						fd = open (sgpath, O_RDWR);
+					}
+				}
+				closedir (dir);
+			}
+		}
+	}
+
+	/* Results must be read back in order, so the driver must honour the pack_id we ask for */
+	one = 1;
+	if (fd >= 0 && (ioctl (fd, SG_GET_VERSION_NUM, &version) < 0 || version < DVD_SG_MIN_VERSION || ioctl (fd, SG_SET_FORCE_PACK_ID, &one) < 0)) {
+		close (fd);
+		fd = -1;
+	}
+
+	dvd -> sg_fd = fd;
+	if (fd >= 0) {
+		debug ("Using sg device %s to queue commands", sgpath);
+	} else {
+		debug ("No usable sg device, commands will be executed synchronously");
+	}
+
+	return;
+}
+
+
+/**
+ * Waits for a command that was handed to the sg driver and stores its result, as dvd_execute_cmd() would have returned it.
+ * @param dvd The DVD drive.
+ * @param r The queued command.
+ */
+static void dvd_complete (dvd_drive *dvd, dvd_request *r) {
+	ssize_t n;
+
+	do {
+		n = read (dvd -> sg_fd, &(r -> hdr), sizeof (sg_io_hdr_t));
+	} while (n < 0 && errno == EINTR);
+
+	if ((n < 0 || (r -> hdr.info & SG_INFO_OK_MASK) != SG_INFO_OK) && !r -> ignore_errors) {
+		r -> status = -1;	/* Failure */
+		error ("Execution of queued MMC command failed: %s", n < 0 ? strerror (errno) : "SCSI error");
+		debug ("Command was:");
+		hex_and_ascii_print ("", r -> mmc.cmd, sizeof (r -> mmc.cmd));
+		debug ("Sense data: %02X/%02X/%02X", r -> sense[2] & 0x0F, r -> sense[12], r -> sense[13]);
+	} else {
+		r -> status = 0;
+	}
+	metrics_add_time (dvd -> metrics, dvd_command_timer (&(r -> mmc)), my_time_usec () - r -> submitted);
+	if (r -> status < 0)
+		metrics_count (dvd -> metrics, METRICS_COUNT_CMD_FAILED);
+
+	if (r -> mmc.sense) {
+		r -> mmc.sense -> sense_key = r -> sense[2] & 0x0F;
+		r -> mmc.sense -> asc = r -> sense[12];
+		r -> mmc.sense -> ascq = r -> sense[13];
+	}
+	r -> async = false;
+
+	return;
+}
+#endif
+
+
+/* Waits for all the commands in flight, so that a command can be executed synchronously without overtaking them */
+static void dvd_complete_all (dvd_drive *dvd) {
+#ifdef DVD_HAVE_SG
+	u_int32_t i;
+	dvd_request *r;
+
+	for (i = 0; i < dvd -> queue_len; i++) {
+		r = &(dvd -> queue[(dvd -> queue_head + i) % DVD_QUEUE_DEPTH]);
+		if (r -> async)
+			dvd_complete (dvd, r);
+	}
+#endif
+
+	return;
+}
+
+
+/**
+ * Queues an MMC command. When the sg driver can be used (On Linux, with real drives), up to DVD_QUEUE_DEPTH commands can be in flight at the same
+ * time, so that the drive does not sit idle waiting for the host between them. Otherwise the command is executed right away. Either way, results
+ * must be collected with dvd_reap(), in submission order, and synchronous commands should not be used while some are queued.
+ * @param dvd The DVD drive the command should be exectued on.
+ * @param mmc The command to be queued. It is copied, but its buffer and sense structure must stay valid until it is reaped.
+ * @param ignore_errors If set to true, no error will be printed if the command fails.
+ * @return 0 if the command was queued, < 0 if the queue is full.
+ */
+int dvd_submit (dvd_drive *dvd, mmc_command *mmc, bool ignore_errors) {
+	dvd_request *r;
+	int out;
+
+	if (dvd -> queue_len == DVD_QUEUE_DEPTH) {
+		error ("Command queue full");
+		out = -1;
+	} else {
+		r = &(dvd -> queue[(dvd -> queue_head + dvd -> queue_len) % DVD_QUEUE_DEPTH]);
+		memcpy (&(r -> mmc), mmc, sizeof (mmc_command));
+		r -> ignore_errors = ignore_errors;
+		r -> async = false;
+#ifdef DVD_HAVE_SG
+		if (!dvd -> sim && dvd -> sg_fd >= 0) {
+			memset (&(r -> hdr), 0, sizeof (sg_io_hdr_t));
+			memset (r -> sense, 0, sizeof (r -> sense));
+			r -> hdr.interface_id = 'S';
+			r -> hdr.dxfer_direction = mmc -> buflen > 0 ? SG_DXFER_FROM_DEV : SG_DXFER_NONE;
+			r -> hdr.cmd_len = sizeof (mmc -> cmd);
+			r -> hdr.cmdp = r -> mmc.cmd;
+			r -> hdr.mx_sb_len = sizeof (r -> sense);
+			r -> hdr.sbp = r -> sense;
+			r -> hdr.dxfer_len = mmc -> buflen;
+			r -> hdr.dxferp = mmc -> buffer;
+			r -> hdr.timeout = MMC_CMD_TIMEOUT * 1000;	/* Milliseconds */
+			r -> hdr.flags = SG_FLAG_Q_AT_TAIL;
+			r -> hdr.pack_id = ++(dvd -> pack_id);
+			r -> submitted = my_time_usec ();
+			if (write (dvd -> sg_fd, &(r -> hdr), sizeof (sg_io_hdr_t)) == sizeof (sg_io_hdr_t)) {
+				r -> async = true;
+			} else {
+				debug ("Cannot queue command (%s), executing it synchronously", strerror (errno));
+				dvd_complete_all (dvd);
+			}
+		}
+#endif
+		if (!r -> async)
+			r -> status = dvd_execute_cmd (dvd, &(r -> mmc), ignore_errors);
+		dvd -> queue_len++;
+		out = 0;
+	}
+
+	return (out);
+}
+
+
+/**
+ * Waits for the oldest command queued with dvd_submit() to complete.
+ * @param dvd The DVD drive.
+ * @return 0 if the command was executed successfully, < 0 otherwise (or if no command was queued).
+ */
+int dvd_reap (dvd_drive *dvd) {
+	dvd_request *r;
+	int out;
+
+	if (dvd -> queue_len == 0) {
+		error ("No command to reap");
+		out = -1;
+	} else {
+		r = &(dvd -> queue[dvd -> queue_head]);
+#ifdef DVD_HAVE_SG
+		if (r -> async)
+			dvd_complete (dvd, r);
+#endif
+		out = r -> status;
+		dvd -> queue_head = (dvd -> queue_head + 1) % DVD_QUEUE_DEPTH;
+		dvd -> queue_len--;
+	}
+
+	return (out);
+}
+
+
+/**
+ * Tells how many more commands can be queued with dvd_submit() before some must be reaped.
+ * @param dvd The DVD drive.
+ * @return The number of free queue slots.
+ */
+u_int32_t dvd_get_queue_free (dvd_drive *dvd) {
+	return (DVD_QUEUE_DEPTH - dvd -> queue_len);
+}
+
+
 /**
  * Sends an INQUIRY command to the drive to retrieve drive identification strings.
  * @param dvd The DVD drive the command should be exectued on.
@@ -264,14 +598,112 @@ static int dvd_get_drive_info (dvd_drive *dvd) {
 }
 
 
+/**
+ * Looks for the parameters tuner_run() found for this drive model in the per-user profile file. Each line of the file holds the memory dump command,
+ * the read method, the requested and expected sectors and the speed, followed by the model string.
+ * @param dvd The DVD drive.
+ * @return True if a profile was found.
+ */
+static bool dvd_load_profile (dvd_drive *dvd) {
+	char *path, line[256];
+	dvd_profile p;
+	int speed, n;
+	FILE *fp;
+	bool out;
+
+	out = false;
+	if (dvd -> model_string && (path = my_user_file (DVD_PROFILES_FILE))) {
+		if ((fp = fopen (path, "r"))) {
+			while (!out && fgets (line, sizeof (line), fp)) {
+				strtrimr (line);
+				if (sscanf (line, "%u %u %u %u %d %n", &p.command, &p.method, &p.sec_disc, &p.sec_mem, &speed, &n) == 5 &&
+					strcmp (line + n, dvd -> model_string) == 0 && p.command <= 4 && p.method <= 9) {
+					p.speed = speed;
+					memcpy (&(dvd -> profile), &p, sizeof (dvd_profile));
+					out = true;
+				}
+			}
+			fclose (fp);
+		}
+		free (path);
+	}
+	dvd -> has_profile = out;
+
+	return (out);
+}
+
+
+/**
+ * Stores the parameters that work best with this drive model in the per-user profile file, replacing the previous ones, so that they are used by
+ * default from now on.
+ * @param dvd The DVD drive.
+ * @param p The parameters.
+ * @return True if the profile could be saved.
+ */
+bool dvd_save_profile (dvd_drive *dvd, dvd_profile *p) {
+	char *path, *tmp, line[256];
+	u_int32_t u;
+	int speed, n;
+	FILE *fp, *fpold;
+	bool out;
+
+	out = false;
+	if (dvd -> model_string && (path = my_user_file (DVD_PROFILES_FILE))) {
+		if ((tmp = (char *) malloc (strlen (path) + 5))) {
+			sprintf (tmp, "%s.tmp", path);
+			if ((fp = fopen (tmp, "w"))) {
+				fprintf (fp, "# FriiDump drive profiles: command, method, requested sectors, expected sectors, speed and drive model\n");
+
+				/* Keep the profiles of the other drives */
+				if ((fpold = fopen (path, "r"))) {
+					while (fgets (line, sizeof (line), fpold)) {
+						strtrimr (line);
+						if (sscanf (line, "%u %u %u %u %d %n", &u, &u, &u, &u, &speed, &n) == 5 && strcmp (line + n, dvd -> model_string) != 0)
+							fprintf (fp, "%s\n", line);
+					}
+					fclose (fpold);
+				}
+				fprintf (fp, "%u %u %u %u %d %s\n", p -> command, p -> method, p -> sec_disc, p -> sec_mem, (int) p -> speed, dvd -> model_string);
+				out = fclose (fp) == 0;
+#ifdef WIN32
+				remove (path);
+#endif
+				if (out)
+					out = rename (tmp, path) == 0;
+				else
+					remove (tmp);
+			}
+			free (tmp);
+		}
+		free (path);
+	}
+
+	if (out) {
+		memcpy (&(dvd -> profile), p, sizeof (dvd_profile));
+		dvd -> has_profile = true;
+		dvd -> def_method = p -> method;
+	} else {
+		warning ("Cannot save drive profile");
+	}
+
+	return (out);
+}
+
+
 /**
  * Assigns the proper memory dump functions to a dvd_drive object, according to vendor, model and other parameters. Actually this scheme probably needs to
- * to be improved, but it is enough for the moment.
+ * to be improved, but it is enough for the moment. Drives that have been tuned with tuner_run() use the parameters found then.
  * @param dvd The DVD drive the command should be exectued on.
  */
 static void dvd_assign_functions (dvd_drive *dvd, u_int32_t command) {
 	dvd -> def_method = 0;
-	if (strcmp (dvd -> vendor, "HL-DT-ST") == 0 && (
+	if (dvd_load_profile (dvd)) {
+		debug ("Tuned DVD drive detected, using memory dump command %u and method %u", dvd -> profile.command, dvd -> profile.method);
+		dvd_set_command (dvd, dvd -> profile.command);
+		dvd -> supported = true;
+		dvd -> def_method = dvd -> profile.method;
+
+	} else if (strcmp (dvd -> vendor, "HL-DT-ST") == 0 && (
 //		strcmp (dvd -> prod_id, "DVDRAM GSA-T10N") == 0 ||
 		strcmp (dvd -> prod_id, "DVD-ROM GDR8082N") == 0 ||
 		strcmp (dvd -> prod_id, "DVD-ROM GDR8161B") == 0 ||
@@ -323,18 +755,14 @@ static void dvd_assign_functions (dvd_drive *dvd, u_int32_t command) {
 		dvd -> supported = false;
 	}
 
-	if (command!=-1) {
-		dvd -> command = command;
-		if	    (command == 0) dvd -> memdump = &vanilla_2064_dvd_dump_mem;
-		else if	(command == 1) dvd -> memdump = &vanilla_2384_dvd_dump_mem;
-		else if	(command == 2) dvd -> memdump = &hitachi_dvd_dump_mem;
-		else if	(command == 3) dvd -> memdump = &liteon_dvd_dump_mem;
-		else if	(command == 4) dvd -> memdump = &renesas_dvd_dump_mem;
-	}
+	if (command!=-1)
+		dvd_set_command (dvd, command);
+	else
+		dvd_set_command (dvd, dvd -> command);
 
-	//init Reed-Solomon for Lite-On
-	generate_gf();
-	gen_poly();
+	/* Build the Reed-Solomon tables and pick the frame conversion kernel, for the drives returning 2384-byte frames */
+	ecc_init ();
+	raw2384_init ();
 
 	return;
 }
@@ -347,6 +775,7 @@ static void dvd_assign_functions (dvd_drive *dvd, u_int32_t command) {
  */
 dvd_drive *dvd_drive_new (char *device, u_int32_t command) {
 	dvd_drive *dvd;
+	dvd_sim *sim;
 #ifdef WIN32
 	HANDLE fd;
 	char dev[40];
@@ -358,25 +787,42 @@ dvd_drive *dvd_drive_new (char *device, u_int32_t command) {
 	   must gain access to the device somehow else (i. e. get added to the "cdrom" group or similar things) */
 	drop_euid ();
 	
-	debug ("Trying to open DVD device %s", device);
+	sim = NULL;
+	if (strncmp (device, DVD_SIM_PREFIX, strlen (DVD_SIM_PREFIX)) == 0) {
+		debug ("Creating simulated DVD drive %s", device);
+		if (!(sim = dvd_sim_new (device + strlen (DVD_SIM_PREFIX))))
+			return (NULL);
+	} else {
+		debug ("Trying to open DVD device %s", device);
 #ifdef WIN32
-	sprintf (dev, "\\\\.\\%c:", device[0]);
-	if ((fd = CreateFile (dev, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE) {
-		error ("Cannot open drive: %d", GetLastError ());
+		sprintf (dev, "\\\\.\\%c:", device[0]);
+		if ((fd = CreateFile (dev, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE) {
+			error ("Cannot open drive: %d", GetLastError ());
 #else
-	if ((fd = open (device, O_RDONLY | O_NONBLOCK)) < 0) {
-		perror ("Cannot open drive");
+		if ((fd = open (device, O_RDONLY | O_NONBLOCK)) < 0) {
+			perror ("Cannot open drive");
 #endif
-		dvd = NULL;
-	} else {
+			return (NULL);
+		}
 		debug ("Opened successfully");
 		drop_euid ();
-		dvd = (dvd_drive *) malloc (sizeof (dvd_drive));
-		my_strdup (dvd -> device, device);
+	}
+
+	dvd = (dvd_drive *) malloc (sizeof (dvd_drive));
+	memset (dvd, 0, sizeof (dvd_drive));
+	my_strdup (dvd -> device, device);
+	dvd -> sim = sim;
+#ifndef WIN32
+	dvd -> sg_fd = -1;
+#endif
+	if (!sim) {
 		dvd -> fd = fd;
-		dvd_get_drive_info (dvd);
-		dvd_assign_functions (dvd, command);
+#ifdef DVD_HAVE_SG
+		dvd_open_sg (dvd);
+#endif
 	}
+	dvd_get_drive_info (dvd);
+	dvd_assign_functions (dvd, command);
 
 	return (dvd);
 }
@@ -388,12 +834,26 @@ dvd_drive *dvd_drive_new (char *device, u_int32_t command) {
  * @return NULL.
  */
 void *dvd_drive_destroy (dvd_drive *dvd) {
-	if (dvd) {
+	/* Do not leave the drive writing to buffers that are about to be freed */
+	while (dvd && dvd -> queue_len > 0)
+		dvd_reap (dvd);
+
+	if (dvd && dvd -> memdump_bytes > 0)
+		debug ("%u memory dump commands for %.1f MB, %.1f commands/MB", dvd -> memdump_cmds, (double) dvd -> memdump_bytes / 1024 / 1024,
+			dvd -> memdump_cmds / ((double) dvd -> memdump_bytes / 1024 / 1024));
+
+	if (dvd && dvd -> sim) {
+		dvd -> sim = dvd_sim_destroy (dvd -> sim);
+	} else if (dvd) {
 #ifdef WIN32
 		CloseHandle (dvd -> fd);
 #else
 		close (dvd -> fd);
+		if (dvd -> sg_fd >= 0)
+			close (dvd -> sg_fd);
 #endif
+	}
+	if (dvd) {
 		my_free (dvd -> device);
 		my_free (dvd -> vendor);
 		my_free (dvd -> prod_id);
@@ -421,6 +881,144 @@ int dvd_memdump (dvd_drive *dvd, u_int32_t block_off, u_int32_t block_len, u_int
 	upgrade_euid ();
 	out = dvd -> memdump (dvd, block_off, block_len, block_size, buf);
 	drop_euid ();
+	dvd -> memdump_cmds += block_len;
+	dvd -> memdump_bytes += block_len * block_size;
+
+	return (out);
+}
+
+
+/* Dumps an area of the drive sector cache in chunks as large as the command accepts, either as the command returns it or as 2384-byte frames */
+static int dvd_memdump_chunks (dvd_drive *dvd, u_int32_t offset, u_int32_t size, u_int8_t *buf, bool frames) {
+	const dvd_memdump_caps *caps;
+	u_int32_t chunk, n;
+	int out;
+
+	caps = dvd -> memdump_caps;
+	chunk = caps -> max_transfer - caps -> max_transfer % caps -> alignment;
+	if (offset % caps -> alignment != 0) {
+		error ("Memory dump offset %u is not a multiple of %u", offset, caps -> alignment);
+		out = -2;
+	} else if (offset > caps -> max_offset || size > caps -> max_offset - offset) {
+		error ("Memory dump of %u bytes at offset %u is out of range", size, offset);
+		out = -2;
+	} else {
+		upgrade_euid ();
+		for (out = 0; size > 0 && out >= 0; offset += n, size -= n) {
+			n = size < chunk ? size : chunk;
+			if (frames) {
+				out = dvd -> memdump_frames (dvd, offset, n, buf);
+				buf += n / RAW_SECTOR_SIZE * RAW2384_FRAME_SIZE;
+			} else {
+				out = dvd -> memdump (dvd, offset, 1, n, buf);
+				buf += n;
+			}
+			dvd -> memdump_cmds++;
+			dvd -> memdump_bytes += n;
+		}
+		drop_euid ();
+	}
+
+	return (out);
+}
+
+
+/**
+ * Dumps an area of the drive sector cache using as few memory dump commands as possible, each one as large as the drive accepts. With drives
+ * returning 2384-byte frames, the whole area is corrected at once, so that the ECC blocks split between two commands can still be corrected with
+ * their PO parity.
+ * @param dvd The DVD drive the command should be exectued on.
+ * @param offset The offset to start dumping, WRT the beginning of the sector cache. Must be a multiple of the alignment of the command.
+ * @param size The number of bytes to dump.
+ * @param buf A buffer where to store the dumped data, which must be able to hold at least size bytes.
+ * @return 0 if the commands were executed successfully, < 0 otherwise.
+ */
+int dvd_memdump_range (dvd_drive *dvd, u_int32_t offset, u_int32_t size, u_int8_t *buf) {
+	u_int8_t *frames;
+	u_int32_t n;
+	int out;
+
+	if (!dvd -> memdump_frames) {
+		out = dvd_memdump_chunks (dvd, offset, size, buf, false);
+	} else if (!(frames = (u_int8_t *) malloc (size / RAW_SECTOR_SIZE * RAW2384_FRAME_SIZE + 1))) {
+		error ("Cannot allocate memory for %u frames", size / RAW_SECTOR_SIZE);
+		out = -1;
+	} else {
+		n = size / RAW_SECTOR_SIZE;
+		if ((out = dvd_memdump_chunks (dvd, offset, size, frames, true)) >= 0) {
+			raw2384_correct (frames, n);
+			if (raw2384_deinterleave (frames, n, buf) < n) {
+				error ("sector sequence broken");
+				out = -3;
+			}
+		}
+		free (frames);
+	}
+
+	return (out);
+}
+
+
+/**
+ * Same as dvd_memdump_range(), but for drives returning 2384-byte frames, which are left uncorrected. This allows callers dumping an area with
+ * several dvd_memdump_frames() calls, each one after a different READ, to correct it as a whole with raw2384_correct() once it is complete.
+ * @param dvd The DVD drive the command should be exectued on.
+ * @param offset The offset to start dumping, WRT the beginning of the sector cache, counting 2064 bytes per frame. Must be a multiple of the
+ *               alignment of the command.
+ * @param size The number of bytes to dump, counting 2064 bytes per frame.
+ * @param buf A buffer where to store the frames, which must be able to hold at least size / 2064 * 2384 bytes.
+ * @return 0 if the commands were executed successfully, < 0 otherwise (-1 if the drive does not return 2384-byte frames).
+ */
+int dvd_memdump_frames (dvd_drive *dvd, u_int32_t offset, u_int32_t size, u_int8_t *buf) {
+	return (dvd -> memdump_frames ? dvd_memdump_chunks (dvd, offset, size, buf, true) : -1);
+}
+
+
+/**
+ * Tells whether the memory dump command of a drive returns 2384-byte frames, which can be dumped with dvd_memdump_frames().
+ * @param dvd The DVD drive.
+ * @return True if it does, false if it returns 2064-byte sectors.
+ */
+bool dvd_memdump_returns_frames (dvd_drive *dvd) {
+	return (dvd -> memdump_frames != NULL);
+}
+
+
+/**
+ * Queues a command dumping a block of the drive sector cache, see dvd_submit(). Drives whose dumped data needs post-processing dump it right
+ * away, after the commands in flight have completed.
+ * @param dvd The DVD drive the command should be exectued on.
+ * @param block_off The offset to start dumping, WRT the beginning of the sector cache.
+ * @param block_size The number of bytes to dump (1 - 65535).
+ * @param buf A buffer where to store the dumped data, which must stay valid until the command is reaped.
+ * @return 0 if the command was queued, < 0 if the queue is full.
+ */
+int dvd_memdump_submit (dvd_drive *dvd, u_int32_t block_off, u_int32_t block_size, u_int8_t *buf) {
+	mmc_command mmc;
+	dvd_request *r;
+	int out;
+
+	upgrade_euid ();
+	if (dvd -> memdump_cmd) {
+		dvd -> memdump_cmd (&mmc, block_off, block_size, buf);
+		if ((out = dvd_submit (dvd, &mmc, false)) >= 0) {
+			dvd -> memdump_cmds++;
+			dvd -> memdump_bytes += block_size;
+		}
+	} else if (dvd -> queue_len == DVD_QUEUE_DEPTH) {
+		error ("Command queue full");
+		out = -1;
+	} else {
+		dvd_complete_all (dvd);
+		r = &(dvd -> queue[(dvd -> queue_head + dvd -> queue_len) % DVD_QUEUE_DEPTH]);
+		memset (r, 0, sizeof (dvd_request));
+		r -> status = dvd -> memdump (dvd, block_off, 1, block_size, buf) < 0 ? -1 : 0;
+		dvd -> queue_len++;
+		dvd -> memdump_cmds++;
+		dvd -> memdump_bytes += block_size;
+		out = 0;
+	}
+	drop_euid ();
 
 	return (out);
 }
@@ -466,6 +1064,24 @@ int dvd_read_sector_dummy (dvd_drive *dvd, u_int32_t sector, u_int32_t sectors,
 }
 
 
+/* Prepares the READ(12) command used by dvd_read_sector_streaming() */
+static void dvd_init_read_sector_streaming (mmc_command *mmc, u_int32_t sector, req_sense *sense, u_int8_t *buf, size_t bufsize) {
+	dvd_init_command (mmc, buf, bufsize, sense);
+	mmc -> cmd[0] = MMC_READ_12;
+	mmc -> cmd[2] = (u_int8_t) ((sector & 0xFF000000) >> 24);	/* LBA from MSB to LSB */
+	mmc -> cmd[3] = (u_int8_t) ((sector & 0x00FF0000) >> 16);
+	mmc -> cmd[4] = (u_int8_t) ((sector & 0x0000FF00) >> 8);
+	mmc -> cmd[5] = (u_int8_t) (sector & 0x000000FF);
+	mmc -> cmd[6] = 0;
+	mmc -> cmd[7] = 0;
+	mmc -> cmd[8] = 0;
+	mmc -> cmd[9] = 0x10;
+	mmc -> cmd[10] = 0x80;	/* STREAMING bit set */
+
+	return;
+}
+
+
 /**
  * Issues a READ(12) command using the STREAMING bit, which causes the requested 16-sector block to be read into memory,
  * together with the following four. This way we will be able to dump 5 sector with a single READ request.
@@ -493,23 +1109,31 @@ int dvd_read_sector_streaming (dvd_drive *dvd, u_int32_t sector, req_sense *sens
 		bufsize = sizeof (intbuf);
 	}
 	
-	dvd_init_command (&mmc, buf, bufsize, sense);
-	mmc.cmd[0] = MMC_READ_12;
-	mmc.cmd[2] = (u_int8_t) ((sector & 0xFF000000) >> 24);	/* LBA from MSB to LSB */
-	mmc.cmd[3] = (u_int8_t) ((sector & 0x00FF0000) >> 16);
-	mmc.cmd[4] = (u_int8_t) ((sector & 0x0000FF00) >> 8);
-	mmc.cmd[5] = (u_int8_t) (sector & 0x000000FF);
-	mmc.cmd[6] = 0;
-	mmc.cmd[7] = 0;
-	mmc.cmd[8] = 0;
-	mmc.cmd[9] = 0x10;
-	mmc.cmd[10] = 0x80;	/* STREAMING bit set */
+	dvd_init_read_sector_streaming (&mmc, sector, sense, buf, bufsize);
 	out = dvd_execute_cmd (dvd, &mmc, true);		/* Ignore errors! */
 	
 	return (out);
 }
 
 
+/**
+ * Queues the same command as dvd_read_sector_streaming(), see dvd_submit().
+ * @param dvd The DVD drive the command should be exectued on.
+ * @param sector The sector to be read.
+ * @param sense A pointer to a structure which will hold the SENSE DATA got from the drive after the command has been executed, or NULL.
+ * @param buf A buffer where to store the read data, which must stay valid until the command is reaped.
+ * @param bufsize The size of the buffer.
+ * @return 0 if the command was queued, < 0 if the queue is full.
+ */
+int dvd_submit_read_sector_streaming (dvd_drive *dvd, u_int32_t sector, req_sense *sense, u_int8_t *buf, size_t bufsize) {
+	mmc_command mmc;
+
+	dvd_init_read_sector_streaming (&mmc, sector, sense, buf, bufsize);
+
+	return (dvd_submit (dvd, &mmc, true));		/* Ignore errors! */
+}
+
+
 int dvd_read_streaming (dvd_drive *dvd, u_int32_t sector, u_int32_t sectors, req_sense *sense, u_int8_t *extbuf, size_t extbufsize) {
 	mmc_command mmc;
 	int out;
@@ -752,4 +1376,51 @@ u_int32_t dvd_get_def_method (dvd_drive *dvd){
 
 u_int32_t dvd_get_command (dvd_drive *dvd){
 	return (dvd -> command);
+}
+
+/**
+ * Selects the memory dump command.
+ * @param dvd The DVD drive.
+ * @param command The command (0 - vanilla 2064, 1 - vanilla 2384, 2 - Hitachi, 3 - Lite-On, 4 - Renesas).
+ */
+void dvd_set_command (dvd_drive *dvd, u_int32_t command) {
+	dvd -> command = command;
+	if	    (command == 0) { dvd -> memdump = &vanilla_2064_dvd_dump_mem; dvd -> memdump_caps = &vanilla_2064_dvd_memdump_caps; }
+	else if	(command == 1) { dvd -> memdump = &vanilla_2384_dvd_dump_mem; dvd -> memdump_caps = &vanilla_2384_dvd_memdump_caps; }
+	else if	(command == 2) { dvd -> memdump = &hitachi_dvd_dump_mem;      dvd -> memdump_caps = &hitachi_dvd_memdump_caps; }
+	else if	(command == 3) { dvd -> memdump = &liteon_dvd_dump_mem;       dvd -> memdump_caps = &liteon_dvd_memdump_caps; }
+	else if	(command == 4) { dvd -> memdump = &renesas_dvd_dump_mem;      dvd -> memdump_caps = &renesas_dvd_memdump_caps; }
+
+	/* Only the 2384-byte frames of the vanilla 2384 and Lite-On commands can be corrected as a whole */
+	if	    (command == 1) dvd -> memdump_frames = &vanilla_2384_dvd_dump_frames;
+	else if	(command == 3) dvd -> memdump_frames = &liteon_dvd_dump_frames;
+	else dvd -> memdump_frames = NULL;
+
+	/* Only the Hitachi command returns memory as-is, so that it can be queued */
+	dvd -> memdump_cmd = (dvd -> memdump == &hitachi_dvd_dump_mem) ? &hitachi_dvd_memdump_cmd : NULL;
+
+	return;
+}
+
+const dvd_memdump_caps *dvd_get_memdump_caps (dvd_drive *dvd) {
+	return (dvd -> memdump_caps);
+}
+
+metrics *dvd_get_metrics (dvd_drive *dvd) {
+	return (dvd -> metrics);
+}
+
+/**
+ * Starts or stops recording the latency of the commands sent to the drive.
+ * @param dvd The DVD drive.
+ * @param m Where to record them, which must stay valid as long as the drive is used, or NULL to stop.
+ */
+void dvd_set_metrics (dvd_drive *dvd, metrics *m) {
+	dvd -> metrics = m;
+
+	return;
+}
+
+dvd_profile *dvd_get_profile (dvd_drive *dvd) {
+	return (dvd -> has_profile ? &(dvd -> profile) : NULL);
 }
\ No newline at end of file
@@ -24,6 +24,7 @@
 
 #include "misc.h"
 #include <sys/types.h>
+#include "metrics.h"
 
 
 typedef struct dvd_drive_s dvd_drive;
@@ -36,6 +37,26 @@ typedef struct {
 } req_sense;
 
 
+/*! \brief The dumping parameters that work best with a drive model, as found by tuner_run().
+ */
+typedef struct {
+	u_int32_t command;		//!< Memory dump command.
+	u_int32_t method;		//!< Read method.
+	u_int32_t sec_disc;		//!< Sectors requested from the disc at a time (Methods 0-6 only).
+	u_int32_t sec_mem;		//!< Sectors read from the cache at a time (Methods 0-6 only).
+	u_int32_t speed;		//!< Speed multiplier, or -1 to leave the drive default.
+} dvd_profile;
+
+
+/*! \brief What the memory dump command of a drive accepts.
+ */
+typedef struct {
+	u_int32_t max_transfer;		//!< The largest number of bytes a single command can dump.
+	u_int32_t alignment;		//!< Commands must start at a multiple of this offset, and can only be split at multiples of it.
+	u_int32_t max_offset;		//!< The end of the memory the command can address, WRT the beginning of the sector cache.
+} dvd_memdump_caps;
+
+
 typedef struct {
 	u_int8_t cmd[12];
 	req_sense *sense;
@@ -49,6 +70,7 @@ dvd_drive *dvd_drive_new (char *device, u_int32_t command);
 void *dvd_drive_destroy (dvd_drive *d);
 int dvd_read_sector_dummy (dvd_drive *dvd, u_int32_t sector, u_int32_t sectors, req_sense *sense, u_int8_t *extbuf, size_t extbufsize);
 int dvd_read_sector_streaming (dvd_drive *dvd, u_int32_t sector, req_sense *sense, u_int8_t *extbuf, size_t extbufsize);
+int dvd_submit_read_sector_streaming (dvd_drive *dvd, u_int32_t sector, req_sense *sense, u_int8_t *buf, size_t bufsize);
 int dvd_read_streaming (dvd_drive *dvd, u_int32_t sector, u_int32_t sectors, req_sense *sense, u_int8_t *extbuf, size_t extbufsize);
 int dvd_flush_cache_READ12 (dvd_drive *dvd, u_int32_t sector, req_sense *sense);
 int dvd_stop_unit (dvd_drive *dvd, bool start, req_sense *sense);
@@ -57,6 +79,13 @@ int dvd_get_size (dvd_drive *dvd, u_int32_t *size, req_sense *sense);
 int dvd_get_layerbreak (dvd_drive *dvd, u_int32_t *layerbreak, req_sense *sense);
 int dvd_set_streaming (dvd_drive *dvd, u_int32_t speed, req_sense *sense);
 int dvd_memdump (dvd_drive *dvd, u_int32_t block_off, u_int32_t block_len, u_int32_t block_size, u_int8_t *buf);
+int dvd_memdump_submit (dvd_drive *dvd, u_int32_t block_off, u_int32_t block_size, u_int8_t *buf);
+int dvd_memdump_range (dvd_drive *dvd, u_int32_t offset, u_int32_t size, u_int8_t *buf);
+int dvd_memdump_frames (dvd_drive *dvd, u_int32_t offset, u_int32_t size, u_int8_t *buf);
+bool dvd_memdump_returns_frames (dvd_drive *dvd);
+int dvd_submit (dvd_drive *dvd, mmc_command *mmc, bool ignore_errors);
+int dvd_reap (dvd_drive *dvd);
+u_int32_t dvd_get_queue_free (dvd_drive *dvd);
 char *dvd_get_vendor (dvd_drive *dvd);
 char *dvd_get_product_id (dvd_drive *dvd);
 char *dvd_get_product_revision (dvd_drive *dvd);
@@ -64,9 +93,17 @@ char *dvd_get_model_string (dvd_drive *dvd);
 bool dvd_get_support_status (dvd_drive *dvd);
 u_int32_t dvd_get_def_method (dvd_drive *dvd);
 u_int32_t dvd_get_command (dvd_drive *dvd);
+void dvd_set_command (dvd_drive *dvd, u_int32_t command);
+const dvd_memdump_caps *dvd_get_memdump_caps (dvd_drive *dvd);
+metrics *dvd_get_metrics (dvd_drive *dvd);
+void dvd_set_metrics (dvd_drive *dvd, metrics *m);
+dvd_profile *dvd_get_profile (dvd_drive *dvd);
+bool dvd_save_profile (dvd_drive *dvd, dvd_profile *p);
 
 /* The following are exported for use by drive-specific functions */
 typedef int (*dvd_drive_memdump_func) (dvd_drive *dvd, u_int32_t block_off, u_int32_t block_len, u_int32_t block_size, u_int8_t *buf);
+typedef int (*dvd_drive_memdump_frames_func) (dvd_drive *dvd, u_int32_t offset, u_int32_t block_size, u_int8_t *buf);
+typedef void (*dvd_drive_memdump_cmd_func) (mmc_command *mmc, u_int32_t block_off, u_int32_t block_size, u_int8_t *buf);
 void dvd_init_command (mmc_command *mmc, u_int8_t *buf, int len, req_sense *sense);
 int dvd_execute_cmd (dvd_drive *dvd, mmc_command *mmc, bool ignore_errors);
 
@@ -0,0 +1,562 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief A simulated DVD drive, replaying a raw disc image.
+ *
+ * This backend is selected with a device path of the form <code>sim:image.raw[,option=value...]</code>, where <code>image.raw</code> is a scrambled
+ * image made of 2064-byte frames, as they are found in the memory of a real drive. It answers the MMC commands used by the library (INQUIRY, READ(12),
+ * READ TRACK INFORMATION, READ DVD STRUCTURE) and the vendor-specific memory dump commands (Hitachi E7, Lite-On/vanilla/Renesas 3C READ BUFFER),
+ * so that all the read methods can be run and benchmarked without a physical drive.
+ *
+ * The drive cache is modelled as a window of sectors that is loaded from the "media" whenever a READ cannot be satisfied with what is already cached,
+ * or when the FUA bit is set. Memory offset 0 always corresponds to the sector requested by the last READ command, which is what the read methods
+ * expect. Available options are:
+ * - <code>drive=hitachi|liteon|tsst|plextor</code>: the drive model to impersonate (default hitachi). This decides which memory dump command and read
+ *   method the library will pick, and whether 3C 02 returns 2064- or 2384-byte frames.
+ * - <code>cache=N</code>: number of sectors loaded into the cache on a miss (default 80).
+ * - <code>latency=N</code>: microseconds spent on every command (default 0).
+ * - <code>seek=N</code>: additional microseconds spent on every non-sequential media access (default 0).
+ * - <code>sector=N</code>: microseconds spent reading a single sector from the media (default 0).
+ * - <code>errors=N</code>: corrupts one out of N sectors read from the media. Such errors are transient: reading the sector again will fix them.
+ * - <code>bad=A-B</code>: sectors A to B (inclusive) always come back corrupted. Can be given more than once. As on real discs, drives returning
+ *   2384-byte frames still allow a single such sector to be corrected with the PO parity of its ECC block, while two or more in the same block
+ *   are beyond repair.
+ * - <code>layerbreak=N</code>: layer break reported for DVDs (default none).
+ * - <code>rand=N</code>: seed for the pseudo-random generator used to inject errors, so that runs can be reproduced.
+ *
+ * User data returned by READ commands is taken as-is from the user data field of the frames (i.e.: it is not unscrambled), which is what drives do
+ * with Nintendo discs.
+ */
+
+#include "misc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "constants.h"
+#include "raw2384.h"
+#include "dvd_sim.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+#define SIM_DEFAULT_WINDOW 80
+#define SIM_MAX_BAD_RANGES 16
+
+/*! \brief Size of the frames returned by drives that include the PI/PO parity bytes */
+#define SIM_FRAME_2384_SIZE 0x950
+
+#define HITACHI_MEM_BASE 0x80000000
+
+/* Damage types */
+#define SIM_DAMAGE_NONE 0
+#define SIM_DAMAGE_TRANSIENT 1
+#define SIM_DAMAGE_PERMANENT 2
+
+
+/*! \brief The drives the simulator can impersonate.
+ */
+static struct {
+	char *name;
+	char *vendor;
+	char *prod_id;
+	bool frames_2384;		//!< True if 3C 02 00 returns 2384-byte frames.
+} sim_models[] = {
+	{"hitachi", "HL-DT-ST", "DVD-ROM GDR8164B", false},
+	{"liteon", "LITE-ON", "DVDRW LH-18A1H", true},
+	{"tsst", "TSSTcorp", "DVD-ROM SH-D162C", true},
+	{"plextor", "PLEXTOR", "DVDR   PX-760A", false},
+	{NULL, NULL, NULL, false}
+};
+
+
+/*! \brief A structure that represents a simulated drive.
+ */
+struct dvd_sim_s {
+	FILE *fp;				//!< The disc image.
+	u_int32_t sectors_no;			//!< Number of sectors in the image.
+	u_int32_t layerbreak;			//!< The layer break to report, or 0.
+	int model;				//!< Index in sim_models[].
+
+	/* Cache */
+	u_int32_t window;			//!< Number of sectors loaded on a cache miss.
+	u_int8_t *cache;			//!< Cached frames, as stored on the media.
+	u_int8_t *damage;			//!< Damage type of every cached frame.
+	u_int16_t *damage_pos;			//!< Offset of the corrupted byte of every damaged frame.
+	u_int32_t cache_lba;			//!< First sector in the cache.
+	u_int32_t cache_len;			//!< Number of sectors in the cache.
+	u_int32_t base_lba;			//!< Sector mapped at memory offset 0.
+	u_int32_t head;				//!< Sector following the last one read from the media.
+	u_int8_t *ecc_block;			//!< The last ECC block built for 2384-byte frames, as recorded on the media.
+	u_int32_t ecc_block_lba;		//!< First sector of ecc_block, or -1.
+
+	/* Timing, in microseconds */
+	u_int32_t cmd_latency;
+	u_int32_t seek_latency;
+	u_int32_t sector_latency;
+
+	/* Error injection */
+	u_int32_t error_rate;
+	u_int32_t bad_first[SIM_MAX_BAD_RANGES];
+	u_int32_t bad_last[SIM_MAX_BAD_RANGES];
+	u_int32_t bad_no;
+	u_int32_t rand;
+
+	/* Statistics */
+	u_int32_t commands;
+	u_int32_t media_reads;
+	u_int32_t injected;
+};
+
+
+static u_int32_t sim_rand (dvd_sim *sim) {
+	/* xorshift32 */
+	sim -> rand ^= sim -> rand << 13;
+	sim -> rand ^= sim -> rand >> 17;
+	sim -> rand ^= sim -> rand << 5;
+
+	return (sim -> rand);
+}
+
+
+static void sim_sleep (u_int32_t usec) {
+	if (usec > 0) {
+#ifdef WIN32
+		Sleep (usec / 1000);
+#else
+		usleep (usec);
+#endif
+	}
+
+	return;
+}
+
+
+static void sim_set_sense (mmc_command *mmc, int sense_key, int asc, int ascq) {
+	if (mmc -> sense) {
+		mmc -> sense -> sense_key = sense_key;
+		mmc -> sense -> asc = asc;
+		mmc -> sense -> ascq = ascq;
+	}
+
+	return;
+}
+
+
+static bool sim_parse_option (dvd_sim *sim, char *opt) {
+	char *val;
+	u_int32_t i;
+	bool out;
+
+	out = true;
+	if (!(val = strchr (opt, '='))) {
+		out = false;
+	} else {
+		*val++ = '\0';
+		if (strcmp (opt, "drive") == 0) {
+			for (i = 0; sim_models[i].name && strcmp (sim_models[i].name, val) != 0; i++)
+				;
+			if (sim_models[i].name)
+				sim -> model = i;
+			else
+				out = false;
+		} else if (strcmp (opt, "cache") == 0) {
+			sim -> window = strtoul (val, NULL, 0);
+			out = sim -> window >= SECTORS_PER_BLOCK;
+		} else if (strcmp (opt, "latency") == 0) {
+			sim -> cmd_latency = strtoul (val, NULL, 0);
+		} else if (strcmp (opt, "seek") == 0) {
+			sim -> seek_latency = strtoul (val, NULL, 0);
+		} else if (strcmp (opt, "sector") == 0) {
+			sim -> sector_latency = strtoul (val, NULL, 0);
+		} else if (strcmp (opt, "errors") == 0) {
+			sim -> error_rate = strtoul (val, NULL, 0);
+		} else if (strcmp (opt, "bad") == 0 && sim -> bad_no < SIM_MAX_BAD_RANGES) {
+			sim -> bad_first[sim -> bad_no] = strtoul (val, &val, 0);
+			sim -> bad_last[sim -> bad_no] = *val == '-' ? strtoul (val + 1, NULL, 0) : sim -> bad_first[sim -> bad_no];
+			sim -> bad_no++;
+		} else if (strcmp (opt, "layerbreak") == 0) {
+			sim -> layerbreak = strtoul (val, NULL, 0);
+		} else if (strcmp (opt, "rand") == 0) {
+			sim -> rand = strtoul (val, NULL, 0);
+			if (!sim -> rand)
+				sim -> rand = 1;
+		} else {
+			out = false;
+		}
+	}
+
+	if (!out)
+		error ("Invalid simulated drive option \"%s\"", opt);
+
+	return (out);
+}
+
+
+/**
+ * Creates a new simulated drive.
+ * @param spec The image file name, optionally followed by comma-separated options (See the file description).
+ * @return The newly-created structure, or NULL if the image could not be opened or an option is not valid.
+ */
+dvd_sim *dvd_sim_new (char *spec) {
+	dvd_sim *sim;
+	char *s, *image, *opt;
+	my_off_t filesize;
+	bool ok;
+
+	sim = (dvd_sim *) malloc (sizeof (dvd_sim));
+	memset (sim, 0, sizeof (dvd_sim));
+	sim -> window = SIM_DEFAULT_WINDOW;
+	sim -> rand = 0x2545F491;
+
+	my_strdup (s, spec);
+	image = strtok (s, ",");
+	for (ok = true; ok && (opt = strtok (NULL, ",")); )
+		ok = sim_parse_option (sim, opt);
+
+	if (!ok || !image) {
+		sim -> fp = NULL;
+	} else if (!(sim -> fp = fopen (image, "rb"))) {
+		error ("Cannot open simulated disc image \"%s\"", image);
+	} else {
+		my_fseek (sim -> fp, 0, SEEK_END);
+		filesize = my_ftell (sim -> fp);
+		sim -> sectors_no = (u_int32_t) (filesize / RAW_SECTOR_SIZE);
+		sim -> cache = (u_int8_t *) malloc (sim -> window * RAW_SECTOR_SIZE);
+		sim -> damage = (u_int8_t *) malloc (sim -> window);
+		sim -> damage_pos = (u_int16_t *) malloc (sim -> window * sizeof (u_int16_t));
+		sim -> ecc_block = (u_int8_t *) malloc (RAW2384_BLOCK_FRAMES * SIM_FRAME_2384_SIZE);
+		sim -> ecc_block_lba = (u_int32_t) -1;
+		debug ("Simulating a %s drive with image \"%s\" (%u sectors, cache window %u sectors)", sim_models[sim -> model].name, image,
+			sim -> sectors_no, sim -> window);
+	}
+	my_free (s);
+
+	if (!sim -> fp)
+		sim = dvd_sim_destroy (sim);
+
+	return (sim);
+}
+
+
+/**
+ * Frees resources used by a simulated drive and destroys it.
+ * @param sim The simulated drive.
+ * @return NULL.
+ */
+void *dvd_sim_destroy (dvd_sim *sim) {
+	if (sim) {
+		debug ("Simulated drive: %u commands, %u media reads, %u injected errors", sim -> commands, sim -> media_reads, sim -> injected);
+		if (sim -> fp)
+			fclose (sim -> fp);
+		my_free (sim -> cache);
+		my_free (sim -> damage);
+		my_free (sim -> damage_pos);
+		my_free (sim -> ecc_block);
+		my_free (sim);
+	}
+
+	return (NULL);
+}
+
+
+/* Reads sectors from the "media" into the cache, injecting errors */
+static void sim_load_cache (dvd_sim *sim, u_int32_t lba) {
+	u_int32_t i, j, n;
+
+	n = sim -> window;
+	if (lba + n > sim -> sectors_no)
+		n = sim -> sectors_no - lba;
+
+	if (lba != sim -> head)
+		sim_sleep (sim -> seek_latency);
+	sim_sleep (sim -> sector_latency * n);
+
+	my_fseek (sim -> fp, (my_off_t) lba * RAW_SECTOR_SIZE, SEEK_SET);
+	n = (u_int32_t) fread (sim -> cache, RAW_SECTOR_SIZE, n, sim -> fp);
+
+	for (i = 0; i < n; i++) {
+		sim -> damage[i] = SIM_DAMAGE_NONE;
+		for (j = 0; j < sim -> bad_no; j++) {
+			if (lba + i >= sim -> bad_first[j] && lba + i <= sim -> bad_last[j])
+				sim -> damage[i] = SIM_DAMAGE_PERMANENT;
+		}
+		if (sim -> damage[i] == SIM_DAMAGE_NONE && sim -> error_rate > 0 && sim_rand (sim) % sim -> error_rate == 0) {
+			sim -> damage[i] = SIM_DAMAGE_TRANSIENT;
+			sim -> damage_pos[i] = (u_int16_t) (12 + sim_rand (sim) % SECTOR_SIZE);
+			sim -> injected++;
+		}
+	}
+
+	sim -> cache_lba = lba;
+	sim -> cache_len = n;
+	sim -> head = lba + n;
+	sim -> media_reads++;
+
+	return;
+}
+
+
+/* Applies the damage of a cached frame to a 2064-byte copy of it */
+static void sim_damage_frame (dvd_sim *sim, u_int32_t i, u_int8_t *frame) {
+	u_int32_t k;
+
+	if (sim -> damage[i] == SIM_DAMAGE_TRANSIENT) {
+		frame[sim -> damage_pos[i]] ^= 0xFF;
+	} else if (sim -> damage[i] == SIM_DAMAGE_PERMANENT) {
+		/* Everything but the ID is garbage: no row can be corrected with PI, and two such frames are too many for PO */
+		for (k = 12; k < RAW_SECTOR_SIZE; k++)
+			frame[k] ^= 0xA5;
+	}
+
+	return;
+}
+
+
+/**
+ * Gets a frame as seen in the drive memory.
+ * @param sim The simulated drive.
+ * @param idx The frame index, relative to memory offset 0.
+ * @param frame A buffer for the 2064-byte frame.
+ * @return The index of the frame in the cache, or -1 if the memory location does not hold a cached frame (in which case the frame will be zeroed).
+ */
+static int sim_get_frame (dvd_sim *sim, u_int32_t idx, u_int8_t *frame) {
+	int out;
+	u_int32_t lba;
+
+	lba = sim -> base_lba + idx;
+	if (lba >= sim -> cache_lba && lba < sim -> cache_lba + sim -> cache_len) {
+		out = lba - sim -> cache_lba;
+		memcpy (frame, sim -> cache + out * RAW_SECTOR_SIZE, RAW_SECTOR_SIZE);
+	} else {
+		out = -1;
+		memset (frame, 0, RAW_SECTOR_SIZE);
+	}
+
+	return (out);
+}
+
+
+/* Copies len bytes of the drive memory, seen as a sequence of 2064-byte frames, starting at offset */
+static void sim_read_mem_2064 (dvd_sim *sim, u_int32_t offset, u_int8_t *buf, u_int32_t len) {
+	u_int8_t frame[RAW_SECTOR_SIZE];
+	u_int32_t n, pos;
+	int i;
+
+	while (len > 0) {
+		pos = offset % RAW_SECTOR_SIZE;
+		n = RAW_SECTOR_SIZE - pos;
+		if (n > len)
+			n = len;
+		if ((i = sim_get_frame (sim, offset / RAW_SECTOR_SIZE, frame)) >= 0)
+			sim_damage_frame (sim, i, frame);
+		memcpy (buf, frame + pos, n);
+		buf += n;
+		offset += n;
+		len -= n;
+	}
+
+	return;
+}
+
+
+/* Gets the 2384-byte frame of a sector as recorded on the media, building its ECC block from the image if needed */
+static u_int8_t *sim_get_frame_2384 (dvd_sim *sim, u_int32_t lba) {
+	u_int8_t frame[RAW_SECTOR_SIZE];
+	u_int32_t first, i, row;
+
+	first = lba - lba % RAW2384_BLOCK_FRAMES;
+	if (first != sim -> ecc_block_lba) {
+		memset (sim -> ecc_block, 0, RAW2384_BLOCK_FRAMES * SIM_FRAME_2384_SIZE);
+		my_fseek (sim -> fp, (my_off_t) first * RAW_SECTOR_SIZE, SEEK_SET);
+		for (i = 0; i < RAW2384_BLOCK_FRAMES && fread (frame, RAW_SECTOR_SIZE, 1, sim -> fp) == 1; i++) {
+			for (row = 0; row < 12; row++)
+				memcpy (sim -> ecc_block + i * SIM_FRAME_2384_SIZE + row * 182, frame + row * 172, 172);
+		}
+		raw2384_add_parity (sim -> ecc_block);
+		sim -> ecc_block_lba = first;
+	}
+
+	return (sim -> ecc_block + (lba - first) * SIM_FRAME_2384_SIZE);
+}
+
+
+/* Same as above, but with 2384-byte frames: 12 rows of 172 data bytes plus 10 PI bytes each, followed by a PO row of the ECC block and 18 bytes
+   that are left blank */
+static void sim_read_mem_2384 (dvd_sim *sim, u_int32_t offset, u_int8_t *buf, u_int32_t len) {
+	u_int8_t frame[RAW_SECTOR_SIZE], frame_2384[SIM_FRAME_2384_SIZE];
+	u_int32_t n, pos, row;
+	int i;
+
+	while (len > 0) {
+		pos = offset % SIM_FRAME_2384_SIZE;
+		n = SIM_FRAME_2384_SIZE - pos;
+		if (n > len)
+			n = len;
+
+		memset (frame_2384, 0, sizeof (frame_2384));
+		if ((i = sim_get_frame (sim, offset / SIM_FRAME_2384_SIZE, frame)) >= 0) {
+			/* Parity is calculated on the block as recorded, then damage happens */
+			memcpy (frame_2384, sim_get_frame_2384 (sim, sim -> cache_lba + i), SIM_FRAME_2384_SIZE);
+			sim_damage_frame (sim, i, frame);
+			for (row = 0; row < 12; row++)
+				memcpy (frame_2384 + row * 182, frame + row * 172, 172);
+		}
+		memcpy (buf, frame_2384 + pos, n);
+		buf += n;
+		offset += n;
+		len -= n;
+	}
+
+	return;
+}
+
+
+static int sim_read_12 (dvd_sim *sim, mmc_command *mmc) {
+	u_int32_t lba, count, i, n;
+	u_int8_t frame[RAW_SECTOR_SIZE];
+	bool fua;
+	int out, j;
+
+	lba = (mmc -> cmd[2] << 24) | (mmc -> cmd[3] << 16) | (mmc -> cmd[4] << 8) | mmc -> cmd[5];
+	count = (mmc -> cmd[6] << 24) | (mmc -> cmd[7] << 16) | (mmc -> cmd[8] << 8) | mmc -> cmd[9];
+	fua = (mmc -> cmd[1] & 0x08) != 0;
+
+	if (lba >= sim -> sectors_no || lba + count > sim -> sectors_no) {
+		/* LOGICAL BLOCK ADDRESS OUT OF RANGE */
+		sim_set_sense (mmc, 0x05, 0x21, 0x00);
+		out = -1;
+	} else {
+		if (fua || lba < sim -> cache_lba || lba + count > sim -> cache_lba + sim -> cache_len || count == 0)
+			sim_load_cache (sim, lba);
+		sim -> base_lba = lba;
+
+		/* Return user data fields */
+		n = mmc -> buflen / SECTOR_SIZE;
+		if (n > count)
+			n = count;
+		for (i = 0; i < n; i++) {
+			if ((j = sim_get_frame (sim, i, frame)) >= 0)
+				sim_damage_frame (sim, j, frame);
+			memcpy (mmc -> buffer + i * SECTOR_SIZE, frame + 12, SECTOR_SIZE);
+		}
+		out = 0;
+	}
+
+	return (out);
+}
+
+
+/**
+ * Executes an MMC command on the simulated drive.
+ * @param sim The simulated drive.
+ * @param mmc The command to be executed.
+ * @return 0 if the command was executed successfully, < 0 otherwise (Sense data will be filled in).
+ */
+int dvd_sim_execute_cmd (dvd_sim *sim, mmc_command *mmc) {
+	u_int8_t *cmd;
+	u_int32_t addr, len;
+	int out;
+
+	sim -> commands++;
+	sim_sleep (sim -> cmd_latency);
+	sim_set_sense (mmc, 0, 0, 0);
+
+	cmd = mmc -> cmd;
+	out = 0;
+	switch (cmd[0]) {
+		case 0x12:		/* INQUIRY */
+			if (mmc -> buflen >= 36) {
+				memset (mmc -> buffer, ' ', 36);
+				mmc -> buffer[0] = 0x05;	/* CD/DVD device */
+				mmc -> buffer[4] = 31;
+				memcpy (mmc -> buffer + 8, sim_models[sim -> model].vendor, strlen (sim_models[sim -> model].vendor));
+				memcpy (mmc -> buffer + 16, sim_models[sim -> model].prod_id, strlen (sim_models[sim -> model].prod_id));
+				memcpy (mmc -> buffer + 32, "SIM1", 4);
+			}
+			break;
+		case 0xA8:		/* READ(12) */
+			out = sim_read_12 (sim, mmc);
+			break;
+		case 0x52:		/* READ TRACK INFORMATION */
+			if (mmc -> buflen >= 0x1C) {
+				mmc -> buffer[0x18] = (u_int8_t) (sim -> sectors_no >> 24);
+				mmc -> buffer[0x19] = (u_int8_t) (sim -> sectors_no >> 16);
+				mmc -> buffer[0x1A] = (u_int8_t) (sim -> sectors_no >> 8);
+				mmc -> buffer[0x1B] = (u_int8_t) sim -> sectors_no;
+			}
+			break;
+		case 0xAD:		/* READ DVD STRUCTURE */
+			if (mmc -> buflen >= 0x14 && sim -> layerbreak > 0) {
+				addr = sim -> layerbreak + 0x30000 - 1;		/* End sector of layer 0 */
+				mmc -> buffer[0x11] = (u_int8_t) (addr >> 16);
+				mmc -> buffer[0x12] = (u_int8_t) (addr >> 8);
+				mmc -> buffer[0x13] = (u_int8_t) addr;
+			}
+			break;
+		case 0xE7:		/* Hitachi memory dump */
+			addr = (cmd[6] << 24) | (cmd[7] << 16) | (cmd[8] << 8) | cmd[9];
+			len = (cmd[10] << 8) | cmd[11];
+			if (cmd[1] != 'H' || cmd[2] != 'I' || cmd[3] != 'T' || cmd[4] != 0x01 || addr < HITACHI_MEM_BASE || len > (u_int32_t) mmc -> buflen) {
+				sim_set_sense (mmc, 0x05, 0x24, 0x00);
+				out = -1;
+			} else {
+				sim_read_mem_2064 (sim, addr - HITACHI_MEM_BASE, mmc -> buffer, len);
+			}
+			break;
+		case 0x3C:		/* READ BUFFER */
+			if (cmd[1] == 0x05) {
+				/* Renesas */
+				addr = (cmd[2] << 24) | (cmd[3] << 16) | (cmd[4] << 8) | cmd[5];
+				len = (cmd[7] << 8) | cmd[8];
+			} else {
+				addr = (cmd[3] << 16) | (cmd[4] << 8) | cmd[5];
+				len = (cmd[6] << 16) | (cmd[7] << 8) | cmd[8];
+			}
+			if (len > (u_int32_t) mmc -> buflen) {
+				sim_set_sense (mmc, 0x05, 0x24, 0x00);
+				out = -1;
+			} else if ((cmd[1] == 0x01 && cmd[2] == 0x01) || (cmd[1] == 0x02 && sim_models[sim -> model].frames_2384)) {
+				sim_read_mem_2384 (sim, addr, mmc -> buffer, len);
+			} else if (cmd[1] == 0x02 || cmd[1] == 0x05) {
+				sim_read_mem_2064 (sim, addr, mmc -> buffer, len);
+			} else {
+				sim_set_sense (mmc, 0x05, 0x24, 0x00);
+				out = -1;
+			}
+			break;
+		case 0x1B:		/* START STOP UNIT */
+		case 0xBB:		/* SET CD SPEED */
+		case 0xB6:		/* SET STREAMING */
+			break;
+		default:
+			/* INVALID COMMAND OPERATION CODE */
+			sim_set_sense (mmc, 0x05, 0x20, 0x00);
+			out = -1;
+			break;
+	}
+
+	return (out);
+}
@@ -0,0 +1,38 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef DVD_SIM_H_INCLUDED
+#define DVD_SIM_H_INCLUDED
+
+#include "misc.h"
+#include <sys/types.h>
+#include "dvd_drive.h"
+
+/*! \brief Prefix of the device paths that select the simulated drive */
+#define DVD_SIM_PREFIX "sim:"
+
+typedef struct dvd_sim_s dvd_sim;
+
+dvd_sim *dvd_sim_new (char *spec);
+void *dvd_sim_destroy (dvd_sim *sim);
+int dvd_sim_execute_cmd (dvd_sim *sim, mmc_command *mmc);
+
+#endif
@@ -0,0 +1,422 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Reed-Solomon codes over GF(2^8), as used by the PI and PO parity of DVD ECC blocks.
+ *
+ * Both codes use the field generated by x^8 + x^4 + x^3 + x^2 + 1, with the generator polynomial roots starting at alpha^0. Checking a
+ * codeword is the common case, so it is done by dividing it by the generator polynomial with a table holding all the products of a byte by the
+ * polynomial: each byte then costs a lookup, a shift and a XOR, however many parity bytes there are. Syndromes, error locations and values are
+ * only computed for damaged codewords, with log/antilog tables.
+ */
+
+#include "misc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thread.h"
+#include "ecc.h"
+
+/*! \brief Primitive polynomial of the field */
+#define ECC_POLY 0x11D
+
+/*! \brief Number of non-zero elements of the field, and maximum codeword length */
+#define ECC_NN 255
+
+
+/*! \brief alpha^i, twice over so that the sum of two logarithms needs no reduction */
+static u_int8_t gf_exp[2 * ECC_NN];
+
+/*! \brief Logarithm of each non-zero element */
+static u_int8_t gf_log[ECC_NN + 1];
+
+/*! \brief gf_mul_root[i][x] = x * alpha^i */
+static u_int8_t gf_mul_root[ECC_MAX_ROOTS][ECC_NN + 1];
+
+/*! \brief ecc_rem[n][x] = x times the generator polynomial with n roots, leading term excluded, highest degree first in a 128-bit register */
+static u_int64_t ecc_rem[ECC_MAX_ROOTS + 1][ECC_NN + 1][2];
+
+/*! \brief Makes sure the tables are built only once */
+static my_once ecc_once = MY_ONCE_INIT;
+
+
+static inline u_int8_t gf_mul (u_int8_t a, u_int8_t b) {
+	return (a && b ? gf_exp[gf_log[a] + gf_log[b]] : 0);
+}
+
+
+/* b must not be 0 */
+static inline u_int8_t gf_div (u_int8_t a, u_int8_t b) {
+	return (a ? gf_exp[gf_log[a] + ECC_NN - gf_log[b]] : 0);
+}
+
+
+/* Evaluates p, of degree deg, in alpha^e */
+static u_int8_t gf_poly_eval (u_int8_t *p, u_int32_t deg, u_int32_t e) {
+	u_int32_t i, ie;
+	u_int8_t v;
+
+	v = 0;
+	for (i = 0, ie = 0; i <= deg; i++, ie = (ie + e) % ECC_NN) {
+		if (p[i])
+			v ^= gf_exp[gf_log[p[i]] + ie];
+	}
+
+	return (v);
+}
+
+
+/* gen(x) = (x - alpha^0) (x - alpha^1) ... (x - alpha^(nroots - 1)), gen[i] being the coefficient of x^i */
+static void ecc_gen_poly (u_int32_t nroots, u_int8_t *gen) {
+	u_int32_t i, j;
+
+	memset (gen, 0, ECC_MAX_ROOTS + 1);
+	gen[0] = 1;
+	for (i = 0; i < nroots; i++) {
+		for (j = i + 1; j > 0; j--)
+			gen[j] = gen[j - 1] ^ gf_mul_root[i][gen[j]];
+		gen[0] = gf_mul_root[i][gen[0]];
+	}
+
+	return;
+}
+
+
+static void ecc_build_tables (void) {
+	u_int8_t gen[ECC_MAX_ROOTS + 1];
+	u_int32_t i, n, x;
+	u_int64_t p;
+
+	for (i = 0, x = 1; i < ECC_NN; i++) {
+		gf_exp[i] = gf_exp[i + ECC_NN] = (u_int8_t) x;
+		gf_log[x] = (u_int8_t) i;
+		x <<= 1;
+		if (x & 0x100)
+			x ^= ECC_POLY;
+	}
+	gf_log[0] = 0;
+
+	for (i = 0; i < ECC_MAX_ROOTS; i++) {
+		for (x = 0; x <= ECC_NN; x++)
+			gf_mul_root[i][x] = gf_mul ((u_int8_t) x, gf_exp[i]);
+	}
+
+	for (n = 1; n <= ECC_MAX_ROOTS; n++) {
+		ecc_gen_poly (n, gen);
+		for (x = 0; x <= ECC_NN; x++) {
+			for (i = 0; i < n; i++) {
+				p = gf_mul ((u_int8_t) x, gen[n - 1 - i]);
+				ecc_rem[n][x][i / 8] |= p << (56 - 8 * (i % 8));
+			}
+		}
+	}
+
+	return;
+}
+
+
+/**
+ * Builds the field tables, if they were not built already. Must be called before codewords are handled from more threads.
+ */
+void ecc_init (void) {
+	my_once_run (&ecc_once, ecc_build_tables);
+
+	return;
+}
+
+
+/* Computes the remainder of data(x) * x^nroots divided by the generator polynomial, highest degree first. This is the parity of data, or 0 if
+   data is a whole codeword without errors. */
+static void ecc_remainder (u_int8_t *data, u_int32_t len, u_int32_t nroots, u_int64_t *rem) {
+	u_int64_t (*t)[2], hi, lo;
+	u_int32_t j;
+	u_int8_t fb;
+
+	t = ecc_rem[nroots];
+	hi = lo = 0;
+	for (j = 0; j < len; j++) {
+		fb = data[j] ^ (u_int8_t) (hi >> 56);
+		hi = ((hi << 8) | (lo >> 56)) ^ t[fb][0];
+		lo = (lo << 8) ^ t[fb][1];
+	}
+	rem[0] = hi;
+	rem[1] = lo;
+
+	return;
+}
+
+
+/* Computes the syndromes of a codeword, returning true if they are all 0 */
+static bool ecc_syndromes (u_int8_t *data, u_int32_t len, u_int32_t nroots, u_int8_t *s) {
+	u_int32_t i, j;
+	u_int8_t any;
+
+	memset (s, 0, nroots);
+	for (j = 0; j < len; j++) {
+		for (i = 0; i < nroots; i++)
+			s[i] = gf_mul_root[i][s[i]] ^ data[j];
+	}
+
+	for (i = 0, any = 0; i < nroots; i++)
+		any |= s[i];
+
+	return (any == 0);
+}
+
+
+/**
+ * Computes the parity bytes of a systematic codeword.
+ * @param data The data bytes.
+ * @param len The number of data bytes. The codeword will be len + nroots bytes long, which must not be more than 255.
+ * @param nroots The number of parity bytes, up to ECC_MAX_ROOTS.
+ * @param parity Where to place the parity bytes, which follow the data in the codeword.
+ */
+void ecc_encode (u_int8_t *data, u_int32_t len, u_int32_t nroots, u_int8_t *parity) {
+	u_int64_t rem[2];
+	u_int32_t i;
+
+	ecc_init ();
+	ecc_remainder (data, len, nroots, rem);
+	for (i = 0; i < nroots; i++)
+		parity[i] = (u_int8_t) (rem[i / 8] >> (56 - 8 * (i % 8)));
+
+	return;
+}
+
+
+/**
+ * Tells if a codeword is free of errors.
+ * @param data The codeword, data bytes followed by parity bytes.
+ * @param len The length of the codeword.
+ * @param nroots The number of parity bytes, up to ECC_MAX_ROOTS.
+ * @return True if the codeword is consistent with its parity.
+ */
+bool ecc_check (u_int8_t *data, u_int32_t len, u_int32_t nroots) {
+	u_int64_t rem[2];
+
+	ecc_init ();
+	ecc_remainder (data, len, nroots, rem);
+
+	return ((rem[0] | rem[1]) == 0);
+}
+
+
+/* One step of the division for each of four codewords, which are independent so that the lookups can overlap */
+#define ECC_STEP(k) \
+	fb = data[k * stride + j] ^ (u_int8_t) (hi[k] >> 56); \
+	hi[k] = ((hi[k] << 8) | (lo[k] >> 56)) ^ t[fb][0]; \
+	lo[k] = (lo[k] << 8) ^ t[fb][1];
+
+/**
+ * Tells which of a sequence of equally-spaced codewords have errors, such as the rows of a frame.
+ * @param data The first codeword.
+ * @param len The length of each codeword.
+ * @param nroots The number of parity bytes, up to ECC_MAX_ROOTS.
+ * @param stride The distance between the start of two codewords.
+ * @param rows The number of codewords, up to 32.
+ * @return A mask with bit i set if codeword i has errors.
+ */
+u_int32_t ecc_check_rows (u_int8_t *data, u_int32_t len, u_int32_t nroots, u_int32_t stride, u_int32_t rows) {
+	u_int64_t (*t)[2], hi[4], lo[4];
+	u_int32_t i, j, k, out;
+	u_int8_t fb;
+
+	ecc_init ();
+	t = ecc_rem[nroots];
+	out = 0;
+	for (i = 0; i + 4 <= rows; i += 4, data += 4 * stride) {
+		memset (hi, 0, sizeof (hi));
+		memset (lo, 0, sizeof (lo));
+		for (j = 0; j < len; j++) {
+			ECC_STEP (0);
+			ECC_STEP (1);
+			ECC_STEP (2);
+			ECC_STEP (3);
+		}
+		for (k = 0; k < 4; k++) {
+			if (hi[k] | lo[k])
+				out |= 1 << (i + k);
+		}
+	}
+	for (; i < rows; i++, data += stride) {
+		if (!ecc_check (data, len, nroots))
+			out |= 1 << i;
+	}
+
+	return (out);
+}
+
+
+/**
+ * Corrects errors and erasures in a codeword, which is left untouched if it cannot be corrected. Up to nroots erasures and e errors can be
+ * corrected, as long as erasures + 2 * e <= nroots.
+ * @param data The codeword, data bytes followed by parity bytes.
+ * @param len The length of the codeword, up to 255.
+ * @param nroots The number of parity bytes, up to ECC_MAX_ROOTS.
+ * @param eras_pos The positions of the bytes known to be wrong, or NULL.
+ * @param eras_no The number of such positions.
+ * @return The number of bytes corrected, or -1 if the codeword could not be corrected.
+ */
+int ecc_decode (u_int8_t *data, u_int32_t len, u_int32_t nroots, u_int32_t *eras_pos, u_int32_t eras_no) {
+	u_int8_t s[ECC_MAX_ROOTS], lambda[ECC_MAX_ROOTS + 1], b[ECC_MAX_ROOTS + 1], t[ECC_MAX_ROOTS + 1], omega[ECC_MAX_ROOTS];
+	u_int8_t err[ECC_MAX_ROOTS], d, num, den, x;
+	u_int32_t pos[ECC_MAX_ROOTS], i, j, k, r, el, deg, count, xinv;
+	int out;
+
+	if (ecc_check (data, len, nroots) || ecc_syndromes (data, len, nroots, s)) {
+		out = 0;
+	} else if (eras_no > nroots) {
+		out = -1;
+	} else {
+		/* Erasure locator, the product of (1 - X x) for each erased position, X being alpha^(len - 1 - position) */
+		memset (lambda, 0, sizeof (lambda));
+		lambda[0] = 1;
+		for (k = 0; k < eras_no; k++) {
+			x = gf_exp[(len - 1 - eras_pos[k]) % ECC_NN];
+			for (j = k + 1; j > 0; j--)
+				lambda[j] ^= gf_mul (x, lambda[j - 1]);
+		}
+		memcpy (b, lambda, sizeof (b));
+
+		/* Berlekamp-Massey, starting from the erasures */
+		el = eras_no;
+		for (r = eras_no + 1; r <= nroots; r++) {
+			for (i = 0, d = 0; i < r; i++)
+				d ^= gf_mul (lambda[i], s[r - i - 1]);
+			if (d == 0) {
+				memmove (b + 1, b, nroots);
+				b[0] = 0;
+			} else {
+				t[0] = lambda[0];
+				for (i = 0; i < nroots; i++)
+					t[i + 1] = lambda[i + 1] ^ gf_mul (d, b[i]);
+				if (2 * el <= r + eras_no - 1) {
+					el = r + eras_no - el;
+					for (i = 0; i <= nroots; i++)
+						b[i] = gf_div (lambda[i], d);
+				} else {
+					memmove (b + 1, b, nroots);
+					b[0] = 0;
+				}
+				memcpy (lambda, t, sizeof (lambda));
+			}
+		}
+		for (i = 0, deg = 0; i <= nroots; i++) {
+			if (lambda[i])
+				deg = i;
+		}
+
+		/* Chien search, limited to the positions of the (shortened) codeword: there must be as many roots as the degree of the locator */
+		count = 0;
+		for (j = 0; j < len && count < deg; j++) {
+			xinv = (ECC_NN - (len - 1 - j) % ECC_NN) % ECC_NN;
+			if (gf_poly_eval (lambda, deg, xinv) == 0)
+				pos[count++] = j;
+		}
+
+		if (deg == 0 || count != deg) {
+			out = -1;
+		} else {
+			/* omega(x) = s(x) lambda(x) mod x^nroots */
+			for (i = 0; i < nroots; i++) {
+				omega[i] = 0;
+				for (j = 0; j <= i && j <= deg; j++)
+					omega[i] ^= gf_mul (s[i - j], lambda[j]);
+			}
+
+			/* Forney: the error value is X omega(X^-1) / lambda'(X^-1), with the roots starting at alpha^0 */
+			out = (int) count;
+			for (k = 0; k < count && out >= 0; k++) {
+				xinv = (ECC_NN - (len - 1 - pos[k]) % ECC_NN) % ECC_NN;
+				num = gf_poly_eval (omega, nroots - 1, xinv);
+				for (i = 1, den = 0; i <= deg; i += 2) {
+					if (lambda[i])
+						den ^= gf_exp[gf_log[lambda[i]] + (xinv * (i - 1)) % ECC_NN];
+				}
+				if (den == 0)
+					out = -1;
+				else
+					err[k] = gf_mul (gf_exp[(len - 1 - pos[k]) % ECC_NN], gf_div (num, den));
+			}
+
+			if (out >= 0) {
+				for (k = 0; k < count; k++)
+					data[pos[k]] ^= err[k];
+			}
+		}
+	}
+
+	return (out);
+}
+
+
+/**
+ * Checks the decoder against random codewords with as many errors and erasures as can be corrected, and with one error too many.
+ * @param verbose If true, results will be printed to stdout.
+ * @return True if all tests passed, false otherwise.
+ */
+bool ecc_self_test (bool verbose) {
+	static const u_int32_t codes[][2] = { {182, 10}, {208, 16} };
+	u_int8_t cw[ECC_NN], ref[ECC_NN];
+	u_int32_t c, round, i, r, eras[ECC_MAX_ROOTS], eras_no, errors_no, len, nroots, p;
+	int ret;
+	bool out;
+
+	out = true;
+	r = 0x2468ACE1;
+	for (c = 0; c < sizeof (codes) / sizeof (codes[0]) && out; c++) {
+		len = codes[c][0];
+		nroots = codes[c][1];
+		if (verbose)
+			printf ("  Reed-Solomon (%u,%u): ", len, len - nroots);
+		for (round = 0; round < 1000 && out; round++) {
+			for (i = 0; i < len - nroots; i++) {
+				r = r * 1103515245 + 12345;
+				ref[i] = (u_int8_t) (r >> 16);
+			}
+			ecc_encode (ref, len - nroots, nroots, ref + len - nroots);
+			memcpy (cw, ref, len);
+			out = ecc_check (cw, len, nroots);
+
+			/* Damage distinct positions, the first ones being reported as erasures */
+			eras_no = round % (nroots + 1);
+			errors_no = (nroots - eras_no) / 2 + (round % 7 == 0 ? 1 : 0);
+			for (i = 0; i < eras_no + errors_no && i < len; i++) {
+				do {
+					r = r * 1103515245 + 12345;
+					p = (r >> 16) % len;
+				} while (cw[p] != ref[p]);
+				cw[p] ^= (u_int8_t) ((r >> 8) | 1);
+				if (i < eras_no)
+					eras[i] = p;
+			}
+			ret = ecc_decode (cw, len, nroots, eras, eras_no);
+			if (eras_no + 2 * errors_no <= nroots)
+				out = out && ret == (int) (eras_no + errors_no) && memcmp (cw, ref, len) == 0;
+			else
+				out = out && (ret < 0 || ecc_check (cw, len, nroots));
+		}
+		if (verbose)
+			printf (out ? "passed\n" : "failed\n");
+	}
+
+	return (out);
+}
@@ -0,0 +1,42 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Reed-Solomon codes over GF(2^8), as used by the PI and PO parity of DVD ECC blocks.
+ */
+
+#ifndef ECC_H_INCLUDED
+#define ECC_H_INCLUDED
+
+#include "misc.h"
+#include <sys/types.h>
+
+/*! \brief Maximum number of parity bytes of a codeword (PO has 16) */
+#define ECC_MAX_ROOTS 16
+
+void ecc_init (void);
+FRIIDUMPLIB_EXPORT void ecc_encode (u_int8_t *data, u_int32_t len, u_int32_t nroots, u_int8_t *parity);
+FRIIDUMPLIB_EXPORT int ecc_decode (u_int8_t *data, u_int32_t len, u_int32_t nroots, u_int32_t *eras_pos, u_int32_t eras_no);
+FRIIDUMPLIB_EXPORT bool ecc_check (u_int8_t *data, u_int32_t len, u_int32_t nroots);
+FRIIDUMPLIB_EXPORT u_int32_t ecc_check_rows (u_int8_t *data, u_int32_t len, u_int32_t nroots, u_int32_t stride, u_int32_t rows);
+FRIIDUMPLIB_EXPORT bool ecc_self_test (bool verbose);
+
+#endif
@@ -19,7 +19,10 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include "ecma-267.h"
+#include "cpu.h"
 
 /* EDC stuff */
 unsigned int edc_table[256] = {
@@ -57,16 +60,279 @@ unsigned int edc_table[256] = {
     0x80000A5F, 0x00000A4E, 0x00000A6C, 0x80000A7D, 0x00000A28, 0x80000A39, 0x80000A1B, 0x00000A0AL
 };
 
-u32 edc_calc(u32 edc, u8 *ptr, u32  len) {
+/*
+ * The EDC is a non-reflected CRC-32 with polynomial P = x^32+x^31+x^4+1 (the
+ * low part of which is edc_table[1]), no initial value and no final XOR.
+ *
+ * Besides the byte-at-a-time reference implementation, we have:
+ * - Slicing-by-8 and slicing-by-16 kernels, which process 8 or 16 bytes per
+ *   step with 8 or 16 lookup tables (edc_slice[k][b] is the EDC of byte b
+ *   followed by k zero bytes).
+ * - A kernel for x86 CPUs with carry-less multiplication, which folds four
+ *   128-bit lanes at a time: folding a 128-bit value A by n bits means
+ *   replacing A * x^n with Ahi * (x^(n+64) mod P) + Alo * (x^n mod P), which
+ *   leaves the remainder unchanged. The final 128 bits are then reduced with
+ *   the tables.
+ * The fastest kernel supported by the CPU is selected the first time an EDC
+ * is calculated, or when edc_init() is called. The latter must happen before
+ * EDCs are calculated from several threads.
+ */
+
+typedef u32 (*edc_func) (u32 edc, u8 *ptr, u32 len);
+
+static u32 edc_slice[16][256];
+
+static const char *edc_kernel_names[EDC_KERNELS] = {
+    "auto", "reference", "slice8", "slice16", "clmul"
+};
+
+static u32 edc_calc_first(u32 edc, u8 *ptr, u32 len);
+
+static edc_func edc_kernel_func = edc_calc_first;
+static edc_kernel edc_kernel_current = EDC_KERNEL_AUTO;
+
+u32 edc_calc_reference(u32 edc, u8 *ptr, u32 len) {
     while (len--) edc=edc_table[((edc>>24)^*ptr++)&0xFF]^(edc<<8);
     return edc;
 }
 
+static u32 edc_calc_slice8(u32 edc, u8 *ptr, u32 len) {
+    while (len >= 8) {
+        edc ^= (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
+        edc = edc_slice[7][edc >> 24] ^ edc_slice[6][(edc >> 16) & 0xFF] ^
+              edc_slice[5][(edc >> 8) & 0xFF] ^ edc_slice[4][edc & 0xFF] ^
+              edc_slice[3][ptr[4]] ^ edc_slice[2][ptr[5]] ^
+              edc_slice[1][ptr[6]] ^ edc_slice[0][ptr[7]];
+        ptr += 8;
+        len -= 8;
+    }
+    return edc_calc_reference(edc, ptr, len);
+}
+
+static u32 edc_calc_slice16(u32 edc, u8 *ptr, u32 len) {
+    while (len >= 16) {
+        edc ^= (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
+        edc = edc_slice[15][edc >> 24] ^ edc_slice[14][(edc >> 16) & 0xFF] ^
+              edc_slice[13][(edc >> 8) & 0xFF] ^ edc_slice[12][edc & 0xFF] ^
+              edc_slice[11][ptr[4]] ^ edc_slice[10][ptr[5]] ^
+              edc_slice[9][ptr[6]] ^ edc_slice[8][ptr[7]] ^
+              edc_slice[7][ptr[8]] ^ edc_slice[6][ptr[9]] ^
+              edc_slice[5][ptr[10]] ^ edc_slice[4][ptr[11]] ^
+              edc_slice[3][ptr[12]] ^ edc_slice[2][ptr[13]] ^
+              edc_slice[1][ptr[14]] ^ edc_slice[0][ptr[15]];
+        ptr += 16;
+        len -= 16;
+    }
+    return edc_calc_slice8(edc, ptr, len);
+}
+
+/* Returns x^n mod P */
+static u32 edc_xpow(u32 n) {
+    u32 r;
+
+    for (r = 1; n--; )
+        r = (r << 1) ^ ((r & 0x80000000) ? edc_table[1] : 0);
+    return r;
+}
+
+#ifdef CPU_X86_DISPATCH
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+
+static unsigned long long edc_k128[2], edc_k512[2];
+
+#define EDC_FOLD(x, k, d) _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), _mm_clmulepi64_si128(x, k, 0x00)), d)
+
+__attribute__((target("pclmul,ssse3")))
+static u32 edc_calc_clmul(u32 edc, u8 *ptr, u32 len) {
+    __m128i swap, k128, k512, x0, x1, x2, x3;
+    u8 tmp[16];
+
+    if (len < 64)
+        return edc_calc_slice16(edc, ptr, len);
+
+    /* Load data so that bit i of a 128-bit lane is the coefficient of x^i */
+    swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    k128 = _mm_set_epi64x(edc_k128[1], edc_k128[0]);
+    k512 = _mm_set_epi64x(edc_k512[1], edc_k512[0]);
+    x0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) ptr), swap);
+    x1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (ptr + 16)), swap);
+    x2 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (ptr + 32)), swap);
+    x3 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (ptr + 48)), swap);
+    x0 = _mm_xor_si128(x0, _mm_set_epi32(edc, 0, 0, 0));
+    ptr += 64;
+    len -= 64;
+
+    while (len >= 64) {
+        x0 = EDC_FOLD(x0, k512, _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) ptr), swap));
+        x1 = EDC_FOLD(x1, k512, _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (ptr + 16)), swap));
+        x2 = EDC_FOLD(x2, k512, _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (ptr + 32)), swap));
+        x3 = EDC_FOLD(x3, k512, _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (ptr + 48)), swap));
+        ptr += 64;
+        len -= 64;
+    }
+
+    x0 = EDC_FOLD(x0, k128, x1);
+    x0 = EDC_FOLD(x0, k128, x2);
+    x0 = EDC_FOLD(x0, k128, x3);
+    while (len >= 16) {
+        x0 = EDC_FOLD(x0, k128, _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) ptr), swap));
+        ptr += 16;
+        len -= 16;
+    }
+
+    _mm_storeu_si128((__m128i *) tmp, _mm_shuffle_epi8(x0, swap));
+    return edc_calc_slice16(edc_calc_slice16(0, tmp, sizeof (tmp)), ptr, len);
+}
+#endif
+
+/* Builds the tables used by the kernels. They do not depend on the kernel
+ * selected, so they are built whichever way the kernel gets selected */
+static void edc_init_tables(void) {
+    static int done = 0;
+    int i, k;
+
+    if (done)
+        return;
+
+    for (i = 0; i < 256; i++) {
+        edc_slice[0][i] = edc_table[i];
+        for (k = 1; k < 16; k++)
+            edc_slice[k][i] = (edc_slice[k - 1][i] << 8) ^ edc_table[edc_slice[k - 1][i] >> 24];
+    }
+#ifdef CPU_X86_DISPATCH
+    edc_k128[0] = edc_xpow(128);
+    edc_k128[1] = edc_xpow(128 + 64);
+    edc_k512[0] = edc_xpow(512);
+    edc_k512[1] = edc_xpow(512 + 64);
+#endif
+    done = 1;
+}
+
+void edc_init(void) {
+    edc_init_tables();
+    if (edc_kernel_current == EDC_KERNEL_AUTO)
+        edc_set_kernel(EDC_KERNEL_AUTO);
+}
+
+void edc_get_fold_constants(unsigned long long *k128, unsigned long long *k512) {
+    k128[0] = edc_xpow(128);
+    k128[1] = edc_xpow(128 + 64);
+    k512[0] = edc_xpow(512);
+    k512[1] = edc_xpow(512 + 64);
+}
+
+static u32 edc_calc_first(u32 edc, u8 *ptr, u32 len) {
+    edc_init();
+    return edc_kernel_func(edc, ptr, len);
+}
+
+int edc_set_kernel(edc_kernel k) {
+    u32 f;
+    int ret;
+
+    edc_init_tables();
+    f = cpu_get_features();
+    if (k == EDC_KERNEL_AUTO)
+        k = (f & CPU_FEATURE_PCLMUL) && (f & CPU_FEATURE_SSSE3) ? EDC_KERNEL_CLMUL : EDC_KERNEL_SLICE16;
+
+    ret = 0;
+    switch (k) {
+        case EDC_KERNEL_REFERENCE:
+            edc_kernel_func = edc_calc_reference;
+            break;
+        case EDC_KERNEL_SLICE8:
+            edc_kernel_func = edc_calc_slice8;
+            break;
+        case EDC_KERNEL_SLICE16:
+            edc_kernel_func = edc_calc_slice16;
+            break;
+#ifdef CPU_X86_DISPATCH
+        case EDC_KERNEL_CLMUL:
+            if ((f & CPU_FEATURE_PCLMUL) && (f & CPU_FEATURE_SSSE3))
+                edc_kernel_func = edc_calc_clmul;
+            else
+                ret = -1;
+            break;
+#endif
+        default:
+            ret = -1;
+            break;
+    }
+    if (ret == 0)
+        edc_kernel_current = k;
+
+    return ret;
+}
+
+edc_kernel edc_get_kernel(void) {
+    edc_init();
+    return edc_kernel_current;
+}
+
+const char *edc_kernel_name(edc_kernel k) {
+    return k < EDC_KERNELS ? edc_kernel_names[k] : "unknown";
+}
+
+u32 edc_calc(u32 edc, u8 *ptr, u32  len) {
+    return edc_kernel_func(edc, ptr, len);
+}
+
+/*
+ * Checkup routine: all the kernels supported by the CPU must agree with the
+ * reference implementation, on buffers of any length and alignment.
+ */
+int edc_self_test(int verbose) {
+    static const u32 lengths[] = {0, 1, 3, 15, 16, 17, 63, 64, 65, 127, 128, 200, 1000, 2060, 2064, 33008};
+    u8 *buf;
+    u32 i, j, n, r, edc, expected, got;
+    edc_kernel k, saved;
+    int ret;
+
+    edc_init();
+    saved = edc_kernel_current;
+
+    buf = (u8 *) malloc(33008 + 16);
+    for (i = 0, r = 0x12345678; i < 33008 + 16; i++) {
+        r = r * 1103515245 + 12345;
+        buf[i] = (u8) (r >> 16);
+    }
+
+    ret = 0;
+    for (k = EDC_KERNEL_REFERENCE + 1; k < EDC_KERNELS && ret == 0; k++) {
+        if (edc_set_kernel(k) < 0) {
+            if (verbose != 0)
+                printf("  EDC %s kernel: not supported\n", edc_kernel_name(k));
+            continue;
+        }
+        if (verbose != 0)
+            printf("  EDC %s kernel: ", edc_kernel_name(k));
+        for (i = 0; i < sizeof (lengths) / sizeof (lengths[0]) && ret == 0; i++) {
+            for (j = 0; j < 16 && ret == 0; j += 5) {
+                n = lengths[i];
+                edc = i * 0x9E3779B9 + j;
+                expected = edc_calc_reference(edc, buf + j, n);
+                got = edc_calc(edc, buf + j, n);
+                if (got != expected)
+                    ret = 1;
+            }
+        }
+        if (verbose != 0)
+            printf(ret == 0 ? "passed\n" : "failed\n");
+    }
+
+    free(buf);
+    edc_set_kernel(saved);
+
+    return ret;
+}
+
 /* end of EDC stuff */
 
 /* LFSR stuff */
 
-u16 ecma267_ivs[]= {
+static const u16 ecma267_ivs[]= {
     0x0001, 0x5500, 0x0002, 0x2A00,
     0x0004, 0x5400, 0x0008, 0x2800,
     0x0010, 0x5000, 0x0020, 0x2001,
@@ -74,36 +340,139 @@ u16 ecma267_ivs[]= {
 };
 
 
-unsigned short LFSR;
-
-void LFSR_ecma_init(int iv) {
-     LFSR=ecma267_ivs[iv];
+void LFSR_ecma_init(u16 *lfsr, int iv) {
+     *lfsr=ecma267_ivs[iv];
 }
 
-void LFSR_init(u16 seed) {
-     LFSR=seed;
+void LFSR_init(u16 *lfsr, u16 seed) {
+     *lfsr=seed;
 }
 
-int LFSR_tick() {
+int LFSR_tick(u16 *lfsr) {
     int ret;
     int n;
     
-    ret=LFSR>>14;
+    ret=*lfsr>>14;
     
-    n=ret^((LFSR>>10)&1);
-    LFSR=((LFSR<<1)|n)&0x7FFF;
+    n=ret^((*lfsr>>10)&1);
+    *lfsr=((*lfsr<<1)|n)&0x7FFF;
     
     return ret;
 }
 
-unsigned char LFSR_byte() {
+unsigned char LFSR_byte(u16 *lfsr) {
     u8 ret;
     int i;
     
     ret=0;
-    for(i=0; i<8; i++) ret=(ret<<1)|LFSR_tick();
+    for(i=0; i<8; i++) ret=(ret<<1)|LFSR_tick(lfsr);
     
     return ret;
 }
 
+/*
+ * Byte-parallel version of the above: the 8 bits shifted out by 8 ticks are
+ * bits 14-7 of the register, and the 8 bits shifted in only depend on bits
+ * 14-3, which are still there.
+ */
+void LFSR_stream(u16 seed, u8 *out, u32 len) {
+    u32 s;
+
+    s=seed&0x7FFF;
+    while (len--) {
+        *out++=(u8) (s>>7);
+        s=((s<<8)|(((s>>7)^(s>>3))&0xFF))&0x7FFF;
+    }
+}
+
+/*
+ * As both the LFSR and the EDC are linear over GF(2), the EDC of the
+ * keystream generated by a seed is the XOR of the EDCs of the keystreams
+ * generated by each bit of the seed. Moreover, the EDC of a scrambled sector
+ * is the EDC of the unscrambled sector XOR the EDC of the keystream, so a
+ * seed can be checked against a sector with a single comparison.
+ */
+static u32 LFSR_edc_table[0x8000];
+static int LFSR_edc_ready = 0;
+
+void LFSR_edc_init(void) {
+    u8 ks[LFSR_EDC_LENGTH];
+    u32 basis[15];
+    int i, j;
+
+    if (LFSR_edc_ready)
+        return;
+
+    for (i = 0; i < 15; i++) {
+        LFSR_stream(1 << i, ks, sizeof (ks));
+        basis[i] = edc_calc(0, ks, sizeof (ks));
+    }
+
+    /* Add one basis EDC per entry, clearing the lowest bit of the seed */
+    LFSR_edc_table[0] = 0;
+    for (j = 1; j < 0x8000; j++) {
+        for (i = 0; !(j & (1 << i)); i++)
+            ;
+        LFSR_edc_table[j] = LFSR_edc_table[j & (j - 1)] ^ basis[i];
+    }
+
+    LFSR_edc_ready = 1;
+}
+
+u32 LFSR_stream_edc(u16 seed) {
+    LFSR_edc_init();
+    return LFSR_edc_table[seed & 0x7FFF];
+}
+
+int LFSR_find_seed(u32 edc_diff) {
+    int j;
+
+    LFSR_edc_init();
+    for (j = 0; j < 0x7FFF; j++) {
+        if (LFSR_edc_table[j] == edc_diff)
+            return j;
+    }
+    return -1;
+}
+
+/*
+ * Checkup routine: the byte-parallel LFSR must match the bit-serial one, and
+ * the precomputed keystream EDCs must match the ones calculated directly.
+ */
+int LFSR_self_test(int verbose) {
+    u8 ks[LFSR_EDC_LENGTH];
+    u32 i, j, seed;
+    u16 lfsr;
+    int ret;
+
+    ret = 0;
+
+    if (verbose != 0)
+        printf("  LFSR byte-parallel stream: ");
+    for (i = 0, seed = 0; i < 64 && ret == 0; i++, seed = (seed * 0x2F1 + 0x3D) & 0x7FFF) {
+        LFSR_stream(seed, ks, sizeof (ks));
+        LFSR_init(&lfsr, seed);
+        for (j = 0; j < sizeof (ks) && ret == 0; j++) {
+            if (ks[j] != LFSR_byte(&lfsr))
+                ret = 1;
+        }
+    }
+    if (verbose != 0)
+        printf(ret == 0 ? "passed\n" : "failed\n");
+
+    if (ret == 0) {
+        if (verbose != 0)
+            printf("  LFSR keystream EDC table: ");
+        for (i = 0, seed = 0x7FFE; i < 64 && ret == 0; i++, seed = (seed * 0x2F1 + 0x3D) % 0x7FFF) {
+            LFSR_stream(seed, ks, sizeof (ks));
+            if (LFSR_stream_edc(seed) != edc_calc(0, ks, sizeof (ks)) || LFSR_find_seed(LFSR_stream_edc(seed)) != (int) seed)
+                ret = 1;
+        }
+        if (verbose != 0)
+            printf(ret == 0 ? "passed\n" : "failed\n");
+    }
+
+    return ret;
+}
+
 /* end of LFSR stuff */
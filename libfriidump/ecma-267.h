@@ -30,18 +30,57 @@ typedef char s8;
 
 /* EDC stuff */
 
+typedef enum {
+    EDC_KERNEL_AUTO,
+    EDC_KERNEL_REFERENCE,
+    EDC_KERNEL_SLICE8,
+    EDC_KERNEL_SLICE16,
+    EDC_KERNEL_CLMUL,
+    EDC_KERNELS
+} edc_kernel;
+
+void edc_init(void);
+
 u32 edc_calc(u32 edc, u8 *ptr, u32  len);
+
+u32 edc_calc_reference(u32 edc, u8 *ptr, u32 len);
+
+int edc_set_kernel(edc_kernel k);
+
+edc_kernel edc_get_kernel(void);
+
+const char *edc_kernel_name(edc_kernel k);
+
+/* Constants to fold 128-bit lanes by 128 and 512 bits, low word first */
+void edc_get_fold_constants(unsigned long long *k128, unsigned long long *k512);
+
+int edc_self_test(int verbose);
  
 /* end of EDC stuff */
 
 /* LFSR stuff */
 
-void LFSR_ecma_init(int iv);
+/* The state of the bit-serial LFSR is kept by the caller, so that several
+ * of them can run at the same time */
+void LFSR_ecma_init(u16 *lfsr, int iv);
+
+void LFSR_init(u16 *lfsr, u16 seed);
+
+int LFSR_tick(u16 *lfsr);
+
+u8 LFSR_byte(u16 *lfsr);
+
+/* Length of the keystream that is XOR'ed to every sector */
+#define LFSR_EDC_LENGTH 2048
+
+void LFSR_stream(u16 seed, u8 *out, u32 len);
+
+void LFSR_edc_init(void);
 
-void LFSR_init(u16 seed);
+u32 LFSR_stream_edc(u16 seed);
 
-int LFSR_tick();
+int LFSR_find_seed(u32 edc_diff);
 
-u8 LFSR_byte();
+int LFSR_self_test(int verbose);
 
 /* end of LFSR stuff */
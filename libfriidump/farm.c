@@ -0,0 +1,427 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Concurrent dumping of the discs inserted in several drives, sharing CPU and output bandwidth.
+ *
+ * Every drive of a farm runs its job in a thread of its own, so that slow drives do not hold up the others. Jobs share two resources: a pool of
+ * CPU slots, that unscrambling and hashing must hold while they run, so that a rack of drives does not start more CPU-bound work than there
+ * are CPUs, and the total output bandwidth, which writes are scheduled against so that the output disk is not swamped.
+ */
+
+#include "misc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thread.h"
+#include "dvd_drive.h"
+#include "farm.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+/*! \brief How often farm_run() checks if jobs have terminated, in microseconds */
+#define FARM_POLL_INTERVAL 100000
+
+/*! \brief How often farm_run() calls the status function, in microseconds */
+#define FARM_STATUS_INTERVAL 1000000
+
+
+/*! \brief A drive of a farm.
+ */
+typedef struct {
+	farm *f;
+	u_int32_t index;
+	char *device;				//!< The device, as passed to dvd_drive_new().
+	char *model;				//!< The drive model string.
+	farm_drive_state state;
+	u_int32_t current_sector;		//!< Progress of the job, as reported with farm_set_progress().
+	u_int32_t total_sectors;
+	farm_job_func job;
+	void *job_data;
+	my_thread thread;
+} farm_drive;
+
+
+/*! \brief A structure that represents a farm of drives.
+ */
+struct farm_s {
+	farm_drive drives[FARM_MAX_DRIVES];
+	u_int32_t drives_no;
+	u_int32_t running;			//!< Number of jobs that have not terminated yet.
+	my_mutex lock;
+	my_cond cond;
+
+	/* CPU pool */
+	u_int32_t cpu_slots;			//!< Number of CPU-bound tasks that can run at the same time.
+	u_int32_t cpu_busy;			//!< Number of CPU slots in use.
+
+	/* Output bandwidth */
+	u_int64_t bandwidth;			//!< Total output bandwidth, in bytes per second, or 0 for no limit.
+	u_int64_t write_next;			//!< The time the next write can take place at.
+
+	char **claimed;				//!< The output files claimed by the jobs.
+	u_int32_t claimed_no;
+};
+
+
+/**
+ * Creates a new structure representing a farm of drives. No drive is part of it at first, see farm_add_drive() and farm_discover_drives().
+ * @param cpu_slots The number of CPU-bound tasks that can run at the same time, or 0 for as many as there are CPUs.
+ * @param bandwidth The total output bandwidth, in MB/s, or 0 for no limit.
+ * @return The newly-created structure, to be used with the other commands.
+ */
+farm *farm_new (u_int32_t cpu_slots, u_int32_t bandwidth) {
+	farm *f;
+
+	f = (farm *) malloc (sizeof (farm));
+	memset (f, 0, sizeof (farm));
+	my_mutex_init (&(f -> lock));
+	my_cond_init (&(f -> cond));
+	f -> cpu_slots = cpu_slots > 0 ? cpu_slots : my_cpu_count ();
+	f -> bandwidth = (u_int64_t) bandwidth * 1024 * 1024;
+
+	return (f);
+}
+
+
+/**
+ * Frees resources used by a farm structure and destroys it. No job must be running.
+ * @param f The farm structure.
+ * @return NULL.
+ */
+void *farm_destroy (farm *f) {
+	u_int32_t i;
+
+	for (i = 0; i < f -> drives_no; i++) {
+		my_free (f -> drives[i].device);
+		my_free (f -> drives[i].model);
+	}
+	for (i = 0; i < f -> claimed_no; i++)
+		my_free (f -> claimed[i]);
+	my_free (f -> claimed);
+	my_cond_destroy (&(f -> cond));
+	my_mutex_destroy (&(f -> lock));
+	my_free (f);
+
+	return (NULL);
+}
+
+
+/**
+ * Adds a drive to the farm, if it is supported.
+ * @param f The farm structure.
+ * @param device The device, in OS-dependent format or as a simulated drive.
+ * @return True if the drive was added.
+ */
+bool farm_add_drive (farm *f, char *device) {
+	dvd_drive *dvd;
+	farm_drive *fd;
+	bool out;
+
+	out = false;
+	if (f -> drives_no >= FARM_MAX_DRIVES) {
+		error ("Too many drives, \"%s\" ignored", device);
+	} else if (!(dvd = dvd_drive_new (device, -1))) {
+		debug ("Cannot open drive \"%s\"", device);
+	} else {
+		if (!dvd_get_support_status (dvd)) {
+			warning ("Drive \"%s\" (%s) is not supported, ignored", device, dvd_get_model_string (dvd));
+		} else {
+			fd = &(f -> drives[f -> drives_no]);
+			memset (fd, 0, sizeof (farm_drive));
+			fd -> f = f;
+			fd -> index = f -> drives_no;
+			my_strdup (fd -> device, device);
+			my_strdup (fd -> model, dvd_get_model_string (dvd));
+			fd -> state = FARM_DRIVE_IDLE;
+			f -> drives_no++;
+			out = true;
+		}
+		dvd_drive_destroy (dvd);
+	}
+
+	return (out);
+}
+
+
+/**
+ * Looks for supported drives attached to the system and adds them to the farm.
+ * @param f The farm structure.
+ * @return The number of drives that were added.
+ */
+u_int32_t farm_discover_drives (farm *f) {
+	char device[32];
+	u_int32_t i, out;
+#ifdef WIN32
+	char root[4];
+#endif
+
+	out = 0;
+#ifdef WIN32
+	for (i = 'C'; i <= 'Z'; i++) {
+		snprintf (root, sizeof (root), "%c:\\", i);
+		if (GetDriveType (root) == DRIVE_CDROM) {
+			snprintf (device, sizeof (device), "%c:", i);
+			if (farm_add_drive (f, device))
+				out++;
+		}
+	}
+#else
+	for (i = 0; i < FARM_MAX_DRIVES; i++) {
+		snprintf (device, sizeof (device), "/dev/sr%u", i);
+		if (access (device, F_OK) == 0 && farm_add_drive (f, device))
+			out++;
+	}
+#endif
+
+	return (out);
+}
+
+
+static void *farm_drive_thread (void *arg) {
+	farm_drive *fd;
+	farm *f;
+	bool ok;
+
+	fd = (farm_drive *) arg;
+	f = fd -> f;
+	ok = fd -> job (f, fd -> index, fd -> device, fd -> job_data);
+
+	my_mutex_lock (&(f -> lock));
+	fd -> state = ok ? FARM_DRIVE_DONE : FARM_DRIVE_FAILED;
+	f -> running--;
+	my_mutex_unlock (&(f -> lock));
+
+	return (NULL);
+}
+
+
+/**
+ * Runs a job on every drive of the farm, concurrently, and waits for all of them to terminate.
+ * @param f The farm structure.
+ * @param job The function running the job.
+ * @param job_data Data passed to <code>job</code>.
+ * @param status A function that is called periodically while jobs are running (Can be NULL).
+ * @param status_data Data passed to <code>status</code>.
+ * @return The number of jobs that completed successfully.
+ */
+u_int32_t farm_run (farm *f, farm_job_func job, void *job_data, farm_status_func status, void *status_data) {
+	farm_drive *fd;
+	u_int32_t i, running, out;
+	u_int64_t last_status;
+	bool started[FARM_MAX_DRIVES];
+
+	for (i = 0; i < f -> drives_no; i++) {
+		fd = &(f -> drives[i]);
+		fd -> job = job;
+		fd -> job_data = job_data;
+		fd -> current_sector = 0;
+		fd -> total_sectors = 0;
+
+		my_mutex_lock (&(f -> lock));
+		fd -> state = FARM_DRIVE_RUNNING;
+		f -> running++;
+		my_mutex_unlock (&(f -> lock));
+
+		if (!(started[i] = my_thread_create (&(fd -> thread), farm_drive_thread, fd))) {
+			my_mutex_lock (&(f -> lock));
+			fd -> state = FARM_DRIVE_FAILED;
+			f -> running--;
+			my_mutex_unlock (&(f -> lock));
+		}
+	}
+
+	last_status = my_time_usec ();
+	do {
+		my_sleep_usec (FARM_POLL_INTERVAL);
+		my_mutex_lock (&(f -> lock));
+		running = f -> running;
+		my_mutex_unlock (&(f -> lock));
+
+		if (status && running > 0 && my_time_usec () - last_status >= FARM_STATUS_INTERVAL) {
+			status (f, status_data);
+			last_status = my_time_usec ();
+		}
+	} while (running > 0);
+
+	for (i = 0, out = 0; i < f -> drives_no; i++) {
+		if (started[i])
+			my_thread_join (f -> drives[i].thread);
+		if (f -> drives[i].state == FARM_DRIVE_DONE)
+			out++;
+	}
+	if (status)
+		status (f, status_data);
+
+	return (out);
+}
+
+
+/**
+ * Reserves the name of an output file for a job, so that two jobs (i.e.: dumping two copies of the same game) do not write to the same file.
+ * @param f The farm structure.
+ * @param filename The file name.
+ * @return True if the name was reserved, false if another job is using it.
+ */
+bool farm_claim_file (farm *f, char *filename) {
+	char **p;
+	u_int32_t i;
+	bool out;
+
+	my_mutex_lock (&(f -> lock));
+	for (i = 0, out = true; i < f -> claimed_no && out; i++) {
+		if (strcmp (f -> claimed[i], filename) == 0)
+			out = false;
+	}
+	if (out) {
+		if ((p = (char **) realloc (f -> claimed, (f -> claimed_no + 1) * sizeof (char *)))) {
+			f -> claimed = p;
+			my_strdup (f -> claimed[f -> claimed_no], filename);
+			f -> claimed_no++;
+		} else {
+			out = false;
+		}
+	}
+	my_mutex_unlock (&(f -> lock));
+
+	return (out);
+}
+
+
+/**
+ * Records the progress of the job of a drive, to be retrieved with farm_get_progress(). Can be used as (part of) a dumper progress callback.
+ * @param f The farm structure.
+ * @param drive The drive.
+ * @param current_sector The number of sectors that have been processed.
+ * @param total_sectors The total number of sectors.
+ */
+void farm_set_progress (farm *f, u_int32_t drive, u_int32_t current_sector, u_int32_t total_sectors) {
+	my_mutex_lock (&(f -> lock));
+	f -> drives[drive].current_sector = current_sector;
+	f -> drives[drive].total_sectors = total_sectors;
+	my_mutex_unlock (&(f -> lock));
+
+	return;
+}
+
+
+/**
+ * Waits for a CPU slot to be free and takes it. Must be paired with farm_cpu_release().
+ * @param f The farm structure.
+ */
+void farm_cpu_acquire (farm *f) {
+	my_mutex_lock (&(f -> lock));
+	while (f -> cpu_busy >= f -> cpu_slots)
+		my_cond_wait (&(f -> cond), &(f -> lock));
+	f -> cpu_busy++;
+	my_mutex_unlock (&(f -> lock));
+
+	return;
+}
+
+
+/**
+ * Gives back a CPU slot taken with farm_cpu_acquire().
+ * @param f The farm structure.
+ */
+void farm_cpu_release (farm *f) {
+	my_mutex_lock (&(f -> lock));
+	MY_ASSERT (f -> cpu_busy > 0);
+	f -> cpu_busy--;
+	my_cond_signal (&(f -> cond));
+	my_mutex_unlock (&(f -> lock));
+
+	return;
+}
+
+
+/**
+ * Waits until some data can be written without exceeding the output bandwidth of the farm. Writes are scheduled one after the other, each
+ * one taking the time its size requires at the configured bandwidth.
+ * @param f The farm structure.
+ * @param bytes The size of the data about to be written.
+ */
+void farm_throttle_write (farm *f, u_int32_t bytes) {
+	u_int64_t now, wait;
+
+	if (f -> bandwidth > 0) {
+		my_mutex_lock (&(f -> lock));
+		now = my_time_usec ();
+		if (f -> write_next < now)
+			f -> write_next = now;
+		wait = f -> write_next - now;
+		f -> write_next += (u_int64_t) bytes * 1000000 / f -> bandwidth;
+		my_mutex_unlock (&(f -> lock));
+
+		if (wait > 0)
+			my_sleep_usec (wait);
+	}
+
+	return;
+}
+
+
+u_int32_t farm_get_drives_no (farm *f) {
+	return (f -> drives_no);
+}
+
+
+char *farm_get_device (farm *f, u_int32_t drive) {
+	return (f -> drives[drive].device);
+}
+
+
+char *farm_get_model (farm *f, u_int32_t drive) {
+	return (f -> drives[drive].model);
+}
+
+
+/**
+ * Retrieves the state and progress of the job of a drive.
+ * @param f The farm structure.
+ * @param drive The drive.
+ * @param current_sector Will be set to the number of sectors that have been processed (Can be NULL).
+ * @param total_sectors Will be set to the total number of sectors, or 0 if the job has not reported any progress yet (Can be NULL).
+ * @return The state of the drive.
+ */
+farm_drive_state farm_get_progress (farm *f, u_int32_t drive, u_int32_t *current_sector, u_int32_t *total_sectors) {
+	farm_drive_state out;
+
+	my_mutex_lock (&(f -> lock));
+	out = f -> drives[drive].state;
+	if (current_sector)
+		*current_sector = f -> drives[drive].current_sector;
+	if (total_sectors)
+		*total_sectors = f -> drives[drive].total_sectors;
+	my_mutex_unlock (&(f -> lock));
+
+	return (out);
+}
+
+
+u_int32_t farm_get_cpu_slots (farm *f) {
+	return (f -> cpu_slots);
+}
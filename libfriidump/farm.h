@@ -0,0 +1,80 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Concurrent dumping of the discs inserted in several drives, sharing CPU and output bandwidth.
+ */
+
+#ifndef FARM_H_INCLUDED
+#define FARM_H_INCLUDED
+
+#include "misc.h"
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief Maximum number of drives in a farm */
+#define FARM_MAX_DRIVES 32
+
+typedef struct farm_s farm;
+
+/*! \brief The state of a drive of a farm.
+ */
+typedef enum {
+	FARM_DRIVE_IDLE,		//!< No job was started on the drive, yet.
+	FARM_DRIVE_RUNNING,		//!< A job is running on the drive.
+	FARM_DRIVE_DONE,		//!< The job completed successfully.
+	FARM_DRIVE_FAILED		//!< The job failed.
+} farm_drive_state;
+
+/* Runs the job of a drive, in a thread of its own. Must return true if the job completed successfully */
+typedef bool (*farm_job_func) (farm *f, u_int32_t drive, char *device, void *job_data);
+
+/* Called periodically by farm_run() in the calling thread, while jobs are running, and once more when all of them have terminated */
+typedef void (*farm_status_func) (farm *f, void *status_data);
+
+FRIIDUMPLIB_EXPORT farm *farm_new (u_int32_t cpu_slots, u_int32_t bandwidth);
+FRIIDUMPLIB_EXPORT void *farm_destroy (farm *f);
+FRIIDUMPLIB_EXPORT bool farm_add_drive (farm *f, char *device);
+FRIIDUMPLIB_EXPORT u_int32_t farm_discover_drives (farm *f);
+FRIIDUMPLIB_EXPORT u_int32_t farm_run (farm *f, farm_job_func job, void *job_data, farm_status_func status, void *status_data);
+FRIIDUMPLIB_EXPORT bool farm_claim_file (farm *f, char *filename);
+FRIIDUMPLIB_EXPORT void farm_set_progress (farm *f, u_int32_t drive, u_int32_t current_sector, u_int32_t total_sectors);
+
+/* Getters */
+FRIIDUMPLIB_EXPORT u_int32_t farm_get_drives_no (farm *f);
+FRIIDUMPLIB_EXPORT char *farm_get_device (farm *f, u_int32_t drive);
+FRIIDUMPLIB_EXPORT char *farm_get_model (farm *f, u_int32_t drive);
+FRIIDUMPLIB_EXPORT farm_drive_state farm_get_progress (farm *f, u_int32_t drive, u_int32_t *current_sector, u_int32_t *total_sectors);
+FRIIDUMPLIB_EXPORT u_int32_t farm_get_cpu_slots (farm *f);
+
+/* The following are exported for use by the disc and the dumper */
+void farm_cpu_acquire (farm *f);
+void farm_cpu_release (farm *f);
+void farm_throttle_write (farm *f, u_int32_t bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -33,6 +33,7 @@
 #include <sys/types.h>
 #include "misc.h"
 #include "dvd_drive.h"
+#include "constants.h"
 
 /*! \brief Memory offset at which the drive cache memory is mapped.
  *
@@ -42,6 +43,40 @@
 #define HITACHI_MEM_BASE 0x80000000
 
 
+/*! \brief The Hitachi command dumps up to 64 KB of memory as-is, from anywhere in the address space above the cache start.
+ */
+const dvd_memdump_caps hitachi_dvd_memdump_caps = {
+	65535,
+	1,
+	0xFFFFFFFF - HITACHI_MEM_BASE
+};
+
+
+/**
+ * Prepares the command that dumps a single block of the address space of the MN103 microcontroller, without executing it.
+ * @param mmc The command to prepare.
+ * @param offset The absolute memory offset to start dumping.
+ * @param block_size The block size for the dump.
+ * @param buf Where to place the dumped data.
+ */
+static void hitachi_dvd_init_memblock (mmc_command *mmc, u_int32_t offset, u_int32_t block_size, u_int8_t *buf) {
+	dvd_init_command (mmc, buf, block_size, NULL);
+	mmc -> cmd[0] = 0xE7; // vendor specific command (discovered by DaveX)
+	mmc -> cmd[1] = 0x48; // H
+	mmc -> cmd[2] = 0x49; // I
+	mmc -> cmd[3] = 0x54; // T
+	mmc -> cmd[4] = 0x01; // read MCU memory sub-command
+	mmc -> cmd[6] = (unsigned char) ((offset & 0xFF000000) >> 24);	// address MSB
+	mmc -> cmd[7] = (unsigned char) ((offset & 0x00FF0000) >> 16);	// address
+	mmc -> cmd[8] = (unsigned char) ((offset & 0x0000FF00) >> 8);	// address
+	mmc -> cmd[9] = (unsigned char) (offset & 0x000000FF);		// address LSB
+	mmc -> cmd[10] = (unsigned char) ((block_size & 0xFF00) >> 8);	// length MSB
+	mmc -> cmd[11] = (unsigned char) (block_size & 0x00FF);		// length LSB
+
+	return;
+}
+
+
 /**
  * Dumps a single block (with arbitrary size) of the address space of the MN103 microcontroller within the Hitachi-LG Xbox 360 DVD drive and similar drives.
  * This function is derived from the work of Kevin East (SeventhSon), kev@kev.nu, http://www.kev.nu/360/.
@@ -62,19 +97,7 @@ int hitachi_dvd_dump_memblock (dvd_drive *dvd, u_int32_t offset, u_int32_t block
 		error ("invalid block_size (valid: 1 - 65535)");
 		out = -2;
 	} else {
-		dvd_init_command (&mmc, buf, block_size, NULL);
-		mmc.cmd[0] = 0xE7; // vendor specific command (discovered by DaveX)
-		mmc.cmd[1] = 0x48; // H
-		mmc.cmd[2] = 0x49; // I
-		mmc.cmd[3] = 0x54; // T
-		mmc.cmd[4] = 0x01; // read MCU memory sub-command
-		mmc.cmd[6] = (unsigned char) ((offset & 0xFF000000) >> 24);	// address MSB
-		mmc.cmd[7] = (unsigned char) ((offset & 0x00FF0000) >> 16);	// address
-		mmc.cmd[8] = (unsigned char) ((offset & 0x0000FF00) >> 8);	// address
-		mmc.cmd[9] = (unsigned char) (offset & 0x000000FF);		// address LSB
-		mmc.cmd[10] = (unsigned char) ((block_size & 0xFF00) >> 8);	// length MSB
-		mmc.cmd[11] = (unsigned char) (block_size & 0x00FF);		// length LSB
-
+		hitachi_dvd_init_memblock (&mmc, offset, block_size, buf);
 		out = dvd_execute_cmd (dvd, &mmc, false);
 	}
 
@@ -145,3 +168,18 @@ int hitachi_dvd_dump_mem (dvd_drive *dvd, u_int32_t offset, u_int32_t block_len,
 
 	return (out);
 }
+
+
+/**
+ * Prepares the command that dumps a single block of the sector cache, so that it can be queued with dvd_submit(). As the Hitachi command returns
+ * memory as-is, no post-processing is needed once it completes.
+ * @param mmc The command to prepare.
+ * @param offset The memory offset to start dumping, relative to the cache start offset.
+ * @param block_size The block size for the dump (1 - 65535).
+ * @param buf Where to place the dumped data.
+ */
+void hitachi_dvd_memdump_cmd (mmc_command *mmc, u_int32_t offset, u_int32_t block_size, u_int8_t *buf) {
+	hitachi_dvd_init_memblock (mmc, HITACHI_MEM_BASE + offset, block_size, buf);
+
+	return;
+}
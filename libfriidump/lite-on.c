@@ -19,11 +19,12 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
-#include "rs.h"
 #include <stdio.h>
 #include <sys/types.h>
 #include "misc.h"
 #include "dvd_drive.h"
+#include "constants.h"
+#include "raw2384.h"
 
 /**
  * Command found in Lite-On LH-18A1H; verified with LH-18A1P and LH-20A1H
@@ -37,28 +38,29 @@
 
 //u_int8_t  tmp[64*1024];
 
+/*! \brief The command dumps whole 2384-byte frames, up to 27 at a time (Less than 64 KB), from a 24-bit address.
+ */
+const dvd_memdump_caps liteon_dvd_memdump_caps = {
+	27 * RAW_SECTOR_SIZE,
+	RAW_SECTOR_SIZE,
+	0x1000000 / 0x950 * RAW_SECTOR_SIZE
+};
+
 /**
+ * Dumps 2384-byte frames as they are stored in the drive memory, without correcting or converting them, so that ECC blocks split over several
+ * dumps can be corrected as a whole.
  * @param dvd The DVD drive the command should be exectued on.
- * @param offset The absolute memory offset to start dumping.
- * @param block_size The block size for the dump.
- * @param buf Where to place the dumped data. This must have been setup by the caller to store up to block_size bytes.
+ * @param offset The absolute memory offset to start dumping, counting 2064 bytes per frame as for liteon_dvd_dump_memblock().
+ * @param block_size The block size for the dump, counting 2064 bytes per frame.
+ * @param buf Where to place the dumped frames. This must have been setup by the caller to store up to (block_size / 2064) * 2384 bytes.
  * @return < 0 if an error occurred, 0 otherwise.
  */
-int liteon_dvd_dump_memblock (dvd_drive *dvd, u_int32_t offset, u_int32_t block_size, u_int8_t *buf) {
+int liteon_dvd_dump_frames (dvd_drive *dvd, u_int32_t offset, u_int32_t block_size, u_int8_t *buf) {
 	mmc_command mmc;
 	int out;
 	u_int32_t raw_block_size;
 	u_int32_t raw_offset;
 
-	u_int32_t src_offset;
-	u_int32_t dst_offset;
-	u_int32_t row_nr;
-	u_int32_t sec_nr;
-	u_int32_t sec_cnt;
-	u_int32_t first_sec_nr;
-	u_int8_t  tmp[64*1024];
-	//u_int8_t  *tmp;
-
 	raw_block_size = (block_size / 2064) * 0x950;
 	raw_offset = (offset / 2064) * 0x950;
 
@@ -70,8 +72,7 @@ int liteon_dvd_dump_memblock (dvd_drive *dvd, u_int32_t offset, u_int32_t block_
 		error ("raw_block_size = (block_size / 2064) * 2384");
 		out = -2;
 	} else {
-		//tmp = malloc(64*1024);
-		dvd_init_command (&mmc, tmp, raw_block_size, NULL); //64*1024
+		dvd_init_command (&mmc, buf, raw_block_size, NULL); //64*1024
 		mmc.cmd[0]  = 0x3C; // READ BUFFER
 		mmc.cmd[1]  = 0x01; // Vendor specific - sole parameter supported by Lite-On
 		mmc.cmd[2]  = 0x01; // == 0x02; 0xE2 = EEPROM; 0xF1 = KEYPARA;
@@ -83,40 +84,34 @@ int liteon_dvd_dump_memblock (dvd_drive *dvd, u_int32_t offset, u_int32_t block_
 		mmc.cmd[8]  = (unsigned char) ( raw_block_size & 0x000000FF);		// length  LSB
 
 		out = dvd_execute_cmd (dvd, &mmc, false);
+	}
+	return (out);
+}
 
-		src_offset   = 0;
-		dst_offset   = 0;
-		first_sec_nr = 0x55555555;
-		sec_cnt      = 0;
-		while (src_offset < raw_block_size) {
-			sec_nr=(*(tmp+src_offset+1)<<16)+(*(tmp+src_offset+2)<<8)+(*(tmp+src_offset+3));
-//fprintf (stdout,"sec_nr: %x\n", sec_nr);
-			if (first_sec_nr==0x55555555) {
-				first_sec_nr=sec_nr;
-				rs_decode(tmp+src_offset, 0, 0);
-			}
-			else
-				if (sec_nr==first_sec_nr+sec_cnt) {
-					rs_decode(tmp+src_offset, 0, 0); //sector seq = ok
-				}
-				else { //sector seq broken -> corrupt
-					error ("sector sequence broken");
-					out = -3;
-					*(tmp+src_offset+0)=0xff;
-					*(tmp+src_offset+1)=0xff;
-					*(tmp+src_offset+2)=0xff;
-					*(tmp+src_offset+3)=0xff;
-					break;
-				}
-			for (row_nr=0; row_nr<12; row_nr++) {
-				memcpy(buf+dst_offset, tmp+src_offset, 172);
-				dst_offset += 172;
-				src_offset += 182;
-			}
-			src_offset += 200;
-			sec_cnt += 1;
+
+/**
+ * @param dvd The DVD drive the command should be exectued on.
+ * @param offset The absolute memory offset to start dumping.
+ * @param block_size The block size for the dump.
+ * @param buf Where to place the dumped data. This must have been setup by the caller to store up to block_size bytes.
+ * @return < 0 if an error occurred, 0 otherwise.
+ */
+int liteon_dvd_dump_memblock (dvd_drive *dvd, u_int32_t offset, u_int32_t block_size, u_int8_t *buf) {
+	int out;
+	u_int32_t frames;
+	u_int8_t  tmp[64*1024];
+
+	if (!buf) {
+		error ("NULL buffer");
+		out = -1;
+	} else if ((out = liteon_dvd_dump_frames (dvd, offset, block_size, tmp)) != -2) {
+		/* Correct the frames with their PI and PO parity, then convert the whole transfer */
+		frames = block_size / 2064;
+		raw2384_correct (tmp, frames);
+		if (raw2384_deinterleave (tmp, frames, buf) < frames) { //sector seq broken -> corrupt
+			error ("sector sequence broken");
+			out = -3;
 		}
-		//free(tmp);
 	}
 	return (out);
 }
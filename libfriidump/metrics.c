@@ -0,0 +1,401 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Latency histograms and counters of drive I/O.
+ *
+ * Every drive keeps a histogram of the time taken by each kind of command it is sent and by each stage of the read methods, together with some
+ * counters. Recording is cheap enough to be always on. Histograms can be printed as a summary at the end of a dump, or saved as JSON or in the
+ * Prometheus text exposition format, so that a long dump can be watched while it runs.
+ */
+
+#include "misc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thread.h"
+#include "metrics.h"
+
+/*! \brief Number of histogram buckets, the last one having no upper bound */
+#define METRICS_BUCKETS 20
+
+/*! \brief Upper bounds of the histogram buckets, in microseconds */
+static const u_int64_t metrics_bounds[METRICS_BUCKETS - 1] = {
+	10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+/*! \brief Names of the timers, as exported */
+static const char *metrics_timer_names[METRICS_TIMERS] = {
+	"read12", "read12_fua", "read12_streaming", "memdump_e7", "memdump_3c", "set_cd_speed", "set_streaming", "other",
+	"seek", "flush", "read", "memdump", "unscramble", "cache_add"
+};
+
+/*! \brief Names of the timers, as printed */
+static const char *metrics_timer_titles[METRICS_TIMERS] = {
+	"READ(12)", "READ(12) FUA", "READ(12) streaming", "E7 memory dump", "3C memory dump", "SET CD SPEED", "SET STREAMING", "Other",
+	"Dummy seek", "Cache flush", "Read", "Memory dump", "Unscramble", "Cache add"
+};
+
+/*! \brief Names of the counters, as exported */
+static const char *metrics_counter_names[METRICS_COUNTERS] = {
+	"failed_commands", "window_retries", "block_retries", "recovered_blocks", "unrecovered_blocks", "speed_steps_down", "speed_steps_up",
+	"prefetched_windows", "prefetch_hits"
+};
+
+
+typedef struct {
+	u_int64_t buckets[METRICS_BUCKETS];	//!< Number of operations that took up to the corresponding bound, and more than the previous one.
+	u_int64_t count;
+	u_int64_t sum;				//!< Total time, in microseconds.
+	u_int64_t max;				//!< Longest time, in microseconds.
+} metrics_histogram;
+
+
+typedef struct {
+	metrics_histogram timers[METRICS_TIMERS];
+	u_int64_t counters[METRICS_COUNTERS];
+	u_int64_t start;			//!< When recording started, see my_time_usec().
+} metrics_data;
+
+
+/*! \brief The metrics of a drive. They are recorded by the thread reading from the drive, and can be saved from another one.
+ */
+struct metrics_s {
+	my_mutex lock;
+	metrics_data data;
+};
+
+
+/**
+ * Creates an empty set of metrics.
+ * @return The newly-created structure.
+ */
+metrics *metrics_new (void) {
+	metrics *m;
+
+	m = (metrics *) malloc (sizeof (metrics));
+	memset (m, 0, sizeof (metrics));
+	my_mutex_init (&(m -> lock));
+	m -> data.start = my_time_usec ();
+
+	return (m);
+}
+
+
+/**
+ * Frees resources used by a set of metrics and destroys it.
+ * @param m The metrics.
+ * @return NULL.
+ */
+void *metrics_destroy (metrics *m) {
+	if (m) {
+		my_mutex_destroy (&(m -> lock));
+		my_free (m);
+	}
+
+	return (NULL);
+}
+
+
+/**
+ * Records the duration of an operation.
+ * @param m The metrics, or NULL, in which case nothing is recorded.
+ * @param t The operation.
+ * @param usec How long it took, in microseconds.
+ */
+void metrics_add_time (metrics *m, metrics_timer t, u_int64_t usec) {
+	metrics_histogram *h;
+	u_int32_t i;
+
+	if (m) {
+		for (i = 0; i < METRICS_BUCKETS - 1 && usec > metrics_bounds[i]; i++)
+			;
+		my_mutex_lock (&(m -> lock));
+		h = &(m -> data.timers[t]);
+		h -> buckets[i]++;
+		h -> count++;
+		h -> sum += usec;
+		if (usec > h -> max)
+			h -> max = usec;
+		my_mutex_unlock (&(m -> lock));
+	}
+
+	return;
+}
+
+
+/**
+ * Counts an event.
+ * @param m The metrics, or NULL, in which case nothing is recorded.
+ * @param c The event.
+ */
+void metrics_count (metrics *m, metrics_counter c) {
+	if (m) {
+		my_mutex_lock (&(m -> lock));
+		m -> data.counters[c]++;
+		my_mutex_unlock (&(m -> lock));
+	}
+
+	return;
+}
+
+
+static void metrics_get_data (metrics *m, metrics_data *data) {
+	my_mutex_lock (&(m -> lock));
+	memcpy (data, &(m -> data), sizeof (metrics_data));
+	my_mutex_unlock (&(m -> lock));
+
+	return;
+}
+
+
+/* Estimates a quantile of a histogram, interpolating within the bucket it falls in. Returns microseconds. */
+static double metrics_quantile (metrics_histogram *h, double q) {
+	double target, done, lower, upper, out;
+	u_int32_t i;
+
+	target = q * h -> count;
+	done = 0;
+	out = 0;
+	for (i = 0; i < METRICS_BUCKETS && h -> count > 0; i++) {
+		if (h -> buckets[i] > 0 && done + h -> buckets[i] >= target) {
+			lower = i > 0 ? (double) metrics_bounds[i - 1] : 0;
+			upper = i < METRICS_BUCKETS - 1 && metrics_bounds[i] < h -> max ? (double) metrics_bounds[i] : (double) h -> max;
+			out = lower + (upper - lower) * (target - done) / h -> buckets[i];
+			break;
+		}
+		done += h -> buckets[i];
+	}
+
+	return (out);
+}
+
+
+/**
+ * Prints a summary of where time went: the number, total and latency of every kind of command and stage, and the counters.
+ * @param m The metrics.
+ * @param fp Where to print.
+ */
+void metrics_print (metrics *m, FILE *fp) {
+	metrics_data data;
+	metrics_histogram *h;
+	double elapsed;
+	u_int32_t t, c;
+
+	metrics_get_data (m, &data);
+	elapsed = (double) (my_time_usec () - data.start);
+	if (elapsed <= 0)
+		elapsed = 1;
+
+	for (t = 0; t < METRICS_TIMERS; t++) {
+		if (t == 0 || t == METRICS_FIRST_STAGE) {
+			fprintf (fp, "%-20s %8s %9s %6s %9s %9s %9s %9s\n", t == 0 ? "Drive command" : "Read stage", "Count", "Total s", "Time",
+				"Mean ms", "p50 ms", "p99 ms", "Max ms");
+		}
+		h = &(data.timers[t]);
+		if (h -> count > 0) {
+			fprintf (fp, "%-20s %8.0f %9.2f %5.1f%% %9.2f %9.2f %9.2f %9.2f\n", metrics_timer_titles[t], (double) h -> count,
+				h -> sum / 1e6, h -> sum * 100 / elapsed, (double) h -> sum / h -> count / 1000, metrics_quantile (h, 0.5) / 1000,
+				metrics_quantile (h, 0.99) / 1000, h -> max / 1000.0);
+		}
+	}
+
+	fprintf (fp, "Counters:");
+	for (c = 0; c < METRICS_COUNTERS; c++)
+		fprintf (fp, "%s %s %.0f", c > 0 ? "," : "", metrics_counter_names[c], (double) data.counters[c]);
+	fprintf (fp, "\n");
+
+	return;
+}
+
+
+/* Writes a string escaping what needs to be, which is the same for JSON strings and Prometheus label values */
+static void metrics_write_string (FILE *fp, char *s) {
+	fputc ('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc ('\\', fp);
+		if (*s == '\n')
+			fputs ("\\n", fp);
+		else
+			fputc (*s, fp);
+	}
+	fputc ('"', fp);
+
+	return;
+}
+
+
+/**
+ * Writes the metrics of some drives as a JSON object. Times are in microseconds, and histogram buckets are not cumulative, the last one having a
+ * null bound.
+ * @param fp Where to write.
+ * @param m The metrics of each drive.
+ * @param drives The name of each drive.
+ * @param n The number of drives.
+ * @return True if everything could be written.
+ */
+bool metrics_write_json (FILE *fp, metrics **m, char **drives, u_int32_t n) {
+	metrics_data data;
+	metrics_histogram *h;
+	u_int32_t i, t, c, b;
+
+	fprintf (fp, "{\n  \"drives\": [");
+	for (i = 0; i < n; i++) {
+		metrics_get_data (m[i], &data);
+		fprintf (fp, "%s\n    {\n      \"drive\": ", i > 0 ? "," : "");
+		metrics_write_string (fp, drives[i]);
+		fprintf (fp, ",\n      \"elapsed_us\": %.0f,\n      \"timers\": {", (double) (my_time_usec () - data.start));
+		for (t = 0; t < METRICS_TIMERS; t++) {
+			h = &(data.timers[t]);
+			fprintf (fp, "%s\n        \"%s\": {\"kind\": \"%s\", \"count\": %.0f, \"sum_us\": %.0f, \"max_us\": %.0f, \"buckets\": [", t > 0 ? "," : "",
+				metrics_timer_names[t], t < METRICS_FIRST_STAGE ? "command" : "stage", (double) h -> count, (double) h -> sum, (double) h -> max);
+			for (b = 0; b < METRICS_BUCKETS; b++) {
+				if (b < METRICS_BUCKETS - 1)
+					fprintf (fp, "%s[%.0f, %.0f]", b > 0 ? ", " : "", (double) metrics_bounds[b], (double) h -> buckets[b]);
+				else
+					fprintf (fp, ", [null, %.0f]", (double) h -> buckets[b]);
+			}
+			fprintf (fp, "]}");
+		}
+		fprintf (fp, "\n      },\n      \"counters\": {");
+		for (c = 0; c < METRICS_COUNTERS; c++)
+			fprintf (fp, "%s\n        \"%s\": %.0f", c > 0 ? "," : "", metrics_counter_names[c], (double) data.counters[c]);
+		fprintf (fp, "\n      }\n    }");
+	}
+	fprintf (fp, "\n  ]\n}\n");
+
+	return (!ferror (fp));
+}
+
+
+/* Writes a histogram family in the Prometheus format, for the timers from first to last */
+static void metrics_write_prometheus_family (FILE *fp, metrics_data *data, char **drives, u_int32_t n, char *name, char *label, char *help,
+	u_int32_t first, u_int32_t last) {
+	metrics_histogram *h;
+	u_int64_t cumulative;
+	u_int32_t i, t, b;
+
+	fprintf (fp, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+	for (i = 0; i < n; i++) {
+		for (t = first; t < last; t++) {
+			h = &(data[i].timers[t]);
+			for (b = 0, cumulative = 0; b < METRICS_BUCKETS; b++) {
+				cumulative += h -> buckets[b];
+				fprintf (fp, "%s_bucket{drive=", name);
+				metrics_write_string (fp, drives[i]);
+				if (b < METRICS_BUCKETS - 1)
+					fprintf (fp, ",%s=\"%s\",le=\"%g\"} %.0f\n", label, metrics_timer_names[t], metrics_bounds[b] / 1e6, (double) cumulative);
+				else
+					fprintf (fp, ",%s=\"%s\",le=\"+Inf\"} %.0f\n", label, metrics_timer_names[t], (double) cumulative);
+			}
+			fprintf (fp, "%s_sum{drive=", name);
+			metrics_write_string (fp, drives[i]);
+			fprintf (fp, ",%s=\"%s\"} %g\n", label, metrics_timer_names[t], h -> sum / 1e6);
+			fprintf (fp, "%s_count{drive=", name);
+			metrics_write_string (fp, drives[i]);
+			fprintf (fp, ",%s=\"%s\"} %.0f\n", label, metrics_timer_names[t], (double) h -> count);
+		}
+	}
+
+	return;
+}
+
+
+/**
+ * Writes the metrics of some drives in the Prometheus text exposition format, labelled with the drive name. Times are in seconds.
+ * @param fp Where to write.
+ * @param m The metrics of each drive.
+ * @param drives The name of each drive.
+ * @param n The number of drives.
+ * @return True if everything could be written.
+ */
+bool metrics_write_prometheus (FILE *fp, metrics **m, char **drives, u_int32_t n) {
+	metrics_data *data;
+	u_int32_t i, c;
+
+	data = (metrics_data *) malloc (n * sizeof (metrics_data));
+	for (i = 0; i < n; i++)
+		metrics_get_data (m[i], &data[i]);
+
+	metrics_write_prometheus_family (fp, data, drives, n, "friidump_command_seconds", "command", "Time taken by the commands sent to the drive.",
+		0, METRICS_FIRST_STAGE);
+	metrics_write_prometheus_family (fp, data, drives, n, "friidump_stage_seconds", "stage", "Time taken by each stage of the read methods.",
+		METRICS_FIRST_STAGE, METRICS_TIMERS);
+	for (c = 0; c < METRICS_COUNTERS; c++) {
+		fprintf (fp, "# TYPE friidump_%s_total counter\n", metrics_counter_names[c]);
+		for (i = 0; i < n; i++) {
+			fprintf (fp, "friidump_%s_total{drive=", metrics_counter_names[c]);
+			metrics_write_string (fp, drives[i]);
+			fprintf (fp, "} %.0f\n", (double) data[i].counters[c]);
+		}
+	}
+	my_free (data);
+
+	return (!ferror (fp));
+}
+
+
+/**
+ * Saves the metrics of some drives to a file, replacing it atomically so that it can be read at any time. The format is JSON if the file name
+ * ends with <code>.json</code>, Prometheus text exposition otherwise.
+ * @param filename The file.
+ * @param m The metrics of each drive.
+ * @param drives The name of each drive.
+ * @param n The number of drives.
+ * @return True if the file was saved.
+ */
+bool metrics_save (char *filename, metrics **m, char **drives, u_int32_t n) {
+	char *tmp;
+	size_t len;
+	FILE *fp;
+	bool out;
+
+	len = strlen (filename) + 5;
+	if (!(tmp = (char *) malloc (len))) {
+		out = false;
+	} else {
+		snprintf (tmp, len, "%s.tmp", filename);
+		if (!(fp = fopen (tmp, "w"))) {
+			out = false;
+		} else {
+			len = strlen (filename);
+			if (len >= 5 && strcmp (filename + len - 5, ".json") == 0)
+				out = metrics_write_json (fp, m, drives, n);
+			else
+				out = metrics_write_prometheus (fp, m, drives, n);
+			out = fclose (fp) == 0 && out;
+#ifdef WIN32
+			remove (filename);
+#endif
+			if (out)
+				out = rename (tmp, filename) == 0;
+			else
+				remove (tmp);
+		}
+		free (tmp);
+	}
+
+	if (!out)
+		warning ("Cannot save metrics to \"%s\"", filename);
+
+	return (out);
+}
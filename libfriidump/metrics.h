@@ -0,0 +1,80 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Latency histograms and counters of drive I/O.
+ */
+
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include "misc.h"
+#include <stdio.h>
+#include <sys/types.h>
+
+/*! \brief Timed operations: commands sent to the drive, then the stages of a read window */
+typedef enum {
+	METRICS_CMD_READ12,
+	METRICS_CMD_READ12_FUA,
+	METRICS_CMD_READ12_STREAMING,
+	METRICS_CMD_MEMDUMP_E7,
+	METRICS_CMD_MEMDUMP_3C,
+	METRICS_CMD_SET_CD_SPEED,
+	METRICS_CMD_SET_STREAMING,
+	METRICS_CMD_OTHER,
+	METRICS_STAGE_SEEK,
+	METRICS_STAGE_FLUSH,
+	METRICS_STAGE_READ,
+	METRICS_STAGE_MEMDUMP,
+	METRICS_STAGE_UNSCRAMBLE,
+	METRICS_STAGE_CACHE_ADD,
+	METRICS_TIMERS
+} metrics_timer;
+
+/*! \brief The first timer that is a stage rather than a command */
+#define METRICS_FIRST_STAGE METRICS_STAGE_SEEK
+
+/*! \brief Counted events */
+typedef enum {
+	METRICS_COUNT_CMD_FAILED,	//!< Commands that failed.
+	METRICS_COUNT_WINDOW_RETRIES,	//!< Read windows read again.
+	METRICS_COUNT_BLOCK_RETRIES,	//!< Attempts at recovering a single block.
+	METRICS_COUNT_RECOVERED,	//!< Blocks recovered.
+	METRICS_COUNT_UNRECOVERED,	//!< Blocks that could not be recovered.
+	METRICS_COUNT_SPEED_DOWN,	//!< Times the adaptive speed control lowered the speed.
+	METRICS_COUNT_SPEED_UP,		//!< Times the adaptive speed control raised the speed.
+	METRICS_COUNT_PREFETCH,		//!< Read windows whose first commands were queued while the previous one was processed.
+	METRICS_COUNT_PREFETCH_HITS,	//!< Prefetched read windows that were actually requested next.
+	METRICS_COUNTERS
+} metrics_counter;
+
+typedef struct metrics_s metrics;
+
+FRIIDUMPLIB_EXPORT metrics *metrics_new (void);
+FRIIDUMPLIB_EXPORT void *metrics_destroy (metrics *m);
+FRIIDUMPLIB_EXPORT void metrics_add_time (metrics *m, metrics_timer t, u_int64_t usec);
+FRIIDUMPLIB_EXPORT void metrics_count (metrics *m, metrics_counter c);
+FRIIDUMPLIB_EXPORT void metrics_print (metrics *m, FILE *fp);
+FRIIDUMPLIB_EXPORT bool metrics_write_json (FILE *fp, metrics **m, char **drives, u_int32_t n);
+FRIIDUMPLIB_EXPORT bool metrics_write_prometheus (FILE *fp, metrics **m, char **drives, u_int32_t n);
+FRIIDUMPLIB_EXPORT bool metrics_save (char *filename, metrics **m, char **drives, u_int32_t n);
+
+#endif
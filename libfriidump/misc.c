@@ -26,8 +26,10 @@
 #include <string.h>
 #include <ctype.h>
 #include <sys/types.h>
-//#include <sys/time.h>
 #include <time.h>
+#ifndef WIN32
+#include <sys/time.h>
+#endif
 
 /*** LOGGING STUFF ***/
 /* Uses code from the printf man page */
@@ -260,6 +262,52 @@ my_off_t my_ftell (FILE* fp) {
 
 
 
+/*** STUFF FOR PER-USER FILES ***/
+
+#ifdef WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+/**
+ * Builds the path of a file in the per-user FriiDump directory ($HOME/.friidump, or %APPDATA%\friidump on Windows), creating the directory
+ * if it does not exist yet.
+ * @param name The file name.
+ * @return The path, to be freed by the caller, or NULL if there is no place to store per-user files.
+ */
+char *my_user_file (char *name) {
+	char *out, *home;
+	size_t len;
+
+#ifdef WIN32
+	home = getenv ("APPDATA");
+#else
+	home = getenv ("HOME");
+#endif
+
+	if (!home || !*home) {
+		out = NULL;
+	} else {
+		len = strlen (home) + strlen (name) + 12;
+		if ((out = (char *) malloc (len))) {
+#ifdef WIN32
+			snprintf (out, len, "%s\\friidump", home);
+			_mkdir (out);
+			snprintf (out, len, "%s\\friidump\\%s", home, name);
+#else
+			snprintf (out, len, "%s/.friidump", home);
+			mkdir (out, 0755);
+			snprintf (out, len, "%s/.friidump/%s", home, name);
+#endif
+		}
+	}
+
+	return (out);
+}
+
+
+
 /*** STUFF FOR DROPPING PRIVILEGES ***/
 
 /* WARNING: I'm not sure at all that the privileges-dropping system I have implemented is secure, so don't rely too much on it. */
@@ -122,6 +122,11 @@ my_off_t my_ftell (FILE* fp);
 /*******/
 
 
+/*** STUFF FOR PER-USER FILES ***/
+FRIIDUMPLIB_EXPORT char *my_user_file (char *name);
+/******/
+
+
 /*** STUFF FOR DROPPING PRIVILEGES ***/
 FRIIDUMPLIB_EXPORT void drop_euid ();
 FRIIDUMPLIB_EXPORT void upgrade_euid ();
@@ -0,0 +1,578 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Conversion of the 2384-byte frames some drives keep in their cache to 2064-byte raw sectors.
+ *
+ * The Lite-On and vanilla 2384 memory dump commands return frames as the drive stores them, with the PI parity bytes after each 172-byte row
+ * and the PO parity rows at the end. Every dumped byte goes through here, so besides the reference code there are SIMD kernels, which move
+ * each row with a few wide loads and stores, the last one overlapping the previous, so that nothing is written past the sector.
+ *
+ * Before conversion, the parity is used to correct the frames as ECC blocks are meant to be: every row is checked and corrected with its PI
+ * bytes, then, if some rows are beyond PI, each column of the ECC block is corrected with its PO bytes, the failed rows being erasures. This
+ * can only be done when the whole block is there, so the generic read methods keep the frames of the whole read window, which is dumped after
+ * several READs, and correct them at once (See dvd_memdump_frames()). A re-read is then left for the blocks that are really damaged.
+ */
+
+#include "misc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "constants.h"
+#include "cpu.h"
+#include "thread.h"
+#include "ecc.h"
+#include "raw2384.h"
+
+/*! \brief Number of data rows in a frame */
+#define RAW2384_ROWS 12
+
+/*! \brief Size of a row, without and with PI bytes */
+#define RAW2384_ROW_DATA 172
+#define RAW2384_ROW_SIZE 182
+
+/*! \brief Number of rows of a frame, including the PO one */
+#define RAW2384_FRAME_ROWS (RAW2384_ROWS + 1)
+
+/*! \brief Number of PI and PO parity bytes */
+#define RAW2384_PI_ROOTS (RAW2384_ROW_SIZE - RAW2384_ROW_DATA)
+#define RAW2384_PO_ROOTS 16
+
+/*! \brief Length of a PO codeword: a column of the data rows of all the frames of the block, then of their PO rows */
+#define RAW2384_PO_LEN (RAW2384_BLOCK_FRAMES * RAW2384_FRAME_ROWS)
+
+/*! \brief Sector number from the ID field of a frame */
+#define RAW2384_SEC_NR(f) (((f)[1] << 16) + ((f)[2] << 8) + (f)[3])
+
+
+/* Converts a frame, without checking anything */
+typedef void (*raw2384_frame_func) (u_int8_t *in, u_int8_t *out);
+
+
+/* The original code */
+static void raw2384_frame_reference (u_int8_t *in, u_int8_t *out) {
+	u_int32_t row;
+
+	for (row = 0; row < RAW2384_ROWS; row++)
+		memcpy (out + row * RAW2384_ROW_DATA, in + row * RAW2384_ROW_SIZE, RAW2384_ROW_DATA);
+
+	return;
+}
+
+
+#ifdef CPU_X86_DISPATCH
+#include <emmintrin.h>
+#include <immintrin.h>
+
+/* 172 = 10 * 16 + 12: the last 16 bytes of each row are moved with a load overlapping the previous one. Each load is stored right away, as
+   source and destination are often 4 KB apart and grouping loads would make them wait for unrelated stores. */
+#define MOVE16(o) _mm_storeu_si128 ((__m128i *) (out + (o)), _mm_loadu_si128 ((__m128i *) (in + (o))))
+#define MOVE32(o) _mm256_storeu_si256 ((__m256i *) (out + (o)), _mm256_loadu_si256 ((__m256i *) (in + (o))))
+
+__attribute__((target("sse2")))
+static void raw2384_frame_sse2 (u_int8_t *in, u_int8_t *out) {
+	u_int32_t row;
+
+	for (row = 0; row < RAW2384_ROWS; row++, in += RAW2384_ROW_SIZE, out += RAW2384_ROW_DATA) {
+		MOVE16 (0);
+		MOVE16 (16);
+		MOVE16 (32);
+		MOVE16 (48);
+		MOVE16 (64);
+		MOVE16 (80);
+		MOVE16 (96);
+		MOVE16 (112);
+		MOVE16 (128);
+		MOVE16 (144);
+		MOVE16 (RAW2384_ROW_DATA - 16);
+	}
+
+	return;
+}
+
+
+/* 172 = 5 * 32 + 12, same as above */
+__attribute__((target("avx2")))
+static void raw2384_frame_avx2 (u_int8_t *in, u_int8_t *out) {
+	u_int32_t row;
+
+	for (row = 0; row < RAW2384_ROWS; row++, in += RAW2384_ROW_SIZE, out += RAW2384_ROW_DATA) {
+		MOVE32 (0);
+		MOVE32 (32);
+		MOVE32 (64);
+		MOVE32 (96);
+		MOVE32 (128);
+		MOVE16 (RAW2384_ROW_DATA - 16);
+	}
+
+	return;
+}
+#endif
+
+
+static const char *raw2384_kernel_names[RAW2384_KERNELS] = {
+	"auto", "reference", "sse2", "avx2"
+};
+
+/*! \brief The kernel used to convert frames */
+static raw2384_frame_func raw2384_frame_kernel = raw2384_frame_reference;
+
+/*! \brief True once a kernel has been selected, either automatically or by the user */
+static bool raw2384_kernel_selected = false;
+
+/*! \brief Makes sure the kernel is selected only once */
+static my_once raw2384_once = MY_ONCE_INIT;
+
+
+/**
+ * Selects the kernel used to convert frames.
+ * @param k The kernel, or RAW2384_KERNEL_AUTO to select the fastest one supported by the CPU.
+ * @return True if the kernel was selected, false if it is not supported by the CPU.
+ */
+bool raw2384_set_kernel (raw2384_kernel k) {
+	u_int32_t f, needed;
+	bool out;
+
+	f = cpu_get_features ();
+	if (k == RAW2384_KERNEL_AUTO) {
+		if (f & CPU_FEATURE_AVX2)
+			k = RAW2384_KERNEL_AVX2;
+		else if (f & CPU_FEATURE_SSE2)
+			k = RAW2384_KERNEL_SSE2;
+		else
+			k = RAW2384_KERNEL_REFERENCE;
+	}
+
+	out = true;
+	needed = 0;
+	switch (k) {
+		case RAW2384_KERNEL_REFERENCE:
+			raw2384_frame_kernel = raw2384_frame_reference;
+			break;
+#ifdef CPU_X86_DISPATCH
+		case RAW2384_KERNEL_SSE2:
+			needed = CPU_FEATURE_SSE2;
+			raw2384_frame_kernel = raw2384_frame_sse2;
+			break;
+		case RAW2384_KERNEL_AVX2:
+			needed = CPU_FEATURE_AVX2;
+			raw2384_frame_kernel = raw2384_frame_avx2;
+			break;
+#endif
+		default:
+			out = false;
+			break;
+	}
+
+	if (out && (f & needed) != needed) {
+		raw2384_frame_kernel = raw2384_frame_reference;
+		out = false;
+	}
+	if (out)
+		debug ("Using %s kernel to convert 2384-byte frames", raw2384_kernel_names[k]);
+	raw2384_kernel_selected = true;
+
+	return (out);
+}
+
+
+static void raw2384_select_kernel (void) {
+	if (!raw2384_kernel_selected)
+		raw2384_set_kernel (RAW2384_KERNEL_AUTO);
+
+	return;
+}
+
+
+/**
+ * Selects the conversion kernel, if it was not chosen already. Must be called before frames are converted from more threads.
+ */
+void raw2384_init (void) {
+	my_once_run (&raw2384_once, raw2384_select_kernel);
+
+	return;
+}
+
+
+/* Index in a PO codeword of a row of a frame of the block */
+static inline u_int32_t raw2384_po_index (u_int32_t frame, u_int32_t row) {
+	return (row < RAW2384_ROWS ? frame * RAW2384_ROWS + row : RAW2384_BLOCK_FRAMES * RAW2384_ROWS + frame);
+}
+
+
+/* Offset in the block of a row of a PO codeword */
+static inline u_int32_t raw2384_po_offset (u_int32_t r) {
+	u_int32_t frame, row;
+
+	if (r < RAW2384_BLOCK_FRAMES * RAW2384_ROWS) {
+		frame = r / RAW2384_ROWS;
+		row = r % RAW2384_ROWS;
+	} else {
+		frame = r - RAW2384_BLOCK_FRAMES * RAW2384_ROWS;
+		row = RAW2384_ROWS;
+	}
+
+	return (frame * RAW2384_FRAME_SIZE + row * RAW2384_ROW_SIZE);
+}
+
+
+/* Corrects every column of a whole ECC block with PO. Rows PI gave up on are erasures, unless there are more than PO can handle: then errors
+   are located column by column, as they might still be few in each. */
+static void raw2384_correct_po (u_int8_t *block, bool *bad) {
+	u_int8_t col[RAW2384_PO_LEN];
+	u_int32_t eras[RAW2384_PO_ROOTS], eras_no, c, r;
+
+	for (r = 0, eras_no = 0; r < RAW2384_PO_LEN; r++) {
+		if (bad[r]) {
+			if (eras_no < RAW2384_PO_ROOTS)
+				eras[eras_no] = r;
+			eras_no++;
+		}
+	}
+	if (eras_no > RAW2384_PO_ROOTS)
+		eras_no = 0;
+
+	for (c = 0; c < RAW2384_ROW_SIZE; c++) {
+		for (r = 0; r < RAW2384_PO_LEN; r++)
+			col[r] = block[raw2384_po_offset (r) + c];
+		if (ecc_decode (col, RAW2384_PO_LEN, RAW2384_PO_ROOTS, eras, eras_no) > 0) {
+			for (r = 0; r < RAW2384_PO_LEN; r++)
+				block[raw2384_po_offset (r) + c] = col[r];
+		}
+	}
+
+	return;
+}
+
+
+/* Corrects all the rows of some frames with PI, returning the number of data rows that could not be corrected */
+static u_int32_t raw2384_correct_pi (u_int8_t *in, u_int32_t frames, bool *bad) {
+	u_int32_t f, row, r, out, damaged;
+
+	out = 0;
+	for (f = 0; f < frames; f++, in += RAW2384_FRAME_SIZE) {
+		damaged = ecc_check_rows (in, RAW2384_ROW_SIZE, RAW2384_PI_ROOTS, RAW2384_ROW_SIZE, RAW2384_FRAME_ROWS);
+		for (row = 0; row < RAW2384_FRAME_ROWS; row++) {
+			r = raw2384_po_index (f, row);
+			bad[r] = (damaged & (1 << row)) && ecc_decode (in + row * RAW2384_ROW_SIZE, RAW2384_ROW_SIZE, RAW2384_PI_ROOTS, NULL, 0) < 0;
+			if (bad[r] && row < RAW2384_ROWS)
+				out++;
+		}
+	}
+
+	return (out);
+}
+
+
+/**
+ * Corrects a sequence of 2384-byte frames with their parity. Every row is corrected with PI and, where it is not enough, ECC blocks that were
+ * dumped whole are corrected with PO.
+ * @param in The frames, which are corrected in place.
+ * @param frames The number of frames.
+ * @return The number of data rows that could not be corrected.
+ */
+u_int32_t raw2384_correct (u_int8_t *in, u_int32_t frames) {
+	bool bad[RAW2384_PO_LEN], known, whole;
+	u_int32_t i, k, n, first, left, failed;
+
+	ecc_init ();
+
+	/* ECC blocks start at sector numbers multiple of 16: find out where, from the first frame whose ID can be corrected */
+	known = false;
+	first = 0;
+	for (i = 0; i < frames && !known; i++) {
+		if (ecc_decode (in + i * RAW2384_FRAME_SIZE, RAW2384_ROW_SIZE, RAW2384_PI_ROOTS, NULL, 0) >= 0) {
+			first = RAW2384_SEC_NR (in + i * RAW2384_FRAME_SIZE) - i;
+			known = true;
+		}
+	}
+
+	left = 0;
+	for (i = 0; i < frames; i += n) {
+		n = known ? RAW2384_BLOCK_FRAMES - (first + i) % RAW2384_BLOCK_FRAMES : 1;
+		if (n > frames - i)
+			n = frames - i;
+		failed = raw2384_correct_pi (in + i * RAW2384_FRAME_SIZE, n, bad);
+
+		/* PO needs the whole block, and the frames must really belong to it */
+		whole = n == RAW2384_BLOCK_FRAMES;
+		for (k = 0; k < n && whole && failed > 0; k++) {
+			if (!bad[raw2384_po_index (k, 0)] && RAW2384_SEC_NR (in + (i + k) * RAW2384_FRAME_SIZE) != first + i + k)
+				whole = false;
+		}
+		if (whole && failed > 0) {
+			raw2384_correct_po (in + i * RAW2384_FRAME_SIZE, bad);
+			failed = raw2384_correct_pi (in + i * RAW2384_FRAME_SIZE, n, bad);
+		}
+		left += failed;
+	}
+
+	return (left);
+}
+
+
+/**
+ * Computes the PO rows of an ECC block and the PI bytes of all its rows, as they are recorded on the disc.
+ * @param block The RAW2384_BLOCK_FRAMES frames of the block, with the data rows filled in.
+ */
+void raw2384_add_parity (u_int8_t *block) {
+	u_int8_t col[RAW2384_PO_LEN];
+	u_int32_t c, r;
+
+	for (c = 0; c < RAW2384_ROW_DATA; c++) {
+		for (r = 0; r < RAW2384_PO_LEN - RAW2384_PO_ROOTS; r++)
+			col[r] = block[raw2384_po_offset (r) + c];
+		ecc_encode (col, RAW2384_PO_LEN - RAW2384_PO_ROOTS, RAW2384_PO_ROOTS, col + RAW2384_PO_LEN - RAW2384_PO_ROOTS);
+		for (; r < RAW2384_PO_LEN; r++)
+			block[raw2384_po_offset (r) + c] = col[r];
+	}
+
+	for (r = 0; r < RAW2384_PO_LEN; r++)
+		ecc_encode (block + raw2384_po_offset (r), RAW2384_ROW_DATA, RAW2384_PI_ROOTS, block + raw2384_po_offset (r) + RAW2384_ROW_DATA);
+
+	return;
+}
+
+
+/**
+ * Converts a sequence of 2384-byte frames to 2064-byte raw sectors, checking that they hold consecutive sectors. Conversion stops at the first
+ * frame that breaks the sequence, which is not converted.
+ * @param in The frames.
+ * @param frames The number of frames.
+ * @param out Where to place the raw sectors. This must be able to hold frames * RAW_SECTOR_SIZE bytes.
+ * @return The number of frames converted, which is <code>frames</code> unless the sequence was broken.
+ */
+u_int32_t raw2384_deinterleave (u_int8_t *in, u_int32_t frames, u_int8_t *out) {
+	u_int32_t i, first_sec_nr, sec_nr;
+
+	raw2384_init ();
+	first_sec_nr = RAW2384_SEC_NR (in);
+	for (i = 0; i < frames; i++, in += RAW2384_FRAME_SIZE, out += RAW_SECTOR_SIZE) {
+		sec_nr = RAW2384_SEC_NR (in);
+		if (sec_nr != first_sec_nr + i)
+			break;
+		raw2384_frame_kernel (in, out);
+	}
+
+	return (i);
+}
+
+
+/* Fills frames of whole ECC blocks with pseudo-random data and their parity, starting from sector first_sec_nr */
+static void raw2384_fill_blocks (u_int8_t *in, u_int32_t blocks, u_int32_t first_sec_nr, u_int32_t r) {
+	u_int32_t i, j, sec_nr;
+
+	memset (in, 0, blocks * RAW2384_BLOCK_FRAMES * RAW2384_FRAME_SIZE);
+	for (i = 0; i < blocks * RAW2384_BLOCK_FRAMES; i++) {
+		for (j = 0; j < RAW2384_ROWS * RAW2384_ROW_SIZE; j++) {
+			r = r * 1103515245 + 12345;
+			in[i * RAW2384_FRAME_SIZE + j] = (u_int8_t) (r >> 16);
+		}
+		sec_nr = first_sec_nr + i;
+		in[i * RAW2384_FRAME_SIZE + 1] = (u_int8_t) (sec_nr >> 16);
+		in[i * RAW2384_FRAME_SIZE + 2] = (u_int8_t) (sec_nr >> 8);
+		in[i * RAW2384_FRAME_SIZE + 3] = (u_int8_t) sec_nr;
+	}
+	for (i = 0; i < blocks; i++)
+		raw2384_add_parity (in + i * RAW2384_BLOCK_FRAMES * RAW2384_FRAME_SIZE);
+
+	return;
+}
+
+
+/* Checks correction on a transfer that covers an ECC block and parts of the ones around it */
+static bool raw2384_self_test_correct (bool verbose) {
+	u_int8_t *clean, *damaged;
+	u_int32_t i, frames;
+	bool out;
+
+	frames = 3 * RAW2384_BLOCK_FRAMES;
+	clean = (u_int8_t *) malloc (frames * RAW2384_FRAME_SIZE);
+	damaged = (u_int8_t *) malloc (frames * RAW2384_FRAME_SIZE);
+	raw2384_fill_blocks (clean, 3, 0x30000, 0x1234567);
+	memcpy (damaged, clean, frames * RAW2384_FRAME_SIZE);
+
+	/* A byte in many rows, which PI can fix, a whole frame of the middle block, which needs PO, and two frames of the last block, which was
+	   not dumped whole and cannot be corrected */
+	for (i = 0; i < frames * RAW2384_FRAME_SIZE; i += 997)
+		damaged[i] ^= 0x5A;
+	for (i = 0; i < RAW2384_FRAME_SIZE; i++)
+		damaged[20 * RAW2384_FRAME_SIZE + i] ^= 0xC3;
+	for (i = 0; i < 2 * RAW2384_FRAME_SIZE; i++)
+		damaged[40 * RAW2384_FRAME_SIZE + i] ^= 0x3C;
+
+	if (verbose)
+		printf ("  Frame correction: ");
+	out = raw2384_correct (damaged + 8 * RAW2384_FRAME_SIZE, 36) == 2 * RAW2384_ROWS;
+	for (i = 8; i < 44 && out; i++) {
+		if (i != 40 && i != 41)
+			out = memcmp (damaged + i * RAW2384_FRAME_SIZE, clean + i * RAW2384_FRAME_SIZE, RAW2384_FRAME_ROWS * RAW2384_ROW_SIZE) == 0;
+	}
+	if (verbose)
+		printf (out ? "passed\n" : "failed\n");
+
+	my_free (clean);
+	my_free (damaged);
+
+	return (out);
+}
+
+
+/**
+ * Checks that the optimized kernels give the same results as the reference one, and that damaged frames are corrected.
+ * @param verbose If true, results will be printed to stdout.
+ * @return True if all tests passed, false otherwise.
+ */
+bool raw2384_self_test (bool verbose) {
+	u_int8_t *in, *ref, *test;
+	u_int32_t i, r, frames;
+	raw2384_frame_func saved;
+	raw2384_kernel k;
+	bool out;
+
+	/* A broken sequence in the last frame, and data that differs everywhere */
+	frames = 8;
+	in = (u_int8_t *) malloc (frames * RAW2384_FRAME_SIZE);
+	ref = (u_int8_t *) malloc (frames * RAW_SECTOR_SIZE);
+	test = (u_int8_t *) malloc (frames * RAW_SECTOR_SIZE);
+	for (i = 0, r = 0x13579BDF; i < frames * RAW2384_FRAME_SIZE; i++) {
+		r = r * 1103515245 + 12345;
+		in[i] = (u_int8_t) (r >> 16);
+	}
+	for (i = 0; i < frames; i++) {
+		r = 0x30000 + 1000 + (i < frames - 1 ? i : i + 1);
+		in[i * RAW2384_FRAME_SIZE + 1] = (u_int8_t) (r >> 16);
+		in[i * RAW2384_FRAME_SIZE + 2] = (u_int8_t) (r >> 8);
+		in[i * RAW2384_FRAME_SIZE + 3] = (u_int8_t) r;
+	}
+
+	raw2384_init ();
+	saved = raw2384_frame_kernel;
+	raw2384_frame_kernel = raw2384_frame_reference;
+	memset (ref, 0, frames * RAW_SECTOR_SIZE);
+	out = raw2384_deinterleave (in, frames, ref) == frames - 1;
+
+	for (k = RAW2384_KERNEL_REFERENCE + 1; k < RAW2384_KERNELS && out; k++) {
+		if (!raw2384_set_kernel (k)) {
+			if (verbose)
+				printf ("  Frame conversion %s kernel: not supported\n", raw2384_kernel_names[k]);
+		} else {
+			if (verbose)
+				printf ("  Frame conversion %s kernel: ", raw2384_kernel_names[k]);
+			memset (test, 0, frames * RAW_SECTOR_SIZE);
+			out = raw2384_deinterleave (in, frames, test) == frames - 1 && memcmp (test, ref, frames * RAW_SECTOR_SIZE) == 0;
+			if (verbose)
+				printf (out ? "passed\n" : "failed\n");
+		}
+	}
+	raw2384_frame_kernel = saved;
+
+	my_free (in);
+	my_free (ref);
+	my_free (test);
+
+	if (out)
+		out = raw2384_self_test_correct (verbose);
+
+	return (out);
+}
+
+
+/* Measures the throughput of correction on a transfer as large as the largest memory dump, either clean or with a damaged frame in each
+   ECC block */
+static void raw2384_benchmark_correct (bool damaged) {
+	u_int8_t *clean, *in;
+	u_int32_t i, frames, rounds;
+	u_int64_t start, elapsed;
+
+	frames = 65536 / RAW2384_FRAME_SIZE;
+	clean = (u_int8_t *) malloc (2 * RAW2384_BLOCK_FRAMES * RAW2384_FRAME_SIZE);
+	in = (u_int8_t *) malloc (2 * RAW2384_BLOCK_FRAMES * RAW2384_FRAME_SIZE);
+	raw2384_fill_blocks (clean, 2, 0x30000, 0x7654321);
+	if (damaged) {
+		for (i = 0; i < RAW2384_FRAME_SIZE; i++)
+			clean[5 * RAW2384_FRAME_SIZE + i] ^= 0xC3;
+	}
+
+	start = my_time_usec ();
+	rounds = 0;
+	do {
+		memcpy (in, clean, frames * RAW2384_FRAME_SIZE);
+		raw2384_correct (in, frames);
+		rounds++;
+		elapsed = my_time_usec () - start;
+	} while (elapsed < 250000);
+	printf ("  Frame correction, %-8s %6.2f MB/s\n", damaged ? "damaged" : "clean", (double) rounds * frames * RAW2384_FRAME_SIZE / elapsed);
+
+	my_free (clean);
+	my_free (in);
+
+	return;
+}
+
+
+/**
+ * Measures the throughput of all the conversion kernels supported by the CPU on 64 KB transfers, and that of correction, printing results to
+ * stdout.
+ */
+void raw2384_benchmark (void) {
+	u_int8_t *in, *out;
+	u_int32_t i, frames, rounds;
+	u_int64_t start, elapsed;
+	raw2384_frame_func saved;
+	raw2384_kernel k;
+
+	/* As many frames as the largest memory dump returns */
+	frames = 65536 / RAW2384_FRAME_SIZE;
+	in = (u_int8_t *) malloc (frames * RAW2384_FRAME_SIZE);
+	out = (u_int8_t *) malloc (frames * RAW_SECTOR_SIZE);
+	for (i = 0; i < frames * RAW2384_FRAME_SIZE; i++)
+		in[i] = (u_int8_t) (i * 7 + (i >> 11));
+	for (i = 0; i < frames; i++) {
+		in[i * RAW2384_FRAME_SIZE + 1] = 0x03;
+		in[i * RAW2384_FRAME_SIZE + 2] = (u_int8_t) (i >> 8);
+		in[i * RAW2384_FRAME_SIZE + 3] = (u_int8_t) i;
+	}
+
+	raw2384_init ();
+	saved = raw2384_frame_kernel;
+	for (k = RAW2384_KERNEL_REFERENCE; k < RAW2384_KERNELS; k++) {
+		if (raw2384_set_kernel (k)) {
+			start = my_time_usec ();
+			rounds = 0;
+			do {
+				raw2384_deinterleave (in, frames, out);
+				rounds++;
+				elapsed = my_time_usec () - start;
+			} while (elapsed < 250000);
+			printf ("  Frame conversion %-8s %6.2f GB/s\n", raw2384_kernel_names[k], (double) rounds * frames * RAW2384_FRAME_SIZE / elapsed / 1000);
+		}
+	}
+	raw2384_frame_kernel = saved;
+
+	my_free (in);
+	my_free (out);
+
+	raw2384_benchmark_correct (false);
+	raw2384_benchmark_correct (true);
+
+	return;
+}
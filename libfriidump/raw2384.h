@@ -0,0 +1,56 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Conversion of the 2384-byte frames some drives keep in their cache to 2064-byte raw sectors.
+ */
+
+#ifndef RAW2384_H_INCLUDED
+#define RAW2384_H_INCLUDED
+
+#include "misc.h"
+#include <sys/types.h>
+
+/*! \brief Size of a frame as stored by the drive: 12 rows of 172 data bytes plus 10 PI bytes each, followed by 200 bytes holding one of the
+ * PO rows of its ECC block (182 bytes, with its own PI) */
+#define RAW2384_FRAME_SIZE 2384
+
+/*! \brief Number of frames of an ECC block, which share the PO parity */
+#define RAW2384_BLOCK_FRAMES 16
+
+/*! \brief Implementations of the de-interleaving code, see raw2384_set_kernel() */
+typedef enum {
+	RAW2384_KERNEL_AUTO,
+	RAW2384_KERNEL_REFERENCE,
+	RAW2384_KERNEL_SSE2,
+	RAW2384_KERNEL_AVX2,
+	RAW2384_KERNELS
+} raw2384_kernel;
+
+FRIIDUMPLIB_EXPORT u_int32_t raw2384_correct (u_int8_t *in, u_int32_t frames);
+FRIIDUMPLIB_EXPORT u_int32_t raw2384_deinterleave (u_int8_t *in, u_int32_t frames, u_int8_t *out);
+FRIIDUMPLIB_EXPORT void raw2384_add_parity (u_int8_t *block);
+FRIIDUMPLIB_EXPORT bool raw2384_set_kernel (raw2384_kernel k);
+FRIIDUMPLIB_EXPORT bool raw2384_self_test (bool verbose);
+FRIIDUMPLIB_EXPORT void raw2384_benchmark (void);
+void raw2384_init (void);
+
+#endif
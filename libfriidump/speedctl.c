@@ -0,0 +1,276 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Adaptive drive speed control, following the read errors across the disc.
+ *
+ * Reading too fast makes marginal discs fail, and the fastest speed that reads cleanly is usually not the same all over the disc: it depends on
+ * the radius, as the linear speed grows towards the outer edge, and on the layer. So the disc is split into zones by radius on each layer, and
+ * each zone has its own speed. A zone that is read for the first time starts from the speed of the zone that was read before it.
+ *
+ * The speed of the zone is lowered one step as soon as a read window needs retries, or when reading gets much slower than usual, which is how
+ * errors corrected by the drive itself show up. After enough clean blocks it is raised one step. When a raised speed fails again, the zone has
+ * to stay clean twice as long before the next attempt, so that it settles on the fastest speed that reads it without errors.
+ */
+
+#include "misc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "constants.h"
+#include "dvd_drive.h"
+#include "metrics.h"
+#include "speedctl.h"
+
+
+/*! \brief Number of zones each layer is split into, from the inner to the outer edge */
+#define SPEEDCTL_ZONES 8
+
+/*! \brief Speed used when no limit is given, meaning as fast as the drive can */
+#define SPEEDCTL_MAX_SPEED 0xFFFF
+
+/*! \brief Speeds that can be stepped through below the limit, in KB/s, from the fastest */
+static u_int32_t speedctl_steps[] = {
+	16 * 177, 12 * 177, 8 * 177, 6 * 177, 4 * 177, 3 * 177, 2 * 177, 1 * 177
+};
+
+#define SPEEDCTL_STEPS (sizeof (speedctl_steps) / sizeof (speedctl_steps[0]))
+
+/*! \brief Clean blocks needed before raising the speed of a zone, doubled at every failed attempt up to SPEEDCTL_MAX_CLEAN */
+#define SPEEDCTL_MIN_CLEAN 256
+#define SPEEDCTL_MAX_CLEAN 16384
+
+/*! \brief Number of blocks read time is measured over. Blocks found in the cache make single windows look much faster than the drive is */
+#define SPEEDCTL_GROUP_BLOCKS 40
+
+/*! \brief A group of blocks taking this many times the average time counts as an error */
+#define SPEEDCTL_SLOW_FACTOR 4
+
+/*! \brief Groups averaged at a new speed before they can count as slow */
+#define SPEEDCTL_WARMUP 4
+
+/*! \brief Weight of the last group in the average time per block, as 1/n */
+#define SPEEDCTL_AVG_GROUPS 8
+
+/*! \brief Level of a zone that was never read */
+#define SPEEDCTL_UNVISITED 0xFF
+
+
+struct speedctl_s {
+	disc *dsk;
+	u_int32_t speeds[SPEEDCTL_STEPS + 1];		//!< The speeds that can be used, from the fastest, in KB/s.
+	u_int32_t levels_no;				//!< The number of speeds.
+	u_int32_t sectors_no;
+	u_int32_t layerbreak;				//!< The first sector of the second layer, or sectors_no on single-layer discs.
+	u_int8_t level[2][SPEEDCTL_ZONES];		//!< Speed of each zone, as an index in <code>speeds</code>.
+	u_int32_t needed[2][SPEEDCTL_ZONES];		//!< Clean blocks each zone needs before its speed is raised.
+	int layer;					//!< The layer of the zone being read, or -1 before the first window.
+	int zone;					//!< The zone being read.
+	u_int32_t current;				//!< The level the drive is set to.
+	u_int32_t clean;				//!< Clean blocks since the last change or error.
+	bool raised;					//!< True if the last change raised the speed and no error was seen since.
+	u_int64_t group_usec;				//!< Time taken by the blocks of the current group.
+	u_int32_t group_blocks;				//!< Blocks read in the current group.
+	double usec_avg;				//!< Average time per block at the current speed.
+	u_int32_t samples;				//!< Groups in <code>usec_avg</code>.
+};
+
+
+/* Sets the drive to one of the speeds */
+static void speedctl_set_level (speedctl *c, u_int32_t level) {
+	metrics *m;
+
+	if (level != c -> current) {
+		m = dvd_get_metrics (disc_get_dvd (c -> dsk));
+		metrics_count (m, level > c -> current ? METRICS_COUNT_SPEED_DOWN : METRICS_COUNT_SPEED_UP);
+		debug ("Speed %s to %u KB/s", level > c -> current ? "lowered" : "raised", c -> speeds[level]);
+		disc_set_speed (c -> dsk, c -> speeds[level]);
+		disc_set_streaming_speed (c -> dsk, c -> speeds[level]);
+		c -> current = level;
+		c -> samples = 0;
+		c -> group_usec = 0;
+		c -> group_blocks = 0;
+	}
+
+	return;
+}
+
+
+/* Switches to the zone a sector is in. Second layers are taken to run from the outer edge back to the inner one (Opposite Track Path) */
+static void speedctl_enter_zone (speedctl *c, u_int32_t sector) {
+	int layer, zone;
+
+	if (sector < c -> layerbreak) {
+		layer = 0;
+		zone = (int) ((u_int64_t) sector * SPEEDCTL_ZONES / c -> layerbreak);
+	} else {
+		layer = 1;
+		zone = SPEEDCTL_ZONES - 1 - (int) ((u_int64_t) (sector - c -> layerbreak) * SPEEDCTL_ZONES / (c -> sectors_no - c -> layerbreak));
+	}
+	if (zone >= SPEEDCTL_ZONES)
+		zone = SPEEDCTL_ZONES - 1;
+	else if (zone < 0)
+		zone = 0;
+
+	if (layer != c -> layer || zone != c -> zone) {
+		if (c -> layer >= 0)
+			c -> level[c -> layer][c -> zone] = (u_int8_t) c -> current;
+		c -> layer = layer;
+		c -> zone = zone;
+		if (c -> level[layer][zone] == SPEEDCTL_UNVISITED)
+			c -> level[layer][zone] = (u_int8_t) c -> current;
+		else
+			speedctl_set_level (c, c -> level[layer][zone]);
+		c -> clean = 0;
+		c -> raised = false;
+	}
+
+	return;
+}
+
+
+/**
+ * Creates a speed controller. The drive is assumed to be reading at the given speed, which is never exceeded.
+ * @param d The disc structure.
+ * @param max_speed The fastest speed that can be used, in KB/s, or -1 for the fastest speed of the drive.
+ * @return The controller.
+ */
+speedctl *speedctl_new (disc *d, u_int32_t max_speed) {
+	speedctl *c;
+	disc_type type;
+	char *type_s;
+	u_int32_t i;
+
+	if (!(c = (speedctl *) malloc (sizeof (speedctl)))) {
+		error ("Cannot allocate speed controller");
+		return (NULL);
+	}
+	memset (c, 0, sizeof (speedctl));
+	c -> dsk = d;
+
+	c -> speeds[c -> levels_no++] = max_speed != -1 ? max_speed : SPEEDCTL_MAX_SPEED;
+	for (i = 0; i < SPEEDCTL_STEPS; i++) {
+		if (speedctl_steps[i] < c -> speeds[0])
+			c -> speeds[c -> levels_no++] = speedctl_steps[i];
+	}
+
+	/* Wii dual-layer discs do not report their layer break, which is in the middle */
+	c -> sectors_no = disc_get_sectors_no (d);
+	c -> layerbreak = disc_get_layerbreak (d);
+	disc_get_type (d, &type, &type_s);
+	if (type == DISC_TYPE_WII_DL && (c -> layerbreak == 0 || c -> layerbreak == -1))
+		c -> layerbreak = c -> sectors_no / 2;
+	if (c -> layerbreak == 0 || c -> layerbreak >= c -> sectors_no)
+		c -> layerbreak = c -> sectors_no;
+
+	memset (c -> level, SPEEDCTL_UNVISITED, sizeof (c -> level));
+	for (i = 0; i < SPEEDCTL_ZONES; i++) {
+		c -> needed[0][i] = SPEEDCTL_MIN_CLEAN;
+		c -> needed[1][i] = SPEEDCTL_MIN_CLEAN;
+	}
+	c -> layer = -1;
+	debug ("Adaptive speed between %u and %u KB/s, layer break at sector %u", c -> speeds[c -> levels_no - 1], c -> speeds[0], c -> layerbreak);
+
+	return (c);
+}
+
+
+/**
+ * Tells the controller how a read window went, changing the speed of the drive if needed.
+ * @param c The controller.
+ * @param sector The first sector of the window.
+ * @param blocks The number of blocks that were read.
+ * @param errors The number of retries needed, plus one if the window could not be read completely.
+ * @param usec The time the window took.
+ */
+void speedctl_update (speedctl *c, u_int32_t sector, u_int32_t blocks, u_int32_t errors, u_int64_t usec) {
+	double per_block;
+	u_int32_t *needed;
+
+	speedctl_enter_zone (c, sector);
+	needed = &(c -> needed[c -> layer][c -> zone]);
+
+	c -> group_usec += usec;
+	c -> group_blocks += blocks;
+	if (errors == 0 && c -> group_blocks >= SPEEDCTL_GROUP_BLOCKS) {
+		per_block = (double) c -> group_usec / c -> group_blocks;
+		if (c -> samples >= SPEEDCTL_WARMUP && per_block > c -> usec_avg * SPEEDCTL_SLOW_FACTOR) {
+			debug ("Blocks before sector %u took %.0f us each, %.0f on average", sector, per_block, c -> usec_avg);
+			errors = 1;
+		} else {
+			c -> usec_avg = c -> samples == 0 ? per_block : c -> usec_avg + (per_block - c -> usec_avg) / SPEEDCTL_AVG_GROUPS;
+			c -> samples++;
+		}
+		c -> group_usec = 0;
+		c -> group_blocks = 0;
+	}
+
+	if (errors > 0) {
+		/* Too fast: slow down, and wait longer before trying this speed again if it was just raised */
+		if (c -> raised && *needed < SPEEDCTL_MAX_CLEAN)
+			*needed *= 2;
+		c -> raised = false;
+		c -> clean = 0;
+		c -> group_usec = 0;
+		c -> group_blocks = 0;
+		if (c -> current + 1 < c -> levels_no)
+			speedctl_set_level (c, c -> current + 1);
+	} else {
+		c -> clean += blocks;
+		if (c -> clean >= *needed && c -> current > 0) {
+			speedctl_set_level (c, c -> current - 1);
+			c -> raised = true;
+			c -> clean = 0;
+		}
+	}
+
+	return;
+}
+
+
+/**
+ * Tells the speed the drive is currently set to.
+ * @param c The controller.
+ * @return The speed, in KB/s.
+ */
+u_int32_t speedctl_get_speed (speedctl *c) {
+	return (c -> speeds[c -> current]);
+}
+
+
+void *speedctl_destroy (speedctl *c) {
+	int layer, zone;
+
+	if (c) {
+		if (c -> layer >= 0)
+			c -> level[c -> layer][c -> zone] = (u_int8_t) c -> current;
+		for (layer = 0; layer < (c -> layerbreak < c -> sectors_no ? 2 : 1); layer++) {
+			for (zone = 0; zone < SPEEDCTL_ZONES; zone++) {
+				if (c -> level[layer][zone] != SPEEDCTL_UNVISITED) {
+					debug ("Layer %d, zone %d: %u KB/s", layer, zone, c -> speeds[c -> level[layer][zone]]);
+				}
+			}
+		}
+		my_free (c);
+	}
+
+	return (NULL);
+}
@@ -0,0 +1,48 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Adaptive drive speed control, following the read errors across the disc.
+ */
+
+#ifndef SPEEDCTL_H_INCLUDED
+#define SPEEDCTL_H_INCLUDED
+
+#include "misc.h"
+#include <sys/types.h>
+#include "disc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct speedctl_s speedctl;
+
+speedctl *speedctl_new (disc *d, u_int32_t max_speed);
+void speedctl_update (speedctl *c, u_int32_t sector, u_int32_t blocks, u_int32_t errors, u_int64_t usec);
+u_int32_t speedctl_get_speed (speedctl *c);
+void *speedctl_destroy (speedctl *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
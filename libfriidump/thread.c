@@ -0,0 +1,279 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Minimal portable threading layer (POSIX threads on Unix, native threads on Windows).
+ *
+ * Only the few primitives needed by the library are wrapped here: threads, mutexes, condition variables and one-time initialization, plus a couple of helpers to find
+ * out how many CPUs are available and to take timestamps for statistics.
+ */
+
+#include "misc.h"
+#include <stdlib.h>
+#include "thread.h"
+
+#ifndef WIN32
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+
+#ifdef WIN32
+/* Windows thread functions have a different prototype, so we need a trampoline */
+typedef struct {
+	my_thread_func func;
+	void *arg;
+} thread_start;
+
+
+static DWORD WINAPI my_thread_trampoline (LPVOID p) {
+	thread_start ts;
+
+	ts = *(thread_start *) p;
+	free (p);
+	ts.func (ts.arg);
+
+	return (0);
+}
+
+
+static BOOL CALLBACK my_once_trampoline (PINIT_ONCE o, PVOID p, PVOID *ctx) {
+	((my_once_func) p) ();
+
+	return (TRUE);
+}
+#endif
+
+
+/**
+ * Starts a new thread.
+ * @param t The thread handle.
+ * @param func The function the thread will run.
+ * @param arg The argument passed to <code>func</code>.
+ * @return true if the thread was started, false otherwise.
+ */
+bool my_thread_create (my_thread *t, my_thread_func func, void *arg) {
+	bool out;
+#ifdef WIN32
+	thread_start *ts;
+
+	if ((ts = (thread_start *) malloc (sizeof (thread_start)))) {
+		ts -> func = func;
+		ts -> arg = arg;
+		if ((*t = CreateThread (NULL, 0, my_thread_trampoline, ts, 0, NULL))) {
+			out = true;
+		} else {
+			free (ts);
+			out = false;
+		}
+	} else {
+		out = false;
+	}
+#else
+	out = pthread_create (t, NULL, func, arg) == 0;
+#endif
+
+	if (!out)
+		error ("Cannot create thread");
+
+	return (out);
+}
+
+
+void my_thread_join (my_thread t) {
+#ifdef WIN32
+	WaitForSingleObject (t, INFINITE);
+	CloseHandle (t);
+#else
+	pthread_join (t, NULL);
+#endif
+
+	return;
+}
+
+
+void my_mutex_init (my_mutex *m) {
+#ifdef WIN32
+	InitializeCriticalSection (m);
+#else
+	pthread_mutex_init (m, NULL);
+#endif
+
+	return;
+}
+
+
+void my_mutex_lock (my_mutex *m) {
+#ifdef WIN32
+	EnterCriticalSection (m);
+#else
+	pthread_mutex_lock (m);
+#endif
+
+	return;
+}
+
+
+void my_mutex_unlock (my_mutex *m) {
+#ifdef WIN32
+	LeaveCriticalSection (m);
+#else
+	pthread_mutex_unlock (m);
+#endif
+
+	return;
+}
+
+
+void my_mutex_destroy (my_mutex *m) {
+#ifdef WIN32
+	DeleteCriticalSection (m);
+#else
+	pthread_mutex_destroy (m);
+#endif
+
+	return;
+}
+
+
+void my_cond_init (my_cond *c) {
+#ifdef WIN32
+	InitializeConditionVariable (c);
+#else
+	pthread_cond_init (c, NULL);
+#endif
+
+	return;
+}
+
+
+void my_cond_wait (my_cond *c, my_mutex *m) {
+#ifdef WIN32
+	SleepConditionVariableCS (c, m, INFINITE);
+#else
+	pthread_cond_wait (c, m);
+#endif
+
+	return;
+}
+
+
+void my_cond_signal (my_cond *c) {
+#ifdef WIN32
+	WakeConditionVariable (c);
+#else
+	pthread_cond_signal (c);
+#endif
+
+	return;
+}
+
+
+void my_cond_broadcast (my_cond *c) {
+#ifdef WIN32
+	WakeAllConditionVariable (c);
+#else
+	pthread_cond_broadcast (c);
+#endif
+
+	return;
+}
+
+
+void my_cond_destroy (my_cond *c) {
+#ifndef WIN32
+	pthread_cond_destroy (c);
+#endif
+
+	return;
+}
+
+
+/**
+ * Runs a function exactly once, even if called concurrently from several threads. Callers return only after the function has completed.
+ * @param o The control variable, initialized with MY_ONCE_INIT.
+ * @param func The function.
+ */
+void my_once_run (my_once *o, my_once_func func) {
+#ifdef WIN32
+	InitOnceExecuteOnce (o, my_once_trampoline, (PVOID) func, NULL);
+#else
+	pthread_once (o, func);
+#endif
+
+	return;
+}
+
+
+/**
+ * Finds out how many CPUs are available.
+ * @return The number of online CPUs, at least 1.
+ */
+u_int32_t my_cpu_count (void) {
+	long n;
+#ifdef WIN32
+	SYSTEM_INFO si;
+
+	GetSystemInfo (&si);
+	n = (long) si.dwNumberOfProcessors;
+#elif defined (_SC_NPROCESSORS_ONLN)
+	n = sysconf (_SC_NPROCESSORS_ONLN);
+#else
+	n = 1;
+#endif
+
+	return (n > 0 ? (u_int32_t) n : 1);
+}
+
+
+/**
+ * Takes a timestamp, to be used for measuring intervals.
+ * @return The current time, in microseconds.
+ */
+u_int64_t my_time_usec (void) {
+	struct timeval now;
+
+	gettimeofday (&now, NULL);
+
+	return ((u_int64_t) now.tv_sec * 1000000 + now.tv_usec);
+}
+
+
+/**
+ * Suspends the calling thread.
+ * @param usec The time to sleep for, in microseconds.
+ */
+void my_sleep_usec (u_int64_t usec) {
+#ifdef WIN32
+	Sleep ((DWORD) (usec / 1000));
+#else
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while (nanosleep (&ts, &ts) < 0 && errno == EINTR)
+		;
+#endif
+
+	return;
+}
@@ -0,0 +1,73 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Minimal portable threading layer (POSIX threads on Unix, native threads on Windows).
+ */
+
+#ifndef THREAD_H_INCLUDED
+#define THREAD_H_INCLUDED
+
+#include "misc.h"
+#include <sys/types.h>
+
+#ifdef WIN32
+#include <windows.h>
+
+typedef HANDLE my_thread;
+typedef CRITICAL_SECTION my_mutex;
+typedef CONDITION_VARIABLE my_cond;
+typedef INIT_ONCE my_once;
+#define MY_ONCE_INIT INIT_ONCE_STATIC_INIT
+#else
+#include <pthread.h>
+
+typedef pthread_t my_thread;
+typedef pthread_mutex_t my_mutex;
+typedef pthread_cond_t my_cond;
+typedef pthread_once_t my_once;
+#define MY_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+typedef void *(*my_thread_func) (void *arg);
+typedef void (*my_once_func) (void);
+
+bool my_thread_create (my_thread *t, my_thread_func func, void *arg);
+void my_thread_join (my_thread t);
+
+void my_mutex_init (my_mutex *m);
+void my_mutex_lock (my_mutex *m);
+void my_mutex_unlock (my_mutex *m);
+void my_mutex_destroy (my_mutex *m);
+
+void my_cond_init (my_cond *c);
+void my_cond_wait (my_cond *c, my_mutex *m);
+void my_cond_signal (my_cond *c);
+void my_cond_broadcast (my_cond *c);
+void my_cond_destroy (my_cond *c);
+
+void my_once_run (my_once *o, my_once_func func);
+
+u_int32_t my_cpu_count (void);
+u_int64_t my_time_usec (void);
+void my_sleep_usec (u_int64_t usec);
+
+#endif
@@ -0,0 +1,183 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Automatic selection of the best dumping parameters for a drive.
+ *
+ * Which read method and window sizes work best depends on the drive firmware. The tuner reads a few sample ranges, spread across the whole disc
+ * (And thus across both layers of dual-layer discs), with every candidate combination and keeps the one with the best throughput, penalizing
+ * those that needed retries. The winner is saved as the profile of the drive model, which is then used by default.
+ */
+
+#include "misc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "constants.h"
+#include "thread.h"
+#include "tuner.h"
+
+
+/*! \brief Number of sample ranges read with each candidate */
+#define TUNER_SAMPLES 4
+
+/*! \brief Size of each sample range, enough for several reads with every method */
+#define TUNER_SAMPLE_SECTORS (SECTORS_PER_BLOCK * 5 * 8)
+
+/*! \brief How much an average of one retry per block reduces the score, WRT a retry-free candidate */
+#define TUNER_RETRY_PENALTY 4
+
+/*! \brief Requested/expected sectors tried with methods 0-6 */
+static u_int32_t tuner_ranges[][2] = {
+	{16, 16},
+	{27, 27},
+	{32, 32},
+	{48, 48}
+};
+
+
+/**
+ * Reads the sample ranges with a candidate combination.
+ * @param d The disc structure.
+ * @param p The combination to try.
+ * @param mb_hour Will hold the measured throughput.
+ * @param retry_rate Will hold the average number of retries per block.
+ * @return True if all the samples could be read.
+ */
+static bool tuner_measure (disc *d, dvd_profile *p, double *mb_hour, double *retry_rate) {
+	u_int32_t i, sector, start, sectors_no, retries, blocks;
+	u_int64_t t;
+	bool out;
+
+	*mb_hour = 0;
+	*retry_rate = 0;
+	disc_set_command (d, p -> command);
+	init_range (d, p -> sec_disc, p -> sec_mem);
+	out = disc_set_read_method (d, p -> method);
+
+	/* Blocks read by the previous candidates must be read again */
+	disc_cache_flush (d);
+
+	sectors_no = disc_get_sectors_no (d);
+	retries = disc_get_retries (d);
+	blocks = 0;
+	t = my_time_usec ();
+	for (i = 0; out && i < TUNER_SAMPLES; i++) {
+		/* Each sample is centered in one of TUNER_SAMPLES equal slices of the disc */
+		start = (u_int32_t) ((u_int64_t) sectors_no * (2 * i + 1) / (2 * TUNER_SAMPLES));
+		start -= start % SECTORS_PER_BLOCK;
+		for (sector = start; out && sector < start + TUNER_SAMPLE_SECTORS && sector < sectors_no; sector += SECTORS_PER_BLOCK, blocks++)
+			out = disc_read_sector (d, sector, NULL, NULL);
+	}
+	t = my_time_usec () - t;
+
+	if (out && blocks > 0) {
+		*mb_hour = (double) blocks * RAW_BLOCK_SIZE / 1024 / 1024 / ((double) (t > 0 ? t : 1) / 1000000) * 60 * 60;
+		*retry_rate = (double) (disc_get_retries (d) - retries) / blocks;
+	} else {
+		out = false;
+	}
+
+	return (out);
+}
+
+
+/**
+ * Tries all the candidate combinations of memory dump command, read method, requested/expected sectors and speed, then saves the best one as the
+ * profile of the drive and selects it. Supported drives only try their own memory dump command. The disc must have been initialized already.
+ * @param d The disc structure.
+ * @param speeds The speeds to try (Multipliers, -1 for the drive default), or NULL to only try the current one.
+ * @param speeds_no The number of speeds.
+ * @param progress A function that will be called after each candidate has been tried, or NULL.
+ * @param progress_data Data that will be passed to the progress function.
+ * @param best Will hold the best combination.
+ * @return True if at least a combination worked.
+ */
+bool tuner_run (disc *d, u_int32_t *speeds, u_int32_t speeds_no, tuner_progress_func progress, void *progress_data, dvd_profile *best) {
+	static u_int32_t current_speed = -1;
+	u_int32_t s, r, ranges, first_command, last_command;
+	double mb_hour, retry_rate, score, best_score;
+	dvd_profile p;
+	bool ok, out;
+
+	if (!speeds || speeds_no == 0) {
+		speeds = &current_speed;
+		speeds_no = 1;
+	}
+
+	if (disc_get_drive_support_status (d)) {
+		first_command = disc_get_command (d);
+		last_command = first_command;
+	} else {
+		first_command = 0;
+		last_command = 4;
+	}
+
+	out = false;
+	best_score = 0;
+	for (s = 0; s < speeds_no; s++) {
+		p.speed = speeds[s];
+		disc_set_speed (d, p.speed != -1 ? p.speed * 177 : -1);
+		disc_set_streaming_speed (d, p.speed != -1 ? p.speed * 177 : -1);
+
+		for (p.command = first_command; p.command <= last_command; p.command++) {
+			for (p.method = 0; p.method <= 9; p.method++) {
+				/* Methods 7-9 rely on the layout of the Hitachi cache */
+				if (p.method >= 7 && p.command != 2)
+					continue;
+
+				ranges = p.method <= 6 ? sizeof (tuner_ranges) / sizeof (tuner_ranges[0]) : 1;
+				for (r = 0; r < ranges; r++) {
+					p.sec_disc = p.method <= 6 ? tuner_ranges[r][0] : 16;
+					p.sec_mem = p.method <= 6 ? tuner_ranges[r][1] : 16;
+
+					if ((ok = tuner_measure (d, &p, &mb_hour, &retry_rate))) {
+						score = mb_hour / (1 + TUNER_RETRY_PENALTY * retry_rate);
+						debug ("Command %u, method %u (%u,%u), speed %d: %.2f MB/h, %.3f retries/block, score %.2f", p.command, p.method,
+							p.sec_disc, p.sec_mem, (int) p.speed, mb_hour, retry_rate, score);
+						if (!out || score > best_score) {
+							memcpy (best, &p, sizeof (dvd_profile));
+							best_score = score;
+							out = true;
+						}
+					}
+
+					if (progress)
+						progress (&p, ok, mb_hour, retry_rate, progress_data);
+				}
+			}
+		}
+	}
+
+	if (out) {
+		/* Leave the disc set up with the winner, and use it by default from now on */
+		disc_set_speed (d, best -> speed != -1 ? best -> speed * 177 : -1);
+		disc_set_streaming_speed (d, best -> speed != -1 ? best -> speed * 177 : -1);
+		disc_set_command (d, best -> command);
+		init_range (d, -1, -1);
+		dvd_save_profile (disc_get_dvd (d), best);
+		disc_set_read_method (d, best -> method);
+	} else {
+		error ("No working combination found");
+	}
+
+	return (out);
+}
@@ -0,0 +1,46 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Automatic selection of the best dumping parameters for a drive.
+ */
+
+#ifndef TUNER_H_INCLUDED
+#define TUNER_H_INCLUDED
+
+#include "misc.h"
+#include <sys/types.h>
+#include "disc.h"
+#include "dvd_drive.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*tuner_progress_func) (dvd_profile *p, bool ok, double mb_hour, double retry_rate, void *progress_data);
+
+FRIIDUMPLIB_EXPORT bool tuner_run (disc *d, u_int32_t *speeds, u_int32_t speeds_no, tuner_progress_func progress, void *progress_data, dvd_profile *best);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -37,6 +37,8 @@
 #include "constants.h"
 #include "byteorder.h"
 #include "ecma-267.h"
+#include "cpu.h"
+#include "thread.h"
 #include "unscrambler.h"
 
 // #define unscramblerdebug(...) debug (__VA_ARGS__);
@@ -45,6 +47,9 @@
 /*! \brief Size of the seeds cache (Do not touch) */
 #define MAX_SEEDS 4
 
+/*! \brief Number of block classes: the seed of a block only depends on its number modulo 16 */
+#define SEED_CLASSES 16
+
 /*! \brief Number of bytes of a sector on which the EDC is calculated */
 #define EDC_LENGTH (RAW_SECTOR_SIZE - 4)		/* The EDC value is contained in the bottom 4 bytes of a frame */
 
@@ -53,19 +58,76 @@
  */
 typedef struct t_seed {
     int seed;						//!< The seed, in numeric format.
-    unsigned char streamcipher[SECTOR_SIZE];		//!< The stream cipher generated from the seed through the LFSR.
+    unsigned char streamcipher[EDC_LENGTH];		//!< The stream cipher generated from the seed through the LFSR, preceded by 12 zero bytes so that it lines up with a frame.
+    u_int32_t edc;					//!< The EDC of the stream cipher.
 } t_seed;
 
 
+/*! \brief Offset of the scrambled data in a frame */
+#define SCRAMBLED_OFFSET 12
+
+/*! \brief A function that unscrambles a single frame.
+ *
+ * Writes SECTOR_SIZE bytes to out, taken from the unscrambled frame starting at offset off, and returns the EDC of the first EDC_LENGTH bytes
+ * of the frame <i>as it is</i>, i.e.: still scrambled. Since the EDC is linear, XOR'ing it with the EDC of the stream cipher gives the EDC of the
+ * unscrambled frame. The frame is never modified.
+ */
+typedef u_int32_t (*unscrambler_frame_func) (u_int8_t *in, u_int8_t *out, u_int8_t *streamcipher, int off);
+
+
 /*! \brief A structure that represents an unscrambler
  */
 struct unscrambler_s {
-	t_seed seeds[(MAX_SEEDS + 1) * 16];		//!< The seeds cache.
+	t_seed seeds[(MAX_SEEDS + 1) * SEED_CLASSES];	//!< The seeds cache: MAX_SEEDS slots per block class, followed by a terminator.
 	bool bruteforce_seeds;				//!< If true, whenever a seed for a sector is not cached, it will be found via a bruteforce attack, otherwise an error will be returned.
+	char *seed_file;				//!< If not NULL, the file seeds are persisted to whenever a new one is found.
+	u_int32_t threads;				//!< Number of threads used by unscrambler_unscramble_file().
+	u_int8_t disctype;				//!< The disc type, as set by unscrambler_set_disctype() (3 is a regular DVD, anything else a Nintendo disc).
 };
 
-void unscrambler_set_disctype (u_int8_t disc_type){
-	disctype = disc_type;
+
+/* Number of 16-sector blocks a worker reads, unscrambles and writes at a time (2 MB of raw data) */
+#define UNSCRAMBLER_CHUNK_BLOCKS 64
+
+/* Maximum number of threads used to unscramble a file */
+#define UNSCRAMBLER_MAX_THREADS 64
+
+
+/*! \brief Shared state of a parallel file unscrambling.
+ *
+ * The image is split into chunks of UNSCRAMBLER_CHUNK_BLOCKS blocks, which are handed out in order to the workers. Every worker has its own
+ * file handles and its own copy of the unscrambler, so that seed caches are not shared, and writes its results at their final offset. The seeds
+ * found by the workers are merged back into the unscrambler when they are done.
+ */
+typedef struct {
+	char *infile;
+	char *outfile;
+	my_off_t filesize;
+	u_int32_t total_blocks;
+	my_mutex lock;
+	my_cond cond;
+	u_int32_t next_block;		//!< The first block of the next chunk to be handed out.
+	u_int32_t blocks_done;		//!< Number of blocks that have been processed.
+	u_int32_t running;		//!< Number of workers that have not terminated yet.
+	bool failed;			//!< Set when a block cannot be unscrambled or written, so that no more chunks are handed out.
+	u_int32_t failed_sector;	//!< The first sector of the lowest block that failed.
+} unscrambler_job;
+
+
+/*! \brief A worker of a parallel file unscrambling.
+ */
+typedef struct {
+	unscrambler_job *job;
+	unscrambler *u;			//!< The worker's own copy of the unscrambler.
+} unscrambler_worker;
+
+/**
+ * Sets the type of the disc the unscrambler will be used with, as DVDs and Nintendo discs store user data at different offsets.
+ * @param u The unscrambler structure.
+ * @param disc_type The disc type (3 is a regular DVD, anything else a Nintendo disc).
+ */
+void unscrambler_set_disctype (unscrambler *u, u_int8_t disc_type){
+	u -> disctype = disc_type;
 //	fprintf (stdout,"%d",disctype);
 }
 
@@ -76,7 +138,6 @@ void unscrambler_set_disctype (u_int8_t disc_type){
  * @return A structure representing the added seed, or NULL if it could not be added.
  */
 static t_seed *add_seed (t_seed *seeds, unsigned short seed) {
-	int i;
 	t_seed *out;
 
  	unscramblerdebug ("Caching seed %04x\n", seed);
@@ -85,10 +146,9 @@ static t_seed *add_seed (t_seed *seeds, unsigned short seed) {
 		out = NULL;
 	} else {
 		seeds -> seed = seed;
-
-		LFSR_init (seed);
-		for (i = 0; i < SECTOR_SIZE; i++)
-			seeds -> streamcipher[i] = LFSR_byte ();
+		memset (seeds -> streamcipher, 0, SCRAMBLED_OFFSET);
+		LFSR_stream (seed, seeds -> streamcipher + SCRAMBLED_OFFSET, SECTOR_SIZE);
+		seeds -> edc = LFSR_stream_edc (seed);
 
 		out = seeds;
 	}
@@ -98,30 +158,208 @@ static t_seed *add_seed (t_seed *seeds, unsigned short seed) {
 
 
 /**
- * Tests if the specified seed is the one used for the specified sector block: the check is done comparing the generated EDC with the one at the bottom of each
- * sector. Sectors are processed in blocks, as the same seed is used for 16 consecutive sectors.
+ * Calculates the difference between the EDC of the first sector of a scrambled block and the EDC stored at its bottom. As the EDC is linear,
+ * this is the EDC of the keystream the sector was scrambled with.
  * @param buf The sector.
+ * @return The EDC difference, to be used with test_seed().
+ */
+static u_int32_t get_edc_diff (u_int8_t *buf) {
+	return (edc_calc (0x00000000, buf, EDC_LENGTH) ^ my_ntohl (*((u_int32_t *) (&buf[EDC_LENGTH]))));
+}
+
+
+/**
+ * Tests if the specified seed is the one used for the specified sector block: the check is done comparing the EDC of the keystream the
+ * seed generates with the EDC difference of the first sector of the block. Sectors are processed in blocks, as the same seed is used for 16
+ * consecutive sectors.
+ * @param edc_diff The EDC difference of the sector, as returned by get_edc_diff().
  * @param j The seed.
  * @return true if the seed is correct, false otherwise.
  */
-static bool test_seed (u_int8_t *buf, int j) {
+static bool test_seed (u_int32_t edc_diff, int j) {
+	return (LFSR_stream_edc (j) == edc_diff);
+}
+
+
+static u_int32_t unscramble_frame_reference (u_int8_t *in, u_int8_t *out, u_int8_t *streamcipher, int off) {
 	int i;
 	u_int8_t tmp[RAW_SECTOR_SIZE];
-	u_int32_t edc_calculated, edc_correct;
+	u_int32_t *_4bin, *_4cipher;
+
+	memcpy (tmp, in, RAW_SECTOR_SIZE);
+	_4bin = (u_int32_t *) &tmp[SCRAMBLED_OFFSET];
+	_4cipher = (u_int32_t *) &streamcipher[SCRAMBLED_OFFSET];
+	for (i = 0; i < 512; i++)		/* Well, the scrambling algorithm is just a bitwise XOR... */
+		_4bin[i] ^= _4cipher[i];
+	memcpy (out, tmp + off, SECTOR_SIZE);
+
+	return (edc_calc (0x00000000, in, EDC_LENGTH));
+}
+
+
+#ifdef CPU_X86_DISPATCH
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#include <immintrin.h>
+
+/* EDC folding constants, see ecma-267.c */
+static unsigned long long fold_k128[2], fold_k512[2];
+
+/* The SIMD kernels below run a single loop over the frame: each iteration XORs 64 bytes of the output and folds 64 bytes of the frame into four
+   128-bit EDC accumulators with carry-less multiplications. The two are independent, so they overlap nicely. */
+#define FOLD(x, k, d) _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), _mm_clmulepi64_si128(x, k, 0x00)), d)
+#define LOAD_BE(p) _mm_shuffle_epi8 (_mm_loadu_si128 ((__m128i *) (p)), swap)
+
+#define EDC_FOLD_BEGIN \
+	swap = _mm_set_epi8 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); \
+	k128 = _mm_set_epi64x (fold_k128[1], fold_k128[0]); \
+	k512 = _mm_set_epi64x (fold_k512[1], fold_k512[0]); \
+	x0 = LOAD_BE (in); \
+	x1 = LOAD_BE (in + 16); \
+	x2 = LOAD_BE (in + 32); \
+	x3 = LOAD_BE (in + 48);
+
+#define EDC_FOLD_STEP(p) \
+	x0 = FOLD (x0, k512, LOAD_BE (in + (p))); \
+	x1 = FOLD (x1, k512, LOAD_BE (in + (p) + 16)); \
+	x2 = FOLD (x2, k512, LOAD_BE (in + (p) + 32)); \
+	x3 = FOLD (x3, k512, LOAD_BE (in + (p) + 48));
+
+/* 2048 bytes have been folded, the remaining 12 go through the tables */
+#define EDC_FOLD_END \
+	x0 = FOLD (x0, k128, x1); \
+	x0 = FOLD (x0, k128, x2); \
+	x0 = FOLD (x0, k128, x3); \
+	_mm_storeu_si128 ((__m128i *) tmp, _mm_shuffle_epi8 (x0, swap)); \
+	return (edc_calc (edc_calc (0x00000000, tmp, sizeof (tmp)), in + SECTOR_SIZE, EDC_LENGTH - SECTOR_SIZE));
+
+
+__attribute__((target("sse2,ssse3,pclmul")))
+static u_int32_t unscramble_frame_sse2 (u_int8_t *in, u_int8_t *out, u_int8_t *streamcipher, int off) {
+	__m128i swap, k128, k512, x0, x1, x2, x3;
+	u_int8_t tmp[16];
+	int p, i;
+
+	EDC_FOLD_BEGIN
+	for (p = 0; p < SECTOR_SIZE; p += 64) {
+		if (p > 0) {
+			EDC_FOLD_STEP (p)
+		}
+		for (i = p; i < p + 64; i += 16)
+			_mm_storeu_si128 ((__m128i *) (out + i), _mm_xor_si128 (_mm_loadu_si128 ((__m128i *) (in + off + i)), _mm_loadu_si128 ((__m128i *) (streamcipher + off + i))));
+	}
+	EDC_FOLD_END
+}
+
+
+__attribute__((target("avx2,pclmul")))
+static u_int32_t unscramble_frame_avx2 (u_int8_t *in, u_int8_t *out, u_int8_t *streamcipher, int off) {
+	__m128i swap, k128, k512, x0, x1, x2, x3;
+	u_int8_t tmp[16];
+	int p;
+
+	EDC_FOLD_BEGIN
+	for (p = 0; p < SECTOR_SIZE; p += 64) {
+		if (p > 0) {
+			EDC_FOLD_STEP (p)
+		}
+		_mm256_storeu_si256 ((__m256i *) (out + p), _mm256_xor_si256 (_mm256_loadu_si256 ((__m256i *) (in + off + p)), _mm256_loadu_si256 ((__m256i *) (streamcipher + off + p))));
+		_mm256_storeu_si256 ((__m256i *) (out + p + 32), _mm256_xor_si256 (_mm256_loadu_si256 ((__m256i *) (in + off + p + 32)), _mm256_loadu_si256 ((__m256i *) (streamcipher + off + p + 32))));
+	}
+	EDC_FOLD_END
+}
+
+
+__attribute__((target("avx512f,avx512bw,pclmul")))
+static u_int32_t unscramble_frame_avx512 (u_int8_t *in, u_int8_t *out, u_int8_t *streamcipher, int off) {
+	__m128i swap, k128, k512, x0, x1, x2, x3;
+	u_int8_t tmp[16];
+	int p;
+
+	EDC_FOLD_BEGIN
+	for (p = 0; p < SECTOR_SIZE; p += 64) {
+		if (p > 0) {
+			EDC_FOLD_STEP (p)
+		}
+		_mm512_storeu_si512 ((void *) (out + p), _mm512_xor_si512 (_mm512_loadu_si512 ((void *) (in + off + p)), _mm512_loadu_si512 ((void *) (streamcipher + off + p))));
+	}
+	EDC_FOLD_END
+}
+#endif
+
+
+static const char *unscrambler_kernel_names[UNSCRAMBLER_KERNELS] = {
+	"auto", "reference", "sse2", "avx2", "avx512"
+};
+
+/*! \brief The kernel used to unscramble frames */
+static unscrambler_frame_func unscramble_frame_kernel = unscramble_frame_reference;
+
+/*! \brief True once a kernel has been selected, either automatically or by the user */
+static bool unscramble_frame_kernel_selected = false;
+
+/*! \brief Makes sure the tables shared by all unscramblers are built only once */
+static my_once unscrambler_tables_once = MY_ONCE_INIT;
+
+
+/**
+ * Selects the kernel used to unscramble frames.
+ * @param k The kernel, or UNSCRAMBLER_KERNEL_AUTO to select the fastest one supported by the CPU.
+ * @return True if the kernel was selected, false if it is not supported by the CPU.
+ */
+bool unscrambler_set_kernel (unscrambler_kernel k) {
+	u_int32_t f, needed;
 	bool out;
 
-	memcpy (tmp, buf, RAW_SECTOR_SIZE);
+	f = cpu_get_features ();
+	needed = CPU_FEATURE_SSSE3 | CPU_FEATURE_PCLMUL;
+	if (k == UNSCRAMBLER_KERNEL_AUTO) {
+		/* The AVX-512 kernel is not picked automatically: the loop is bound by the EDC folding, so wider XORs do not help, and they might
+		   lower the clock on some CPUs */
+		if ((f & (needed | CPU_FEATURE_AVX2)) == (needed | CPU_FEATURE_AVX2))
+			k = UNSCRAMBLER_KERNEL_AVX2;
+		else if ((f & (needed | CPU_FEATURE_SSE2)) == (needed | CPU_FEATURE_SSE2))
+			k = UNSCRAMBLER_KERNEL_SSE2;
+		else
+			k = UNSCRAMBLER_KERNEL_REFERENCE;
+	}
 
-	LFSR_init (j);
-	for (i = 12; i < EDC_LENGTH; i++)
-		tmp[i] ^= LFSR_byte ();
+#ifdef CPU_X86_DISPATCH
+	edc_get_fold_constants (fold_k128, fold_k512);
+#endif
 
-	edc_calculated = edc_calc (0x00000000, tmp, EDC_LENGTH);
-	edc_correct = my_ntohl (*((u_int32_t *) (&tmp[EDC_LENGTH])));
-	if (edc_calculated == edc_correct)
-		out = true;
-	else
+	out = true;
+	switch (k) {
+		case UNSCRAMBLER_KERNEL_REFERENCE:
+			unscramble_frame_kernel = unscramble_frame_reference;
+			break;
+#ifdef CPU_X86_DISPATCH
+		case UNSCRAMBLER_KERNEL_SSE2:
+			needed |= CPU_FEATURE_SSE2;
+			unscramble_frame_kernel = unscramble_frame_sse2;
+			break;
+		case UNSCRAMBLER_KERNEL_AVX2:
+			needed |= CPU_FEATURE_AVX2;
+			unscramble_frame_kernel = unscramble_frame_avx2;
+			break;
+		case UNSCRAMBLER_KERNEL_AVX512:
+			needed |= CPU_FEATURE_AVX512BW;
+			unscramble_frame_kernel = unscramble_frame_avx512;
+			break;
+#endif
+		default:
+			out = false;
+			break;
+	}
+
+	if (out && k != UNSCRAMBLER_KERNEL_REFERENCE && (f & needed) != needed) {
+		unscramble_frame_kernel = unscramble_frame_reference;
 		out = false;
+	}
+	if (out)
+		debug ("Using %s kernel to unscramble frames", unscrambler_kernel_names[k]);
+	unscramble_frame_kernel_selected = true;
 
 	return (out);
 }
@@ -130,39 +368,34 @@ static bool test_seed (u_int8_t *buf, int j) {
 /**
  * Unscramble a complete block, using an already-cached seed.
  * @param seed The seed to use for the unscrambling.
+ * @param disctype The disc type.
  * @param _bin The 16-sector block to unscramble (RAW_BLOCK_SIZE).
  * @param _bout The unscrambled 16-sector block (BLOCK_SIZE).
  * @return True if the unscrambling was successful, false otherwise.
  */
-static bool unscramble_frame (t_seed *seed, u_int8_t *_bin, u_int8_t *_bout) {
-	int i, j;
-	u_int8_t tmp[RAW_SECTOR_SIZE], *bin, *bout;
-	u_int32_t *_4bin, *_4cipher, edc_calculated, edc_correct;
+static bool unscramble_frame (t_seed *seed, u_int8_t disctype, u_int8_t *_bin, u_int8_t *_bout) {
+	int i, j, off;
+	u_int8_t *bin, *bout;
+	u_int32_t edc_calculated, edc_correct;
 	bool out;
 
+	/* DVD: copy 2048 bytes (starting from CPR_MAI), Nintendo: copy 2048 bytes (up to CPR_MAI) */
+	off = disctype == 3 ? 12 : 6;
+
 	out = true;
 	for(j = 0; j < 16; j++) {
 		bin = &_bin[RAW_SECTOR_SIZE * j];
 		bout = &_bout[SECTOR_SIZE * j];
 
-		memcpy (tmp, bin, RAW_SECTOR_SIZE);
-		_4bin = (u_int32_t *) &tmp[12];		/* Scrambled data begin at byte 12 */
-		_4cipher = (u_int32_t *) seed -> streamcipher;
-		for (i = 0; i < 512; i++)		/* Well, the scrambling algorithm is just a bitwise XOR... */
-			_4bin[i] ^= _4cipher[i];
+		edc_calculated = unscramble_frame_kernel (bin, bout, seed -> streamcipher, off) ^ seed -> edc;
 
-		//memcpy (bout, tmp + 6, SECTOR_SIZE); // copy CPR_MAI bytes
-
-		if (disctype==3) { //Regular
-			memcpy (bout, tmp + 12, SECTOR_SIZE); // DVD: copy 2048 bytes (starting from CPR_MAI)
-		}
-		else { //Nintendo
-			memcpy (bout, tmp + 6, SECTOR_SIZE);  // Nintendo: copy 2048 bytes (up to CPR_MAI)
-			memcpy (&_bin[(RAW_SECTOR_SIZE * j)+2054], &tmp[2054], 6);
+		if (disctype != 3) {
+			/* Nintendo: the bytes following user data are stored unscrambled in the raw frame, too */
+			for (i = SECTOR_SIZE + 6; i < EDC_LENGTH; i++)
+				bin[i] ^= seed -> streamcipher[i];
 		}
 
-		edc_calculated = edc_calc (0x00000000, tmp, EDC_LENGTH);
-		edc_correct = my_ntohl (*((u_int32_t *) (&tmp[EDC_LENGTH])));
+		edc_correct = my_ntohl (*((u_int32_t *) (&bin[EDC_LENGTH])));
 		if (edc_calculated != edc_correct) {
 			debug ("Bad EDC (%08x), must be %08x (sector = %d)", edc_calculated, edc_correct, j);
 			out = false;
@@ -180,13 +413,167 @@ static bool unscramble_frame (t_seed *seed, u_int8_t *_bin, u_int8_t *_bout) {
 static void unscrambler_init_seeds (unscrambler *u) {
 	int i, j;
 
-	for (i = 0; i < 16; i++) {
+	for (i = 0; i < SEED_CLASSES; i++) {
 		for (j = 0; j < MAX_SEEDS; j++)
-			u -> seeds[i * MAX_SEEDS + j].seed = -1;
+			u -> seeds[i * (MAX_SEEDS + 1) + j].seed = -1;
+
+		/* Terminator, so that add_seed() does not overflow into the next class */
+		u -> seeds[i * (MAX_SEEDS + 1) + j].seed = -2;
+	}
+
+	return;
+}
+
+
+/**
+ * Writes all the cached seeds to a file, replacing it atomically.
+ * @param u The unscrambler structure.
+ * @param filename The file.
+ * @return true if the seeds could be saved.
+ */
+bool unscrambler_save_seeds (unscrambler *u, char *filename) {
+	t_seed *seeds;
+	char *tmp;
+	size_t len;
+	FILE *fp;
+	bool out;
+	int i;
+
+	/* Several unscramblers can be working on the same game, so each one needs its own temporary file */
+	len = strlen (filename) + 5 + 17;
+	if (!(tmp = (char *) malloc (len))) {
+		out = false;
+	} else {
+		snprintf (tmp, len, "%s.%lx.tmp", filename, (unsigned long) (size_t) u);
+		if (!(fp = fopen (tmp, "w"))) {
+			out = false;
+		} else {
+			fprintf (fp, "# FriiDump seed cache: block number modulo 16, followed by the seeds used for it\n");
+			for (i = 0; i < SEED_CLASSES; i++) {
+				fprintf (fp, "%d", i);
+				for (seeds = &(u -> seeds[i * (MAX_SEEDS + 1)]); seeds -> seed >= 0; seeds++)
+					fprintf (fp, " %04x", seeds -> seed);
+				fprintf (fp, "\n");
+			}
+			out = fclose (fp) == 0;
+#ifdef WIN32
+			remove (filename);
+#endif
+			if (out)
+				out = rename (tmp, filename) == 0;
+			else
+				remove (tmp);
+		}
+		free (tmp);
+	}
+
+	if (!out)
+		warning ("Cannot save seeds to \"%s\"", filename);
+
+	return (out);
+}
+
+
+/**
+ * Adds a seed to the cache of a block class, unless it is already there.
+ * @param u The unscrambler structure.
+ * @param class The block class (Block number modulo 16).
+ * @param seed The seed.
+ * @return true if the seed was added.
+ */
+static bool unscrambler_cache_seed (unscrambler *u, int class, unsigned short seed) {
+	t_seed *seeds;
+
+	for (seeds = &(u -> seeds[class * (MAX_SEEDS + 1)]); seeds -> seed >= 0 && seeds -> seed != seed; seeds++)
+		;
+
+	return (seeds -> seed == -1 && add_seed (seeds, seed));
+}
+
 
-		u -> seeds[i * MAX_SEEDS + j].seed = -2;	// TODO Check what this does
+/**
+ * Adds the seeds saved by unscrambler_save_seeds() to the cache. Seeds that are already cached are skipped.
+ * @param u The unscrambler structure.
+ * @param filename The file.
+ * @return The number of seeds added to the cache.
+ */
+u_int32_t unscrambler_load_seeds (unscrambler *u, char *filename) {
+	char line[256], *p, *end;
+	u_int32_t out;
+	long i, seed;
+	FILE *fp;
+
+	out = 0;
+	if ((fp = fopen (filename, "r"))) {
+		while (fgets (line, sizeof (line), fp)) {
+			if (line[0] == '#' || (i = strtol (line, &end, 10)) < 0 || i >= SEED_CLASSES || end == line)
+				continue;
+
+			for (p = end; (seed = strtol (p, &end, 16)) >= 0 && seed <= 0x7FFF && end != p; p = end) {
+				if (unscrambler_cache_seed (u, (int) i, (unsigned short) seed))
+					out++;
+			}
+		}
+		fclose (fp);
+		debug ("Loaded %u seeds from \"%s\"", out, filename);
 	}
 
+	return (out);
+}
+
+
+/**
+ * Adds the seeds cached by another unscrambler to the cache.
+ * @param u The unscrambler structure.
+ * @param from The unscrambler to take the seeds from.
+ * @return The number of seeds added to the cache.
+ */
+static u_int32_t unscrambler_merge_seeds (unscrambler *u, unscrambler *from) {
+	t_seed *seeds;
+	u_int32_t out;
+	int i;
+
+	out = 0;
+	for (i = 0; i < SEED_CLASSES; i++) {
+		for (seeds = &(from -> seeds[i * (MAX_SEEDS + 1)]); seeds -> seed >= 0; seeds++) {
+			if (unscrambler_cache_seed (u, i, (unsigned short) seeds -> seed))
+				out++;
+		}
+	}
+
+	return (out);
+}
+
+
+/**
+ * Makes the unscrambler persist its seeds. Seeds already in the file are loaded immediately, and the file is updated whenever a new seed is
+ * found.
+ * @param u The unscrambler structure.
+ * @param filename The file, or NULL to stop persisting seeds.
+ * @return The number of seeds that were loaded from the file.
+ */
+u_int32_t unscrambler_set_seed_file (unscrambler *u, char *filename) {
+	u_int32_t out;
+
+	my_free (u -> seed_file);
+	if (filename) {
+		my_strdup (u -> seed_file, filename);
+		out = unscrambler_load_seeds (u, filename);
+	} else {
+		out = 0;
+	}
+
+	return (out);
+}
+
+
+/* Selects kernels and builds the keystream EDC table, before unscramblers can be used from more threads */
+static void unscrambler_init_tables (void) {
+	edc_init ();
+	LFSR_edc_init ();
+	if (!unscramble_frame_kernel_selected)
+		unscrambler_set_kernel (UNSCRAMBLER_KERNEL_AUTO);
+
 	return;
 }
 
@@ -201,6 +588,11 @@ unscrambler *unscrambler_new (void) {
 	u = (unscrambler *) malloc (sizeof (unscrambler));
 	unscrambler_init_seeds (u);
 	u -> bruteforce_seeds = true;
+	u -> seed_file = NULL;
+	u -> threads = my_cpu_count ();
+	u -> disctype = 0;
+
+	my_once_run (&unscrambler_tables_once, unscrambler_init_tables);
 
 	return (u);
 }
@@ -212,12 +604,150 @@ unscrambler *unscrambler_new (void) {
  * @return NULL.
  */
 void *unscrambler_destroy (unscrambler *u) {
+	my_free (u -> seed_file);
 	my_free (u);
 
 	return (NULL);
 }
 
 
+/**
+ * Checks that the optimized code paths used for unscrambling give the same results as the reference ones.
+ * @param verbose If true, results will be printed to stdout.
+ * @return True if all tests passed, false otherwise.
+ */
+bool unscrambler_self_test (bool verbose) {
+	u_int8_t *in, ref_6[SECTOR_SIZE], ref_12[SECTOR_SIZE], out_6[SECTOR_SIZE], out_12[SECTOR_SIZE];
+	u_int32_t i, r, edc;
+	unscrambler_frame_func saved;
+	unscrambler_kernel k;
+	t_seed seed;
+	bool out;
+
+	if (verbose)
+		printf ("CPU features: %s\n", cpu_get_features_string ());
+
+	out = edc_self_test (verbose) == 0 && LFSR_self_test (verbose) == 0;
+
+	/* All frame kernels must agree with the reference one, both on data and on EDC */
+	if (out) {
+		in = (u_int8_t *) malloc (RAW_SECTOR_SIZE);
+		for (i = 0, r = 0x2468ACE1; i < RAW_SECTOR_SIZE; i++) {
+			r = r * 1103515245 + 12345;
+			in[i] = (u_int8_t) (r >> 16);
+		}
+		seed.seed = -1;
+		add_seed (&seed, 0x1234);
+		unscramble_frame_reference (in, ref_6, seed.streamcipher, 6);
+		edc = unscramble_frame_reference (in, ref_12, seed.streamcipher, 12);
+
+		saved = unscramble_frame_kernel;
+		for (k = UNSCRAMBLER_KERNEL_REFERENCE + 1; k < UNSCRAMBLER_KERNELS && out; k++) {
+			if (!unscrambler_set_kernel (k)) {
+				if (verbose)
+					printf ("  Unscrambler %s kernel: not supported\n", unscrambler_kernel_names[k]);
+			} else {
+				if (verbose)
+					printf ("  Unscrambler %s kernel: ", unscrambler_kernel_names[k]);
+				out = unscramble_frame_kernel (in, out_6, seed.streamcipher, 6) == edc && memcmp (out_6, ref_6, SECTOR_SIZE) == 0 &&
+					unscramble_frame_kernel (in, out_12, seed.streamcipher, 12) == edc && memcmp (out_12, ref_12, SECTOR_SIZE) == 0;
+				if (verbose)
+					printf (out ? "passed\n" : "failed\n");
+			}
+		}
+		unscramble_frame_kernel = saved;
+		my_free (in);
+	}
+
+	return (out);
+}
+
+
+/* Runs a function on a buffer of frames repeatedly for a while, returns throughput in GB/s */
+static double unscrambler_measure (unscrambler_frame_func kernel, u_int8_t *in, u_int8_t *out, t_seed *seed, u_int32_t frames) {
+	u_int64_t start, elapsed;
+	u_int32_t i, rounds;
+	volatile u_int32_t sink;
+
+	start = my_time_usec ();
+	rounds = 0;
+	do {
+		for (i = 0; i < frames; i++) {
+			if (kernel)
+				sink = kernel (in + i * RAW_SECTOR_SIZE, out + i * SECTOR_SIZE, seed -> streamcipher, 6);
+			else
+				sink = edc_calc (0x00000000, in + i * RAW_SECTOR_SIZE, EDC_LENGTH);
+		}
+		rounds++;
+		elapsed = my_time_usec () - start;
+	} while (elapsed < 250000);
+	(void) sink;
+
+	return ((double) rounds * frames * RAW_SECTOR_SIZE / elapsed / 1000);
+}
+
+
+/**
+ * Measures the throughput of all the EDC and unscrambling kernels supported by the CPU, printing results to stdout.
+ */
+void unscrambler_benchmark (void) {
+	u_int8_t *in, *out;
+	u_int32_t i, frames;
+	unscrambler_frame_func saved;
+	unscrambler_kernel k;
+	edc_kernel ek, saved_edc;
+	t_seed seed;
+
+	/* Enough frames to get out of L1, but not out of L2 */
+	frames = 64;
+	in = (u_int8_t *) malloc (frames * RAW_SECTOR_SIZE);
+	out = (u_int8_t *) malloc (frames * SECTOR_SIZE);
+	for (i = 0; i < frames * RAW_SECTOR_SIZE; i++)
+		in[i] = (u_int8_t) (i * 7 + (i >> 11));
+	seed.seed = -1;
+	add_seed (&seed, 0x1234);
+
+	printf ("CPU features: %s\n", cpu_get_features_string ());
+
+	saved_edc = edc_get_kernel ();
+	for (ek = EDC_KERNEL_REFERENCE; ek < EDC_KERNELS; ek++) {
+		if (edc_set_kernel (ek) == 0)
+			printf ("  EDC %-20s %6.2f GB/s\n", edc_kernel_name (ek), unscrambler_measure (NULL, in, out, &seed, frames));
+	}
+	edc_set_kernel (saved_edc);
+
+	saved = unscramble_frame_kernel;
+	for (k = UNSCRAMBLER_KERNEL_REFERENCE; k < UNSCRAMBLER_KERNELS; k++) {
+		if (unscrambler_set_kernel (k))
+			printf ("  Unscrambler %-12s %6.2f GB/s\n", unscrambler_kernel_names[k], unscrambler_measure (unscramble_frame_kernel, in, out, &seed, frames));
+	}
+	unscramble_frame_kernel = saved;
+
+	my_free (in);
+	my_free (out);
+
+	return;
+}
+
+
+/**
+ * Sets how many threads unscrambler_unscramble_file() will use.
+ * @param u The unscrambler structure.
+ * @param threads The number of threads. 1 processes the file in the calling thread, one chunk of UNSCRAMBLER_CHUNK_BLOCKS blocks at a time. The
+ * default is the number of CPUs.
+ */
+void unscrambler_set_threads (unscrambler *u, u_int32_t threads) {
+	if (threads < 1)
+		threads = 1;
+	else if (threads > UNSCRAMBLER_MAX_THREADS)
+		threads = UNSCRAMBLER_MAX_THREADS;
+	u -> threads = threads;
+	debug ("Unscrambling with %u thread(s)", threads);
+
+	return;
+}
+
+
 void unscrambler_set_bruteforce (unscrambler *u, bool b) {
 	u -> bruteforce_seeds = b;
 	debug ("Seed bruteforcing %s", b ? "enabled" : "disabled");
@@ -237,17 +767,19 @@ void unscrambler_set_bruteforce (unscrambler *u, bool b) {
 bool unscrambler_unscramble_16sectors (unscrambler *u, u_int32_t sector_no, u_int8_t *inbuf, u_int8_t *outbuf) {
 	t_seed *seeds;
 	t_seed *current_seed;
+	u_int32_t edc_diff;
 	int j;
 	bool out;
 
 	out = true;
+	edc_diff = get_edc_diff (inbuf);
 
-	seeds = &(u -> seeds[((sector_no / 16) & 0x0F) * MAX_SEEDS]);
+	seeds = &(u -> seeds[((sector_no / 16) & 0x0F) * (MAX_SEEDS + 1)]);
 
 	/* Try to find the seed used for this sector */
 	current_seed = NULL;
 	while (!current_seed && (seeds -> seed) >= 0) {
-		if (test_seed (inbuf, seeds -> seed))
+		if (test_seed (edc_diff, seeds -> seed))
 			current_seed = seeds;
 		else
 			seeds++;
@@ -257,22 +789,22 @@ bool unscrambler_unscramble_16sectors (unscrambler *u, u_int32_t sector_no, u_in
 		/* The seed is not cached, yet. Try to find it with brute force... */
 		unscramblerdebug ("Brute-forcing seed for sector %d...", sector_no);
 
-		for (j = 0; !current_seed && j < 0x7FFF; j++) {
-			if (test_seed (inbuf, j)) {
-				if (!(current_seed = add_seed (seeds, j))) {
-					error ("No enough cache space for caching seed");
-					out = false;
-				}
+		if ((j = LFSR_find_seed (edc_diff)) >= 0) {
+			if (!(current_seed = add_seed (seeds, j))) {
+				error ("No enough cache space for caching seed");
+				out = false;
+			} else if (u -> seed_file) {
+				unscrambler_save_seeds (u, u -> seed_file);
 			}
 		}
 
 		if (current_seed)
-			unscramblerdebug ("Seed found: %04x", --j);
+			unscramblerdebug ("Seed found: %04x", j);
 	}
 
 	if (current_seed) {
 		/* OK, somehow seed was found: unscramble frame, write it and go on */
-		if (!unscramble_frame (current_seed, inbuf, outbuf)) {
+		if (!unscramble_frame (current_seed, u -> disctype, inbuf, outbuf)) {
 			error ("Error unscrambling frame %u\n", sector_no);
 			out = false;
 		} else {
@@ -289,25 +821,22 @@ bool unscrambler_unscramble_16sectors (unscrambler *u, u_int32_t sector_no, u_in
 
 
 /**
- * Unscrambles a complete file.
- * @param u The unscrambler structure.
- * @param infile The input file name.
- * @param outfile The output file name.
- * @param progress A function to be called repeatedly during the operation, useful to report progress data/statistics.
- * @param progress_data Data to be passed as-is to the progress function.
- * @return True if the unscrambling was successful, false otherwise.
+ * Unscrambles a complete file, one chunk of UNSCRAMBLER_CHUNK_BLOCKS blocks at a time.
  */
-bool unscrambler_unscramble_file (unscrambler *u, char *infile, char *outfile, unscrambler_progress_func progress, void *progress_data, u_int32_t *current_sector) {
+static bool unscrambler_unscramble_file_serial (unscrambler *u, char *infile, char *outfile, unscrambler_progress_func progress, void *progress_data, u_int32_t *current_sector) {
 	FILE *in, *outfp;
 	bool out;
-	u_int8_t b_in[RAW_BLOCK_SIZE], b_out[BLOCK_SIZE];
+	u_int8_t *b_in, *b_out;
 	size_t r;
 	my_off_t filesize;
-	int s;
-	u_int32_t total_sectors;
+	u_int32_t s, i, n, total_sectors, last_progress;
 
 	out = false;
-	if(!(in = fopen (infile ? infile : "", "rb"))) {
+	b_in = (u_int8_t *) malloc (UNSCRAMBLER_CHUNK_BLOCKS * RAW_BLOCK_SIZE);
+	b_out = (u_int8_t *) malloc (UNSCRAMBLER_CHUNK_BLOCKS * BLOCK_SIZE);
+	if (!b_in || !b_out) {
+		error ("Cannot allocate unscrambling buffers");
+	} else if (!(in = fopen (infile ? infile : "", "rb"))) {
 		error ("Cannot open input file \"%s\"", infile);
 	} else if (!(outfp = fopen (outfile ? outfile : "", "wb"))) {
 		error ("Cannot open output file \"%s\"", outfile);
@@ -323,36 +852,38 @@ bool unscrambler_unscramble_file (unscrambler *u, char *infile, char *outfile, u
 		if (progress)
 			progress (true, 0, total_sectors, progress_data);
 
-		s = 0, out = true;
-		while ((r = fread (b_in, 1, RAW_BLOCK_SIZE, in)) > 0 && out) {
-			if (r < RAW_BLOCK_SIZE) {
-				warning ("Short block read (%u bytes), padding with zeroes!", r);
-				memset (b_in + r, 0, sizeof (b_in) - r);
+		s = 0, last_progress = 0, out = true;
+		while (out && (r = fread (b_in, 1, UNSCRAMBLER_CHUNK_BLOCKS * RAW_BLOCK_SIZE, in)) > 0) {
+			n = (u_int32_t) ((r + RAW_BLOCK_SIZE - 1) / RAW_BLOCK_SIZE);
+			if (r < n * RAW_BLOCK_SIZE) {
+				warning ("Short block read (%u bytes), padding with zeroes!", (u_int32_t) (r % RAW_BLOCK_SIZE));
+				memset (b_in + r, 0, n * RAW_BLOCK_SIZE - r);
 			}
 
-			if (unscrambler_unscramble_16sectors (u, s, b_in, b_out)) {
-				clearerr (outfp);
-
-				if (!b_out) {
-					error ("NULL buffer");
+			for (i = 0; i < n && out; i++) {
+				if (!unscrambler_unscramble_16sectors (u, s + i * SECTORS_PER_BLOCK, b_in + i * RAW_BLOCK_SIZE, b_out + i * BLOCK_SIZE)) {
+					debug ("unscrambler_unscramble_16sectors() failed");
 					out = false;
-					*(current_sector) = s;
+					*(current_sector) = s + i * SECTORS_PER_BLOCK;
 				}
-				else fwrite (b_out, SECTOR_SIZE, SECTORS_PER_BLOCK, outfp);
-				if (ferror (outfp)) {
-					error ("fwrite() to ISO output file failed");
-					out = false;
+			}
+
+			/* Write what was unscrambled successfully */
+			if (!out)
+				i--;
+			if (fwrite (b_out, BLOCK_SIZE, i, outfp) != i) {
+				error ("fwrite() to ISO output file failed");
+				if (out)
 					*(current_sector) = s;
-				}
-			} else {
-				debug ("unscrambler_unscramble_16sectors() failed");
 				out = false;
-				*(current_sector) = s;
 			}
 
-			s += 16;
+			s += n * SECTORS_PER_BLOCK;
+			if (s > total_sectors)
+				s = total_sectors;
 
-			if ((s % 320 == 0) || (s == total_sectors)) { //speedhack
+			if (s - last_progress >= 320 || s == total_sectors) { //speedhack
+				last_progress = s;
 				if (progress)
 					progress (false, s, total_sectors, progress_data);
 			}
@@ -365,6 +896,233 @@ bool unscrambler_unscramble_file (unscrambler *u, char *infile, char *outfile, u
 		fclose (in);
 		fclose (outfp);
 	}
+	my_free (b_in);
+	my_free (b_out);
+
+	return (out);
+}
+
+
+static void *unscrambler_worker_thread (void *arg) {
+	unscrambler_worker *w;
+	unscrambler_job *job;
+	unscrambler *u;
+	FILE *in, *outfp;
+	u_int8_t *b_in, *b_out;
+	u_int32_t first, n, i;
+	size_t r, len;
+	bool ok;
+
+	w = (unscrambler_worker *) arg;
+	job = w -> job;
+	u = w -> u;
+	b_in = (u_int8_t *) malloc (UNSCRAMBLER_CHUNK_BLOCKS * RAW_BLOCK_SIZE);
+	b_out = (u_int8_t *) malloc (UNSCRAMBLER_CHUNK_BLOCKS * BLOCK_SIZE);
+	in = fopen (job -> infile, "rb");
+	outfp = fopen (job -> outfile, "r+b");
+	ok = u && in && outfp && b_in && b_out;
+	if (!ok) {
+		error ("Cannot setup unscrambling worker");
+		my_mutex_lock (&(job -> lock));
+		if (!job -> failed || job -> next_block < job -> failed_sector / SECTORS_PER_BLOCK)
+			job -> failed_sector = job -> next_block * SECTORS_PER_BLOCK;
+		job -> failed = true;
+		my_mutex_unlock (&(job -> lock));
+	}
+
+	while (ok) {
+		/* Get the next chunk */
+		my_mutex_lock (&(job -> lock));
+		if (job -> failed || job -> next_block >= job -> total_blocks) {
+			my_mutex_unlock (&(job -> lock));
+			break;
+		}
+		first = job -> next_block;
+		n = job -> total_blocks - first;
+		if (n > UNSCRAMBLER_CHUNK_BLOCKS)
+			n = UNSCRAMBLER_CHUNK_BLOCKS;
+		job -> next_block += n;
+		my_mutex_unlock (&(job -> lock));
+
+		my_fseek (in, (my_off_t) first * RAW_BLOCK_SIZE, SEEK_SET);
+		len = n * RAW_BLOCK_SIZE;
+		if ((r = fread (b_in, 1, len, in)) < len) {
+			warning ("Short block read (%u bytes), padding with zeroes!", (u_int32_t) r);
+			memset (b_in + r, 0, len - r);
+		}
+
+		for (i = 0; i < n && ok; i++) {
+			if (!unscrambler_unscramble_16sectors (u, (first + i) * SECTORS_PER_BLOCK, b_in + i * RAW_BLOCK_SIZE, b_out + i * BLOCK_SIZE)) {
+				debug ("unscrambler_unscramble_16sectors() failed");
+				ok = false;
+			}
+		}
+
+		/* Write what was unscrambled successfully */
+		if (!ok)
+			i--;
+		my_fseek (outfp, (my_off_t) first * BLOCK_SIZE, SEEK_SET);
+		if (fwrite (b_out, BLOCK_SIZE, i, outfp) != i) {
+			error ("fwrite() to ISO output file failed");
+			ok = false;
+			i = 0;
+		}
+
+		my_mutex_lock (&(job -> lock));
+		job -> blocks_done += n;
+		if (!ok && (!job -> failed || first + i < job -> failed_sector / SECTORS_PER_BLOCK)) {
+			job -> failed = true;
+			job -> failed_sector = (first + i) * SECTORS_PER_BLOCK;
+		}
+		my_cond_broadcast (&(job -> cond));
+		my_mutex_unlock (&(job -> lock));
+	}
+
+	if (in)
+		fclose (in);
+	if (outfp && fclose (outfp) != 0) {
+		error ("Cannot close ISO output file");
+		my_mutex_lock (&(job -> lock));
+		if (!job -> failed)
+			job -> failed_sector = 0;
+		job -> failed = true;
+		my_mutex_unlock (&(job -> lock));
+	}
+	my_free (b_in);
+	my_free (b_out);
+
+	my_mutex_lock (&(job -> lock));
+	job -> running--;
+	my_cond_broadcast (&(job -> cond));
+	my_mutex_unlock (&(job -> lock));
+
+	return (NULL);
+}
+
+
+/**
+ * Unscrambles a complete file, sharding it across u -> threads worker threads. The calling thread only reports progress.
+ */
+static bool unscrambler_unscramble_file_parallel (unscrambler *u, char *infile, char *outfile, unscrambler_progress_func progress, void *progress_data, u_int32_t *current_sector) {
+	FILE *fp;
+	unscrambler_job job;
+	my_thread threads[UNSCRAMBLER_MAX_THREADS];
+	unscrambler_worker workers[UNSCRAMBLER_MAX_THREADS];
+	u_int32_t i, n, total_sectors, s, last_progress, seeds;
+	bool out;
+
+	memset (&job, 0, sizeof (job));
+	job.infile = infile;
+	job.outfile = outfile;
+
+	out = false;
+	if (!(fp = fopen (infile, "rb"))) {
+		error ("Cannot open input file \"%s\"", infile);
+	} else {
+		/* Find out how many sectors we need to process */
+		my_fseek (fp, 0, SEEK_END);
+		job.filesize = my_ftell (fp);
+		fclose (fp);
+		total_sectors = (u_int32_t) (job.filesize / RAW_SECTOR_SIZE);
+		job.total_blocks = (u_int32_t) ((job.filesize + RAW_BLOCK_SIZE - 1) / RAW_BLOCK_SIZE);
+
+		/* Create (or truncate) the output file, workers will then open it on their own */
+		if (!(fp = fopen (outfile, "wb"))) {
+			error ("Cannot open output file \"%s\"", outfile);
+		} else {
+			fclose (fp);
+			out = true;
+		}
+	}
+
+	if (out) {
+		if (progress)
+			progress (true, 0, total_sectors, progress_data);
+
+		my_mutex_init (&(job.lock));
+		my_cond_init (&(job.cond));
+
+		for (n = 0; n < u -> threads; n++) {
+			/* Start with what the caller already knows about seeds */
+			workers[n].job = &job;
+			if ((workers[n].u = (unscrambler *) malloc (sizeof (unscrambler)))) {
+				memcpy (workers[n].u, u, sizeof (unscrambler));
+				workers[n].u -> seed_file = NULL;
+			}
+			job.running++;
+			if (!my_thread_create (&(threads[n]), unscrambler_worker_thread, &(workers[n]))) {
+				job.running--;
+				my_free (workers[n].u);
+				break;
+			}
+		}
+		debug ("Started %u unscrambling worker(s)", n);
+
+		/* Wait for the workers, reporting progress */
+		last_progress = 0;
+		my_mutex_lock (&(job.lock));
+		while (job.running > 0) {
+			my_cond_wait (&(job.cond), &(job.lock));
+			s = job.blocks_done * SECTORS_PER_BLOCK;
+			if (s > total_sectors)
+				s = total_sectors;
+			if (progress && (s - last_progress >= 320 || (s == total_sectors && s != last_progress))) {
+				my_mutex_unlock (&(job.lock));
+				progress (false, s, total_sectors, progress_data);
+				my_mutex_lock (&(job.lock));
+				last_progress = s;
+			}
+		}
+		my_mutex_unlock (&(job.lock));
+
+		/* Keep the seeds the workers found, and save them once */
+		for (i = 0, seeds = 0; i < n; i++) {
+			my_thread_join (threads[i]);
+			if (workers[i].u) {
+				seeds += unscrambler_merge_seeds (u, workers[i].u);
+				my_free (workers[i].u);
+			}
+		}
+		if (seeds > 0 && u -> seed_file)
+			unscrambler_save_seeds (u, u -> seed_file);
+		my_cond_destroy (&(job.cond));
+		my_mutex_destroy (&(job.lock));
+
+		if (n == 0) {
+			error ("Cannot start unscrambling threads");
+			job.failed = true;
+			job.failed_sector = 0;
+		}
+
+		if (job.failed) {
+			*(current_sector) = job.failed_sector;
+			out = false;
+		} else {
+			debug ("Image successfully unscrambled");
+		}
+	}
+
+	return (out);
+}
+
+
+/**
+ * Unscrambles a complete file.
+ * @param u The unscrambler structure.
+ * @param infile The input file name.
+ * @param outfile The output file name.
+ * @param progress A function to be called repeatedly during the operation, useful to report progress data/statistics.
+ * @param progress_data Data to be passed as-is to the progress function.
+ * @param[out] current_sector In case of failure, the first sector of the block that could not be unscrambled.
+ * @return True if the unscrambling was successful, false otherwise.
+ */
+bool unscrambler_unscramble_file (unscrambler *u, char *infile, char *outfile, unscrambler_progress_func progress, void *progress_data, u_int32_t *current_sector) {
+	bool out;
+
+	if (u -> threads > 1 && infile && outfile)
+		out = unscrambler_unscramble_file_parallel (u, infile, outfile, progress, progress_data, current_sector);
+	else
+		out = unscrambler_unscramble_file_serial (u, infile, outfile, progress, progress_data, current_sector);
 
 	return (out);
 }
@@ -27,17 +27,32 @@
 
 typedef struct unscrambler_s unscrambler;
 
+/*! \brief Implementations of the frame unscrambling code, see unscrambler_set_kernel() */
+typedef enum {
+	UNSCRAMBLER_KERNEL_AUTO,
+	UNSCRAMBLER_KERNEL_REFERENCE,
+	UNSCRAMBLER_KERNEL_SSE2,
+	UNSCRAMBLER_KERNEL_AVX2,
+	UNSCRAMBLER_KERNEL_AVX512,
+	UNSCRAMBLER_KERNELS
+} unscrambler_kernel;
+
 /* We want this module to be independent of the library framework, so that it can be easily recycled. Hence we just define the type of
    the progress function the same format we use elsewhere */
 typedef void (*unscrambler_progress_func) (bool start, u_int32_t current_sector, u_int32_t total_sectors, void *progress_data);
 
-u_int8_t disctype;
-
 FRIIDUMPLIB_EXPORT unscrambler *unscrambler_new (void);
 FRIIDUMPLIB_EXPORT void *unscrambler_destroy (unscrambler *u);
 FRIIDUMPLIB_EXPORT bool unscrambler_unscramble_16sectors (unscrambler *u, u_int32_t sector_no, u_int8_t *inbuf, u_int8_t *outbuf);
 FRIIDUMPLIB_EXPORT bool unscrambler_unscramble_file (unscrambler *u, char *infile, char *outfile, unscrambler_progress_func progress, void *progress_data, u_int32_t *current_sector);
+FRIIDUMPLIB_EXPORT void unscrambler_set_threads (unscrambler *u, u_int32_t threads);
+FRIIDUMPLIB_EXPORT bool unscrambler_set_kernel (unscrambler_kernel k);
+FRIIDUMPLIB_EXPORT bool unscrambler_self_test (bool verbose);
+FRIIDUMPLIB_EXPORT void unscrambler_benchmark (void);
 FRIIDUMPLIB_EXPORT void unscrambler_set_bruteforce (unscrambler *u, bool b);
-FRIIDUMPLIB_EXPORT void unscrambler_set_disctype (u_int8_t disc_type);
+FRIIDUMPLIB_EXPORT bool unscrambler_save_seeds (unscrambler *u, char *filename);
+FRIIDUMPLIB_EXPORT u_int32_t unscrambler_load_seeds (unscrambler *u, char *filename);
+FRIIDUMPLIB_EXPORT u_int32_t unscrambler_set_seed_file (unscrambler *u, char *filename);
+FRIIDUMPLIB_EXPORT void unscrambler_set_disctype (unscrambler *u, u_int8_t disc_type);
 
 #endif
@@ -19,11 +19,11 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
-//#include "rs.h"
 #include <stdio.h>
 #include <sys/types.h>
 #include "misc.h"
 #include "dvd_drive.h"
+#include "constants.h"
 
 /**
  * Command found in Lite-On LH-18A1H
@@ -36,6 +36,15 @@
  */
 
 
+/*! \brief The command dumps up to 64 KB from a 24-bit address. Dumps must start on a frame, so that the sector sequence can be checked.
+ */
+const dvd_memdump_caps vanilla_2064_dvd_memdump_caps = {
+	65535,
+	RAW_SECTOR_SIZE,
+	0x1000000
+};
+
+
 /**
  * @param dvd The DVD drive the command should be exectued on.
  * @param offset The absolute memory offset to start dumping.
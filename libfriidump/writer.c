@@ -0,0 +1,531 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Block-buffered output files with periodic sync points, used by the dumper.
+ *
+ * Data is collected in a large aligned buffer and written with a few big pwrite() calls, optionally bypassing the page cache (O_DIRECT).
+ * Every few MB the file is fdatasync()'ed and the number of sectors that are known to be on stable storage is saved to a small
+ * <code>&lt;file&gt;.resume</code> sidecar, which is removed when the file is closed cleanly. If the program or the system crashes, the sidecar
+ * tells how much of the file can be trusted, as the file size alone might include data that never reached the disk.
+ *
+ * Writing normally goes on sequentially, but writer_seek() can move it anywhere in the file, so that holes left by unreadable sectors can be
+ * filled in later. Then the resume point is capped with writer_set_resume_limit(), as only the caller knows which sectors hold valid data.
+ */
+
+#include "misc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "writer.h"
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#ifndef HAVE_FDATASYNC
+#ifdef WIN32
+#define fdatasync _commit
+#else
+#define fdatasync fsync
+#endif
+#endif
+
+#ifdef WIN32
+#define fsync _commit
+#endif
+
+/* Size of the write buffer. Must be a multiple of WRITER_ALIGNMENT */
+#define WRITER_BUFFER_SIZE (4 * 1024 * 1024)
+
+/* Alignment of buffers, file offsets and sizes required by O_DIRECT */
+#define WRITER_ALIGNMENT 4096
+
+#define WRITER_RESUME_SUFFIX ".resume"
+
+
+struct writer_s {
+	char *resume_file;
+	int fd;
+	u_int32_t sector_size;
+	bool direct;			//!< True if O_DIRECT is in use. Then the buffer always starts at an aligned file offset.
+	u_int8_t *mem;			//!< The memory that was allocated for the buffer.
+	u_int8_t *buf;			//!< The buffer, aligned to WRITER_ALIGNMENT.
+	u_int32_t buf_len;		//!< Number of bytes in the buffer.
+	my_off_t offset;		//!< File offset the buffer starts at.
+	my_off_t written;		//!< Number of bytes that have been handed to the OS, up to the furthest offset written so far.
+	my_off_t synced;		//!< Number of bytes that are known to be on stable storage.
+	u_int32_t resume_limit;		//!< The resume point is never past this sector, or -1.
+	my_off_t sync_interval;		//!< Number of bytes between two sync points, 0 to disable them.
+	bool failed;
+};
+
+
+#ifndef HAVE_PWRITE
+static ssize_t pwrite (int fd, const void *buf, size_t count, my_off_t offset) {
+	ssize_t out;
+
+#ifdef WIN32
+	if (_lseeki64 (fd, offset, SEEK_SET) < 0)
+#else
+	if (lseek (fd, offset, SEEK_SET) < 0)
+#endif
+		out = -1;
+	else
+		out = write (fd, buf, count);
+
+	return (out);
+}
+
+
+static ssize_t pread (int fd, void *buf, size_t count, my_off_t offset) {
+	ssize_t out;
+
+#ifdef WIN32
+	if (_lseeki64 (fd, offset, SEEK_SET) < 0)
+#else
+	if (lseek (fd, offset, SEEK_SET) < 0)
+#endif
+		out = -1;
+	else
+		out = read (fd, buf, count);
+
+	return (out);
+}
+#endif
+
+
+/* Writes a whole buffer, retrying after short writes and interruptions */
+static bool writer_pwrite (writer *w, u_int8_t *data, size_t len, my_off_t offset) {
+	bool out;
+	ssize_t r;
+
+	for (out = true; len > 0 && out; ) {
+		if ((r = pwrite (w -> fd, data, len, offset)) > 0) {
+			data += r;
+			len -= r;
+			offset += r;
+		} else if (r < 0 && errno == EINTR) {
+			continue;
+		} else {
+			error ("pwrite() to output file failed: %s", r < 0 ? strerror (errno) : "nothing written");
+			out = false;
+		}
+	}
+
+	return (out);
+}
+
+
+#ifdef O_DIRECT
+static bool writer_set_direct (writer *w, bool direct) {
+	bool out;
+	int flags;
+
+	if ((flags = fcntl (w -> fd, F_GETFL)) < 0)
+		out = false;
+	else if (fcntl (w -> fd, F_SETFL, direct ? flags | O_DIRECT : flags & ~O_DIRECT) < 0)
+		out = false;
+	else
+		out = true;
+
+	return (out);
+}
+#endif
+
+
+/**
+ * Hands the buffer to the OS.
+ * @param w The writer.
+ * @param all With O_DIRECT, only whole aligned chunks are written, unless this is true. Then the unaligned tail is written through the page
+ *            cache, but also kept in the buffer, so that the file offset of the buffer stays aligned and the tail is written again, as part of
+ *            an aligned chunk, at the next flush.
+ * @return true if the data could be written.
+ */
+static bool writer_flush (writer *w, bool all) {
+	bool out;
+	u_int32_t aligned, tail;
+
+	if (w -> direct)
+		aligned = w -> buf_len & ~(WRITER_ALIGNMENT - 1);
+	else
+		aligned = w -> buf_len;
+	tail = w -> buf_len - aligned;
+
+	out = true;
+	if (aligned > 0)
+		out = writer_pwrite (w, w -> buf, aligned, w -> offset);
+
+#ifdef O_DIRECT
+	if (out && all && tail > 0) {
+		if (!writer_set_direct (w, false)) {
+			error ("Cannot disable O_DIRECT: %s", strerror (errno));
+			out = false;
+		} else {
+			out = writer_pwrite (w, w -> buf + aligned, tail, w -> offset + aligned);
+			if (!writer_set_direct (w, true)) {
+				error ("Cannot re-enable O_DIRECT: %s", strerror (errno));
+				out = false;
+			}
+		}
+	}
+#endif
+
+	if (out) {
+		if (tail > 0)
+			memmove (w -> buf, w -> buf + aligned, tail);
+		w -> offset += aligned;
+		w -> buf_len = tail;
+		if (w -> offset + (all ? tail : 0) > w -> written)
+			w -> written = w -> offset + (all ? tail : 0);
+	} else {
+		w -> failed = true;
+	}
+
+	return (out);
+}
+
+
+/* Atomically replaces the sidecar with the number of sectors that are on stable storage */
+static bool writer_save_resume_point (writer *w) {
+	bool out;
+	char *tmp;
+	FILE *fp;
+	size_t len;
+	u_int32_t sectors;
+
+	sectors = (u_int32_t) (w -> synced / w -> sector_size);
+	if (sectors > w -> resume_limit)
+		sectors = w -> resume_limit;
+
+	len = strlen (w -> resume_file) + 5;
+	if (!(tmp = (char *) malloc (len))) {
+		out = false;
+	} else {
+		snprintf (tmp, len, "%s.tmp", w -> resume_file);
+		if (!(fp = fopen (tmp, "w"))) {
+			out = false;
+		} else {
+			fprintf (fp, "%u %u\n", w -> sector_size, sectors);
+			out = fflush (fp) == 0 && fsync (fileno (fp)) == 0;
+			out = fclose (fp) == 0 && out;
+#ifdef WIN32
+			remove (w -> resume_file);
+#endif
+			if (out)
+				out = rename (tmp, w -> resume_file) == 0;
+			else
+				remove (tmp);
+		}
+		free (tmp);
+	}
+
+	if (!out)
+		error ("Cannot save resume point to \"%s\": %s", w -> resume_file, strerror (errno));
+
+	return (out);
+}
+
+
+/* Makes the buffer start at the given file offset. With O_DIRECT it must start at an aligned offset, so the beginning of the partial chunk
+ * is read back from the file, or zeroed where it is past its end */
+static bool writer_start_at (writer *w, my_off_t start) {
+	bool out;
+	ssize_t r;
+
+	out = true;
+	if (!w -> direct) {
+		w -> offset = start;
+		w -> buf_len = 0;
+	} else {
+		w -> offset = start & ~((my_off_t) WRITER_ALIGNMENT - 1);
+		w -> buf_len = (u_int32_t) (start - w -> offset);
+#ifdef O_DIRECT
+		if (w -> buf_len > 0) {
+			writer_set_direct (w, false);
+			if ((r = pread (w -> fd, w -> buf, w -> buf_len, w -> offset)) < 0 || !writer_set_direct (w, true))
+				out = false;
+			else if (r < (ssize_t) w -> buf_len)
+				memset (w -> buf + r, 0, w -> buf_len - r);
+		}
+#endif
+	}
+
+	return (out);
+}
+
+
+/**
+ * Opens an output file, truncating it to the sector the dump will start from.
+ * @param filename The file name.
+ * @param sector_size The size of the sectors that will be written.
+ * @param start_sector The sector the dump will start from. The file is truncated to this sector.
+ * @param direct If true, try to bypass the page cache using O_DIRECT. If the OS or the filesystem do not support it, the file is written
+ *               normally.
+ * @return The writer, or NULL if the file could not be opened.
+ */
+writer *writer_open (char *filename, u_int32_t sector_size, u_int32_t start_sector, bool direct) {
+	writer *w;
+	my_off_t start;
+	size_t len;
+
+	if (!(w = (writer *) malloc (sizeof (writer)))) {
+		error ("Cannot allocate writer");
+		return (NULL);
+	}
+	memset (w, 0, sizeof (writer));
+	w -> sector_size = sector_size;
+	w -> resume_limit = -1;
+	w -> sync_interval = (my_off_t) WRITER_DEFAULT_SYNC_INTERVAL * 1024 * 1024;
+	len = strlen (filename) + strlen (WRITER_RESUME_SUFFIX) + 1;
+	w -> resume_file = (char *) malloc (len);
+	w -> mem = (u_int8_t *) malloc (WRITER_BUFFER_SIZE + WRITER_ALIGNMENT);
+	if (!w -> resume_file || !w -> mem) {
+		error ("Cannot allocate writer buffers");
+		my_free (w -> resume_file);
+		my_free (w -> mem);
+		my_free (w);
+		return (NULL);
+	}
+	snprintf (w -> resume_file, len, "%s%s", filename, WRITER_RESUME_SUFFIX);
+	w -> buf = (u_int8_t *) (((size_t) w -> mem + WRITER_ALIGNMENT - 1) & ~((size_t) WRITER_ALIGNMENT - 1));
+
+	start = (my_off_t) start_sector * sector_size;
+	if ((w -> fd = open (filename, O_RDWR | O_CREAT | O_BINARY, 0666)) < 0) {
+		error ("Cannot open \"%s\": %s", filename, strerror (errno));
+		w -> failed = true;
+	} else if (ftruncate (w -> fd, start) != 0) {
+		error ("Cannot truncate \"%s\": %s", filename, strerror (errno));
+		w -> failed = true;
+	}
+
+	if (!w -> failed && direct) {
+#ifdef O_DIRECT
+		if (!writer_set_direct (w, true)) {
+			warning ("O_DIRECT not supported for \"%s\", writing through the page cache", filename);
+		} else {
+			w -> direct = true;
+		}
+#else
+		warning ("O_DIRECT not supported on this platform, writing through the page cache");
+#endif
+	}
+
+	if (!w -> failed && !writer_start_at (w, start)) {
+		error ("Cannot read back the end of \"%s\"", filename);
+		w -> failed = true;
+	}
+
+	if (w -> failed) {
+		writer_close (w);
+		w = NULL;
+	} else {
+		w -> written = start;
+		w -> synced = start;
+		writer_save_resume_point (w);
+		debug ("Writing to file \"%s\" from offset %lld%s", filename, (long long) start, w -> direct ? " (O_DIRECT)" : "");
+	}
+
+	return (w);
+}
+
+
+/**
+ * Appends sectors to the file. Data is buffered and written in large chunks, and a sync point is made when enough data has been written
+ * since the last one.
+ * @param w The writer.
+ * @param data The sectors.
+ * @param sectors The number of sectors.
+ * @return true if the data could be written.
+ */
+bool writer_write (writer *w, u_int8_t *data, u_int32_t sectors) {
+	bool out;
+	size_t len, n;
+
+	len = (size_t) sectors * w -> sector_size;
+	for (out = !w -> failed; len > 0 && out; ) {
+		if (w -> buf_len == WRITER_BUFFER_SIZE)
+			out = writer_flush (w, false);
+		if (out) {
+			n = WRITER_BUFFER_SIZE - w -> buf_len;
+			if (n > len)
+				n = len;
+			memcpy (w -> buf + w -> buf_len, data, n);
+			w -> buf_len += n;
+			data += n;
+			len -= n;
+		}
+	}
+
+	if (out && w -> sync_interval > 0 && w -> offset + w -> buf_len - w -> synced >= w -> sync_interval)
+		out = writer_sync (w);
+
+	return (out);
+}
+
+
+/**
+ * Moves writing to another sector of the file, which can be before or after the current one. Buffered data is written out first. Sectors
+ * that are skipped over are left as they are, or read as zeroes if they are past the end of the file.
+ * @param w The writer.
+ * @param sector The sector the next writer_write() will write to.
+ * @return true if the buffered data could be written.
+ */
+bool writer_seek (writer *w, u_int32_t sector) {
+	bool out;
+
+	if (w -> failed || !writer_flush (w, true)) {
+		out = false;
+	} else if (!writer_start_at (w, (my_off_t) sector * w -> sector_size)) {
+		error ("Cannot read back the data before sector %u", sector);
+		w -> failed = true;
+		out = false;
+	} else {
+		out = true;
+	}
+
+	return (out);
+}
+
+
+/**
+ * Makes a sync point: everything written so far is flushed to stable storage, then the resume point is updated.
+ * @param w The writer.
+ * @return true if the data could be synced.
+ */
+bool writer_sync (writer *w) {
+	bool out;
+
+	if (w -> failed) {
+		out = false;
+	} else if (!writer_flush (w, true)) {
+		out = false;
+	} else if (fdatasync (w -> fd) != 0) {
+		error ("fdatasync() failed: %s", strerror (errno));
+		w -> failed = true;
+		out = false;
+	} else {
+		w -> synced = w -> written;
+		out = writer_save_resume_point (w);
+	}
+
+	return (out);
+}
+
+
+/**
+ * Sets how often a sync point is made.
+ * @param w The writer.
+ * @param mb Number of MB between two sync points. 0 disables them: the file is never synced and no resume point is kept.
+ */
+void writer_set_sync_interval (writer *w, u_int32_t mb) {
+	w -> sync_interval = (my_off_t) mb * 1024 * 1024;
+	if (mb == 0)
+		remove (w -> resume_file);
+
+	return;
+}
+
+
+/**
+ * Caps the resume point, for files that are not written sequentially and might have holes. It is updated at the next sync point.
+ * @param w The writer.
+ * @param sectors The number of sectors from the start of the file that hold valid data, or -1 to remove the cap.
+ */
+void writer_set_resume_limit (writer *w, u_int32_t sectors) {
+	w -> resume_limit = sectors;
+
+	return;
+}
+
+
+/**
+ * Flushes and closes the file. If everything was written correctly, the resume point is no longer needed and is removed, as the file size
+ * is then reliable, unless the resume limit is below the end of the file.
+ * @param w The writer.
+ * @return true if all the data could be written.
+ */
+bool writer_close (writer *w) {
+	bool out;
+
+	if (w -> fd < 0) {
+		out = false;
+	} else {
+		out = !w -> failed && writer_flush (w, true);
+		if (out && w -> sync_interval > 0 && fdatasync (w -> fd) != 0) {
+			error ("fdatasync() failed: %s", strerror (errno));
+			out = false;
+		}
+		if (close (w -> fd) != 0)
+			out = false;
+		if (out && (w -> resume_limit == -1 || (my_off_t) w -> resume_limit * w -> sector_size >= w -> written))
+			remove (w -> resume_file);
+	}
+
+	my_free (w -> resume_file);
+	my_free (w -> mem);
+	my_free (w);
+
+	return (out);
+}
+
+
+/**
+ * Finds out how many sectors of an existing output file can be trusted. If a resume point was left by a dump that did not terminate
+ * cleanly, only the sectors it covers are, otherwise the whole file is.
+ * @param filename The file name.
+ * @param sector_size The size of the sectors in the file.
+ * @param filesize The size of the file.
+ * @return The number of sectors.
+ */
+u_int32_t writer_get_resume_sectors (char *filename, u_int32_t sector_size, my_off_t filesize) {
+	u_int32_t out, size, sectors;
+	char *resume_file;
+	size_t len;
+	FILE *fp;
+
+	out = (u_int32_t) (filesize / sector_size);
+
+	len = strlen (filename) + strlen (WRITER_RESUME_SUFFIX) + 1;
+	if ((resume_file = (char *) malloc (len))) {
+		snprintf (resume_file, len, "%s%s", filename, WRITER_RESUME_SUFFIX);
+		if ((fp = fopen (resume_file, "r"))) {
+			if (fscanf (fp, "%u %u", &size, &sectors) == 2 && size == sector_size) {
+				debug ("Resume point for \"%s\": sector %u", filename, sectors);
+				if (sectors < out)
+					out = sectors;
+			} else {
+				warning ("Ignoring invalid resume point \"%s\"", resume_file);
+			}
+			fclose (fp);
+		}
+		free (resume_file);
+	}
+
+	return (out);
+}
@@ -0,0 +1,55 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Block-buffered output files with periodic sync points, used by the dumper.
+ */
+
+#ifndef WRITER_H_INCLUDED
+#define WRITER_H_INCLUDED
+
+#include "misc.h"
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct writer_s writer;
+
+/* Default interval between two sync points, in MB */
+#define WRITER_DEFAULT_SYNC_INTERVAL 32
+
+writer *writer_open (char *filename, u_int32_t sector_size, u_int32_t start_sector, bool direct);
+bool writer_write (writer *w, u_int8_t *data, u_int32_t sectors);
+bool writer_seek (writer *w, u_int32_t sector);
+bool writer_sync (writer *w);
+void writer_set_sync_interval (writer *w, u_int32_t mb);
+void writer_set_resume_limit (writer *w, u_int32_t sectors);
+bool writer_close (writer *w);
+
+u_int32_t writer_get_resume_sectors (char *filename, u_int32_t sector_size, my_off_t filesize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
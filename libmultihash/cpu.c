@@ -0,0 +1,139 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*! \file
+ * \brief Runtime detection of the CPU features used by the optimized code paths.
+ *
+ * Optimized kernels are compiled with per-function target attributes, so that the library still runs on any CPU of the
+ * architecture it was built for: the best kernel is then chosen at runtime, according to what this module reports.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cpu.h"
+
+#ifdef CPU_X86_DISPATCH
+#include <cpuid.h>
+#endif
+
+
+/*! \brief Features that were detected, or 0 if detection has not been done yet */
+static u_int32_t cpu_features = 0;
+
+/*! \brief Features that the user allows us to use */
+static u_int32_t cpu_features_mask = 0xFFFFFFFF;
+
+
+#ifdef CPU_X86_DISPATCH
+/* Returns the OS-enabled state components (XCR0) */
+static u_int32_t cpu_xgetbv (void) {
+	u_int32_t eax, edx;
+
+	__asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+
+	return (eax);
+}
+#endif
+
+
+static u_int32_t cpu_detect (void) {
+	u_int32_t out;
+#ifdef CPU_X86_DISPATCH
+	unsigned int eax, ebx, ecx, edx, max;
+	u_int32_t xcr0;
+
+	out = 0;
+	max = __get_cpuid_max (0, NULL);
+	if (max >= 1 && __get_cpuid (1, &eax, &ebx, &ecx, &edx)) {
+		if (edx & bit_SSE2)
+			out |= CPU_FEATURE_SSE2;
+		if (ecx & bit_SSSE3)
+			out |= CPU_FEATURE_SSSE3;
+		if (ecx & bit_SSE4_1)
+			out |= CPU_FEATURE_SSE41;
+		if (ecx & bit_PCLMUL)
+			out |= CPU_FEATURE_PCLMUL;
+
+		/* AVX state must be enabled by the OS, too */
+		xcr0 = (ecx & bit_OSXSAVE) ? cpu_xgetbv () : 0;
+		if (max >= 7) {
+			__cpuid_count (7, 0, eax, ebx, ecx, edx);
+			if ((ebx & bit_AVX2) && (xcr0 & 0x06) == 0x06)
+				out |= CPU_FEATURE_AVX2;
+			if ((ebx & bit_AVX512BW) && (ebx & bit_AVX512F) && (xcr0 & 0xE6) == 0xE6)
+				out |= CPU_FEATURE_AVX512BW;
+			if (ebx & bit_SHA)
+				out |= CPU_FEATURE_SHA;
+		}
+	}
+#else
+	out = 0;
+#endif
+
+	return (out);
+}
+
+
+/**
+ * Returns the features of the CPU we are running on, restricted to those allowed with cpu_set_features_mask().
+ * @return A bitmask of CPU_FEATURE_* values.
+ */
+u_int32_t cpu_get_features (void) {
+	/* Detection always gives the same result, so it does not matter if more threads get here at the same time */
+	if (!cpu_features)
+		cpu_features = cpu_detect () | 0x80000000;
+
+	return (cpu_features & cpu_features_mask & ~0x80000000);
+}
+
+
+/**
+ * Restricts the CPU features that optimized code paths may use. This is meant for testing and benchmarking purposes, and
+ * only affects kernels selected after the call.
+ * @param mask A bitmask of CPU_FEATURE_* values that are allowed (0xFFFFFFFF to allow everything).
+ */
+void cpu_set_features_mask (u_int32_t mask) {
+	cpu_features_mask = mask;
+
+	return;
+}
+
+
+/**
+ * Returns a human-readable list of the features returned by cpu_get_features().
+ * @return The list, as a static string.
+ */
+char *cpu_get_features_string (void) {
+	static char buf[80];
+	u_int32_t f;
+
+	f = cpu_get_features ();
+	snprintf (buf, sizeof (buf), "%s%s%s%s%s%s%s",
+		f & CPU_FEATURE_SSE2 ? " sse2" : "",
+		f & CPU_FEATURE_SSSE3 ? " ssse3" : "",
+		f & CPU_FEATURE_SSE41 ? " sse4.1" : "",
+		f & CPU_FEATURE_PCLMUL ? " pclmul" : "",
+		f & CPU_FEATURE_AVX2 ? " avx2" : "",
+		f & CPU_FEATURE_AVX512BW ? " avx512bw" : "",
+		f & CPU_FEATURE_SHA ? " sha" : "");
+
+	return (buf[0] ? buf + 1 : "none");
+}
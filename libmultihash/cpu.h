@@ -0,0 +1,54 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Arep                                            *
+ *   Support is provided through the forums at                             *
+ *   http://www.console-tribe.com                                          *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef CPU_H_INCLUDED
+#define CPU_H_INCLUDED
+
+#include <sys/types.h>
+#include "multihash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Optimized code paths are only built where we know how to ask the compiler for them */
+#if (defined (__GNUC__) || defined (__clang__)) && (defined (__x86_64__) || defined (__i386__))
+#define CPU_X86_DISPATCH
+#endif
+
+/* CPU features, as returned by cpu_get_features() */
+#define CPU_FEATURE_SSE2	0x0001
+#define CPU_FEATURE_SSSE3	0x0002
+#define CPU_FEATURE_SSE41	0x0004
+#define CPU_FEATURE_PCLMUL	0x0008
+#define CPU_FEATURE_AVX2	0x0010
+#define CPU_FEATURE_AVX512BW	0x0020
+#define CPU_FEATURE_SHA		0x0040
+
+MULTIHASH_EXPORT u_int32_t cpu_get_features (void);
+MULTIHASH_EXPORT void cpu_set_features_mask (u_int32_t mask);
+MULTIHASH_EXPORT char *cpu_get_features_string (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
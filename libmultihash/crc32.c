@@ -24,9 +24,15 @@
  */
 
 #include "crc32.h"
+#include "cpu.h"
+#include <string.h>
+
+#ifdef CPU_X86_DISPATCH
+#include <immintrin.h>
+#endif
 
 /* This is a pre-computed table to make crc computations efficient */
-static unsigned long crctable[] = {
+static u_int32_t crctable[] = {
   0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL,
   0x076dc419L, 0x706af48fL, 0xe963a535L, 0x9e6495a3L,
   0x0edb8832L, 0x79dcb8a4L, 0xe0d5e91eL, 0x97d2d988L,
@@ -103,11 +109,22 @@ static unsigned long crctable[] = {
  * x^32+x^26+x^23+x^22+x^16+x^12+x^11+x^10+x^8+x^7+x^5+x^4+x^2+x+1
  */
 
-unsigned long CrcUpdate(          /* returns updated crc         */
-  unsigned long crc,              /* starting crc                */
-  unsigned char *buffer,          /* buffer to use to update crc */
-  long length                     /* length of buffer            */
-)
+typedef u_int32_t (*crc32_func)(u_int32_t crc, unsigned char *buffer, long length);
+
+static const char *crc32_kernel_names[CRC32_KERNELS] = {
+  "auto", "reference", "slice16", "clmul"
+};
+
+/* crcslice[0] is crctable, crcslice[n][b] is the CRC of byte b followed by n zero bytes */
+static u_int32_t crcslice[16][256];
+static int crc32_initialized = 0;
+
+static u_int32_t CrcUpdateFirst(u_int32_t crc, unsigned char *buffer, long length);
+
+static crc32_func crc32_kernel_func = CrcUpdateFirst;
+static crc32_kernel crc32_kernel_current = CRC32_KERNEL_AUTO;
+
+u_int32_t CrcUpdateReference(u_int32_t crc, unsigned char *buffer, long length)
 {
   long i;
 
@@ -118,3 +135,165 @@ unsigned long CrcUpdate(          /* returns updated crc         */
 
   return crc;
 }
+
+static u_int32_t CrcUpdateSlice16(u_int32_t crc, unsigned char *buffer, long length)
+{
+  while (length >= 16)
+  {
+    crc ^= (u_int32_t) buffer[0] | ((u_int32_t) buffer[1] << 8) |
+           ((u_int32_t) buffer[2] << 16) | ((u_int32_t) buffer[3] << 24);
+    crc = crcslice[15][crc & 0xff] ^ crcslice[14][(crc >> 8) & 0xff] ^
+          crcslice[13][(crc >> 16) & 0xff] ^ crcslice[12][crc >> 24] ^
+          crcslice[11][buffer[4]] ^ crcslice[10][buffer[5]] ^
+          crcslice[9][buffer[6]] ^ crcslice[8][buffer[7]] ^
+          crcslice[7][buffer[8]] ^ crcslice[6][buffer[9]] ^
+          crcslice[5][buffer[10]] ^ crcslice[4][buffer[11]] ^
+          crcslice[3][buffer[12]] ^ crcslice[2][buffer[13]] ^
+          crcslice[1][buffer[14]] ^ crcslice[0][buffer[15]];
+    buffer += 16;
+    length -= 16;
+  }
+
+  return CrcUpdateReference(crc, buffer, length);
+}
+
+#ifdef CPU_X86_DISPATCH
+/*
+ * Folds 64 bytes at a time with carry-less multiplications (See Intel's
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction"). The constants are the bit-reflected powers of x mod P
+ * that move 128 bits forward by 512 and by 128 bits. The folded 16 bytes
+ * have the same CRC as the data they replace, so they are finished with
+ * the table.
+ */
+#define CRC32_FOLD(x, k, y) \
+  x = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), \
+                                  _mm_clmulepi64_si128(x, k, 0x11)), y)
+
+__attribute__ ((target ("pclmul,sse4.1")))
+static u_int32_t CrcUpdateClmul(u_int32_t crc, unsigned char *buffer, long length)
+{
+  __m128i x1, x2, x3, x4, k;
+  unsigned char folded[16];
+
+  if (length < 64)
+    return CrcUpdateSlice16(crc, buffer, length);
+
+  x1 = _mm_loadu_si128((__m128i *) buffer);
+  x2 = _mm_loadu_si128((__m128i *) (buffer + 16));
+  x3 = _mm_loadu_si128((__m128i *) (buffer + 32));
+  x4 = _mm_loadu_si128((__m128i *) (buffer + 48));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+  buffer += 64;
+  length -= 64;
+
+  k = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+  while (length >= 64)
+  {
+    CRC32_FOLD(x1, k, _mm_loadu_si128((__m128i *) buffer));
+    CRC32_FOLD(x2, k, _mm_loadu_si128((__m128i *) (buffer + 16)));
+    CRC32_FOLD(x3, k, _mm_loadu_si128((__m128i *) (buffer + 32)));
+    CRC32_FOLD(x4, k, _mm_loadu_si128((__m128i *) (buffer + 48)));
+    buffer += 64;
+    length -= 64;
+  }
+
+  k = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+  CRC32_FOLD(x1, k, x2);
+  CRC32_FOLD(x1, k, x3);
+  CRC32_FOLD(x1, k, x4);
+  while (length >= 16)
+  {
+    CRC32_FOLD(x1, k, _mm_loadu_si128((__m128i *) buffer));
+    buffer += 16;
+    length -= 16;
+  }
+
+  _mm_storeu_si128((__m128i *) folded, x1);
+  crc = CrcUpdateSlice16(0, folded, 16);
+
+  return CrcUpdateSlice16(crc, buffer, length);
+}
+#endif
+
+/* Builds the slicing tables and picks the fastest kernel */
+void crc32_init(void)
+{
+  int i, n;
+
+  if (crc32_initialized)
+    return;
+
+  for (i = 0; i < 256; i++)
+    crcslice[0][i] = crctable[i];
+  for (n = 1; n < 16; n++)
+    for (i = 0; i < 256; i++)
+      crcslice[n][i] = (crcslice[n - 1][i] >> 8) ^ crctable[crcslice[n - 1][i] & 0xff];
+  crc32_initialized = 1;
+
+  if (crc32_kernel_func == CrcUpdateFirst)
+    crc32_set_kernel(CRC32_KERNEL_AUTO);
+}
+
+static u_int32_t CrcUpdateFirst(u_int32_t crc, unsigned char *buffer, long length)
+{
+  crc32_init();
+  return crc32_kernel_func(crc, buffer, length);
+}
+
+int crc32_set_kernel(crc32_kernel k)
+{
+  u_int32_t f;
+  int ret;
+
+  crc32_init();
+  f = cpu_get_features();
+  if (k == CRC32_KERNEL_AUTO)
+    k = (f & CPU_FEATURE_PCLMUL) && (f & CPU_FEATURE_SSE41) ? CRC32_KERNEL_CLMUL : CRC32_KERNEL_SLICE16;
+
+  ret = 0;
+  switch (k)
+  {
+    case CRC32_KERNEL_REFERENCE:
+      crc32_kernel_func = CrcUpdateReference;
+      break;
+    case CRC32_KERNEL_SLICE16:
+      crc32_kernel_func = CrcUpdateSlice16;
+      break;
+#ifdef CPU_X86_DISPATCH
+    case CRC32_KERNEL_CLMUL:
+      if ((f & CPU_FEATURE_PCLMUL) && (f & CPU_FEATURE_SSE41))
+        crc32_kernel_func = CrcUpdateClmul;
+      else
+        ret = -1;
+      break;
+#endif
+    default:
+      ret = -1;
+      break;
+  }
+  if (ret == 0)
+    crc32_kernel_current = k;
+
+  return ret;
+}
+
+crc32_kernel crc32_get_kernel(void)
+{
+  crc32_init();
+  return crc32_kernel_current;
+}
+
+const char *crc32_kernel_name(crc32_kernel k)
+{
+  return k < CRC32_KERNELS ? crc32_kernel_names[k] : "unknown";
+}
+
+u_int32_t CrcUpdate(              /* returns updated crc         */
+  u_int32_t crc,                  /* starting crc                */
+  unsigned char *buffer,          /* buffer to use to update crc */
+  long length                     /* length of buffer            */
+)
+{
+  return crc32_kernel_func(crc, buffer, length);
+}
@@ -36,16 +36,33 @@
 #ifndef __CRC_H
 #define __CRC_H
 
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-unsigned long CrcUpdate(          /* returns updated crc         */
-  unsigned long crc,              /* starting crc                */
+u_int32_t CrcUpdate(              /* returns updated crc         */
+  u_int32_t crc,                  /* starting crc                */
   unsigned char *buffer,          /* buffer to use to update crc */
   long length                     /* length of buffer            */
 );
 
+/* Implementations of CrcUpdate(), all giving the same results */
+typedef enum {
+  CRC32_KERNEL_AUTO,              /* fastest one the CPU supports */
+  CRC32_KERNEL_REFERENCE,         /* one byte at a time           */
+  CRC32_KERNEL_SLICE16,           /* slicing-by-16                */
+  CRC32_KERNEL_CLMUL,             /* PCLMULQDQ folding            */
+  CRC32_KERNELS
+} crc32_kernel;
+
+void crc32_init(void);
+u_int32_t CrcUpdateReference(u_int32_t crc, unsigned char *buffer, long length);
+int crc32_set_kernel(crc32_kernel k);
+crc32_kernel crc32_get_kernel(void);
+const char *crc32_kernel_name(crc32_kernel k);
+
 #ifdef __cplusplus
 }
 #endif
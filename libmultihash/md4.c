@@ -39,10 +39,10 @@
 #ifndef GET_UINT32_LE
 #define GET_UINT32_LE(n,b,i)                            \
 {                                                       \
-    (n) = ( (unsigned long) (b)[(i)    ]       )        \
-        | ( (unsigned long) (b)[(i) + 1] <<  8 )        \
-        | ( (unsigned long) (b)[(i) + 2] << 16 )        \
-        | ( (unsigned long) (b)[(i) + 3] << 24 );       \
+    (n) = ( (u_int32_t) (b)[(i)    ]       )        \
+        | ( (u_int32_t) (b)[(i) + 1] <<  8 )        \
+        | ( (u_int32_t) (b)[(i) + 2] << 16 )        \
+        | ( (u_int32_t) (b)[(i) + 3] << 24 );       \
 }
 #endif
 
@@ -72,7 +72,7 @@ void md4_starts( md4_context *ctx )
 
 static void md4_process( md4_context *ctx, unsigned char data[64] )
 {
-    unsigned long X[16], A, B, C, D;
+    u_int32_t X[16], A, B, C, D;
 
     GET_UINT32_LE( X[ 0], data,  0 );
     GET_UINT32_LE( X[ 1], data,  4 );
@@ -179,7 +179,7 @@ static void md4_process( md4_context *ctx, unsigned char data[64] )
 void md4_update( md4_context *ctx, unsigned char *input, int ilen )
 {
     int fill;
-    unsigned long left;
+    u_int32_t left;
 
     if( ilen <= 0 )
         return;
@@ -190,7 +190,7 @@ void md4_update( md4_context *ctx, unsigned char *input, int ilen )
     ctx->total[0] += ilen;
     ctx->total[0] &= 0xFFFFFFFF;
 
-    if( ctx->total[0] < (unsigned long) ilen )
+    if( ctx->total[0] < (u_int32_t) ilen )
         ctx->total[1]++;
 
     if( left && ilen >= fill )
@@ -230,8 +230,8 @@ static const unsigned char md4_padding[64] =
  */
 void md4_finish( md4_context *ctx, unsigned char *output )
 {
-    unsigned long last, padn;
-    unsigned long high, low;
+    u_int32_t last, padn;
+    u_int32_t high, low;
     unsigned char msglen[8];
 
     high = ( ctx->total[0] >> 29 )
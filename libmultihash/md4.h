@@ -4,6 +4,8 @@
 #ifndef _MD4_H
 #define _MD4_H
 
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -13,8 +15,8 @@ extern "C" {
  */
 typedef struct
 {
-    unsigned long total[2];     /*!< number of bytes processed  */
-    unsigned long state[4];     /*!< intermediate digest state  */
+    u_int32_t total[2];         /*!< number of bytes processed  */
+    u_int32_t state[4];         /*!< intermediate digest state  */
     unsigned char buffer[64];   /*!< data block being processed */
     unsigned char ipad[64];     /*!< HMAC: inner padding        */
     unsigned char opad[64];     /*!< HMAC: outer padding        */
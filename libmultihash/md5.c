@@ -34,8 +34,17 @@
 /* -- include the following line if the md5.h header file is separate -- */
 #include "md5.h"
 
+#include <string.h>
+
 /* forward declaration */
 static void Transform ();
+static void MD5UpdateOptimized (MD5_CTX *mdContext, unsigned char *inBuf, unsigned int inLen);
+
+static const char *md5_kernel_names[MD5_KERNELS] = {
+  "auto", "reference", "optimized"
+};
+
+static md5_kernel md5_kernel_current = MD5_KERNEL_OPTIMIZED;
 
 static unsigned char PADDING[64] = {
   0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -102,6 +111,11 @@ unsigned int inLen;
   int mdi;
   unsigned int i, ii;
 
+  if (md5_kernel_current != MD5_KERNEL_REFERENCE) {
+    MD5UpdateOptimized (mdContext, inBuf, inLen);
+    return;
+  }
+
   /* compute number of bytes mod 64 */
   mdi = (int)((mdContext->i[0] >> 3) & 0x3F);
 
@@ -269,6 +283,178 @@ UINT4 *in;
   buf[3] += d;
 }
 
+/* Optimized block function: whole blocks are read straight from the input,
+   and the selection functions take one operation less */
+#define F2(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G2(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define STEP(f, a, b, c, d, x, s, ac) \
+  {(a) += f ((b), (c), (d)) + (x) + (UINT4)(ac); \
+   (a) = ROTATE_LEFT ((a), (s)); \
+   (a) += (b); \
+  }
+
+static void MD5Blocks (UINT4 *buf, const unsigned char *data, unsigned long blocks)
+{
+  UINT4 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+  UINT4 aa, bb, cc, dd, in[16];
+  int i;
+
+  for (; blocks > 0; blocks--, data += 64) {
+    aa = a;
+    bb = b;
+    cc = c;
+    dd = d;
+    for (i = 0; i < 16; i++)
+      in[i] = ((UINT4)data[4*i]) | (((UINT4)data[4*i+1]) << 8) |
+              (((UINT4)data[4*i+2]) << 16) | (((UINT4)data[4*i+3]) << 24);
+
+    /* Round 1 */
+    STEP (F2, a, b, c, d, in[ 0], S11, 3614090360U); /* 1 */
+    STEP (F2, d, a, b, c, in[ 1], S12, 3905402710U); /* 2 */
+    STEP (F2, c, d, a, b, in[ 2], S13,  606105819U); /* 3 */
+    STEP (F2, b, c, d, a, in[ 3], S14, 3250441966U); /* 4 */
+    STEP (F2, a, b, c, d, in[ 4], S11, 4118548399U); /* 5 */
+    STEP (F2, d, a, b, c, in[ 5], S12, 1200080426U); /* 6 */
+    STEP (F2, c, d, a, b, in[ 6], S13, 2821735955U); /* 7 */
+    STEP (F2, b, c, d, a, in[ 7], S14, 4249261313U); /* 8 */
+    STEP (F2, a, b, c, d, in[ 8], S11, 1770035416U); /* 9 */
+    STEP (F2, d, a, b, c, in[ 9], S12, 2336552879U); /* 10 */
+    STEP (F2, c, d, a, b, in[10], S13, 4294925233U); /* 11 */
+    STEP (F2, b, c, d, a, in[11], S14, 2304563134U); /* 12 */
+    STEP (F2, a, b, c, d, in[12], S11, 1804603682U); /* 13 */
+    STEP (F2, d, a, b, c, in[13], S12, 4254626195U); /* 14 */
+    STEP (F2, c, d, a, b, in[14], S13, 2792965006U); /* 15 */
+    STEP (F2, b, c, d, a, in[15], S14, 1236535329U); /* 16 */
+
+    /* Round 2 */
+    STEP (G2, a, b, c, d, in[ 1], S21, 4129170786U); /* 17 */
+    STEP (G2, d, a, b, c, in[ 6], S22, 3225465664U); /* 18 */
+    STEP (G2, c, d, a, b, in[11], S23,  643717713U); /* 19 */
+    STEP (G2, b, c, d, a, in[ 0], S24, 3921069994U); /* 20 */
+    STEP (G2, a, b, c, d, in[ 5], S21, 3593408605U); /* 21 */
+    STEP (G2, d, a, b, c, in[10], S22,   38016083U); /* 22 */
+    STEP (G2, c, d, a, b, in[15], S23, 3634488961U); /* 23 */
+    STEP (G2, b, c, d, a, in[ 4], S24, 3889429448U); /* 24 */
+    STEP (G2, a, b, c, d, in[ 9], S21,  568446438U); /* 25 */
+    STEP (G2, d, a, b, c, in[14], S22, 3275163606U); /* 26 */
+    STEP (G2, c, d, a, b, in[ 3], S23, 4107603335U); /* 27 */
+    STEP (G2, b, c, d, a, in[ 8], S24, 1163531501U); /* 28 */
+    STEP (G2, a, b, c, d, in[13], S21, 2850285829U); /* 29 */
+    STEP (G2, d, a, b, c, in[ 2], S22, 4243563512U); /* 30 */
+    STEP (G2, c, d, a, b, in[ 7], S23, 1735328473U); /* 31 */
+    STEP (G2, b, c, d, a, in[12], S24, 2368359562U); /* 32 */
+
+    /* Round 3 */
+    STEP (H, a, b, c, d, in[ 5], S31, 4294588738U); /* 33 */
+    STEP (H, d, a, b, c, in[ 8], S32, 2272392833U); /* 34 */
+    STEP (H, c, d, a, b, in[11], S33, 1839030562U); /* 35 */
+    STEP (H, b, c, d, a, in[14], S34, 4259657740U); /* 36 */
+    STEP (H, a, b, c, d, in[ 1], S31, 2763975236U); /* 37 */
+    STEP (H, d, a, b, c, in[ 4], S32, 1272893353U); /* 38 */
+    STEP (H, c, d, a, b, in[ 7], S33, 4139469664U); /* 39 */
+    STEP (H, b, c, d, a, in[10], S34, 3200236656U); /* 40 */
+    STEP (H, a, b, c, d, in[13], S31,  681279174U); /* 41 */
+    STEP (H, d, a, b, c, in[ 0], S32, 3936430074U); /* 42 */
+    STEP (H, c, d, a, b, in[ 3], S33, 3572445317U); /* 43 */
+    STEP (H, b, c, d, a, in[ 6], S34,   76029189U); /* 44 */
+    STEP (H, a, b, c, d, in[ 9], S31, 3654602809U); /* 45 */
+    STEP (H, d, a, b, c, in[12], S32, 3873151461U); /* 46 */
+    STEP (H, c, d, a, b, in[15], S33,  530742520U); /* 47 */
+    STEP (H, b, c, d, a, in[ 2], S34, 3299628645U); /* 48 */
+
+    /* Round 4 */
+    STEP (I, a, b, c, d, in[ 0], S41, 4096336452U); /* 49 */
+    STEP (I, d, a, b, c, in[ 7], S42, 1126891415U); /* 50 */
+    STEP (I, c, d, a, b, in[14], S43, 2878612391U); /* 51 */
+    STEP (I, b, c, d, a, in[ 5], S44, 4237533241U); /* 52 */
+    STEP (I, a, b, c, d, in[12], S41, 1700485571U); /* 53 */
+    STEP (I, d, a, b, c, in[ 3], S42, 2399980690U); /* 54 */
+    STEP (I, c, d, a, b, in[10], S43, 4293915773U); /* 55 */
+    STEP (I, b, c, d, a, in[ 1], S44, 2240044497U); /* 56 */
+    STEP (I, a, b, c, d, in[ 8], S41, 1873313359U); /* 57 */
+    STEP (I, d, a, b, c, in[15], S42, 4264355552U); /* 58 */
+    STEP (I, c, d, a, b, in[ 6], S43, 2734768916U); /* 59 */
+    STEP (I, b, c, d, a, in[13], S44, 1309151649U); /* 60 */
+    STEP (I, a, b, c, d, in[ 4], S41, 4149444226U); /* 61 */
+    STEP (I, d, a, b, c, in[11], S42, 3174756917U); /* 62 */
+    STEP (I, c, d, a, b, in[ 2], S43,  718787259U); /* 63 */
+    STEP (I, b, c, d, a, in[ 9], S44, 3951481745U); /* 64 */
+
+    a += aa;
+    b += bb;
+    c += cc;
+    d += dd;
+  }
+
+  buf[0] = a;
+  buf[1] = b;
+  buf[2] = c;
+  buf[3] = d;
+}
+
+static void MD5UpdateOptimized (MD5_CTX *mdContext, unsigned char *inBuf, unsigned int inLen)
+{
+  unsigned int mdi, n;
+
+  /* compute number of bytes mod 64 */
+  mdi = (unsigned int)((mdContext->i[0] >> 3) & 0x3F);
+
+  /* update number of bits */
+  if ((mdContext->i[0] + ((UINT4)inLen << 3)) < mdContext->i[0])
+    mdContext->i[1]++;
+  mdContext->i[0] += ((UINT4)inLen << 3);
+  mdContext->i[1] += ((UINT4)inLen >> 29);
+
+  /* complete the buffered block first */
+  if (mdi > 0) {
+    n = 64 - mdi;
+    if (n > inLen)
+      n = inLen;
+    memcpy (&mdContext->in[mdi], inBuf, n);
+    mdi += n;
+    inBuf += n;
+    inLen -= n;
+    if (mdi < 64)
+      return;
+    MD5Blocks (mdContext->buf, mdContext->in, 1);
+  }
+
+  /* then hash as many blocks as possible in place, and buffer the rest */
+  if (inLen >= 64) {
+    MD5Blocks (mdContext->buf, inBuf, inLen / 64);
+    inBuf += inLen & ~63U;
+    inLen &= 63;
+  }
+  memcpy (mdContext->in, inBuf, inLen);
+}
+
+int md5_set_kernel (md5_kernel k)
+{
+  int ret;
+
+  if (k == MD5_KERNEL_AUTO)
+    k = MD5_KERNEL_OPTIMIZED;
+
+  if (k == MD5_KERNEL_REFERENCE || k == MD5_KERNEL_OPTIMIZED) {
+    md5_kernel_current = k;
+    ret = 0;
+  } else {
+    ret = -1;
+  }
+
+  return ret;
+}
+
+md5_kernel md5_get_kernel (void)
+{
+  return md5_kernel_current;
+}
+
+const char *md5_kernel_name (md5_kernel k)
+{
+  return k < MD5_KERNELS ? md5_kernel_names[k] : "unknown";
+}
+
 /*
  **********************************************************************
  ** End of md5.c                                                     **
@@ -37,8 +37,9 @@
  **********************************************************************
  */
 
-/* typedef a 32 bit type */
-typedef unsigned long int UINT4;
+/* typedef a 32 bit type (unsigned long is 64 bits on most 64-bit systems) */
+#include <sys/types.h>
+typedef u_int32_t UINT4;
 
 /* Data structure for MD5 (Message Digest) computation */
 typedef struct {
@@ -52,6 +53,18 @@ void MD5Init ();
 void MD5Update ();
 void MD5Final ();
 
+/* Implementations of MD5Update (), all giving the same results */
+typedef enum {
+  MD5_KERNEL_AUTO,                  /* fastest one                   */
+  MD5_KERNEL_REFERENCE,             /* one byte at a time            */
+  MD5_KERNEL_OPTIMIZED,             /* whole blocks, in place        */
+  MD5_KERNELS
+} md5_kernel;
+
+int md5_set_kernel (md5_kernel k);
+md5_kernel md5_get_kernel (void);
+const char *md5_kernel_name (md5_kernel k);
+
 /*
  **********************************************************************
  ** End of md5.h                                                     **
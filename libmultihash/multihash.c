@@ -19,12 +19,55 @@
  ***************************************************************************/
 
 #include "multihash.h"
+#include "cpu.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
 
 #define READBUF_SIZE 8192
 
+/* Longest update performed by the self-test, plus the longest test vector */
+#define TEST_BUFSIZE (4000 + 64)
 
+
+/* Digest names, in the same order as the MULTIHASH_* bits */
+static char *digest_names[MULTIHASH_DIGESTS] = {
+	"CRC32",
+	"MD4",
+	"MD5",
+	"ED2K",
+	"SHA-1"
+};
+
+
+/**
+ * Initializes all the supported digests.
+ * @param mh The multihash structure.
+ */
 void multihash_init (multihash *mh) {
+	multihash_init_digests (mh, MULTIHASH_ALL);
+
+	return;
+}
+
+
+/**
+ * Initializes only some digests: the others are skipped by multihash_update() and their strings are left empty by multihash_finish().
+ * @param mh The multihash structure.
+ * @param digests The digests to compute (MULTIHASH_* values, OR'ed together).
+ */
+void multihash_init_digests (multihash *mh, u_int32_t digests) {
+	/* Choose the kernels now, rather than in the threads that will do the updates */
+#ifdef USE_CRC32
+	crc32_init ();
+#endif
+#ifdef USE_SHA1
+	sha1_get_kernel ();
+#endif
+
+	mh -> digests = digests & MULTIHASH_ALL;
 #ifdef USE_CRC32
 	(mh -> crc32_s)[0] = '\0';
 	mh -> crc32 = 0xffffffff;
@@ -50,22 +93,65 @@ void multihash_init (multihash *mh) {
 }
 
 
-void multihash_update (multihash *mh, unsigned char *data, int bytes) {
+/**
+ * Updates a single digest. Every digest has its own context and data is only read, so different digests of the same multihash structure
+ * can be updated by different threads at the same time, over the same buffer.
+ * @param mh The multihash structure.
+ * @param digest The digest to update (A single MULTIHASH_* value).
+ * @param data The data.
+ * @param bytes The length of the data.
+ */
+void multihash_update_digest (multihash *mh, u_int32_t digest, unsigned char *data, int bytes) {
+	switch (digest & mh -> digests) {
 #ifdef USE_CRC32
-	mh -> crc32 = CrcUpdate (mh -> crc32, data, bytes);
+		case MULTIHASH_CRC32:
+			mh -> crc32 = CrcUpdate (mh -> crc32, data, bytes);
+			break;
 #endif
 #ifdef USE_MD4
-//	md4_update (&(mh -> md4), data, bytes);
+		case MULTIHASH_MD4:
+			md4_update (&(mh -> md4), data, bytes);
+			break;
 #endif
 #ifdef USE_MD5
-	MD5Update (&(mh -> md5), data, bytes);
+		case MULTIHASH_MD5:
+			MD5Update (&(mh -> md5), data, bytes);
+			break;
 #endif
 #ifdef USE_ED2K
-//	ed2khash_update (&(mh -> ed2k), data, bytes);
+		case MULTIHASH_ED2K:
+			ed2khash_update (&(mh -> ed2k), data, bytes);
+			break;
 #endif
 #ifdef USE_SHA1
-	SHA1Update (&(mh -> sha1), data, bytes);		/* WARNING: SHA1Update() destroys data! */
+		case MULTIHASH_SHA1:
+			SHA1Update (&(mh -> sha1), data, bytes);
+			break;
 #endif
+		default:
+			break;
+	}
+
+	return;
+}
+
+
+void multihash_update (multihash *mh, unsigned char *data, int bytes) {
+	u_int32_t digest;
+
+	for (digest = 1; digest <= MULTIHASH_ALL; digest <<= 1)
+		multihash_update_digest (mh, digest, data, bytes);
+
+	return;
+}
+
+
+static void multihash_hex (char *out, unsigned char *buf, int len) {
+	int i;
+
+	for (i = 0; i < len; i++)
+		sprintf (out + 2 * i, "%02x", buf[i]);
+	out[2 * len] = '\0';
 
 	return;
 }
@@ -73,49 +159,255 @@ void multihash_update (multihash *mh, unsigned char *data, int bytes) {
 
 void multihash_finish (multihash *mh) {
 	unsigned char buf[MAX_DIGESTSIZE];
-	int bytes;
 	
 #ifdef USE_CRC32
-	mh -> crc32 ^= 0xffffffff;
-	snprintf (mh -> crc32_s, LEN_CRC32 + 1, "%08x", mh -> crc32);
+	if (mh -> digests & MULTIHASH_CRC32) {
+		mh -> crc32 ^= 0xffffffff;
+		snprintf (mh -> crc32_s, LEN_CRC32 + 1, "%08x", mh -> crc32);
+	}
 #endif
 #ifdef USE_MD4
-	md4_finish (&(mh -> md4), buf);
-	for (bytes = 0; bytes < LEN_MD4 / 2; bytes++)
-		sprintf (mh -> md4_s, "%s%02x", mh -> md4_s, buf[bytes]);
-	(mh -> md4_s)[LEN_MD4] = '\0';
+	if (mh -> digests & MULTIHASH_MD4) {
+		md4_finish (&(mh -> md4), buf);
+		multihash_hex (mh -> md4_s, buf, LEN_MD4 / 2);
+	}
 #endif
 #ifdef USE_MD5
-	MD5Final (&(mh -> md5));
-	for (bytes = 0; bytes < LEN_MD5 / 2; bytes++)
-		sprintf (mh -> md5_s, "%s%02x", mh -> md5_s, (mh -> md5).digest[bytes]);
-	(mh -> md5_s)[LEN_MD5] = '\0';
+	if (mh -> digests & MULTIHASH_MD5) {
+		MD5Final (&(mh -> md5));
+		multihash_hex (mh -> md5_s, (mh -> md5).digest, LEN_MD5 / 2);
+	}
 #endif
 #ifdef USE_ED2K
-	ed2khash_finish (&(mh -> ed2k), buf);
-	for (bytes = 0; bytes < LEN_ED2K / 2; bytes++)
-		sprintf (mh -> ed2k_s, "%s%02x", mh -> ed2k_s, buf[bytes]);
-	(mh -> ed2k_s)[LEN_ED2K] = '\0';
+	if (mh -> digests & MULTIHASH_ED2K) {
+		ed2khash_finish (&(mh -> ed2k), buf);
+		multihash_hex (mh -> ed2k_s, buf, LEN_ED2K / 2);
+	}
 #endif	
 #ifdef USE_SHA1
-	SHA1Final (buf, &(mh -> sha1));
-	for (bytes = 0; bytes < LEN_SHA1 / 2; bytes++)
-		sprintf (mh -> sha1_s, "%s%02x", mh -> sha1_s, buf[bytes]);
-	(mh -> sha1_s)[LEN_SHA1] = '\0';
-
+	if (mh -> digests & MULTIHASH_SHA1) {
+		SHA1Final (buf, &(mh -> sha1));
+		multihash_hex (mh -> sha1_s, buf, LEN_SHA1 / 2);
+	}
 #endif
 
 	return;
 }
 
 
+static void multihash_put_words (FILE *fp, u_int32_t *words, int n) {
+	int i;
+
+	for (i = 0; i < n; i++)
+		fprintf (fp, " %08x", (unsigned int) words[i]);
+
+	return;
+}
+
+
+static void multihash_put_bytes (FILE *fp, unsigned char *buf, int len) {
+	int i;
+
+	fprintf (fp, " ");
+	for (i = 0; i < len; i++)
+		fprintf (fp, "%02x", buf[i]);
+
+	return;
+}
+
+
+static int multihash_get_words (FILE *fp, u_int32_t *words, int n) {
+	unsigned int x;
+	int i, out;
+
+	for (i = 0, out = 0; i < n && out == 0; i++) {
+		if (fscanf (fp, "%x", &x) == 1)
+			words[i] = x;
+		else
+			out = -1;
+	}
+
+	return (out);
+}
+
+
+static int multihash_get_bytes (FILE *fp, unsigned char *buf, int len) {
+	unsigned int x;
+	int i, out;
+
+	/* The first conversion skips the blank before the bytes */
+	for (i = 0, out = 0; i < len && out == 0; i++) {
+		if (fscanf (fp, "%2x", &x) == 1)
+			buf[i] = (unsigned char) x;
+		else
+			out = -1;
+	}
+
+	return (out);
+}
+
+
+#ifdef USE_MD4
+static void multihash_put_md4 (FILE *fp, md4_context *ctx) {
+	multihash_put_words (fp, ctx -> total, 2);
+	multihash_put_words (fp, ctx -> state, 4);
+	multihash_put_bytes (fp, ctx -> buffer, 64);
+
+	return;
+}
+
+
+static int multihash_get_md4 (FILE *fp, md4_context *ctx) {
+	int out;
+
+	memset (ctx, 0, sizeof (md4_context));
+	if (multihash_get_words (fp, ctx -> total, 2) < 0 || multihash_get_words (fp, ctx -> state, 4) < 0 || multihash_get_bytes (fp, ctx -> buffer, 64) < 0)
+		out = -1;
+	else
+		out = 0;
+
+	return (out);
+}
+#endif
+
+
+/**
+ * Saves the state of the enabled digests as text, so that hashing can be continued later, even on another machine, with
+ * multihash_load_state().
+ * @param mh The multihash structure, which must not have been finished.
+ * @param fp The file to write to.
+ * @return 0 if the state could be written, -1 otherwise.
+ */
+int multihash_save_state (multihash *mh, FILE *fp) {
+#ifdef USE_ED2K
+	u_int32_t w[2];
+#endif
+
+	fprintf (fp, "%x\n", (unsigned int) mh -> digests);
+#ifdef USE_CRC32
+	if (mh -> digests & MULTIHASH_CRC32)
+		fprintf (fp, "crc32 %08x\n", (unsigned int) mh -> crc32);
+#endif
+#ifdef USE_MD4
+	if (mh -> digests & MULTIHASH_MD4) {
+		fprintf (fp, "md4");
+		multihash_put_md4 (fp, &(mh -> md4));
+		fprintf (fp, "\n");
+	}
+#endif
+#ifdef USE_MD5
+	if (mh -> digests & MULTIHASH_MD5) {
+		fprintf (fp, "md5");
+		multihash_put_words (fp, (mh -> md5).i, 2);
+		multihash_put_words (fp, (mh -> md5).buf, 4);
+		multihash_put_bytes (fp, (mh -> md5).in, 64);
+		fprintf (fp, "\n");
+	}
+#endif
+#ifdef USE_ED2K
+	if (mh -> digests & MULTIHASH_ED2K) {
+		fprintf (fp, "ed2k");
+		w[0] = (u_int32_t) (mh -> ed2k).bytes_processed;
+		w[1] = (u_int32_t) (mh -> ed2k).chunks;
+		multihash_put_words (fp, w, 2);
+		multihash_put_md4 (fp, &((mh -> ed2k).md4cur));
+		multihash_put_md4 (fp, &((mh -> ed2k).md4final));
+		multihash_put_bytes (fp, (mh -> ed2k).lastmd4, MD4_DIGESTSIZE);
+		fprintf (fp, "\n");
+	}
+#endif
+#ifdef USE_SHA1
+	if (mh -> digests & MULTIHASH_SHA1) {
+		fprintf (fp, "sha1");
+		multihash_put_words (fp, (mh -> sha1).state, 5);
+		multihash_put_words (fp, (mh -> sha1).count, 2);
+		multihash_put_bytes (fp, (mh -> sha1).buffer, SHA1_BLOCKSIZE);
+		fprintf (fp, "\n");
+	}
+#endif
+
+	return (ferror (fp) ? -1 : 0);
+}
+
+
+/**
+ * Restores a state saved with multihash_save_state(). The digests that were enabled when it was saved are enabled again, the others are
+ * disabled.
+ * @param mh The multihash structure.
+ * @param fp The file to read from.
+ * @return 0 if a valid state could be read, -1 otherwise.
+ */
+int multihash_load_state (multihash *mh, FILE *fp) {
+	unsigned int digests;
+	char name[8];
+	u_int32_t digest, w[2];
+	int out;
+
+	if (fscanf (fp, "%x", &digests) != 1 || (digests & ~MULTIHASH_ALL) != 0)
+		return (-1);
+	multihash_init_digests (mh, digests);
+
+	for (digest = 1, out = 0; digest <= MULTIHASH_ALL && out == 0; digest <<= 1) {
+		if (!(digests & digest))
+			continue;
+		if (fscanf (fp, "%7s", name) != 1) {
+			out = -1;
+			break;
+		}
+
+		switch (digest) {
+#ifdef USE_CRC32
+			case MULTIHASH_CRC32:
+				out = strcmp (name, "crc32") == 0 ? multihash_get_words (fp, &(mh -> crc32), 1) : -1;
+				break;
+#endif
+#ifdef USE_MD4
+			case MULTIHASH_MD4:
+				out = strcmp (name, "md4") == 0 ? multihash_get_md4 (fp, &(mh -> md4)) : -1;
+				break;
+#endif
+#ifdef USE_MD5
+			case MULTIHASH_MD5:
+				if (strcmp (name, "md5") != 0 || multihash_get_words (fp, (mh -> md5).i, 2) < 0 || multihash_get_words (fp, (mh -> md5).buf, 4) < 0 ||
+				    multihash_get_bytes (fp, (mh -> md5).in, 64) < 0)
+					out = -1;
+				break;
+#endif
+#ifdef USE_ED2K
+			case MULTIHASH_ED2K:
+				if (strcmp (name, "ed2k") != 0 || multihash_get_words (fp, w, 2) < 0 || multihash_get_md4 (fp, &((mh -> ed2k).md4cur)) < 0 ||
+				    multihash_get_md4 (fp, &((mh -> ed2k).md4final)) < 0 || multihash_get_bytes (fp, (mh -> ed2k).lastmd4, MD4_DIGESTSIZE) < 0) {
+					out = -1;
+				} else {
+					(mh -> ed2k).bytes_processed = w[0];
+					(mh -> ed2k).chunks = w[1];
+				}
+				break;
+#endif
+#ifdef USE_SHA1
+			case MULTIHASH_SHA1:
+				if (strcmp (name, "sha1") != 0 || multihash_get_words (fp, (mh -> sha1).state, 5) < 0 || multihash_get_words (fp, (mh -> sha1).count, 2) < 0 ||
+				    multihash_get_bytes (fp, (mh -> sha1).buffer, SHA1_BLOCKSIZE) < 0)
+					out = -1;
+				break;
+#endif
+			default:
+				out = -1;
+				break;
+		}
+	}
+
+	return (out);
+}
+
+
 int multihash_file (multihash *mh, char *filename) {
 	FILE *fp;
 	int bytes, out;
 	unsigned char data[READBUF_SIZE];
 	
 	multihash_init (mh);
-	if ((fp = fopen (filename, "r"))) {
+	if ((fp = fopen (filename, "rb"))) {
 		while ((bytes = fread (data, 1, READBUF_SIZE, fp)) != 0)
 			multihash_update (mh, data, bytes);
 		multihash_finish (mh);
@@ -128,3 +420,424 @@ int multihash_file (multihash *mh, char *filename) {
 
 	return (out);
 }
+
+
+/**
+ * @param digest A single MULTIHASH_* value.
+ * @return The name of the digest, or NULL if digest is not valid.
+ */
+char *multihash_digest_name (u_int32_t digest) {
+	char *out;
+	int i;
+
+	for (i = 0, out = NULL; i < MULTIHASH_DIGESTS && !out; i++) {
+		if (digest == (1U << i))
+			out = digest_names[i];
+	}
+
+	return (out);
+}
+
+
+/* Copies a digest name in lower case and without dashes, stopping at the first comma */
+static char *multihash_normalize_name (char *out, char *in, int size) {
+	int i;
+
+	for (i = 0; *in && *in != ','; in++) {
+		if (*in != '-' && i < size - 1)
+			out[i++] = tolower ((unsigned char) *in);
+	}
+	out[i] = '\0';
+
+	return (in);
+}
+
+
+/**
+ * Parses a comma-separated list of digest names, such as "crc32,md5,sha1". Case and dashes do not matter, and "all" selects all digests.
+ * @param list The list.
+ * @return The digests (MULTIHASH_* values, OR'ed together), or 0 if the list contains an unknown name.
+ */
+u_int32_t multihash_parse_digests (char *list) {
+	u_int32_t out, digest;
+	char name[16], ref[16], *p;
+	int i;
+
+	for (out = 0, p = list; p && *p; ) {
+		p = multihash_normalize_name (name, p, sizeof (name));
+		if (*p == ',')
+			p++;
+
+		if (strcmp (name, "all") == 0) {
+			digest = MULTIHASH_ALL;
+		} else {
+			for (i = 0, digest = 0; i < MULTIHASH_DIGESTS && !digest; i++) {
+				multihash_normalize_name (ref, digest_names[i], sizeof (ref));
+				if (strcmp (ref, name) == 0)
+					digest = 1U << i;
+			}
+		}
+
+		if (digest) {
+			out |= digest;
+		} else {
+			/* Unknown name */
+			out = 0;
+			p = NULL;
+		}
+	}
+
+	return (out);
+}
+
+
+/* Known answers, from the RFCs and from other implementations. ED2K is the MD4 of data shorter than a chunk. */
+static struct {
+	char *data;
+	int repeat;
+	char *crc32;
+	char *md4;
+	char *md5;
+	char *ed2k;
+	char *sha1;
+} test_vectors[] = {
+	{"", 1, "00000000", "31d6cfe0d16ae931b73c59d7e0c089c0", "d41d8cd98f00b204e9800998ecf8427e", "31d6cfe0d16ae931b73c59d7e0c089c0",
+	 "da39a3ee5e6b4b0d3255bfef95601890afd80709"},
+	{"abc", 1, "352441c2", "a448017aaf21d8525fc10ae87aa6729d", "900150983cd24fb0d6963f7d28e17f72", "a448017aaf21d8525fc10ae87aa6729d",
+	 "a9993e364706816aba3e25717850c26c9cd0d89d"},
+	{"123456789", 1, "cbf43926", "2ae523785d0caf4d2fb557c12016185c", "25f9e794323b453885f5181f1b624d0b", "2ae523785d0caf4d2fb557c12016185c",
+	 "f7c3bc1d808e04732adf679965ccc34ca7ae3441"},
+	{"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1, "171a3f5f", "4691a9ec81b1a6bd1ab8557240b245c5",
+	 "8215ef0796a20bcaaae116d3876c664a", "4691a9ec81b1a6bd1ab8557240b245c5", "84983e441c3bd26ebaae4aa1f95129e5e54670f1"},
+	{"a", 1000000, "dc25bfbc", "bbce80cc6bb65e5c6745e30d4eeca9a4", "7707d6ae4e027c70eea2a935c2296f21", "bbce80cc6bb65e5c6745e30d4eeca9a4",
+	 "34aa973cd4c4daa4f61eeb2bdbad27316534016f"},
+	{"0123456789abcdef", 1000000, NULL, NULL, NULL, "e64e84973b4439e8ea9d1858fa648276", NULL}		/* Two ED2K chunks */
+};
+
+
+/* The different implementations (kernels) of each digest, as seen by the self-test and the benchmark */
+static int multihash_kernels (u_int32_t digest) {
+	int out;
+
+	switch (digest) {
+#ifdef USE_CRC32
+		case MULTIHASH_CRC32:
+			out = CRC32_KERNELS;
+			break;
+#endif
+#ifdef USE_MD5
+		case MULTIHASH_MD5:
+			out = MD5_KERNELS;
+			break;
+#endif
+#ifdef USE_SHA1
+		case MULTIHASH_SHA1:
+			out = SHA1_KERNELS;
+			break;
+#endif
+		default:
+			/* Auto and reference */
+			out = 2;
+			break;
+	}
+
+	return (out);
+}
+
+
+static int multihash_get_kernel (u_int32_t digest) {
+	int out;
+
+	switch (digest) {
+#ifdef USE_CRC32
+		case MULTIHASH_CRC32:
+			out = crc32_get_kernel ();
+			break;
+#endif
+#ifdef USE_MD5
+		case MULTIHASH_MD5:
+			out = md5_get_kernel ();
+			break;
+#endif
+#ifdef USE_SHA1
+		case MULTIHASH_SHA1:
+			out = sha1_get_kernel ();
+			break;
+#endif
+		default:
+			out = 1;
+			break;
+	}
+
+	return (out);
+}
+
+
+static int multihash_set_kernel (u_int32_t digest, int k) {
+	int out;
+
+	switch (digest) {
+#ifdef USE_CRC32
+		case MULTIHASH_CRC32:
+			out = crc32_set_kernel ((crc32_kernel) k);
+			break;
+#endif
+#ifdef USE_MD5
+		case MULTIHASH_MD5:
+			out = md5_set_kernel ((md5_kernel) k);
+			break;
+#endif
+#ifdef USE_SHA1
+		case MULTIHASH_SHA1:
+			out = sha1_set_kernel ((sha1_kernel) k);
+			break;
+#endif
+		default:
+			out = k == 1 ? 0 : -1;
+			break;
+	}
+
+	return (out);
+}
+
+
+static const char *multihash_kernel_name (u_int32_t digest, int k) {
+	const char *out;
+
+	switch (digest) {
+#ifdef USE_CRC32
+		case MULTIHASH_CRC32:
+			out = crc32_kernel_name ((crc32_kernel) k);
+			break;
+#endif
+#ifdef USE_MD5
+		case MULTIHASH_MD5:
+			out = md5_kernel_name ((md5_kernel) k);
+			break;
+#endif
+#ifdef USE_SHA1
+		case MULTIHASH_SHA1:
+			out = sha1_kernel_name ((sha1_kernel) k);
+			break;
+#endif
+		default:
+			out = "reference";
+			break;
+	}
+
+	return (out);
+}
+
+
+/* The string of a single digest, after multihash_finish() */
+static char *multihash_string (multihash *mh, u_int32_t digest) {
+	char *out;
+
+	switch (digest) {
+#ifdef USE_CRC32
+		case MULTIHASH_CRC32:
+			out = mh -> crc32_s;
+			break;
+#endif
+#ifdef USE_MD4
+		case MULTIHASH_MD4:
+			out = mh -> md4_s;
+			break;
+#endif
+#ifdef USE_MD5
+		case MULTIHASH_MD5:
+			out = mh -> md5_s;
+			break;
+#endif
+#ifdef USE_ED2K
+		case MULTIHASH_ED2K:
+			out = mh -> ed2k_s;
+			break;
+#endif
+#ifdef USE_SHA1
+		case MULTIHASH_SHA1:
+			out = mh -> sha1_s;
+			break;
+#endif
+		default:
+			out = NULL;
+			break;
+	}
+
+	return (out);
+}
+
+
+/* Hashes <code>repeat</code> copies of <code>data</code> with updates of different sizes, to exercise the buffering of partial blocks */
+static void multihash_feed (multihash *mh, char *data, int repeat, unsigned char *buf) {
+	static const int chunks[] = {1, 7, 64, 200, 4000};
+	int len, total, pos, c, i;
+
+	len = strlen (data);
+	for (i = 0; i < TEST_BUFSIZE; i++)
+		buf[i] = len > 0 ? data[i % len] : 0;
+
+	total = len * repeat;
+	for (pos = 0, i = 0; pos < total; pos += c, i++) {
+		c = chunks[i % (sizeof (chunks) / sizeof (chunks[0]))];
+		if (c > total - pos)
+			c = total - pos;
+		multihash_update (mh, buf + pos % len, c);
+	}
+
+	return;
+}
+
+
+/**
+ * Checks all the kernels the CPU supports, for all digests, against known answers. Kernels must also agree with the reference ones on random
+ * data hashed in irregular pieces.
+ * @param verbose If not 0, results are printed to stdout.
+ * @return 0 if all kernels passed, 1 otherwise.
+ */
+int multihash_self_test (int verbose) {
+	multihash mh;
+	unsigned char *buf, *rnd;
+	char expected[LEN_SHA1 + 1], *answer;
+	u_int32_t digest, r;
+	int i, k, saved, pos, c, ret;
+	FILE *fp;
+
+	buf = (unsigned char *) malloc (TEST_BUFSIZE);
+	rnd = (unsigned char *) malloc (65536);
+	for (i = 0, r = 0x13579BDF; i < 65536; i++) {
+		r = r * 1103515245 + 12345;
+		rnd[i] = (unsigned char) (r >> 16);
+	}
+
+	ret = 0;
+	for (digest = 1; digest <= MULTIHASH_ALL && ret == 0; digest <<= 1) {
+		saved = multihash_get_kernel (digest);
+
+		/* Reference result on random data */
+		multihash_set_kernel (digest, 1);
+		multihash_init_digests (&mh, digest);
+		multihash_update (&mh, rnd, 65536);
+		multihash_finish (&mh);
+		strcpy (expected, multihash_string (&mh, digest));
+
+		for (k = 1; k < multihash_kernels (digest) && ret == 0; k++) {
+			if (multihash_set_kernel (digest, k) < 0) {
+				if (verbose != 0)
+					printf ("  %s %s kernel: not supported\n", multihash_digest_name (digest), multihash_kernel_name (digest, k));
+				continue;
+			}
+			if (verbose != 0)
+				printf ("  %s %s kernel: ", multihash_digest_name (digest), multihash_kernel_name (digest, k));
+
+			for (i = 0; i < (int) (sizeof (test_vectors) / sizeof (test_vectors[0])) && ret == 0; i++) {
+				multihash_init_digests (&mh, digest);
+				multihash_feed (&mh, test_vectors[i].data, test_vectors[i].repeat, buf);
+				multihash_finish (&mh);
+				switch (digest) {
+					case MULTIHASH_CRC32:
+						answer = test_vectors[i].crc32;
+						break;
+					case MULTIHASH_MD4:
+						answer = test_vectors[i].md4;
+						break;
+					case MULTIHASH_MD5:
+						answer = test_vectors[i].md5;
+						break;
+					case MULTIHASH_ED2K:
+						answer = test_vectors[i].ed2k;
+						break;
+					default:
+						answer = test_vectors[i].sha1;
+						break;
+				}
+				if (answer && strcmp (multihash_string (&mh, digest), answer) != 0)
+					ret = 1;
+			}
+
+			multihash_init_digests (&mh, digest);
+			for (pos = 0, c = 1; pos < 65536; pos += c, c = c * 3 + 1) {
+				if (c > 65536 - pos)
+					c = 65536 - pos;
+				multihash_update (&mh, rnd + pos, c);
+			}
+			multihash_finish (&mh);
+			if (strcmp (multihash_string (&mh, digest), expected) != 0)
+				ret = 1;
+
+			if (verbose != 0)
+				printf (ret == 0 ? "passed\n" : "failed\n");
+		}
+
+		multihash_set_kernel (digest, saved);
+
+		/* Hashing must go on seamlessly from a saved state */
+		if (ret == 0 && (fp = tmpfile ())) {
+			if (verbose != 0)
+				printf ("  %s state save/restore: ", multihash_digest_name (digest));
+			multihash_init_digests (&mh, digest);
+			multihash_update (&mh, rnd, 30011);
+			if (multihash_save_state (&mh, fp) < 0)
+				ret = 1;
+			rewind (fp);
+			memset (&mh, 0, sizeof (mh));
+			if (ret != 0 || multihash_load_state (&mh, fp) < 0 || mh.digests != digest) {
+				ret = 1;
+			} else {
+				multihash_update (&mh, rnd + 30011, 65536 - 30011);
+				multihash_finish (&mh);
+				if (strcmp (multihash_string (&mh, digest), expected) != 0)
+					ret = 1;
+			}
+			fclose (fp);
+			if (verbose != 0)
+				printf (ret == 0 ? "passed\n" : "failed\n");
+		}
+	}
+
+	free (buf);
+	free (rnd);
+
+	return (ret);
+}
+
+
+/**
+ * Measures the throughput of all the kernels the CPU supports, for all digests, printing results to stdout.
+ */
+void multihash_benchmark (void) {
+	multihash mh;
+	unsigned char *buf;
+	u_int32_t digest, rounds;
+	int i, k, saved;
+	clock_t start, elapsed;
+
+	/* Same size as the blocks the dumper hashes */
+	buf = (unsigned char *) malloc (16 * 2064);
+	for (i = 0; i < 16 * 2064; i++)
+		buf[i] = (unsigned char) (i * 7 + (i >> 11));
+
+	for (digest = 1; digest <= MULTIHASH_ALL; digest <<= 1) {
+		saved = multihash_get_kernel (digest);
+		for (k = 1; k < multihash_kernels (digest); k++) {
+			if (multihash_set_kernel (digest, k) == 0) {
+				multihash_init_digests (&mh, digest);
+				start = clock ();
+				rounds = 0;
+				do {
+					multihash_update (&mh, buf, 16 * 2064);
+					rounds++;
+					elapsed = clock () - start;
+				} while (elapsed < CLOCKS_PER_SEC / 4);
+				multihash_finish (&mh);
+				printf ("  %-5s %-14s %8.1f MB/s\n", multihash_digest_name (digest), multihash_kernel_name (digest, k),
+					(double) rounds * 16 * 2064 * CLOCKS_PER_SEC / elapsed / 1000000);
+			}
+		}
+		multihash_set_kernel (digest, saved);
+	}
+
+	free (buf);
+
+	return;
+}
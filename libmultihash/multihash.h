@@ -45,11 +45,15 @@
 
 #else	/* !WIN32 */
 
+#include <sys/types.h>
+
 #define MULTIHASH_EXPORT
 
 #endif
 
 
+#include <stdio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -90,7 +94,17 @@ extern "C" {
 /* This must be as long as the longest hash (in bytes) */
 #define MAX_DIGESTSIZE 20
 
+/* Digests, to be OR'ed together and passed to multihash_init_digests() */
+#define MULTIHASH_CRC32		0x01
+#define MULTIHASH_MD4		0x02
+#define MULTIHASH_MD5		0x04
+#define MULTIHASH_ED2K		0x08
+#define MULTIHASH_SHA1		0x10
+#define MULTIHASH_ALL		0x1F
+#define MULTIHASH_DIGESTS	5		/* Number of different digests */
+
 typedef struct {
+	u_int32_t digests;		/* Enabled digests */
 #ifdef USE_CRC32
 	u_int32_t crc32;
 	char crc32_s[LEN_CRC32 + 1];
@@ -116,9 +130,17 @@ typedef struct {
 
 /* Prototypes */
 MULTIHASH_EXPORT void multihash_init (multihash *mh);
+MULTIHASH_EXPORT void multihash_init_digests (multihash *mh, u_int32_t digests);
 MULTIHASH_EXPORT void multihash_update (multihash *mh, unsigned char *data, int bytes);
+MULTIHASH_EXPORT void multihash_update_digest (multihash *mh, u_int32_t digest, unsigned char *data, int bytes);
 MULTIHASH_EXPORT void multihash_finish (multihash *mh);
+MULTIHASH_EXPORT int multihash_save_state (multihash *mh, FILE *fp);
+MULTIHASH_EXPORT int multihash_load_state (multihash *mh, FILE *fp);
 MULTIHASH_EXPORT int multihash_file (multihash *mh, char *filename);
+MULTIHASH_EXPORT char *multihash_digest_name (u_int32_t digest);
+MULTIHASH_EXPORT u_int32_t multihash_parse_digests (char *list);
+MULTIHASH_EXPORT int multihash_self_test (int verbose);
+MULTIHASH_EXPORT void multihash_benchmark (void);
 
 #ifdef __cplusplus
 }
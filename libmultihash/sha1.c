@@ -2,8 +2,6 @@
 ** sha1.c
 **
 ** Contains all of the SHA1 functions: SHA1Transform, SHA1Init, SHA1Update, and SHA1Final.
-** Make sure to define _LITTLE_ENDIAN if running on a little endian machine and NOT to
-** define it otherwise.
 **
 ** Copyright NTT MCL, 2000.
 **
@@ -16,8 +14,23 @@
 ** In SHA1Update, changed "data to be const.  -- S.O.
 */
 #include "sha1.h"
+#include "cpu.h"
 
-#define _LITTLE_ENDIAN /* should be defined if so */
+#ifdef CPU_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+/* Compresses a number of consecutive 64-byte blocks */
+typedef void (*sha1_blocks_func)(u_int32_t state[5], const unsigned char *data, unsigned long blocks);
+
+static const char *sha1_kernel_names[SHA1_KERNELS] = {
+    "auto", "reference", "sha-ni"
+};
+
+static void sha1_blocks_first(u_int32_t state[5], const unsigned char *data, unsigned long blocks);
+
+static sha1_blocks_func sha1_blocks = sha1_blocks_first;
+static sha1_kernel sha1_kernel_current = SHA1_KERNEL_AUTO;
 
 /* Rotation of "value" by "bits" to the left */
 #define rotLeft(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
@@ -27,18 +40,14 @@
 #define g(u,v,w) (((u) & (v)) | ((u) & (w)) | ((v) & (w)))
 #define h(u,v,w) ((u) ^ (v) ^ (w))
 
-/* These are the 16 4-byte words of the 64-byte block */
-#ifdef _LITTLE_ENDIAN
-/* Reverse the order of the bytes in the i-th 4-byte word */
-#define x(i) (block->l[i] = (rotLeft(block->l[i], 24)& 0xff00ff00) \
-| (rotLeft(block->l[i], 8) & 0x00ff00ff))
-#else
-#define x(i) (block->l[i])
-#endif
+/* These are the 16 4-byte words of the 64-byte block, loaded big-endian into a local copy so that the caller's data is never
+** modified (and so that it works whatever the size of a long is) */
+#define x(i) (W[i] = ((u_int32_t) buffer[4 * (i)] << 24) | ((u_int32_t) buffer[4 * (i) + 1] << 16) \
+| ((u_int32_t) buffer[4 * (i) + 2] << 8) | (u_int32_t) buffer[4 * (i) + 3])
 
 /* Used in expanding from a 16 word block into an 80 word block  */
-#define X(i) (block->l[(i)%16] = rotLeft (block->l[((i)-3)%16] ^ block->l[((i)-8)%16] \
-^ block->l[((i)-14)%16] ^ block->l[((i)-16)%16],1))
+#define X(i) (W[(i)%16] = rotLeft (W[((i)-3)%16] ^ W[((i)-8)%16] \
+^ W[((i)-14)%16] ^ W[((i)-16)%16],1))
 
 /* (R0+R1), R2, R3, R4 are the different round operations used in SHA1 */
 #define R0(a, b, c, d, e, i) { \
@@ -65,19 +74,14 @@
 /* Hashes a single 512-bit block. This is the compression function - the core of the algorithm.
 **/
 void SHA1Transform(
-                   unsigned long       state[5], 
+                   u_int32_t           state[5], 
                    const unsigned char buffer[SHA1_BLOCKSIZE]
                    )
 {
-    unsigned long a, b, c, d, e;
-
-    typedef union {
-        unsigned char c[64];
-        unsigned long l[16];
-    } CHAR64LONG16;
+    u_int32_t a, b, c, d, e;
 
     /* This is for the X array  */
-    CHAR64LONG16* block = (CHAR64LONG16*)buffer;
+    u_int32_t W[16];
     
     /* Initialize working variables */
     a = state[0];
@@ -124,6 +128,146 @@ void SHA1Transform(
 
     /* Wipe variables */
     a = b = c = d = e = 0;
+    memset(W, 0, sizeof (W));
+}
+
+static void sha1_blocks_reference(u_int32_t state[5], const unsigned char *data, unsigned long blocks)
+{
+    for ( ; blocks > 0; blocks--, data += SHA1_BLOCKSIZE)
+        SHA1Transform(state, data);
+}
+
+#ifdef CPU_X86_DISPATCH
+/* Four rounds, followed by the message schedule steps that can be overlapped with them */
+#define SHANI_ROUNDS(ecur, enext, m, f) { \
+    ecur = _mm_sha1nexte_epu32(ecur, m); \
+    enext = abcd; \
+    abcd = _mm_sha1rnds4_epu32(abcd, ecur, f); \
+}
+#define SHANI_MSG1(a, b) (a) = _mm_sha1msg1_epu32((a), (b))
+#define SHANI_MSG2(a, b) (a) = _mm_sha1msg2_epu32((a), (b))
+#define SHANI_XOR(a, b) (a) = _mm_xor_si128((a), (b))
+#define SHANI_STEP(ecur, enext, m0, m1, m2, m3, f) { \
+    SHANI_ROUNDS(ecur, enext, m0, f); \
+    SHANI_MSG2(m1, m0); \
+    SHANI_MSG1(m3, m0); \
+    SHANI_XOR(m2, m0); \
+}
+#define SHANI_LOAD(m, i) (m) = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * (i))), mask)
+
+/* Hashes blocks with the SHA instructions: each sha1rnds4 performs 4 of the 80 rounds */
+__attribute__ ((target ("sha,ssse3,sse4.1")))
+static void sha1_blocks_shani(u_int32_t state[5], const unsigned char *data, unsigned long blocks)
+{
+    __m128i abcd, abcd_save, e0, e0_save, e1, m0, m1, m2, m3, mask;
+
+    mask = _mm_set_epi64x(0x0001020304050607LL, 0x08090a0b0c0d0e0fLL);
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0x1B);
+    e0 = _mm_set_epi32((int) state[4], 0, 0, 0);
+
+    for ( ; blocks > 0; blocks--, data += SHA1_BLOCKSIZE) {
+        abcd_save = abcd;
+        e0_save = e0;
+
+        /* Rounds 0-15 */
+        SHANI_LOAD(m0, 0);
+        e0 = _mm_add_epi32(e0, m0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        SHANI_LOAD(m1, 1);
+        SHANI_ROUNDS(e1, e0, m1, 0);
+        SHANI_MSG1(m0, m1);
+        SHANI_LOAD(m2, 2);
+        SHANI_ROUNDS(e0, e1, m2, 0);
+        SHANI_MSG1(m1, m2);
+        SHANI_XOR(m0, m2);
+        SHANI_LOAD(m3, 3);
+        SHANI_ROUNDS(e1, e0, m3, 0);
+        SHANI_MSG2(m0, m3);
+        SHANI_MSG1(m2, m3);
+        SHANI_XOR(m1, m3);
+
+        /* Rounds 16-67 */
+        SHANI_STEP(e0, e1, m0, m1, m2, m3, 0);
+        SHANI_STEP(e1, e0, m1, m2, m3, m0, 1);
+        SHANI_STEP(e0, e1, m2, m3, m0, m1, 1);
+        SHANI_STEP(e1, e0, m3, m0, m1, m2, 1);
+        SHANI_STEP(e0, e1, m0, m1, m2, m3, 1);
+        SHANI_STEP(e1, e0, m1, m2, m3, m0, 1);
+        SHANI_STEP(e0, e1, m2, m3, m0, m1, 2);
+        SHANI_STEP(e1, e0, m3, m0, m1, m2, 2);
+        SHANI_STEP(e0, e1, m0, m1, m2, m3, 2);
+        SHANI_STEP(e1, e0, m1, m2, m3, m0, 2);
+        SHANI_STEP(e0, e1, m2, m3, m0, m1, 2);
+        SHANI_STEP(e1, e0, m3, m0, m1, m2, 3);
+        SHANI_STEP(e0, e1, m0, m1, m2, m3, 3);
+
+        /* Rounds 68-79 */
+        SHANI_ROUNDS(e1, e0, m1, 3);
+        SHANI_MSG2(m2, m1);
+        SHANI_XOR(m3, m1);
+        SHANI_ROUNDS(e0, e1, m2, 3);
+        SHANI_MSG2(m3, m2);
+        SHANI_ROUNDS(e1, e0, m3, 3);
+
+        /* Update the chaining values */
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = (u_int32_t) _mm_extract_epi32(e0, 3);
+}
+#endif
+
+static void sha1_blocks_first(u_int32_t state[5], const unsigned char *data, unsigned long blocks)
+{
+    sha1_set_kernel(SHA1_KERNEL_AUTO);
+    sha1_blocks(state, data, blocks);
+}
+
+int sha1_set_kernel(sha1_kernel k)
+{
+    u_int32_t f;
+    int ret;
+
+    f = cpu_get_features();
+    if (k == SHA1_KERNEL_AUTO)
+        k = (f & CPU_FEATURE_SHA) && (f & CPU_FEATURE_SSE41) ? SHA1_KERNEL_SHANI : SHA1_KERNEL_REFERENCE;
+
+    ret = 0;
+    switch (k) {
+        case SHA1_KERNEL_REFERENCE:
+            sha1_blocks = sha1_blocks_reference;
+            break;
+#ifdef CPU_X86_DISPATCH
+        case SHA1_KERNEL_SHANI:
+            if ((f & CPU_FEATURE_SHA) && (f & CPU_FEATURE_SSE41))
+                sha1_blocks = sha1_blocks_shani;
+            else
+                ret = -1;
+            break;
+#endif
+        default:
+            ret = -1;
+            break;
+    }
+    if (ret == 0)
+        sha1_kernel_current = k;
+
+    return ret;
+}
+
+sha1_kernel sha1_get_kernel(void)
+{
+    if (sha1_blocks == sha1_blocks_first)
+        sha1_set_kernel(SHA1_KERNEL_AUTO);
+    return sha1_kernel_current;
+}
+
+const char *sha1_kernel_name(sha1_kernel k)
+{
+    return k < SHA1_KERNELS ? sha1_kernel_names[k] : "unknown";
 }
 
 /* SHA1Init - Initialize new context.
@@ -152,14 +296,17 @@ void SHA1Update(
 {
     unsigned long numByteDataProcessed; /* Number of bytes processed so far */
     unsigned long numByteInBuffMod64;   /* Number of bytes in the buffer mod 64 */
+    unsigned long numBlocks;            /* Number of whole blocks that can be processed from data */
+    u_int32_t bits;                     /* Low 32 bits of the number of bits of data */
     
     numByteInBuffMod64 = (context->count[0] >> 3) % 64;
 
     /* Adding in the number of bits of data */
-    if ((context->count[0] += dataLen << 3) < (dataLen << 3))   {
+    bits = (u_int32_t) (dataLen << 3);
+    if ((context->count[0] += bits) < bits)   {
         context->count[1]++;	/* add in the carry bit */
     }
-    context->count[1] += (dataLen >> 29);
+    context->count[1] += (u_int32_t) (dataLen >> 29);
 
     /* If there is at least one block to be processed... */
     if ((numByteInBuffMod64 + dataLen) > 63) {
@@ -169,11 +316,12 @@ void SHA1Update(
             (numByteDataProcessed = 64 - numByteInBuffMod64));
 		
         /* Perform the transform on the buffer */
-        SHA1Transform(context->state, context->buffer);
+        sha1_blocks(context->state, context->buffer, 1);
 
-        /* As long as there are 64-bit blocks of data remaining, transform each one. */
-        for ( ; numByteDataProcessed + 63 < dataLen; numByteDataProcessed += 64) {
-            SHA1Transform(context->state, &data[numByteDataProcessed]);
+        /* As long as there are 64-byte blocks of data remaining, transform them all at once. */
+        if ((numBlocks = (dataLen - numByteDataProcessed) / 64) > 0) {
+            sha1_blocks(context->state, &data[numByteDataProcessed], numBlocks);
+            numByteDataProcessed += numBlocks * 64;
         }
         
         numByteInBuffMod64 = 0;
@@ -16,6 +16,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <sys/types.h>
 
 #ifndef SHA1_DIGESTSIZE
 #define SHA1_DIGESTSIZE  20
@@ -26,14 +27,26 @@
 #endif
 
 typedef struct {
-    unsigned long state[5];
-    unsigned long count[2];	/* stores the number of bits */
+    u_int32_t state[5];
+    u_int32_t count[2];	/* stores the number of bits */
     unsigned char buffer[SHA1_BLOCKSIZE];
 } SHA1_CTX; 
 
-void SHA1Transform(unsigned long state[5], const unsigned char buffer[SHA1_BLOCKSIZE]);
+void SHA1Transform(u_int32_t state[5], const unsigned char buffer[SHA1_BLOCKSIZE]);
 void SHA1Init(SHA1_CTX *context);
 void SHA1Update(SHA1_CTX *context, const unsigned char *data, unsigned long len);
 void SHA1Final(unsigned char digest[SHA1_DIGESTSIZE], SHA1_CTX *context);
 
+/* Implementations of the compression function, all giving the same results */
+typedef enum {
+    SHA1_KERNEL_AUTO,           /* fastest one the CPU supports */
+    SHA1_KERNEL_REFERENCE,      /* portable C                   */
+    SHA1_KERNEL_SHANI,          /* Intel SHA extensions         */
+    SHA1_KERNELS
+} sha1_kernel;
+
+int sha1_set_kernel(sha1_kernel k);
+sha1_kernel sha1_get_kernel(void);
+const char *sha1_kernel_name(sha1_kernel k);
+
 #endif /* __SHA1_H__ */
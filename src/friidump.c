@@ -27,9 +27,21 @@
 #include "disc.h"
 #include "dumper.h"
 #include "unscrambler.h"
+#include "tuner.h"
+#include "farm.h"
+#include "ecc.h"
+#include "raw2384.h"
+#include "metrics.h"
+#include <multihash.h>
 
 #define USECS_PER_SEC	1000000
 
+/* Seconds between two saves of the --metrics file */
+#define METRICS_SAVE_INTERVAL 5
+
+/* Maximum number of speeds that can be given to --tune */
+#define MAX_TUNE_SPEEDS 8
+
 
 /* Name of package */
 #define PACKAGE "friidump"
@@ -58,28 +70,111 @@
 /* Struct for program options */
 struct {
 	char *device;
+	char *devices[FARM_MAX_DRIVES];
+	u_int32_t devices_no;
+	bool farm;
+	u_int32_t bandwidth;
 	bool autodump;
 	bool gui;
 	char *raw_in;
 	char *raw_out;
 	char *iso_out;
 	bool resume;
+	char *map_file;
+	u_int32_t passes;
 	int dump_method;
 	u_int32_t command;
 	u_int32_t start_sector;
 	u_int32_t sectors_no;
 	u_int32_t speed;
+	bool autospeed;
+	u_int32_t prefetch;
 	u_int32_t disctype;
 	u_int32_t sec_disc;
 	u_int32_t sec_mem;
 	bool no_hashing;
+	u_int32_t digests;
 	bool no_unscrambling;
 	bool no_flushing;
+	u_int32_t sync_interval;
+	bool direct_io;
 	bool stop_unit;
 	bool allmethods;
+	bool tune;
+	u_int32_t tune_speeds[MAX_TUNE_SPEEDS];
+	u_int32_t tune_speeds_no;
+	u_int32_t threads;
+	bool selftest;
+	bool benchmark;
+	bool stats;
+	char *metrics_file;
 } options;
 
 
+/* Latency metrics of the drives being dumped from, for --stats and --metrics */
+struct {
+	metrics *m[FARM_MAX_DRIVES];
+	char *drives[FARM_MAX_DRIVES];
+	u_int32_t drives_no;
+	time_t last_save;
+} iostats;
+
+
+/* Starts recording metrics for a drive, if they were requested */
+metrics *iostats_add_drive (char *device) {
+	metrics *m;
+
+	if ((options.stats || options.metrics_file) && iostats.drives_no < FARM_MAX_DRIVES) {
+		m = metrics_new ();
+		iostats.m[iostats.drives_no] = m;
+		my_strdup (iostats.drives[iostats.drives_no], device);
+		iostats.drives_no++;
+	} else {
+		m = NULL;
+	}
+
+	return (m);
+}
+
+
+/* Saves the metrics file, if it was requested and it was not saved recently */
+void iostats_save (bool force) {
+	time_t now;
+
+	now = time (NULL);
+	if (options.metrics_file && iostats.drives_no > 0 && (force || now - iostats.last_save >= METRICS_SAVE_INTERVAL)) {
+		if (!metrics_save (options.metrics_file, iostats.m, iostats.drives, iostats.drives_no))
+			fprintf (stderr, "\nCannot save metrics to \"%s\"\n", options.metrics_file);
+		iostats.last_save = now;
+	}
+
+	return;
+}
+
+
+/* Saves the metrics for the last time, prints them if requested and releases them */
+void iostats_done (void) {
+	u_int32_t i;
+
+	iostats_save (true);
+	for (i = 0; i < iostats.drives_no; i++) {
+		if (options.stats) {
+			if (iostats.drives_no > 1)
+				fprintf (stderr, "\n[%s] ", iostats.drives[i]);
+			else
+				fprintf (stderr, "\n");
+			metrics_print (iostats.m[i], stderr);
+			fprintf (stderr, "Prefetch depth: %u\n", options.prefetch);
+		}
+		iostats.m[i] = metrics_destroy (iostats.m[i]);
+		my_free (iostats.drives[i]);
+	}
+	iostats.drives_no = 0;
+
+	return;
+}
+
+
 /* Struct for progress data */
 typedef struct {
 	struct timeval start_time;
@@ -122,6 +217,7 @@ void progress_for_guis (bool start, u_int32_t sectors_done, u_int32_t total_sect
 			 perc, sectors_done, total_sectors, mb_done, stats -> mb_total, elapsed, seconds_left, mb_hour, buf);
 		fflush (stdout);
 	}
+	iostats_save (false);
 
 	/* Save return time, in case this will be the last call */
 	gettimeofday (&(stats -> end_time), NULL);
@@ -172,6 +268,7 @@ void progress (bool start, u_int32_t sectors_done, u_int32_t total_sectors, prog
 
 	if (sectors_done == total_sectors)
 		printf ("\n");
+	iostats_save (false);
 
 	/* Save return time, in case this will be the last call */
 	gettimeofday (&(stats -> end_time), NULL);
@@ -180,6 +277,31 @@ void progress (bool start, u_int32_t sectors_done, u_int32_t total_sectors, prog
 }
 
 
+/* Prints the state of all the drives of a farm on a single line */
+void farm_status (farm *f, void *status_data) {
+	u_int32_t i, cur, total;
+	farm_drive_state state;
+
+	fprintf (stdout, "\r");
+	for (i = 0; i < farm_get_drives_no (f); i++) {
+		state = farm_get_progress (f, i, &cur, &total);
+		fprintf (stdout, "#%u: ", i);
+		if (state == FARM_DRIVE_DONE)
+			fprintf (stdout, "done  ");
+		else if (state == FARM_DRIVE_FAILED)
+			fprintf (stdout, "FAIL  ");
+		else if (total > 0)
+			fprintf (stdout, "%3d%%  ", (int) (100.0 * cur / total));
+		else
+			fprintf (stdout, " ...  ");
+	}
+	fflush (stdout);
+	iostats_save (false);
+
+	return;
+}
+
+
 
 void welcome (void) {
 	/* Welcome text */
@@ -213,7 +335,16 @@ void help (void) {
 		"				if possible\n"
 		" -g, --gui			Use more verbose output that can be easily\n"
 		"				parsed by a GUI frontend\n"
-		" -d, --device <device>		Dump disc from device <device>\n"
+		" -d, --device <device>		Dump disc from device <device>. Use\n"
+		"				sim:<file>[,<option>=<value>...] to simulate\n"
+		"				a drive reading raw image <file> (See docs).\n"
+		"				Can be repeated with -F\n"
+		" -F, --farm			Dump the discs in all the given drives (Default:\n"
+		"				all the drives found) at the same time, each\n"
+		"				one to an ISO file with an automatically-\n"
+		"				generated name, resuming the dump if possible\n"
+		" -W, --bandwidth <MB/s>		Limit the total write speed of -F (Default: no\n"
+		"				limit)\n"
 		" -p, --stop			Instruct device to stop disc rotation\n"
 		" -c, --command <nr>		Force memory dump command:\n"
 		"				0 - vanilla 2064\n"
@@ -223,6 +354,13 @@ void help (void) {
 		"				4 - Renesas\n"
 		" -x, --speed <x>		Set streaming speed (1, 24, 32, 64, etc.,\n"
 		"				where 1 = 150 KiB/s and so on)\n"
+		" -X, --autospeed		Lower the speed where the disc needs retries\n"
+		"				and raise it again where it reads cleanly, up\n"
+		"				to the speed given with -x\n"
+		" -e, --prefetch <n>		Number of commands of the next read window\n"
+		"				queued while the current one is processed\n"
+		"				with methods 7 and 9 (0 disables, 1 only\n"
+		"				queues the READ commands, default 1)\n"
 		" -T, --type <nr>		Force disc type:\n"
 		"				0 - GameCube\n"
 		"				1 - Wii\n"
@@ -237,7 +375,40 @@ void help (void) {
 		"				<file> to ISO format\n"
 		" -H, --nohash			Do not compute CRC32/MD5/SHA-1 hashes\n"
 		"				for generated files\n"
+		" -D, --digests <list>		Hashes to compute, separated with a comma,\n"
+		"				among crc32, md4, md5, ed2k and sha1, or all\n"
+		"				(Default crc32,md5,sha1)\n"
 		" -s, --resume			Resume partial dump\n"
+		" -M, --map <file>		Keep track of the blocks that were read in\n"
+		"				<file>, skipping unreadable ones and trying\n"
+		"				them again in later passes, or in a later run\n"
+		"				with the same <file>, which implies -s\n"
+		" -R, --passes <n>		Number of passes of -M (Default 3). The first\n"
+		"				one tries each block once, the second one\n"
+		"				retries failed blocks, the following ones also\n"
+		"				slow down and change the dumping method\n"
+		" -k, --sync <MB>		Sync output files to disk and save a resume\n"
+		"				point with the hash state every <MB> MB, so\n"
+		"				that resuming does not hash the whole file\n"
+		"				again (Default 32)\n"
+		" -o, --direct			Write output files bypassing the system cache\n"
+		"				(O_DIRECT)\n"
+		" -j, --threads <n>		Number of threads used for dumping (1 disables\n"
+		"				the read/hash/write pipeline, default: one per\n"
+		"				hash plus two) or unscrambling (default:\n"
+		"				number of CPUs). With -F, number of drives\n"
+		"				that can unscramble or hash at the same time\n"
+		"				(Default: number of CPUs)\n"
+		" -y, --selftest			Check the optimized code paths against the\n"
+		"				reference ones and read a simulated disc,\n"
+		"				then exit\n"
+		" -b, --benchmark		Measure the speed of the optimized code paths,\n"
+		"				then exit\n"
+		" -z, --stats			Print a breakdown of the time spent in drive\n"
+		"				commands and read stages at the end\n"
+		" -m, --metrics <file>		Save drive command and read stage latencies\n"
+		"				to <file> every few seconds, as JSON if it\n"
+		"				ends in .json, Prometheus text otherwise\n"
 		"				-  General  -----------------------------------\n"
 		" -0, --method0[=<req>,<exp>]	Use dumping method 0 (Optional argument\n"
 		"				specifies how many sectors to request from disc\n"
@@ -261,11 +432,16 @@ void help (void) {
 		"				some speed tricks)\n"
 		" -A, --allmethods		Try all known methods and commands until\n"
 		"				one works.\n"
+		" -P, --tune[=<x>,...]		Find the fastest reliable command, method and\n"
+		"				sectors for the drive, trying the given speeds\n"
+		"				(Default: current one), and use them by\n"
+		"				default from now on\n"
 #ifdef DEBUG
 		" -n, --donottunscramble		Do not try unscrambling to check EDC. Only\n"
 		"				useful for testing the raw performance of the\n"
 		"				different methods\n"
-		" -f, --donottflush		Do not call fflush() after every fwrite()\n"
+		" -f, --donottflush		Do not sync output files to disk nor keep\n"
+		"				resume points\n"
 #endif
 	);
 
@@ -287,6 +463,7 @@ bool optparse (int argc, char **argv) {
 		{"iso", 1, 0, 'i'},
 		{"unscramble", 1, 0, 'u'},
 		{"nohash", 0, 0, 'H'},
+		{"digests", 1, 0, 'D'},
 		{"resume", 0, 0, 's'},
 		{"method0", 2, 0, '0'},	//2 - optional_argument
 		{"method1", 2, 0, '1'},
@@ -303,8 +480,22 @@ bool optparse (int argc, char **argv) {
 		{"startsector", 1, 0, 't'},
 		{"size", 1, 0, 'S'},
 		{"speed", 1, 0, 'x'},
+		{"autospeed", 0, 0, 'X'},
+		{"prefetch", 1, 0, 'e'},
 		{"type", 1, 0, 'T'},
 		{"allmethods", 0, 0, 'A'},
+		{"tune", 2, 0, 'P'},
+		{"threads", 1, 0, 'j'},
+		{"sync", 1, 0, 'k'},
+		{"direct", 0, 0, 'o'},
+		{"selftest", 0, 0, 'y'},
+		{"benchmark", 0, 0, 'b'},
+		{"farm", 0, 0, 'F'},
+		{"bandwidth", 1, 0, 'W'},
+		{"stats", 0, 0, 'z'},
+		{"metrics", 1, 0, 'm'},
+		{"map", 1, 0, 'M'},
+		{"passes", 1, 0, 'R'},
 #ifdef DEBUG
 		/* We don't want newbies to generate and put into circulation bad dumps, so this options are disabled for releases */
 		{"donottunscramble", 0, 0, 'n'},
@@ -320,31 +511,48 @@ bool optparse (int argc, char **argv) {
 	
 	/* Init options to default values */
 	options.device = NULL;
+	options.devices_no = 0;
+	options.farm = false;
+	options.bandwidth = -1;
 	options.autodump = false;
 	options.gui = false;
 	options.raw_in = NULL;
 	options.raw_out = NULL;
 	options.iso_out = NULL;
 	options.no_hashing = false;
+	options.digests = 0;
 	options.resume = false;
+	options.map_file = NULL;
+	options.passes = 0;
 	options.dump_method = -1;
 	options.command = -1;
 	options.start_sector = -1;
 	options.sectors_no = -1;
 	options.speed = -1;
+	options.autospeed = false;
+	options.prefetch = 1;
 	options.disctype = -1;
 	options.sec_disc = -1;
 	options.sec_mem = -1;
 	options.no_unscrambling = false;
 	options.no_flushing = false;
+	options.sync_interval = -1;
+	options.direct_io = false;
 	options.stop_unit = false;
 	options.allmethods = false;
+	options.tune = false;
+	options.tune_speeds_no = 0;
+	options.threads = -1;
+	options.selftest = false;
+	options.benchmark = false;
+	options.stats = false;
+	options.metrics_file = NULL;
 
 	do {
 #ifdef DEBUG
-		c = getopt_long (argc, argv, "hpagd:r:i:u:Hs0::1::2::3::4::5::6::789c:t:S:x:T:Anf", long_options, &option_index);
+		c = getopt_long (argc, argv, "hpagd:r:i:u:Hs0::1::2::3::4::5::6::789c:t:S:x:T:AP::j:D:k:oybFW:zm:M:R:Xe:nf", long_options, &option_index);
 #else
-		c = getopt_long (argc, argv, "hpagd:r:i:u:Hs0::1::2::3::4::5::6::789c:t:S:x:T:A", long_options, &option_index);
+		c = getopt_long (argc, argv, "hpagd:r:i:u:Hs0::1::2::3::4::5::6::789c:t:S:x:T:AP::j:D:k:oybFW:zm:M:R:Xe:", long_options, &option_index);
 #endif
 
 		switch (c) {
@@ -364,6 +572,10 @@ bool optparse (int argc, char **argv) {
 				break;
 			case 'd':
 				my_strdup (options.device, optarg);
+				if (options.devices_no < FARM_MAX_DRIVES) {
+					my_strdup (options.devices[options.devices_no], optarg);
+					options.devices_no++;
+				}
 				break;
 			case 'r':
 				my_strdup (options.raw_out, optarg);
@@ -377,6 +589,12 @@ bool optparse (int argc, char **argv) {
 			case 'H':
 				options.no_hashing = true;
 				break;
+			case 'D':
+				if (!(options.digests = multihash_parse_digests (optarg))) {
+					help ();
+					exit (1);
+				}
+				break;
 			case 's':
 				options.resume = true;
 				break;
@@ -426,12 +644,66 @@ bool optparse (int argc, char **argv) {
 					help ();
 					exit (1);
 				};
-				unscrambler_set_disctype (options.disctype);
 				break;
 			case 'A':
 				options.allmethods = true;
 				options.resume = true;
 				break;
+			case 'P':
+				options.tune = true;
+				if (optarg) {
+					for (result = strtok (optarg, ","); result && options.tune_speeds_no < MAX_TUNE_SPEEDS; result = strtok (NULL, ","))
+						options.tune_speeds[options.tune_speeds_no++] = atol (result);
+				}
+				break;
+			case 'j':
+				options.threads = atol (optarg);
+				if (options.threads < 1) {
+					help ();
+					exit (1);
+				};
+				break;
+			case 'k':
+				options.sync_interval = atol (optarg);
+				break;
+			case 'o':
+				options.direct_io = true;
+				break;
+			case 'y':
+				options.selftest = true;
+				break;
+			case 'b':
+				options.benchmark = true;
+				break;
+			case 'F':
+				options.farm = true;
+				break;
+			case 'W':
+				options.bandwidth = atol (optarg);
+				break;
+			case 'z':
+				options.stats = true;
+				break;
+			case 'm':
+				my_strdup (options.metrics_file, optarg);
+				break;
+			case 'X':
+				options.autospeed = true;
+				break;
+			case 'e':
+				options.prefetch = atol (optarg);
+				break;
+			case 'M':
+				my_strdup (options.map_file, optarg);
+				options.resume = true;
+				break;
+			case 'R':
+				options.passes = atol (optarg);
+				if (options.passes < 1) {
+					help ();
+					exit (1);
+				};
+				break;
 #ifdef DEBUG
 			case 'n':
 				options.no_unscrambling = true;
@@ -456,8 +728,12 @@ bool optparse (int argc, char **argv) {
 
 	/* Sanity checks... */
 	out = false;
-	if (!options.device && !options.raw_in) {
-		fprintf (stderr, "No operation specified. Please use the -d or -u options.\n");
+	if (!options.device && !options.raw_in && !options.selftest && !options.benchmark && !options.farm) {
+		fprintf (stderr, "No operation specified. Please use the -d, -F or -u options.\n");
+	} else if (options.devices_no > 1 && !options.farm) {
+		fprintf (stderr, "The -d option can only be repeated together with -F.\n");
+	} else if (options.farm && (options.raw_in || options.raw_out || options.iso_out || options.tune || options.allmethods || options.map_file)) {
+		fprintf (stderr, "The -r, -i, -u, -P, -A and -M options cannot be used together with -F.\n");
 	} else if (options.raw_in && options.raw_out) {
 		fprintf (stderr,
 			"Are you sure you want to convert a raw image to another raw image? ;)\n"
@@ -473,6 +749,65 @@ bool optparse (int argc, char **argv) {
 	return (out);
 }
 
+
+/* Prints the hashes of a dumped file, skipping the ones that were not computed */
+void print_hashes (char *title, char *crc32, char *md4, char *md5, char *sha1, char *ed2k) {
+	fprintf (stderr, "%s:\n", title);
+	if (*crc32)
+		fprintf (stderr, "CRC32...: %s\n", crc32);
+	if (*md4)
+		fprintf (stderr, "MD4.....: %s\n", md4);
+	if (*md5)
+		fprintf (stderr, "MD5.....: %s\n", md5);
+	if (*sha1)
+		fprintf (stderr, "SHA-1...: %s\n", sha1);
+	if (*ed2k)
+		fprintf (stderr, "ED2K....: %s\n", ed2k);
+
+	return;
+}
+
+/* Prints the result of each combination tried by the tuner */
+void tune_progress (dvd_profile *p, bool ok, double mb_hour, double retry_rate, void *progress_data) {
+	fprintf (stderr, "Command %u, method %u", p -> command, p -> method);
+	if (p -> method <= 6)
+		fprintf (stderr, " (%u,%u)", p -> sec_disc, p -> sec_mem);
+	if (p -> speed != -1)
+		fprintf (stderr, ", speed %ux", p -> speed);
+	if (ok)
+		fprintf (stderr, ": %.2lf MB/h, %.3lf retries/block\n", mb_hour, retry_rate);
+	else
+		fprintf (stderr, ": Failed\n");
+
+	return;
+}
+
+int dotune (disc *d) {
+	dvd_profile best;
+	int out;
+
+	disc_stop_unit (d, true);
+	fprintf (stderr, "\nRetrieving disc seeds, this might take a while... ");
+	if (!disc_init (d, options.disctype, options.sectors_no)) {
+		fprintf (stderr, "Failed\n");
+		out = false;
+	} else {
+		fprintf (stderr, "OK\n\nTuning drive \"%s\", this will take a LONG time...\n", disc_get_drive_model_string (d));
+		if ((out = tuner_run (d, options.tune_speeds, options.tune_speeds_no, tune_progress, NULL, &best))) {
+			fprintf (stderr, "\nBest combination: command %u, method %u", best.command, best.method);
+			if (best.method <= 6)
+				fprintf (stderr, " (%u,%u)", best.sec_disc, best.sec_mem);
+			if (best.speed != -1)
+				fprintf (stderr, ", speed %ux", best.speed);
+			fprintf (stderr, "\n");
+		} else {
+			fprintf (stderr, "\nNo working combination found\n");
+		}
+	}
+
+	return out;
+}
+
 int dologic (disc *d, progstats stats) {
 	disc_type type_id;
 	char *type, *game_id, *region, *maker_id, *maker, *version, *title, tmp[0x03E0 + 4 + 1];
@@ -526,6 +861,8 @@ int dologic (disc *d, progstats stats) {
 				fprintf (stderr, "\nRetrieving disc seeds, this might take a while... ");
 
 				//set speed for 1st time
+				/* Tuned drives have a preferred speed */
+				if (options.speed == -1) options.speed = disc_get_def_speed(d);
 				if (options.speed != -1) disc_set_speed(d, options.speed * 177);
 				if (options.speed != -1) disc_set_streaming_speed(d, options.speed * 177);
 //				disc_set_speed(d, 0xffff);
@@ -572,8 +909,6 @@ int dologic (disc *d, progstats stats) {
 					
 					disc_set_unscrambling (d, !options.no_unscrambling);
 
-					unscrambler_set_disctype (type_id);
-
 					if (options.autodump) {
 						snprintf (tmp, sizeof (tmp), "%s.iso", title);
 						my_strdup (options.iso_out, tmp);
@@ -594,7 +929,17 @@ int dologic (disc *d, progstats stats) {
 						dmp = dumper_new (d);
 
 						dumper_set_hashing (dmp, !options.no_hashing);
+						if (options.digests != 0)
+							dumper_set_digests (dmp, options.digests);
 						dumper_set_flushing (dmp, !options.no_flushing);
+						if (options.sync_interval != -1)
+							dumper_set_sync_interval (dmp, options.sync_interval);
+						dumper_set_direct_io (dmp, options.direct_io);
+						if (options.threads != -1)
+							dumper_set_threads (dmp, options.threads);
+						if (options.map_file)
+							dumper_set_map (dmp, options.map_file, options.passes);
+						dumper_set_adaptive_speed (dmp, options.autospeed);
 
 						if (!dumper_set_raw_output_file (dmp, options.raw_out, options.resume)) {
 							fprintf (stderr, "Cannot setup raw output file\n");
@@ -614,32 +959,26 @@ int dologic (disc *d, progstats stats) {
 							if (dumper_dump (dmp, &current_sector)) {
 								fprintf (stderr, "Dump completed successfully!\n");
 								if (!options.no_hashing && options.raw_out)
-									fprintf (stderr,
-										"Raw image hashes:\n"
-										"CRC32...: %s\n"
-										//"MD4.....: %s\n"
-										"MD5.....: %s\n"
-										"SHA-1...: %s\n"
-										/*"ED2K....: %s\n"*/,
-										dumper_get_raw_crc32 (dmp), /*dumper_get_raw_md4 (dmp),*/ dumper_get_raw_md5 (dmp),
-										dumper_get_raw_sha1 (dmp)/*, dumper_get_raw_ed2k (dmp)*/
-									);
+									print_hashes ("Raw image hashes", dumper_get_raw_crc32 (dmp), dumper_get_raw_md4 (dmp),
+										dumper_get_raw_md5 (dmp), dumper_get_raw_sha1 (dmp), dumper_get_raw_ed2k (dmp));
 								if (!options.no_hashing && options.iso_out)
-									fprintf (stderr,
-										"ISO image hashes:\n"
-										"CRC32...: %s\n"
-										//"MD4.....: %s\n"
-										"MD5.....: %s\n"
-										"SHA-1...: %s\n"
-										/*"ED2K....: %s\n"*/,
-										dumper_get_iso_crc32 (dmp), /*dumper_get_iso_md4 (dmp),*/ dumper_get_iso_md5 (dmp),
-										dumper_get_iso_sha1 (dmp)/*, dumper_get_iso_ed2k (dmp)*/
+									print_hashes ("ISO image hashes", dumper_get_iso_crc32 (dmp), dumper_get_iso_md4 (dmp),
+										dumper_get_iso_md5 (dmp), dumper_get_iso_sha1 (dmp), dumper_get_iso_ed2k (dmp));
+
+								if (options.threads != 1 && !options.map_file)
+									fprintf (stderr, "Pipeline occupancy: read %.0f%%, hash %.0f%%, write %.0f%%\n",
+										dumper_get_stage_occupancy (dmp, DUMPER_STAGE_READ) * 100,
+										dumper_get_stage_occupancy (dmp, DUMPER_STAGE_HASH) * 100,
+										dumper_get_stage_occupancy (dmp, DUMPER_STAGE_WRITE) * 100
 									);
 
 								out = true;
 								disc_stop_unit (d, 0);
 							} else {
 								fprintf (stderr, "\nDump failed at sectors: %u..%u\n", current_sector, current_sector+15);
+								if (dumper_get_unread_sectors (dmp) > 0)
+									fprintf (stderr, "%u sectors could not be read, run again with the same -M file to retry them\n",
+										dumper_get_unread_sectors (dmp));
 								out = false;
 								//disc_stop_unit (d, 0);
 							}
@@ -653,6 +992,143 @@ int dologic (disc *d, progstats stats) {
 	return out;
 }
 
+/* Data of the job running on a drive of the farm */
+typedef struct {
+	farm *f;
+	u_int32_t drive;
+} farmjob;
+
+void farm_progress (bool start, u_int32_t sectors_done, u_int32_t total_sectors, farmjob *fj) {
+	farm_set_progress (fj -> f, fj -> drive, sectors_done, total_sectors);
+
+	return;
+}
+
+/* Dumps the disc in a drive of the farm to an ISO file named after its title */
+bool farm_dump (farm *f, u_int32_t drive, char *device, void *job_data) {
+	disc *d;
+	dumper *dmp;
+	farmjob fj;
+	char *title, iso_out[0x03E0 + 16];
+	u_int32_t current_sector, n;
+	bool out;
+
+	out = false;
+	if (!(d = disc_new (device, options.command))) {
+		fprintf (stderr, "[%s] Cannot open drive\n", device);
+	} else {
+		disc_set_farm (d, f);
+		if (drive < iostats.drives_no)
+			disc_set_metrics (d, iostats.m[drive]);
+		disc_stop_unit (d, true);
+		init_range (d, options.sec_disc, options.sec_mem);
+		disc_set_prefetch (d, options.prefetch);
+
+		if (options.speed != -1) disc_set_speed (d, options.speed * 177);
+		if (options.speed != -1) disc_set_streaming_speed (d, options.speed * 177);
+
+		if (!disc_set_read_method (d, options.dump_method)) {
+			fprintf (stderr, "[%s] Method %d cannot be used\n", device, options.dump_method);
+		} else if (!disc_init (d, options.disctype, options.sectors_no)) {
+			fprintf (stderr, "[%s] Cannot retrieve disc seeds\n", device);
+		} else {
+			disc_set_unscrambling (d, !options.no_unscrambling);
+
+			/* Two drives might be dumping the same game */
+			disc_get_title (d, &title);
+			for (n = 1; ; n++) {
+				if (n == 1)
+					snprintf (iso_out, sizeof (iso_out), "%s.iso", title);
+				else
+					snprintf (iso_out, sizeof (iso_out), "%s (%u).iso", title, n);
+				if (farm_claim_file (f, iso_out))
+					break;
+			}
+			fprintf (stderr, "[%s] Writing to file \"%s\" in ISO format\n", device, iso_out);
+
+			dmp = dumper_new (d);
+			dumper_set_hashing (dmp, !options.no_hashing);
+			if (options.digests != 0)
+				dumper_set_digests (dmp, options.digests);
+			dumper_set_flushing (dmp, !options.no_flushing);
+			if (options.sync_interval != -1)
+				dumper_set_sync_interval (dmp, options.sync_interval);
+			dumper_set_direct_io (dmp, options.direct_io);
+			dumper_set_farm (dmp, f);
+			dumper_set_adaptive_speed (dmp, options.autospeed);
+
+			fj.f = f;
+			fj.drive = drive;
+			dumper_set_progress_callback (dmp, (progress_func) farm_progress, &fj);
+
+			if (!dumper_set_iso_output_file (dmp, iso_out, true)) {
+				fprintf (stderr, "[%s] Cannot setup ISO output file\n", device);
+			} else if (!dumper_prepare (dmp)) {
+				fprintf (stderr, "[%s] Cannot prepare dumper\n", device);
+			} else if (dumper_dump (dmp, &current_sector)) {
+				fprintf (stderr, "\n[%s] Dump completed successfully!\n", device);
+				if (!options.no_hashing) {
+					snprintf (iso_out, sizeof (iso_out), "[%s] ISO image hashes", device);
+					print_hashes (iso_out, dumper_get_iso_crc32 (dmp), dumper_get_iso_md4 (dmp),
+						dumper_get_iso_md5 (dmp), dumper_get_iso_sha1 (dmp), dumper_get_iso_ed2k (dmp));
+				}
+				out = true;
+				disc_stop_unit (d, false);
+			} else {
+				fprintf (stderr, "\n[%s] Dump failed at sectors: %u..%u\n", device, current_sector, current_sector + 15);
+			}
+
+			dmp = dumper_destroy (dmp);
+		}
+
+		d = disc_destroy (d);
+	}
+
+	return out;
+}
+
+/* Dumps the discs in all the drives at the same time */
+int dofarm (progstats *stats) {
+	farm *f;
+	u_int32_t i, ok;
+	int out;
+
+	f = farm_new (options.threads != -1 ? options.threads : 0, options.bandwidth != -1 ? options.bandwidth : 0);
+	if (options.devices_no == 0) {
+		fprintf (stderr, "Looking for drives... ");
+		fprintf (stderr, "%u found\n", farm_discover_drives (f));
+	} else {
+		for (i = 0; i < options.devices_no; i++) {
+			if (!farm_add_drive (f, options.devices[i]))
+				fprintf (stderr, "Drive \"%s\" cannot be used, ignored\n", options.devices[i]);
+		}
+	}
+
+	if (farm_get_drives_no (f) == 0) {
+		fprintf (stderr, "No supported drive to dump from\n");
+		out = false;
+	} else {
+		fprintf (stderr, "\n");
+		for (i = 0; i < farm_get_drives_no (f); i++)
+			fprintf (stderr, "Drive #%u..........: %s (%s)\n", i, farm_get_device (f, i), farm_get_model (f, i));
+		fprintf (stderr, "\nDumping with %u CPU slot(s), press Ctrl+C at any time to terminate\n\n", farm_get_cpu_slots (f));
+		for (i = 0; i < farm_get_drives_no (f); i++)
+			iostats_add_drive (farm_get_device (f, i));
+
+		gettimeofday (&(stats -> start_time), NULL);
+		ok = farm_run (f, farm_dump, NULL, farm_status, NULL);
+		gettimeofday (&(stats -> end_time), NULL);
+
+		fprintf (stdout, "\n");
+		fprintf (stderr, "%u of %u disc(s) dumped successfully\n", ok, farm_get_drives_no (f));
+		out = ok == farm_get_drives_no (f);
+		iostats_done ();
+	}
+	f = farm_destroy (f);
+
+	return out;
+}
+
 int main (int argc, char *argv[]) {
 	disc *d;
 	progstats stats;
@@ -661,7 +1137,7 @@ int main (int argc, char *argv[]) {
 	int out, ret;
 	unscrambler *u;
 	unscrambler_progress_func pfunc;
-	u_int32_t current_sector;
+	u_int32_t current_sector, i;
 
 	/* First of all... */
 	drop_euid ();
@@ -671,7 +1147,22 @@ int main (int argc, char *argv[]) {
 	d = NULL;
 	out = false;
 	if (optparse (argc, argv)) {
-		if (options.device) {
+		if (options.selftest) {
+			/* Check optimized code paths */
+			out = unscrambler_self_test (true) && ecc_self_test (true) && raw2384_self_test (true) && disc_self_test (true) && multihash_self_test (1) == 0;
+			fprintf (stderr, "Self-test %s\n", out ? "passed" : "FAILED");
+			memset (&stats, 0, sizeof (stats));
+		} else if (options.benchmark) {
+			/* Measure optimized code paths */
+			unscrambler_benchmark ();
+			raw2384_benchmark ();
+			multihash_benchmark ();
+			out = true;
+			memset (&stats, 0, sizeof (stats));
+		} else if (options.farm) {
+			/* Dump several DVDs at once */
+			out = dofarm (&stats);
+		} else if (options.device) {
 			/* Dump DVD to file */
 			fprintf (stderr, "Initializing DVD drive... ");
 
@@ -685,8 +1176,17 @@ int main (int argc, char *argv[]) {
 #endif
 			} else {
 			fprintf (stderr, "OK\n");
+				disc_set_metrics (d, iostats_add_drive (options.device));
+				disc_set_prefetch (d, options.prefetch);
 			
-				if(options.allmethods)
+				if (options.tune) {
+					memset (&stats, 0, sizeof (stats));
+					out = dotune (d);
+
+					/* Dump with the tuned parameters, if requested */
+					if (out && (options.raw_out || options.iso_out || options.autodump))
+						out = dologic (d, stats);
+				} else if(options.allmethods)
 				{
 					fprintf (stderr, "Trying all methods... This will take a LOOOONG time and generate an insanely long console output :p\n");
 					for(options.command=0;options.command<=4;options.command++)
@@ -710,11 +1210,16 @@ int main (int argc, char *argv[]) {
 					out = dologic(d, stats);
 				}	
 				
+				iostats_done ();
 				d = disc_destroy (d);
 			}
 		} else if (options.raw_in) {
 			/* Convert raw image to ISO format */
 			u = unscrambler_new ();
+			if (options.threads != -1)
+				unscrambler_set_threads (u, options.threads);
+			if (options.disctype != -1)
+				unscrambler_set_disctype (u, options.disctype);
 			
 			if (options.gui)
 				pfunc = (unscrambler_progress_func) progress_for_guis;
@@ -743,7 +1248,8 @@ int main (int argc, char *argv[]) {
 			duration += ((double) us / (double) USECS_PER_SEC);
 			if (duration < 0)
 				duration = 0;
-			fprintf (stderr, "Operation took %.2f seconds\n", duration);
+			if (!options.selftest && !options.benchmark)
+				fprintf (stderr, "Operation took %.2f seconds\n", duration);
 
 			ret = EXIT_SUCCESS;
 		} else {
@@ -751,9 +1257,12 @@ int main (int argc, char *argv[]) {
 		}
 		
 		my_free (options.device);
+		for (i = 0; i < options.devices_no; i++)
+			my_free (options.devices[i]);
 		my_free (options.iso_out);
 		my_free (options.raw_out);
 		my_free (options.raw_in);
+		my_free (options.metrics_file);
 	}
 
 	return (out);